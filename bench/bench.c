@@ -0,0 +1,473 @@
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// default sizes run from L1-resident to well past the last level cache
+static const size_t default_sizes[] = {1024, 16384, 262144, 4194304};
+
+// loop kernels are also verified at sizes that leave a tail: less than a
+// vector, and some vectors plus a remainder on every target
+static const size_t tail_sizes[] = {1, 7, 37, 1021};
+
+#define MAX_SIZES 16
+#define TRIALS 5
+#define TRIAL_ELEMS ((size_t)1 << 24)   // work per trial, so small n repeats
+#define PAD_FLOATS 256                  // room for [buf + offset] past n
+#define VERIFY_THREADS 4                // pva_run's pool, whatever the core count
+
+int bench_lanes;
+
+// core cycles from perf when the kernel lets us, else the TSC, which ticks
+// at a fixed reference rate and not the boosted core clock
+typedef struct {
+    int fd;
+    const char* source;
+} cycle_counter_t;
+
+static void counter_open(cycle_counter_t* counter) {
+    counter->fd = -1;
+    counter->source = NULL;
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    counter->fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (counter->fd >= 0) {
+        counter->source = "perf core cycles";
+        return;
+    }
+#endif
+#if defined(__x86_64__)
+    counter->source = "rdtsc reference cycles";
+#endif
+}
+
+static uint64_t counter_read(const cycle_counter_t* counter) {
+#ifdef __linux__
+    if (counter->fd >= 0) {
+        uint64_t value = 0;
+        if (read(counter->fd, &value, sizeof(value)) != sizeof(value)) return 0;
+        return value;
+    }
+#endif
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    (void)counter;
+    return 0;
+#endif
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// a kernel under test: the JIT output or a C reference. loop-less kernels
+// handle one vector per call, so they are called once per `chunk` elements
+typedef struct {
+    const char* label;
+    pva_kernel_fn fn;
+} impl_t;
+
+typedef struct {
+    float* bufs[PVA_MAX_BUFFERS];
+    int num_buffers;
+    size_t n;
+    size_t chunk;        // 0 for kernels with a loop
+    size_t reach;        // elements a strided load walks per element of n
+    unsigned index_bufs; // bit b set when buffer b holds int32 indices
+} workload_t;
+
+static size_t work_len(const workload_t* work) {
+    return work->n * work->reach + PAD_FLOATS;
+}
+
+// buffers shaped like `shape` for n elements; 0 on success, else none are left
+static int work_alloc(workload_t* work, const workload_t* shape, size_t n, size_t chunk) {
+    *work = *shape;
+    work->n = n;
+    work->chunk = chunk;
+    for (int b = 0; b < work->num_buffers; b++) {
+        work->bufs[b] = aligned_alloc(64, work_len(work) * sizeof(float));
+        if (!work->bufs[b]) {
+            fprintf(stderr, "[bench] err: memory alloc failed\n");
+            for (int k = 0; k < b; k++) free(work->bufs[k]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void work_free(workload_t* work) {
+    for (int b = 0; b < work->num_buffers; b++) free(work->bufs[b]);
+}
+
+static void fill(workload_t* work) {
+    size_t len = work_len(work);
+    // one value per 64-byte row, see reference.c. index buffers get a
+    // permutation of [0, len) instead, so no two lanes scatter to one spot
+    for (int b = 0; b < work->num_buffers; b++) {
+        if (work->index_bufs & (1u << b)) {
+            int32_t* index = (int32_t*)work->bufs[b];
+            for (size_t i = 0; i < len; i++) index[i] = (int32_t)((i ^ 5) < len ? i ^ 5 : i);
+            continue;
+        }
+        for (size_t i = 0; i < len; i++) {
+            uint32_t h = (uint32_t)(i / 16 + b * 977) * 2654435761u;
+            work->bufs[b][i] = 0.5f + (float)(h >> 16) / 65536.0f;
+        }
+    }
+}
+
+static void run(const workload_t* work, pva_kernel_fn fn) {
+    float* const* b = work->bufs;
+    if (!work->chunk) {
+        fn(work->n, b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7]);
+        return;
+    }
+    for (size_t i = 0; i + work->chunk <= work->n; i += work->chunk) {
+        float* p[PVA_MAX_BUFFERS] = {0};
+        for (int k = 0; k < work->num_buffers; k++) p[k] = b[k] + i;
+        fn(work->chunk, p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
+    }
+}
+
+// best of TRIALS, each repeating the kernel until it has covered
+// TRIAL_ELEMS elements
+static void measure(const workload_t* work, pva_kernel_fn fn, const cycle_counter_t* counter,
+                    double* ns_per_elem, double* cycles_per_elem) {
+    size_t reps = work->n < TRIAL_ELEMS ? TRIAL_ELEMS / work->n : 1;
+    run(work, fn);  // warm the caches and the page tables
+
+    *ns_per_elem = INFINITY;
+    *cycles_per_elem = INFINITY;
+    for (int t = 0; t < TRIALS; t++) {
+        uint64_t c0 = counter_read(counter);
+        double t0 = now_ns();
+        for (size_t r = 0; r < reps; r++) run(work, fn);
+        double t1 = now_ns();
+        uint64_t c1 = counter_read(counter);
+
+        double elems = (double)reps * work->n;
+        if ((t1 - t0) / elems < *ns_per_elem) *ns_per_elem = (t1 - t0) / elems;
+        if ((c1 - c0) / elems < *cycles_per_elem) *cycles_per_elem = (c1 - c0) / elems;
+    }
+}
+
+// JIT and reference must agree on every buffer given the same input;
+// contraction and split accumulators allow for rounding differences
+static int matches(const workload_t* work, float* const* expect, const char* name, const char* how) {
+    for (int b = 0; b < work->num_buffers; b++) {
+        for (size_t i = 0; i < work_len(work); i++) {
+            float want = expect[b][i], got = work->bufs[b][i];
+            if (fabsf(want - got) > 1e-4f * (fabsf(want) + fabsf(got)) + 1e-30f) {
+                fprintf(stderr, "[bench] err: %s%s: buffer %d [%zu] is %g, reference %g\n",
+                        name, how, b, i, got, want);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// called directly and through pva_run, whose chunks are kept small so
+// even the tail sizes spread over the pool. pva_run refuses loop-less
+// kernels that do not split, so those are only called directly
+static int verify(workload_t* work, const pva_jit_kernel_t* kernel, pva_kernel_fn ref,
+                  pva_pool_t* pool, const char* name) {
+    size_t len = work_len(work);
+    float* expect[PVA_MAX_BUFFERS] = {0};
+    int ok = 1;
+
+    fill(work);
+    run(work, ref);
+    for (int b = 0; b < work->num_buffers; b++) {
+        expect[b] = malloc(len * sizeof(float));
+        if (!expect[b]) {
+            ok = 0;
+            goto out;
+        }
+        memcpy(expect[b], work->bufs[b], len * sizeof(float));
+    }
+
+    fill(work);
+    run(work, kernel->fn);
+    ok = matches(work, expect, name, "");
+
+    if (!ok || (!kernel->info.has_loop && !kernel->info.splittable)) goto out;
+    pva_run_options_t opts = {pool, 64};
+    fill(work);
+    if (pva_run(kernel, work->n, work->bufs, &opts) != 0) {
+        fprintf(stderr, "[bench] err: %s: pva_run failed\n", name);
+        ok = 0;
+    } else {
+        ok = matches(work, expect, name, " (pva_run)");
+    }
+    // a loop-less kernel has no tail, so a partial vector must be refused
+    if (ok && !kernel->info.has_loop && pva_run(kernel, work->n - 1, work->bufs, &opts) != -1) {
+        fprintf(stderr, "[bench] err: %s: pva_run took %zu elements, not a whole number of vectors\n",
+                name, work->n - 1);
+        ok = 0;
+    }
+
+out:
+    for (int b = 0; b < work->num_buffers; b++) free(expect[b]);
+    return ok;
+}
+
+// flops per element the source describes: the loop body, or the whole
+// kernel when it has no loop. counted before optimization so every
+// implementation is credited with the same work
+static int count_flops(const pva_module_t* mod, int* has_loop) {
+    long begin, end;
+    if (pva_find_loop(mod, &begin, &end) != 0) return -1;
+    *has_loop = begin >= 0;
+    size_t from = begin >= 0 ? (size_t)begin + 1 : 0;
+    size_t to = begin >= 0 ? (size_t)end : mod->size;
+
+    int flops = 0;
+    for (size_t i = from; i < to; i++) {
+        switch (mod->code[i].op) {
+            case PVA_ADD_F32:
+            case PVA_SUB_F32:
+            case PVA_MUL_F32:
+            case PVA_DIV_F32:
+                flops += 1;
+                break;
+            case PVA_FMA_F32:
+            case PVA_FMS_F32:
+                flops += 2;
+                break;
+            default:
+                break;
+        }
+    }
+    return flops;
+}
+
+// buffers the kernel indexes with (named index*, the convention the
+// examples follow), and how far its strided loads walk past n
+static void scan_buffers(const pva_module_t* mod, workload_t* shape) {
+    shape->num_buffers = mod->num_buffers;
+    shape->reach = 1;
+    shape->index_bufs = 0;
+    for (int b = 0; b < mod->num_buffers; b++) {
+        if (strncmp(mod->buffers[b], "index", 5) == 0) shape->index_bufs |= 1u << b;
+    }
+    for (size_t i = 0; i < mod->size; i++) {
+        const pva_instr_t* instr = &mod->code[i];
+        if (instr->op != PVA_LOAD_STRIDED_F32) continue;
+        int32_t stride = (int32_t)instr->src2;
+        size_t reach = (size_t)(stride < 0 ? -stride : stride) / 4;
+        if (reach > shape->reach) shape->reach = reach;
+    }
+}
+
+static const bench_ref_t* find_ref(const bench_ref_t* table, const char* name) {
+    for (; table->name; table++) {
+        if (strcmp(table->name, name) == 0) return table;
+    }
+    return NULL;
+}
+
+static void stem(const char* path, char* name, size_t size) {
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    size_t len = 0;
+    while (base[len] && base[len] != '.' && len + 1 < size) {
+        name[len] = base[len];
+        len++;
+    }
+    name[len] = 0;
+}
+
+static const char* arch_label(pva_arch_t arch) {
+    switch (arch) {
+        case PVA_ARCH_X86_AVX512: return "avx512";
+        case PVA_ARCH_X86_AVX2: return "avx2";
+        case PVA_ARCH_X86_SSE: return "sse";
+        case PVA_ARCH_ARM_SVE: return "sve";
+        case PVA_ARCH_ARM_NEON: return "neon";
+        case PVA_ARCH_RISCV_RVV: return "rvv";
+        default: return "unknown";
+    }
+}
+
+static int bench_file(const char* path, const char* target, int unroll, const size_t* sizes,
+                      int num_sizes, const cycle_counter_t* counter, pva_pool_t* pool) {
+    char name[PVA_MAX_BUFFER_NAME];
+    stem(path, name, sizeof(name));
+
+    pva_module_t* src = pva_parse_file(path);
+    pva_module_t* mod = pva_parse_file(path);
+    if (!src || !mod) {
+        fprintf(stderr, "[bench] err: failed to parse %s\n", path);
+        pva_free(src);
+        pva_free(mod);
+        return -1;
+    }
+    int has_loop = 0;
+    int flops = count_flops(src, &has_loop);
+    workload_t shape;
+    scan_buffers(src, &shape);
+    pva_free(src);
+
+    if (target) {
+        int vec_width = 0;
+        mod->arch = pva_arch_from_name(target, &vec_width);
+        mod->vec_width_bytes = vec_width;
+        if (mod->arch == PVA_ARCH_UNKNOWN) {
+            fprintf(stderr, "[bench] err: unknown target '%s'\n", target);
+            pva_free(mod);
+            return -1;
+        }
+    }
+    mod->fp_contract = 1;
+    if (unroll) mod->unroll = unroll;
+    pva_jit_kernel_t* kernel = pva_jit_compile(mod);
+    if (!kernel) {
+        fprintf(stderr, "[bench] err: failed to compile %s\n", path);
+        pva_free(mod);
+        return -1;
+    }
+    int lanes = mod->vec_width_bytes / 4;
+    bench_lanes = lanes;
+
+    impl_t impls[3];
+    int num_impls = 0;
+    impls[num_impls++] = (impl_t){"pva", kernel->fn};
+    const bench_ref_t* scalar = find_ref(bench_ref_scalar, name);
+    const bench_ref_t* vector = find_ref(bench_ref_vector, name);
+    if (scalar) impls[num_impls++] = (impl_t){"gcc scalar", scalar->fn};
+    if (vector) impls[num_impls++] = (impl_t){"gcc -O3 vec", vector->fn};
+
+    printf("\n[bench] %s: %s, %d floats per vector, %d flop/elem%s\n", path,
+           arch_label(kernel->arch), lanes, flops, has_loop ? "" : ", one vector per call");
+    if (!scalar) printf("[bench]     no C reference for %s, timing pva alone\n", name);
+    printf("%10s  %-12s %10s %10s %10s\n", "n", "impl", "ns/elem", "cyc/elem", "GFLOP/s");
+
+    int result = 0;
+    for (size_t t = 0; t < sizeof(tail_sizes) / sizeof(tail_sizes[0]) && has_loop && scalar; t++) {
+        workload_t work;
+        if (work_alloc(&work, &shape, tail_sizes[t], 0) != 0) {
+            result = -1;
+            break;
+        }
+        if (!verify(&work, kernel, scalar->fn, pool, name)) result = -1;
+        work_free(&work);
+        if (result != 0) break;
+    }
+
+    for (int s = 0; s < num_sizes && result == 0; s++) {
+        workload_t work;
+        size_t n = has_loop ? sizes[s] : (sizes[s] + lanes - 1) / lanes * lanes;
+        if (work_alloc(&work, &shape, n, has_loop ? 0 : (size_t)lanes) != 0) {
+            result = -1;
+            break;
+        }
+
+        if (scalar && !verify(&work, kernel, scalar->fn, pool, name)) result = -1;
+
+        for (int k = 0; k < num_impls && result == 0; k++) {
+            double ns, cycles;
+            fill(&work);
+            measure(&work, impls[k].fn, counter, &ns, &cycles);
+            printf("%10zu  %-12s %10.3f ", work.n, impls[k].label, ns);
+            if (counter->source) printf("%10.3f ", cycles);
+            else printf("%10s ", "-");
+            printf("%10.2f\n", flops / ns);
+        }
+
+        work_free(&work);
+    }
+
+    pva_jit_release(kernel);
+    pva_free(mod);
+    return result;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-n <n>[,<n>...]] [--target=<name>] [--unroll=<n>] kernel.pva...\n", prog);
+    fprintf(stderr, "  -n         element counts to time (default: 1024,16384,262144,4194304)\n");
+    fprintf(stderr, "  --target=  sse, avx2, avx512, neon or sve; must run here (default: this CPU)\n");
+}
+
+int main(int argc, char** argv) {
+    size_t sizes[MAX_SIZES];
+    int num_sizes = 0;
+    const char* target = NULL;
+    int unroll = 0;
+    int first_file = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            char* list = argv[++i];
+            while (*list) {
+                char* end;
+                unsigned long long n = strtoull(list, &end, 10);
+                if (end == list || n == 0 || num_sizes == MAX_SIZES || (*end && *end != ',')) {
+                    fprintf(stderr, "err: -n takes up to %d positive counts\n", MAX_SIZES);
+                    return 1;
+                }
+                sizes[num_sizes++] = (size_t)n;
+                list = *end ? end + 1 : end;
+            }
+        } else if (strncmp(argv[i], "--target=", 9) == 0) {
+            target = argv[i] + 9;
+        } else if (strncmp(argv[i], "--unroll=", 9) == 0) {
+            char* end;
+            long factor = strtol(argv[i] + 9, &end, 10);
+            if (*end || factor < 1 || factor > PVA_MAX_UNROLL) {
+                fprintf(stderr, "err: --unroll takes 1 to %d\n", PVA_MAX_UNROLL);
+                return 1;
+            }
+            unroll = (int)factor;
+        } else if (argv[i][0] != '-') {
+            first_file = i;
+            break;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!first_file) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (num_sizes == 0) {
+        num_sizes = (int)(sizeof(default_sizes) / sizeof(default_sizes[0]));
+        memcpy(sizes, default_sizes, sizeof(default_sizes));
+    }
+
+    cycle_counter_t counter;
+    counter_open(&counter);
+    printf("[bench] cycles: %s\n", counter.source ? counter.source : "unavailable");
+
+    // NULL falls back to the default pool, one thread per core
+    pva_pool_t* pool = pva_pool_create(VERIFY_THREADS, 0);
+    int failed = 0;
+    for (int i = first_file; i < argc; i++) {
+        if (bench_file(argv[i], target, unroll, sizes, num_sizes, &counter, pool) != 0) failed++;
+    }
+    if (pool) pva_pool_destroy(pool);
+    if (counter.fd >= 0) close(counter.fd);
+    return failed ? 1 : 0;
+}
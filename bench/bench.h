@@ -0,0 +1,23 @@
+#ifndef PVA_BENCH_H
+#define PVA_BENCH_H
+
+#include "pva.h"
+
+// hand-written C equivalents of the example kernels, with the same
+// signature so the driver times them exactly like the JIT output.
+// reference.c is built twice: scalar (-fno-tree-vectorize) and as gcc
+// vectorizes it at -O3 -march=native
+typedef struct {
+    const char* name;   // example file stem: examples/saxpy.pva -> "saxpy"
+    pva_kernel_fn fn;
+} bench_ref_t;
+
+// both tables end with a NULL name
+extern const bench_ref_t bench_ref_scalar[];
+extern const bench_ref_t bench_ref_vector[];
+
+// floats per vector on the target being timed, for the references of
+// kernels that store a single vector after their loop
+extern int bench_lanes;
+
+#endif
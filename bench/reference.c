@@ -0,0 +1,105 @@
+#include "bench.h"
+
+// buffers are filled so every 64-byte row holds a single value; a vector
+// the kernel loads outside its loop is then a splat of element 0 on every
+// target, which is what the scalar code reads
+
+static void saxpy(size_t n, float* restrict alpha, float* restrict x, float* restrict y,
+                  float* b3, float* b4, float* b5, float* b6, float* b7) {
+    (void)b3; (void)b4; (void)b5; (void)b6; (void)b7;
+    float a = alpha[0];
+    for (size_t i = 0; i < n; i++) y[i] = a * x[i] + y[i];
+}
+
+static void poly(size_t n, float* restrict coeffs, float* restrict x, float* restrict y,
+                 float* b3, float* b4, float* b5, float* b6, float* b7) {
+    (void)b3; (void)b4; (void)b5; (void)b6; (void)b7;
+    float c4 = coeffs[0], c3 = coeffs[16], c2 = coeffs[32], c1 = coeffs[48], c0 = coeffs[64];
+    for (size_t i = 0; i < n; i++) {
+        float v = x[i];
+        y[i] = (((c4 * v + c3) * v + c2) * v + c1) * v + c0;
+    }
+}
+
+// one step of the escape test, as written in mandelbrot.pva; only the
+// iteration count reaches memory, counted in the lanes still iterating
+static void mandelbrot(size_t n, float* restrict input_re, float* restrict input_im,
+                       float* restrict max_iter, float* restrict escape_limit,
+                       float* restrict c_re, float* restrict c_im, float* restrict output,
+                       float* b7) {
+    (void)c_re; (void)c_im; (void)b7;
+    for (size_t i = 0; i < n; i++) {
+        float re = input_re[i], im = input_im[i], iter = 0.0f;
+        int active = iter < max_iter[i] && re * re + im * im < escape_limit[i];
+        output[i] = active ? iter + 1.0f : iter;
+    }
+}
+
+static void masked(size_t n, float* restrict limit, float* restrict x, float* restrict y,
+                   float* restrict z, float* restrict w, float* b5, float* b6, float* b7) {
+    (void)b5; (void)b6; (void)b7;
+    float l = limit[0];
+    for (size_t i = 0; i < n; i++) {
+        float v = x[i];
+        int below = v < l;
+        z[i] = below ? v * y[i] : 0.0f;
+        y[i] = below ? v : l;
+        if (below) w[i] = v;
+    }
+}
+
+// sum, max and min of x, each broadcast over the one vector reduce.pva
+// stores at a 64-byte row of out; the sum is kept in double so the
+// reference does not lose more than the jit's per-lane partial sums
+static void reduce(size_t n, float* restrict x, float* restrict out, float* b2, float* b3,
+                   float* b4, float* b5, float* b6, float* b7) {
+    (void)b2; (void)b3; (void)b4; (void)b5; (void)b6; (void)b7;
+    double sum = 0.0;
+    float max = 0.0f, min = 1e30f;
+    for (size_t i = 0; i < n; i++) {
+        sum += x[i];
+        if (max < x[i]) max = x[i];
+        if (x[i] < min) min = x[i];
+    }
+    float row[4] = {(float)sum, (float)sum, max, min};
+    for (int r = 0; r < 4; r++) {
+        for (int l = 0; l < bench_lanes; l++) out[r * 16 + l] = row[r];
+    }
+}
+
+static void constant(size_t n, float* restrict x, float* restrict y, float* restrict z, float* b3,
+                     float* b4, float* b5, float* b6, float* b7) {
+    (void)b3; (void)b4; (void)b5; (void)b6; (void)b7;
+    for (size_t i = 0; i < n; i++) {
+        y[i] = x[i] < 1.0f ? 0.0f : 0.1f * x[i] - 2.5f;
+        z[i] = x[i] + 0.1f;
+        if (x[i] < 1.0f) z[i] *= 2.0f;
+    }
+}
+
+// index holds int32 offsets into table and out (see fill in bench.c);
+// points is read as pairs, taking the second float of each
+static void gather(size_t n, float* restrict index, float* restrict table, float* restrict points,
+                   float* restrict y, float* restrict out, float* b5, float* b6, float* b7) {
+    (void)b5; (void)b6; (void)b7;
+    const int32_t* idx = (const int32_t*)index;
+    for (size_t i = 0; i < n; i++) {
+        y[i] = table[idx[i]] + points[2 * i + 1];
+        out[idx[i]] = y[i];
+    }
+}
+
+#ifndef REF_TABLE
+#error "build with -DREF_TABLE=bench_ref_scalar or bench_ref_vector"
+#endif
+
+const bench_ref_t REF_TABLE[] = {
+    {"saxpy", saxpy},
+    {"poly", poly},
+    {"mandelbrot", mandelbrot},
+    {"masked", masked},
+    {"reduce", reduce},
+    {"const", constant},
+    {"gather", gather},
+    {NULL, NULL},
+};
@@ -0,0 +1,105 @@
+// synthetic .pva generator for compiler-throughput runs:
+//   synth <instructions> [seed] > kernel.pva
+// a few loads ahead of one loop whose body holds nearly everything, then
+// stores of the last results. the opcode mix follows the hand-written
+// kernels: mostly arithmetic, about a quarter memory traffic, and some
+// compare/mask work. operands favour recently written registers, so live
+// ranges stay short the way generated code's do
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_REGS 256    // virtual registers, reused round-robin
+#define RECENT 16       // window most operands are drawn from
+#define NUM_BUFFERS 8
+
+static const char* buffers[NUM_BUFFERS] = {"a", "b", "c", "d", "e", "f", "g", "out"};
+
+// percent of the body per opcode class
+typedef enum { LOAD, STORE, ADD, SUB, MUL, FMA, DIV, CMP, MASK, MOV, ZERO } kind_t;
+static const struct {
+    kind_t kind;
+    int weight;
+} mix[] = {
+    {LOAD, 18}, {STORE, 7}, {ADD, 20}, {SUB, 8}, {MUL, 20}, {FMA, 10},
+    {DIV, 2},   {CMP, 6},   {MASK, 4}, {MOV, 3},  {ZERO, 2},
+};
+
+static unsigned long long state;
+
+static unsigned rnd(void) {
+    // xorshift64*
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return (unsigned)((state * 2685821657736338717ull) >> 32);
+}
+
+static unsigned long defs;  // registers written so far
+
+static unsigned dst(void) {
+    return (unsigned)(defs++ % NUM_REGS);
+}
+
+static unsigned src(void) {
+    if (defs == 0) return 0;
+    unsigned long window = defs < NUM_REGS ? defs : NUM_REGS;
+    unsigned long back = rnd() % 8 ? rnd() % (window < RECENT ? window : RECENT) : rnd() % window;
+    return (unsigned)((defs - 1 - back) % NUM_REGS);
+}
+
+static void mem(FILE* out, const char* op, unsigned reg) {
+    const char* buf = buffers[rnd() % NUM_BUFFERS];
+    unsigned offset = (rnd() % 16) * 64;
+    if (offset) fprintf(out, "%s r%u, [%s + %u]\n", op, reg, buf, offset);
+    else fprintf(out, "%s r%u, [%s]\n", op, reg, buf);
+}
+
+static void emit(FILE* out) {
+    int total = 0;
+    for (size_t i = 0; i < sizeof(mix) / sizeof(mix[0]); i++) total += mix[i].weight;
+    int pick = (int)(rnd() % total);
+    size_t k = 0;
+    while (pick >= mix[k].weight) pick -= mix[k++].weight;
+
+    // read the sources before the destination takes its register
+    unsigned a = src(), b = src(), c = src();
+    switch (mix[k].kind) {
+        case LOAD: mem(out, "vload", dst()); break;
+        case STORE: mem(out, "vstore", a); break;
+        case ADD: fprintf(out, "vadd r%u, r%u, r%u\n", dst(), a, b); break;
+        case SUB: fprintf(out, "vsub r%u, r%u, r%u\n", dst(), a, b); break;
+        case MUL: fprintf(out, "vmul r%u, r%u, r%u\n", dst(), a, b); break;
+        case FMA: fprintf(out, "vfma r%u, r%u, r%u, r%u\n", dst(), a, b, c); break;
+        case DIV: fprintf(out, "vdiv r%u, r%u, r%u\n", dst(), a, b); break;
+        case CMP: fprintf(out, "%s r%u, r%u, r%u\n", rnd() % 2 ? "vlt" : "veq", dst(), a, b); break;
+        case MASK: fprintf(out, "%s r%u, r%u, r%u\n", rnd() % 2 ? "vand" : "vor", dst(), a, b); break;
+        case MOV: fprintf(out, "vmov r%u, r%u\n", dst(), a); break;
+        case ZERO: fprintf(out, "vzero r%u\n", dst()); break;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <instructions> [seed] > kernel.pva\n", argv[0]);
+        return 1;
+    }
+    char* end;
+    unsigned long long count = strtoull(argv[1], &end, 10);
+    if (*end || count < 64) {
+        fprintf(stderr, "err: instruction count must be at least 64\n");
+        return 1;
+    }
+    state = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+    if (state == 0) state = 1;
+
+    FILE* out = stdout;
+    unsigned long long prologue = 32, epilogue = 16;
+    fprintf(out, "# synthetic kernel, %llu instructions\n", count);
+    for (unsigned long long i = 0; i < prologue; i++) mem(out, "vload", dst());
+    fprintf(out, "loop_begin\n");
+    for (unsigned long long i = 0; i < count - prologue - epilogue - 2; i++) emit(out);
+    fprintf(out, "loop_end\n");
+    for (unsigned long long i = 0; i < epilogue; i++) mem(out, "vstore", src());
+    return 0;
+}
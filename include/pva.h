@@ -20,30 +20,472 @@ typedef enum {
     PVA_CMP_LT_F32, PVA_CMP_EQ_F32,
     PVA_AND_MASK, PVA_OR_MASK,
     PVA_SETZERO, PVA_LOOP_BEGIN, PVA_LOOP_END,
-    PVA_NOP
+    PVA_NOP,
+    PVA_FMA_F32,    // dst = src1 * src2 + src3
+    PVA_FMS_F32,    // dst = src3 - src1 * src2
+    PVA_MOV_F32,    // dst = src1
+    // every lane of dst = the sum, max or min of src1's lanes. only allowed
+    // outside the loop, where every lane is live. the sum is in no
+    // particular order, or lane by lane from the first for _ORD
+    PVA_REDSUM_F32, PVA_REDSUM_ORD_F32, PVA_REDMAX_F32, PVA_REDMIN_F32,
+    PVA_CONST_F32,  // every lane of dst = imm, the bits of a float
+    // indexed and strided memory, see pva_instr_t
+    PVA_GATHER_F32, PVA_SCATTER_F32, PVA_LOAD_STRIDED_F32,
+    // inserted by unrolling: the loop body up to here is one original
+    // iteration, the rest repeats it imm - 1 times. leftover whole vectors
+    // and the tail run the first copy alone
+    PVA_LOOP_SPLIT,
+    // inserted by the register allocator: imm is the stack slot
+    PVA_SPILL,      // slot[imm] = src1
+    PVA_RELOAD      // dst = slot[imm]
 } pva_opcode_t;
 
+// register operands are virtual (unbounded) until pva_regalloc maps them
+// onto the target's vector registers. vstore keeps its value in dst;
+// vload/vstore take the buffer index in src1 and a signed byte offset in imm,
+// plus vec_offset whole vectors of the target (set by unrolling, so one IR
+// serves every width of a fat kernel). src3 is the addend of fma/fms.
+// vgather/vscatter address lane i at buffer src1 + src2[i] * imm bytes
+// (imm 1 or 4, src2 holding int32 indices from 0 to INT32_MAX) whichever
+// iteration they run in, and vscatter keeps its value in dst like vstore.
+// vload.strided reads lane i from buffer src1 + imm + (j + i) * src2
+// bytes, j being the element the loop iteration starts at (0 outside the
+// loop) and src2 a multiple of 4 no larger than PVA_MAX_STRIDE either way;
+// vec_offset adds whole vectors to j
+// mask_reg is PVA_NO_MASK or a register holding a comparison result, all
+// ones in the lanes that compared true and zero in the rest: arithmetic
+// and vmov then write only those lanes, the others taking src3 (the
+// addend of fma/fms), or zero when imm is PVA_MASK_ZERO, and vstore
+// leaves the memory of the others alone
 typedef struct {
     pva_opcode_t op;
-    uint8_t dst, src1, src2;
+    uint32_t dst, src1, src2, src3;
     uint32_t imm;
-    int mask_reg;
+    uint32_t mask_reg;
+    uint32_t vec_offset;
 } pva_instr_t;
 
+#define PVA_NO_MASK UINT32_MAX
+#define PVA_MASK_ZERO 1
+
+// part of every compile cache key: bump it with any change to the code
+// the compiler produces
+#define PVA_VERSION "0.6.2"
+
+// .pvab files (--emit-ir) hold pva_instr_t records as they are in memory,
+// opcode numbers included: bump the version whenever either changes
+#define PVA_IR_VERSION 5
+
+#define PVA_MAX_USES 4
+#define PVA_MAX_REGS (1u << 20)     // passes size per-register tables from the highest number
+#define PVA_MAX_UNROLL 8
+#define PVA_MAX_STRIDE 65536
+
+// named buffers ([input_re], [output + 64], ...) are numbered in order of
+// first use and become the kernel's pointer arguments after n
+#define PVA_MAX_BUFFERS 8
+#define PVA_MAX_BUFFER_NAME 64
+
+// --time-passes: wall time, instruction counts and the process's peak
+// resident memory after each stage, printed by pva_timer_report
+#define PVA_MAX_TIMED_PASSES 32
+#define PVA_TIMER_NONE SIZE_MAX     // count that does not apply to a stage
+
+typedef struct {
+    const char* name;
+    double ms;
+    size_t in, out;
+    long peak_rss_kb;
+} pva_pass_time_t;
+
+typedef struct {
+    pva_pass_time_t passes[PVA_MAX_TIMED_PASSES];
+    int count;
+} pva_timer_t;
+
+// diagnostics: every line a stage reports, as pva_log delivers it. with
+// no handler set they are printed the way the command line shows them,
+// notes to stdout and the rest to stderr
+typedef enum {
+    PVA_DIAG_NOTE,      // progress: what each pass did
+    PVA_DIAG_WARNING,
+    PVA_DIAG_ERROR
+} pva_diag_level_t;
+
+typedef struct {
+    pva_diag_level_t level;
+    int line;               // source line it concerns, 0 for none
+    const char* message;    // "[parser] line 3: unknown opcode 'vfoo'", no newline
+} pva_diag_t;
+
+typedef void (*pva_diag_fn)(const pva_diag_t* diag, void* user);
+
+typedef struct {
+    pva_diag_fn fn;         // NULL prints
+    void* user;
+    pva_diag_level_t level; // less severe messages are dropped unformatted
+} pva_diag_sink_t;
+
 typedef struct {
     pva_instr_t* code;
     size_t size, capacity;
     pva_arch_t arch;
     int vec_width_bytes;
+    int spill_slots;    // set by pva_regalloc
+    int fp_contract;    // fuse vmul into a following vadd/vsub (-ffp-contract=fast)
+    int unroll;         // loop unroll factor: 0 picks one, 1 disables (--unroll=)
+    char buffers[PVA_MAX_BUFFERS][PVA_MAX_BUFFER_NAME];
+    int num_buffers;
     char* filename;
+    pva_timer_t* timer; // stages record into it when set (--time-passes)
+    void* code_map;     // .pvab mapping code points into; NULL when code is on the heap
+    size_t code_map_size;
+    pva_diag_sink_t diag;   // where every stage working on the module reports
 } pva_module_t;
 
+// kernel entry point: element count in the first argument, then one
+// pointer per named buffer in mod->buffers order (unused trailing ones may
+// be NULL). code between loop_begin and loop_end runs once per vector over
+// [0, n) with every buffer pointer advancing; the remainder that does not
+// fill a whole vector is handled in a tail
+typedef void (*pva_kernel_fn)(size_t n, float* buf0, float* buf1, float* buf2,
+                              float* buf3, float* buf4, float* buf5, float* buf6,
+                              float* buf7);
+
+// how a kernel's element range divides (pva_run). the loop indexes its
+// buffers from the element it starts at, while code outside it always
+// sees element 0, so a chunk [lo, hi) is one call with n = hi - lo and
+// the walked buffers advanced by lo. that equals a call over [0, n) unless
+// a walked buffer is also used outside the loop or something is stored
+// after it (a reduction). loop-less kernels handle one vector per call.
+// gathered buffers are never advanced, and kernels that scatter or load
+// strided do not divide at all
+typedef struct {
+    int num_buffers;
+    int vec_width_bytes;
+    int has_loop;
+    int splittable;
+    uint32_t walked;    // bit b: the loop (or, without one, the kernel) indexes buffer b
+} pva_kernel_info_t;
+
+typedef struct {
+    pva_kernel_fn fn;
+    void* mem;          // executable mapping backing fn
+    size_t mem_size;
+    size_t code_size;
+    pva_arch_t arch;
+    pva_kernel_info_t info;
+} pva_jit_kernel_t;
+
+// a code location that refers into the constant pool. `target` is the
+// pool offset; x86 disp32 fields take `addend` (-4, or less when an imm8
+// follows) since rip points past the instruction. the RISC-V lo12 half
+// names the auipc it pairs with in `pair`
+typedef enum {
+    PVA_RELOC_X86_PC32,         // rip-relative disp32
+    PVA_RELOC_ARM_ADR_PAGE,     // adrp xd, page
+    PVA_RELOC_ARM_ADD_LO12,     // add xd, xd, #lo12
+    PVA_RELOC_RISCV_PCREL_HI20, // auipc
+    PVA_RELOC_RISCV_PCREL_LO12  // addi / I-type load
+} pva_reloc_kind_t;
+
+typedef struct {
+    pva_reloc_kind_t kind;
+    size_t offset;
+    size_t target;
+    int32_t addend;
+    size_t pair;
+} pva_reloc_t;
+
+// growable output buffer shared by all backends; `size` is the exact
+// number of bytes emitted. once an allocation fails `failed` sticks and
+// further emits are dropped, so callers only need to check at the end.
+// constants live in a separate pool that either becomes .rodata or is
+// appended to the code by pva_codebuf_link; one already in the pool is
+// not added twice
+typedef struct {
+    uint8_t* data;
+    size_t size, capacity;
+    int failed;
+    uint8_t* rodata;
+    size_t rodata_size, rodata_capacity;
+    pva_reloc_t* relocs;
+    size_t num_relocs, reloc_capacity;
+} pva_codebuf_t;
+
+#define PVA_RODATA_ALIGN 64
+
+// SSA form of a module: every register is defined once. values the loop
+// carries meet in phis at the loop header; entry is the value from before
+// the loop (UINT32_MAX if there is none), back the one the body leaves
+typedef struct {
+    uint32_t var;       // register before conversion
+    uint32_t dst, entry, back;
+} pva_phi_t;
+
+typedef struct {
+    pva_phi_t* phis;
+    size_t num_phis, phi_capacity;
+    uint32_t num_names;
+} pva_ssa_t;
+
+// basic blocks of a kernel: the code before the loop, the body and the code
+// after it (just one block without a loop). the loop may run zero times, so
+// the entry block also falls through to the exit. live_in/live_out are
+// register bitsets of `reg_words` words per block. def-use chains: the
+// instructions reading the value defined at i are
+// use_sites[use_start[i] .. use_start[i + 1]), following the back edge
+#define PVA_MAX_BLOCKS 3
+
+typedef struct {
+    size_t begin, end;          // mod->code[begin, end), markers excluded
+    int succ[2];                // -1 when absent
+} pva_block_t;
+
+typedef struct {
+    pva_block_t blocks[PVA_MAX_BLOCKS];
+    int num_blocks;
+    uint32_t num_regs;
+    size_t reg_words;
+    uint64_t* live_in;
+    uint64_t* live_out;
+    size_t* use_start;
+    size_t* use_sites;
+} pva_liveness_t;
+
+// dependency graph over one straight-line region mod->code[begin, begin +
+// count) (no loop markers inside); nodes are region-relative indices and
+// every edge points forward. latency is how long `to` must wait after
+// `from` issues
+typedef enum {
+    PVA_DEP_RAW,
+    PVA_DEP_WAR,
+    PVA_DEP_WAW,
+    PVA_DEP_MEM
+} pva_dep_kind_t;
+
+typedef struct {
+    uint32_t from, to;
+    int latency;
+    pva_dep_kind_t kind;
+} pva_dep_t;
+
+typedef struct {
+    size_t begin, count;
+    pva_dep_t* edges;           // grouped by `to`, in discovery order
+    size_t num_edges, edge_capacity;
+    size_t* succ_start;         // successors of i: succ[succ_start[i] .. succ_start[i + 1])
+    pva_dep_t* succ;
+    int* latency;               // per node, from the mod->arch machine model
+    uint32_t* num_preds;
+} pva_dag_t;
+
+void pva_log(const pva_module_t* mod, pva_diag_level_t level, int line, const char* fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+// the sink a *_diag entry point reports through: NULL prints, like a sink
+// without a handler
+const pva_diag_sink_t* pva_diag_or_print(const pva_diag_sink_t* diag);
+
 pva_arch_t pva_detect_arch(int* vec_width_bytes);
+pva_arch_t pva_arch_from_name(const char* name, int* vec_width_bytes);
+const char* pva_arch_name(pva_arch_t arch);
 pva_module_t* pva_parse_file(const char* filename);
+// -j: the source split at line boundaries and parsed on up to `jobs`
+// threads, then joined; the module is the one pva_parse_file returns
+#define PVA_MAX_JOBS 256
+pva_module_t* pva_parse_file_parallel(const char* filename, int jobs);
+// the same, reporting through diag instead of printing
+pva_module_t* pva_parse_file_diag(const char* filename, int jobs, const pva_diag_sink_t* diag);
+// source held in memory; `name` stands in for the file name
+pva_module_t* pva_parse_source(const char* source, size_t size, const char* name,
+                               const pva_diag_sink_t* diag);
 void pva_optimize(pva_module_t* mod);
-void pva_emit_x86(pva_module_t* mod, uint8_t* buffer);
-void pva_emit_arm(pva_module_t* mod, uint8_t* buffer);
-void pva_emit_riscv(pva_module_t* mod, uint8_t* buffer);
+int pva_regalloc(pva_module_t* mod);
+int pva_regalloc_num_regs(pva_arch_t arch);
+int pva_emit_x86(pva_module_t* mod, pva_codebuf_t* cb);
+int pva_emit_arm(pva_module_t* mod, pva_codebuf_t* cb);
+int pva_emit_riscv(pva_module_t* mod, pva_codebuf_t* cb);
+int pva_emit(pva_module_t* mod, pva_codebuf_t* cb);
+// fat x86 output: SSE, AVX2 and AVX-512 variants of mod behind a resolver at
+// offset 0, `pva_kernel_fn (*)(void)`, that picks the best one for the CPU
+// it runs on, or returns NULL on one without SSE4.1. offsets[] receives where the AVX-512, AVX2 and SSE variants
+// start (may be NULL). optimize mod with fp_contract off: SSE has no FMA,
+// so contracted ops would round differently on that tier
+int pva_emit_x86_fat(pva_module_t* mod, pva_codebuf_t* cb, size_t offsets[3]);
+int pva_find_loop(const pva_module_t* mod, long* begin, long* end);
 void pva_free(pva_module_t* mod);
 
+int pva_instr_def(const pva_instr_t* instr);
+int pva_instr_is_marker(const pva_instr_t* instr);
+int pva_op_maskable(pva_opcode_t op);
+int pva_op_memory(pva_opcode_t op);
+int pva_op_reduction(pva_opcode_t op);
+int pva_instr_uses(const pva_instr_t* instr, uint32_t uses[PVA_MAX_USES]);
+int pva_instr_use_fields(pva_instr_t* instr, uint32_t* fields[PVA_MAX_USES]);
+uint32_t pva_module_num_regs(const pva_module_t* mod);
+void pva_module_replace_code(pva_module_t* mod, pva_instr_t* code, size_t size, size_t capacity);
+
+int pva_ssa_build(pva_module_t* mod, pva_ssa_t* ssa);
+int pva_gvn(pva_module_t* mod, pva_ssa_t* ssa);
+int pva_ssa_destroy(pva_module_t* mod, pva_ssa_t* ssa);
+void pva_ssa_free(pva_ssa_t* ssa);
+
+int pva_liveness_build(pva_liveness_t* live, const pva_module_t* mod);
+int pva_live_in(const pva_liveness_t* live, int block, uint32_t reg);
+int pva_live_out(const pva_liveness_t* live, int block, uint32_t reg);
+void pva_liveness_free(pva_liveness_t* live);
+
+int pva_dag_build(pva_dag_t* dag, const pva_module_t* mod, size_t begin, size_t end);
+int pva_dag_longest_chain(const pva_dag_t* dag);
+void pva_dag_free(pva_dag_t* dag);
+int pva_schedule(pva_module_t* mod);
+int pva_sched_fp_parallelism(pva_arch_t arch);
+
+int pva_codebuf_init(pva_codebuf_t* cb, size_t initial_capacity);
+int pva_codebuf_reserve(pva_codebuf_t* cb, size_t extra);
+void pva_codebuf_emit(pva_codebuf_t* cb, const void* data, size_t len);
+void pva_codebuf_emit8(pva_codebuf_t* cb, uint8_t byte);
+void pva_codebuf_emit32(pva_codebuf_t* cb, uint32_t word);
+void pva_codebuf_patch32(pva_codebuf_t* cb, size_t offset, uint32_t word);
+size_t pva_codebuf_rodata(pva_codebuf_t* cb, const void* data, size_t len, size_t align);
+void pva_codebuf_reloc(pva_codebuf_t* cb, pva_reloc_kind_t kind, size_t offset,
+                       size_t target, int32_t addend, size_t pair);
+int pva_codebuf_link(pva_codebuf_t* cb);
+void pva_codebuf_free(pva_codebuf_t* cb);
+
+// object file output: an ELF64 relocatable for mod->arch defining `name`
+// (an IFUNC over the variants when fat_offsets is given), and a C header
+// declaring it
+int pva_write_elf(const char* path, const pva_module_t* mod, const pva_codebuf_t* cb,
+                  const char* name, const size_t fat_offsets[3]);
+int pva_write_header(const char* path, const pva_module_t* mod, const char* name, int fat);
+void pva_symbol_from_path(const char* path, char* name, size_t size);
+
+// binary IR (--emit-ir / --load-ir): the module with its target, options
+// and buffer table, loaded by mapping the file so code is used in place
+int pva_write_ir(const char* path, const pva_module_t* mod);
+pva_module_t* pva_load_ir(const char* path);
+// the same, reporting through diag instead of printing
+pva_module_t* pva_load_ir_diag(const char* path, const pva_diag_sink_t* diag);
+
+// compile cache (--cache-dir): finished code on disk, keyed by a SHA-256
+// over PVA_VERSION, the options below and the input file's bytes. options
+// are taken as given, so the key is known before anything is parsed
+#define PVA_CACHE_DEFAULT_MB 256
+
+typedef struct {
+    const char* dir;
+    uint64_t max_bytes;         // least recently used entries go past this
+    pva_diag_sink_t diag;       // hits, stores, evictions and unusable entries
+} pva_cache_t;
+
+typedef struct {
+    pva_arch_t arch;            // --target, else the detected one
+    int vec_width_bytes;
+    int target_given;
+    int fp_contract;            // -1 when left to the module
+    int unroll;                 // 0 when left to the module
+    int fat;
+    int load_ir;                // the input is a .pvab file
+} pva_cache_options_t;
+
+typedef struct {
+    char hex[65];
+} pva_cache_key_t;
+
+int pva_cache_key(pva_cache_key_t* key, const char* input, const pva_cache_options_t* opts);
+// a hit returns 0 with cb as pva_emit left it (constant pool not yet
+// linked) and a module carrying the target and buffer table but no code;
+// info (may be NULL) receives what pva_kernel_info found when it was stored
+int pva_cache_load(const pva_cache_t* cache, const pva_cache_key_t* key, const char* filename,
+                   pva_module_t** mod, pva_codebuf_t* cb, size_t fat_offsets[3],
+                   pva_kernel_info_t* info);
+int pva_cache_store(const pva_cache_t* cache, const pva_cache_key_t* key, const pva_module_t* mod,
+                    const pva_codebuf_t* cb, const size_t fat_offsets[3]);
+
+// embedding (libpva): source text in memory to finished code, with no
+// files and nothing printed unless a handler asks for the diagnostics.
+// calls share no state, so threads may compile concurrently
+typedef struct {
+    pva_arch_t arch;            // PVA_ARCH_UNKNOWN: the best this CPU runs
+    int vec_width_bytes;        // 0 takes the target's own
+    int fp_contract;            // -1 leaves the module's default
+    int unroll;                 // 0 picks one, 1 disables
+    pva_diag_fn diag;           // NULL: silent
+    void* diag_user;
+    pva_diag_level_t diag_level;
+} pva_options_t;
+
+typedef struct {
+    pva_codebuf_t code;         // linked: the constant pool follows the code
+    pva_arch_t arch;
+    int vec_width_bytes;
+    char buffers[PVA_MAX_BUFFERS][PVA_MAX_BUFFER_NAME];
+    int num_buffers;            // the kernel's buffer arguments, in order
+    pva_kernel_info_t info;
+    pva_diag_sink_t diag;
+} pva_compiled_t;
+
+void pva_options_init(pva_options_t* opts);
+int pva_compile_source(const char* source, size_t size, const pva_options_t* opts, pva_compiled_t* out);
+void pva_compiled_free(pva_compiled_t* compiled);
+
+// batch compilation (--batch): every input for every target as a job of
+// its own on a fixed pool of threads. inputs are paths, glob patterns or
+// @manifest files listing either, one per line; outputs go to out_dir as
+// <stem>.<target>.bin, or .o with a .h beside it when object is set
+typedef struct {
+    const char* const* inputs;
+    int num_inputs;
+    const pva_arch_t* targets;
+    int num_targets;
+    const char* out_dir;
+    int object;
+    int fp_contract;            // -1 and 0 keep the module's own
+    int unroll;
+    int threads;
+} pva_batch_t;
+
+// prints a summary line per job; 0 when every job succeeded
+int pva_batch_compile(const pva_batch_t* batch);
+
+// all three are no-ops on a NULL timer
+void pva_timer_begin(pva_timer_t* timer, const char* name, size_t in);
+void pva_timer_end(pva_timer_t* timer, size_t out);
+void pva_timer_report(const pva_timer_t* timer);
+
+pva_jit_kernel_t* pva_jit_compile(pva_module_t* mod);
+// parse, optimize and map a kernel for this CPU with default options,
+// through the cache when one is given (may be NULL)
+pva_jit_kernel_t* pva_jit_compile_file(const char* path, const pva_cache_t* cache);
+// the same, with the parse, the cache and the mapping all reporting through diag
+pva_jit_kernel_t* pva_jit_compile_file_diag(const char* path, const pva_cache_t* cache,
+                                            const pva_diag_sink_t* diag);
+// maps code pva_compile_source produced for this CPU
+pva_jit_kernel_t* pva_jit_load(const pva_compiled_t* compiled);
+void pva_jit_release(pva_jit_kernel_t* kernel);
+
+// runtime: [0, n) split into chunks run on a persistent pool of threads.
+// each thread starts on an even share of the chunks and steals half of
+// another's remainder once its own is done. one pva_run at a time per pool
+typedef struct pva_pool pva_pool_t;
+
+typedef struct {
+    pva_pool_t* pool;       // NULL: a process-wide pool, one thread per core
+    size_t chunk_elems;     // 0: sized so a chunk's buffers stay in L2
+} pva_run_options_t;
+
+// threads <= 0 is one per online core; pin_cores binds the pool's i-th
+// thread to core i
+pva_pool_t* pva_pool_create(int threads, int pin_cores);
+void pva_pool_destroy(pva_pool_t* pool);
+int pva_kernel_info(const pva_module_t* mod, pva_kernel_info_t* info);
+// buffers in mod->buffers order; a kernel with a loop that does not split
+// runs as one call on the caller's thread. a loop-less kernel runs once per
+// vector, so it must split and n must be a multiple of its lanes: with no
+// tail to mask, a partial vector would write past n. otherwise, and for a
+// NULL kernel, -1 and nothing runs
+int pva_run(const pva_jit_kernel_t* kernel, size_t n, float* const buffers[],
+            const pva_run_options_t* opts);
+
 #endif
\ No newline at end of file
@@ -1,151 +1,844 @@
 #include "pva.h"
-#include <stdio.h>
 #include <string.h>
 
-void pva_emit_arm(pva_module_t* mod, uint8_t* buffer) {
-    if (!mod || !buffer) return;
+// AAPCS64: n in x0, buffer pointers in x1-x7, the eighth on the stack
+#define X_COUNT 0
+#define X_INDEX 9    // byte offset of the current loop iteration
+#define X_ADDR  10   // address temp for offset and lane loads/stores
+#define X_STACK_BUFFER 11
+#define X_OFFSET 12  // large buffer offsets
+#define X_LANES 13   // SVE: elements per vector
+#define X_FP    29
 
-    uint8_t* ptr = buffer;
-    memset(buffer, 0x00, 8192);
+#define NUM_ARG_BUFFERS 7
 
-    printf("[codegen] generating ARM NEON/SVE code for %zu instructions\n", mod->size);
-    printf("[codegen] target vector width: %d bytes\n", mod->vec_width_bytes);
+static int buffer_reg(uint32_t buffer) {
+    return buffer < NUM_ARG_BUFFERS ? (int)buffer + 1 : X_STACK_BUFFER;
+}
 
-    // prologue: save callee-saved registers
-    // stp fp, lr, [sp, #-16]!
-    *ptr++ = 0xfd; *ptr++ = 0x7b; *ptr++ = 0xbf; *ptr++ = 0xa9;
-    // add fp, sp, #0
-    *ptr++ = 0xfd; *ptr++ = 0x03; *ptr++ = 0x00; *ptr++ = 0x91;
-    // sub sp, sp, #0x100 (allocate stack space)
-    *ptr++ = 0xff; *ptr++ = 0x83; *ptr++ = 0x04; *ptr++ = 0xd1;
+#define V_SCRATCH 31
 
-    // gen instruction codes
-    for (size_t i = 0; i < mod->size; i++) {
+// SVE predicates
+#define P_ALL  0     // ptrue, whole vector
+#define P_TAIL 1     // whilelo, lanes left in the last iteration
+#define P_CMP  2     // comparison results, and masks tested out of their registers
+
+// condition codes
+#define COND_NE 0x1
+#define COND_HS 0x2
+#define COND_LO 0x3
+
+// how one IR instruction is lowered
+typedef enum {
+    MODE_FULL,      // whole vector
+    MODE_LANE0,     // lane 0 only, other lanes preserved (NEON scalar tail)
+    MODE_MASKED     // lanes active in p1 only, others preserved (SVE tail)
+} emit_mode_t;
+
+// three-register vector op: <base> Vd, Vn, Vm
+static void emit_vec3(pva_codebuf_t* cb, uint32_t base, uint8_t d, uint8_t n, uint8_t m) {
+    pva_codebuf_emit32(cb, base | ((m & 0x1f) << 16) | ((n & 0x1f) << 5) | (d & 0x1f));
+}
+
+// b.cond / cbz placeholder, target patched by patch_branch
+static size_t emit_branch(pva_codebuf_t* cb, uint32_t opcode) {
+    size_t at = cb->size;
+    pva_codebuf_emit32(cb, opcode);
+    return at;
+}
+
+static void patch_branch(pva_codebuf_t* cb, size_t at, uint32_t opcode, size_t target) {
+    int32_t imm19 = (int32_t)((long)target - (long)at) / 4;
+    pva_codebuf_patch32(cb, at, opcode | (((uint32_t)imm19 & 0x7ffff) << 5));
+}
+
+static void emit_alu(pva_codebuf_t* cb, emit_mode_t mode, const pva_instr_t* instr) {
+    uint32_t base;
+    uint8_t n = instr->src1, m = instr->src2;
+
+    switch (instr->op) {
+        case PVA_ADD_F32: base = 0x4e20d400; break;     // fadd v.4s
+        case PVA_SUB_F32: base = 0x4ea0d400; break;     // fsub v.4s
+        case PVA_MUL_F32: base = 0x6e20dc00; break;     // fmul v.4s
+        case PVA_DIV_F32: base = 0x6e20fc00; break;     // fdiv v.4s
+        case PVA_CMP_EQ_F32: base = 0x4e20e400; break;  // fcmeq v.4s
+        case PVA_CMP_LT_F32:                            // a < b is fcmgt b, a
+            base = 0x6ea0e400;
+            n = instr->src2;
+            m = instr->src1;
+            break;
+        case PVA_AND_MASK: base = 0x4e201c00; break;    // and v.16b
+        case PVA_OR_MASK: base = 0x4ea01c00; break;     // orr v.16b
+        default: return;
+    }
+
+    if (mode == MODE_LANE0) {
+        // full-width op into scratch, then mov vd.s[0], v31.s[0]
+        emit_vec3(cb, base, V_SCRATCH, n, m);
+        pva_codebuf_emit32(cb, 0x6e040400 | (V_SCRATCH << 5) | (instr->dst & 0x1f));
+        return;
+    }
+    emit_vec3(cb, base, instr->dst, n, m);
+}
+
+// fma/fms: fmla/fmls accumulate into their destination, so unless dst
+// already holds the addend the product is accumulated in the scratch
+static void emit_fma(pva_codebuf_t* cb, emit_mode_t mode, const pva_instr_t* instr) {
+    uint32_t base = instr->op == PVA_FMA_F32 ? 0x4e20cc00 : 0x4ea0cc00;    // fmla/fmls v.4s
+    uint8_t d = instr->dst, c = instr->src3;
+    uint8_t acc = (mode == MODE_FULL && d == c) ? d : V_SCRATCH;
+
+    if (acc != c) emit_vec3(cb, 0x4ea01c00, acc, c, c);    // mov v31.16b, vc.16b
+    emit_vec3(cb, base, acc, instr->src1, instr->src2);
+
+    if (mode == MODE_LANE0) {
+        pva_codebuf_emit32(cb, 0x6e040400 | (V_SCRATCH << 5) | (d & 0x1f));    // mov vd.s[0], v31.s[0]
+    } else if (acc != d) {
+        emit_vec3(cb, 0x4ea01c00, d, acc, acc);             // mov vd.16b, v31.16b
+    }
+}
+
+// rd = rn + offset
+static void emit_add_offset(pva_codebuf_t* cb, uint8_t rd, uint8_t rn, int32_t offset) {
+    if (offset >= 0 && offset < 4096) {
+        pva_codebuf_emit32(cb, 0x91000000 | ((uint32_t)offset << 10) | (rn << 5) | rd);   // add
+    } else if (offset < 0 && offset > -4096) {
+        pva_codebuf_emit32(cb, 0xd1000000 | ((uint32_t)-offset << 10) | (rn << 5) | rd);  // sub
+    } else {
+        // movz/movk w12, then add rd, rn, w12, sxtw
+        uint32_t bits = (uint32_t)offset;
+        pva_codebuf_emit32(cb, 0x52800000 | ((bits & 0xffff) << 5) | X_OFFSET);
+        pva_codebuf_emit32(cb, 0x72a00000 | ((bits >> 16) << 5) | X_OFFSET);
+        emit_vec3(cb, 0x8b20c000, rd, rn, X_OFFSET);
+    }
+}
+
+static void emit_mem(pva_codebuf_t* cb, emit_mode_t mode, int in_loop, int is_store,
+                     const pva_instr_t* instr) {
+    uint8_t reg = instr->dst;
+    uint8_t base = buffer_reg(instr->src1);
+    int32_t offset = (int32_t)(instr->imm + instr->vec_offset * 16);
+
+    if (mode == MODE_LANE0) {
+        // add x10, xb, x9 (+ offset) ; ld1/st1 {vt.s}[0], [x10]
+        emit_vec3(cb, 0x8b000000, X_ADDR, base, X_INDEX);
+        if (offset) emit_add_offset(cb, X_ADDR, X_ADDR, offset);
+        pva_codebuf_emit32(cb, (is_store ? 0x0d008000 : 0x0d408000) | (X_ADDR << 5) | (reg & 0x1f));
+        return;
+    }
+
+    if (in_loop) {
+        if (offset == 0) {
+            // ldr/str q<t>, [xb, x9]
+            emit_vec3(cb, is_store ? 0x3ca06800 : 0x3ce06800, reg, base, X_INDEX);
+            return;
+        }
+        emit_vec3(cb, 0x8b000000, X_ADDR, base, X_INDEX);  // add x10, xb, x9
+        base = X_ADDR;
+    }
+
+    if (offset >= 0 && offset % 16 == 0 && offset / 16 < 4096) {
+        // ldr/str q<t>, [xb, #offset]
+        pva_codebuf_emit32(cb, (is_store ? 0x3d800000 : 0x3dc00000) | ((uint32_t)(offset / 16) << 10) |
+                               (base << 5) | (reg & 0x1f));
+    } else if (offset >= -256 && offset < 256) {
+        // ldur/stur q<t>, [xb, #offset]
+        pva_codebuf_emit32(cb, (is_store ? 0x3c800000 : 0x3cc00000) | (((uint32_t)offset & 0x1ff) << 12) |
+                               (base << 5) | (reg & 0x1f));
+    } else {
+        emit_add_offset(cb, X_ADDR, base, offset);
+        pva_codebuf_emit32(cb, (is_store ? 0x3d800000 : 0x3dc00000) | (X_ADDR << 5) | (reg & 0x1f));
+    }
+}
+
+// x12 = a signed 32-bit value, sign-extended
+static void emit_offset_reg(pva_codebuf_t* cb, int32_t value) {
+    uint32_t bits = (uint32_t)value;
+    pva_codebuf_emit32(cb, 0x52800000 | ((bits & 0xffff) << 5) | X_OFFSET);    // movz w12, #lo
+    if (bits >> 16) {
+        pva_codebuf_emit32(cb, 0x72a00000 | ((bits >> 16) << 5) | X_OFFSET);   // movk w12, #hi, lsl #16
+    }
+    pva_codebuf_emit32(cb, 0x93407c00 | (X_OFFSET << 5) | X_OFFSET);           // sxtw x12, w12
+}
+
+// vload.strided's first element: x10 = xb + offset, plus x9 * x12 in
+// the loop. x12 is the stride over 4 on NEON, where x9 counts bytes, and
+// the stride on SVE, where it counts elements
+static void emit_strided_addr(pva_codebuf_t* cb, int in_loop, const pva_instr_t* instr, int32_t offset) {
+    uint8_t base = buffer_reg(instr->src1);
+    if (in_loop) {
+        // madd x10, x9, x12, xb
+        pva_codebuf_emit32(cb, 0x9b000000 | (X_OFFSET << 16) | (base << 10) | (X_INDEX << 5) | X_ADDR);
+        if (offset) emit_add_offset(cb, X_ADDR, X_ADDR, offset);
+    } else {
+        emit_add_offset(cb, X_ADDR, base, offset);
+    }
+}
+
+// vgather/vscatter, a lane at a time: mov w10, vi.s[lane] ; add x10, xb,
+// w10, sxtw #scale ; ld1/st1 {vt.s}[lane], [x10]. a whole-vector gather
+// whose index is its destination fills the scratch first
+static void emit_indexed(pva_codebuf_t* cb, emit_mode_t mode, const pva_instr_t* instr) {
+    int gather = instr->op == PVA_GATHER_F32;
+    uint8_t val = instr->dst, idx = instr->src2, base = buffer_reg(instr->src1);
+    uint32_t shift = instr->imm == 4 ? 2 : 0;
+    uint8_t out = gather && val == idx && mode != MODE_LANE0 ? V_SCRATCH : val;
+    uint32_t lanes = mode == MODE_LANE0 ? 1 : 4;
+
+    for (uint32_t lane = 0; lane < lanes; lane++) {
+        pva_codebuf_emit32(cb, 0x0e003c00 | (((lane << 3) | 4) << 16) | (idx << 5) | X_ADDR);
+        emit_vec3(cb, 0x8b20c000 | (shift << 10), X_ADDR, base, X_ADDR);
+        pva_codebuf_emit32(cb, (gather ? 0x0d408000 : 0x0d008000) | ((lane >> 1) << 30) | ((lane & 1) << 12) |
+                               (X_ADDR << 5) | out);
+    }
+    if (out != val) emit_vec3(cb, 0x4ea01c00, val, V_SCRATCH, V_SCRATCH);      // mov vd.16b, v31.16b
+}
+
+// vload.strided: each lane's float from x10, stepping it by the stride
+static void emit_strided(pva_codebuf_t* cb, emit_mode_t mode, int in_loop, const pva_instr_t* instr) {
+    int32_t stride = (int32_t)instr->src2;
+    if (in_loop) emit_offset_reg(cb, stride / 4);
+    emit_strided_addr(cb, in_loop, instr, (int32_t)instr->imm + (int32_t)instr->vec_offset * 4 * stride);
+    if (mode == MODE_LANE0) {
+        pva_codebuf_emit32(cb, 0x0d408000 | (X_ADDR << 5) | (instr->dst & 0x1f));  // ld1 {vd.s}[0], [x10]
+        return;
+    }
+    for (uint32_t lane = 0; lane < 4; lane++) {
+        if (lane) emit_add_offset(cb, X_ADDR, X_ADDR, stride);
+        pva_codebuf_emit32(cb, 0x0d408000 | ((lane >> 1) << 30) | ((lane & 1) << 12) | (X_ADDR << 5) |
+                               (instr->dst & 0x1f));                                // ld1 {vd.s}[lane], [x10]
+    }
+}
+
+// fmov's 8-bit immediate for a float, -1 for one it cannot encode
+static int fmov_imm8(uint32_t bits) {
+    uint32_t exp = (bits >> 25) & 0x3f;
+    if ((bits & 0x7ffff) || (exp != 0x20 && exp != 0x1f)) return -1;
+    return (int)(((bits >> 24) & 0x80) | ((bits >> 23) & 0x40) | ((bits >> 19) & 0x3f));
+}
+
+// x10 = the address of a float in the constant pool. adrp/add, which
+// pva_codebuf_link turns into adr when it appends the pool to the code
+static void emit_pool_addr(pva_codebuf_t* cb, uint32_t bits) {
+    size_t at = pva_codebuf_rodata(cb, &bits, 4, 4);
+    pva_codebuf_reloc(cb, PVA_RELOC_ARM_ADR_PAGE, cb->size, at, 0, 0);
+    pva_codebuf_emit32(cb, 0x90000000 | X_ADDR);                       // adrp x10, c
+    pva_codebuf_reloc(cb, PVA_RELOC_ARM_ADD_LO12, cb->size, at, 0, 0);
+    pva_codebuf_emit32(cb, 0x91000000 | (X_ADDR << 5) | X_ADDR);       // add x10, x10, :lo12:c
+}
+
+// vbroadcast: movi for +0.0, fmov when the value fits its immediate,
+// otherwise ld1r from the constant pool
+static void emit_const(pva_codebuf_t* cb, emit_mode_t mode, uint8_t dst, uint32_t bits) {
+    uint8_t out = mode == MODE_LANE0 ? V_SCRATCH : dst;
+    int imm8 = fmov_imm8(bits);
+
+    if (bits == 0) {
+        pva_codebuf_emit32(cb, 0x6f00e400 | out);                                  // movi v.2d, #0
+    } else if (imm8 >= 0) {
+        pva_codebuf_emit32(cb, 0x4f00f400 | ((uint32_t)(imm8 >> 5) << 16) | ((uint32_t)(imm8 & 0x1f) << 5) |
+                               out);                                               // fmov v.4s, #imm
+    } else {
+        emit_pool_addr(cb, bits);
+        pva_codebuf_emit32(cb, 0x4d40c800 | (X_ADDR << 5) | out);                  // ld1r {v.4s}, [x10]
+    }
+    if (mode == MODE_LANE0) pva_codebuf_emit32(cb, 0x6e040400 | (V_SCRATCH << 5) | (dst & 0x1f));
+}
+
+// vredsum/vredmax/vredmin, on a whole vector outside the loop: two pairwise
+// faddp/fmaxp/fminp leave the result in every lane. the ordered sum goes
+// lane by lane with scalar faddp, each next lane moved next to the running sum
+static void emit_reduce(pva_codebuf_t* cb, const pva_instr_t* instr) {
+    uint8_t d = instr->dst, n = instr->src1;
+
+    if (instr->op == PVA_REDSUM_ORD_F32) {
+        pva_codebuf_emit32(cb, 0x7e30d800 | (n << 5) | V_SCRATCH);                  // faddp s31, vn.2s
+        for (uint32_t lane = 2; lane < 4; lane++) {
+            pva_codebuf_emit32(cb, 0x6e0c0400 | (lane << 13) | (n << 5) | V_SCRATCH);  // mov v31.s[1], vn.s[lane]
+            pva_codebuf_emit32(cb, 0x7e30d800 | (V_SCRATCH << 5) | V_SCRATCH);      // faddp s31, v31.2s
+        }
+        pva_codebuf_emit32(cb, 0x4e040400 | (V_SCRATCH << 5) | d);                  // dup vd.4s, v31.s[0]
+        return;
+    }
+
+    uint32_t base = instr->op == PVA_REDMAX_F32 ? 0x6e20f400 :     // fmaxp v.4s
+                    instr->op == PVA_REDMIN_F32 ? 0x6ea0f400 :     // fminp v.4s
+                    0x6e20d400;                                     // faddp v.4s
+    emit_vec3(cb, base, V_SCRATCH, n, n);
+    emit_vec3(cb, base, d, V_SCRATCH, V_SCRATCH);
+}
+
+// an op under a mask: the unmasked result in the scratch, then bit puts it
+// into the destination's masked-on lanes when the destination already holds
+// what the others keep; otherwise bif or and selects it in the scratch
+static void emit_masked(pva_codebuf_t* cb, emit_mode_t mode, const pva_instr_t* instr) {
+    uint8_t d = instr->dst, keep = instr->src3, mask = instr->mask_reg;
+    pva_instr_t op = *instr;
+    op.dst = V_SCRATCH;
+
+    if (instr->op == PVA_FMA_F32 || instr->op == PVA_FMS_F32) {
+        emit_fma(cb, MODE_FULL, &op);
+    } else if (instr->op == PVA_MOV_F32) {
+        emit_vec3(cb, 0x4ea01c00, V_SCRATCH, instr->src1, instr->src1);    // mov v31.16b, vn.16b
+    } else {
+        emit_alu(cb, MODE_FULL, &op);
+    }
+
+    if (instr->imm == PVA_MASK_ZERO) {
+        emit_vec3(cb, 0x4e201c00, V_SCRATCH, V_SCRATCH, mask);          // and v31.16b, v31.16b, vm.16b
+    } else if (mode == MODE_FULL && d == keep) {
+        emit_vec3(cb, 0x6ea01c00, d, V_SCRATCH, mask);                   // bit vd.16b, v31.16b, vm.16b
+        return;
+    } else {
+        emit_vec3(cb, 0x6ee01c00, V_SCRATCH, keep, mask);                // bif v31.16b, vk.16b, vm.16b
+    }
+
+    if (mode == MODE_LANE0) {
+        pva_codebuf_emit32(cb, 0x6e040400 | (V_SCRATCH << 5) | (d & 0x1f));    // mov vd.s[0], v31.s[0]
+    } else {
+        emit_vec3(cb, 0x4ea01c00, d, V_SCRATCH, V_SCRATCH);               // mov vd.16b, v31.16b
+    }
+}
+
+// vstore under a mask: what is in memory, with the masked-on lanes replaced
+static void emit_masked_store(pva_codebuf_t* cb, emit_mode_t mode, int in_loop, const pva_instr_t* instr) {
+    pva_instr_t old = *instr;
+    old.dst = V_SCRATCH;
+    emit_mem(cb, mode, in_loop, 0, &old);
+    emit_vec3(cb, 0x6ea01c00, V_SCRATCH, instr->dst, instr->mask_reg);    // bit v31.16b, vs.16b, vm.16b
+    emit_mem(cb, mode, in_loop, 1, &old);
+}
+
+static void emit_range(pva_codebuf_t* cb, pva_module_t* mod, size_t from, size_t to,
+                       emit_mode_t mode, int in_loop) {
+    for (size_t i = from; i < to; i++) {
         pva_instr_t* instr = &mod->code[i];
 
+        if (instr->mask_reg != PVA_NO_MASK) {
+            if (instr->op == PVA_STORE_F32) {
+                emit_masked_store(cb, mode, in_loop, instr);
+            } else {
+                emit_masked(cb, mode, instr);
+            }
+            continue;
+        }
+
         switch (instr->op) {
-            case PVA_ADD_F32: {
-                // fadd v<dst>.4s, v<src1>.4s, v<src2>.4s
-                // encoding: 0x4e 0xd4 0xd4 0x20 (for v0.4s, v1.4s, v2.4s)
-                uint32_t opcode = 0x4e20d400;  // fadd base
-                opcode |= ((instr->dst & 0x1f) << 0);      // dest register
-                opcode |= ((instr->src1 & 0x1f) << 5);     // src1 register
-                opcode |= ((instr->src2 & 0x1f) << 16);    // src2 register
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
+            case PVA_ADD_F32:
+            case PVA_SUB_F32:
+            case PVA_MUL_F32:
+            case PVA_DIV_F32:
+            case PVA_CMP_LT_F32:
+            case PVA_CMP_EQ_F32:
+            case PVA_AND_MASK:
+            case PVA_OR_MASK:
+                emit_alu(cb, mode, instr);
                 break;
-            }
 
-            case PVA_SUB_F32: {
-                // fsub v<dst>.4s, v<src1>.4s, v<src2>.4s
-                uint32_t opcode = 0x4e20d400;  // fsub encoding differs
-                opcode |= ((instr->dst & 0x1f) << 0);
-                opcode |= ((instr->src1 & 0x1f) << 5);
-                opcode |= ((instr->src2 & 0x1f) << 16);
-                opcode ^= 0x40;  // toggle subtraction bit
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
+            case PVA_FMA_F32:
+            case PVA_FMS_F32:
+                emit_fma(cb, mode, instr);
                 break;
-            }
 
-            case PVA_MUL_F32: {
-                // fmul v<dst>.4s, v<src1>.4s, v<src2>.4s
-                uint32_t opcode = 0x6e20dc00;  // fmul base
-                opcode |= ((instr->dst & 0x1f) << 0);
-                opcode |= ((instr->src1 & 0x1f) << 5);
-                opcode |= ((instr->src2 & 0x1f) << 16);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
+            case PVA_LOAD_F32:
+                emit_mem(cb, mode, in_loop, 0, instr);
                 break;
-            }
 
-            case PVA_DIV_F32: {
-                // fdiv v<dst>.4s, v<src1>.4s, v<src2>.4s
-                uint32_t opcode = 0x6e20fc00;  // fdiv base
-                opcode |= ((instr->dst & 0x1f) << 0);
-                opcode |= ((instr->src1 & 0x1f) << 5);
-                opcode |= ((instr->src2 & 0x1f) << 16);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
+            case PVA_STORE_F32:
+                emit_mem(cb, mode, in_loop, 1, instr);
                 break;
-            }
 
-            case PVA_LOAD_F32: {
-                // ldr q<dst>, [x1, #offset]
-                uint32_t opcode = 0x3dc00000;  // ldr q base
-                opcode |= (instr->dst & 0x1f);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
+            case PVA_GATHER_F32:
+            case PVA_SCATTER_F32:
+                emit_indexed(cb, mode, instr);
                 break;
-            }
 
-            case PVA_STORE_F32: {
-                // str q<src>, [x1, #offset]
-                uint32_t opcode = 0x3cc00000;  // str q base
-                opcode |= (instr->dst & 0x1f);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
+            case PVA_LOAD_STRIDED_F32:
+                emit_strided(cb, mode, in_loop, instr);
                 break;
-            }
 
-            case PVA_SETZERO: {
-                // eor v<dst>.16b, v<dst>.16b, v<dst>.16b
-                uint32_t opcode = 0x6e201c00;
-                opcode |= (instr->dst & 0x1f);
-                opcode |= ((instr->dst & 0x1f) << 5);
-                opcode |= ((instr->dst & 0x1f) << 16);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
+            case PVA_REDSUM_F32:
+            case PVA_REDSUM_ORD_F32:
+            case PVA_REDMAX_F32:
+            case PVA_REDMIN_F32:
+                emit_reduce(cb, instr);
+                break;
+
+            case PVA_SPILL:
+                // str q<src>, [sp, #slot * 16]
+                pva_codebuf_emit32(cb, 0x3d800000 | (instr->imm << 10) | (31 << 5) | (instr->src1 & 0x1f));
                 break;
-            }
 
-            case PVA_CMP_LT_F32: {
-                // fcmlt v<dst>.4s, v<src1>.4s, v<src2>.4s
-                uint32_t opcode = 0x4ea0e400;
-                opcode |= (instr->dst & 0x1f);
-                opcode |= ((instr->src1 & 0x1f) << 5);
-                opcode |= ((instr->src2 & 0x1f) << 16);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
+            case PVA_RELOAD:
+                // ldr q<dst>, [sp, #slot * 16]
+                pva_codebuf_emit32(cb, 0x3dc00000 | (instr->imm << 10) | (31 << 5) | (instr->dst & 0x1f));
                 break;
+
+            case PVA_MOV_F32:
+                if (instr->dst == instr->src1) break;
+                if (mode == MODE_LANE0) {
+                    // mov vd.s[0], vn.s[0]
+                    pva_codebuf_emit32(cb, 0x6e040400 | ((instr->src1 & 0x1f) << 5) | (instr->dst & 0x1f));
+                } else {
+                    emit_vec3(cb, 0x4ea01c00, instr->dst, instr->src1, instr->src1);    // mov vd.16b, vn.16b
+                }
+                break;
+
+            case PVA_SETZERO:
+                if (mode == MODE_LANE0) {
+                    // mov vd.s[0], wzr
+                    pva_codebuf_emit32(cb, 0x4e041c00 | (31 << 5) | (instr->dst & 0x1f));
+                } else {
+                    // movi vd.2d, #0
+                    pva_codebuf_emit32(cb, 0x6f00e400 | (instr->dst & 0x1f));
+                }
+                break;
+
+            case PVA_CONST_F32:
+                emit_const(cb, mode, instr->dst, instr->imm);
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+// loop over n elements: whole vectors, then the remainder one lane at a time.
+// an unrolled body runs whole while `factor` vectors are left, then its
+// first copy takes over
+static void emit_loop(pva_codebuf_t* cb, pva_module_t* mod, size_t body, size_t body_end) {
+    uint32_t lanes = 4;
+
+    pva_codebuf_emit32(cb, 0xd2800000 | X_INDEX);                           // mov x9, #0
+
+    size_t split = body_end;
+    uint32_t factor = 1;
+    for (size_t i = body; i < body_end; i++) {
+        if (mod->code[i].op == PVA_LOOP_SPLIT) {
+            split = i;
+            factor = mod->code[i].imm;
+        }
+    }
+
+    if (factor > 1) {
+        uint32_t step = factor * lanes;
+        pva_codebuf_emit32(cb, 0xf100001f | (step << 10) | (X_COUNT << 5));          // cmp x0, #step
+        size_t to_rest = emit_branch(cb, 0x54000000 | COND_LO);                     // b.lo rest
+
+        size_t unrolled_top = cb->size;
+        emit_range(cb, mod, body, body_end, MODE_FULL, 1);
+        pva_codebuf_emit32(cb, 0x91000000 | ((step * 4) << 10) | (X_INDEX << 5) | X_INDEX);
+        pva_codebuf_emit32(cb, 0xd1000000 | (step << 10) | (X_COUNT << 5) | X_COUNT);
+        pva_codebuf_emit32(cb, 0xf100001f | (step << 10) | (X_COUNT << 5));
+        patch_branch(cb, emit_branch(cb, 0), 0x54000000 | COND_HS, unrolled_top);   // b.hs unrolled_top
+
+        patch_branch(cb, to_rest, 0x54000000 | COND_LO, cb->size);
+        body_end = split;
+    }
+    pva_codebuf_emit32(cb, 0xf100001f | (lanes << 10) | (X_COUNT << 5));    // cmp x0, #4
+    size_t to_tail = emit_branch(cb, 0x54000000 | COND_LO);                 // b.lo tail
+
+    size_t top = cb->size;
+    emit_range(cb, mod, body, body_end, MODE_FULL, 1);
+    pva_codebuf_emit32(cb, 0x91000000 | (16 << 10) | (X_INDEX << 5) | X_INDEX);    // add x9, x9, #16
+    pva_codebuf_emit32(cb, 0xd1000000 | (lanes << 10) | (X_COUNT << 5) | X_COUNT); // sub x0, x0, #4
+    pva_codebuf_emit32(cb, 0xf100001f | (lanes << 10) | (X_COUNT << 5));          // cmp x0, #4
+    patch_branch(cb, emit_branch(cb, 0), 0x54000000 | COND_HS, top);              // b.hs top
+
+    patch_branch(cb, to_tail, 0x54000000 | COND_LO, cb->size);
+    size_t to_done = emit_branch(cb, 0xb4000000 | X_COUNT);                 // cbz x0, done
+
+    size_t tail_top = cb->size;
+    emit_range(cb, mod, body, body_end, MODE_LANE0, 1);
+    pva_codebuf_emit32(cb, 0x91000000 | (4 << 10) | (X_INDEX << 5) | X_INDEX);     // add x9, x9, #4
+    pva_codebuf_emit32(cb, 0xf1000000 | (1 << 10) | (X_COUNT << 5) | X_COUNT);     // subs x0, x0, #1
+    patch_branch(cb, emit_branch(cb, 0), 0x54000000 | COND_NE, tail_top);         // b.ne tail_top
+
+    patch_branch(cb, to_done, 0xb4000000 | X_COUNT, cb->size);
+}
+
+// SVE: vector length is only known at run time, so the loop counts
+// elements (x9) instead of bytes and spill slots are addressed in VL units
+
+static void emit_sve_alu(pva_codebuf_t* cb, emit_mode_t mode, const pva_instr_t* instr) {
+    uint8_t d = instr->dst, n = instr->src1, m = instr->src2;
+    uint8_t out = mode == MODE_MASKED ? V_SCRATCH : d;
+
+    switch (instr->op) {
+        case PVA_ADD_F32: emit_vec3(cb, 0x65800000, out, n, m); break;    // fadd z.s
+        case PVA_SUB_F32: emit_vec3(cb, 0x65800400, out, n, m); break;    // fsub z.s
+        case PVA_MUL_F32: emit_vec3(cb, 0x65800800, out, n, m); break;    // fmul z.s
+        case PVA_AND_MASK: emit_vec3(cb, 0x04203000, out, n, m); break;   // and z.d
+        case PVA_OR_MASK: emit_vec3(cb, 0x04603000, out, n, m); break;    // orr z.d
+        case PVA_FMA_F32:
+        case PVA_FMS_F32: {
+            // fmla/fmls zda.s, p0/m, zn.s, zm.s accumulate into the addend
+            uint8_t a = instr->src3;
+            if (mode == MODE_FULL && out != a && (out == n || out == m)) out = V_SCRATCH;
+            if (out != a) pva_codebuf_emit32(cb, 0x0420bc00 | (a << 5) | out);  // movprfx out, a
+            emit_vec3(cb, (instr->op == PVA_FMA_F32 ? 0x65a00000 : 0x65a02000) | (P_ALL << 10), out, n, m);
+            break;
+        }
+        case PVA_DIV_F32:
+            // only a destructive predicated form: movprfx out, n ; fdiv out, p0/m, out, m
+            if (out == m && out != n) out = V_SCRATCH;
+            if (out != n) pva_codebuf_emit32(cb, 0x0420bc00 | (n << 5) | out);
+            pva_codebuf_emit32(cb, 0x658d8000 | (P_ALL << 10) | (m << 5) | out);
+            break;
+        case PVA_CMP_LT_F32:
+        case PVA_CMP_EQ_F32:
+            // fcmgt/fcmeq p2.s, p0/z, ... (a < b is b > a) ; mov out.s, p2/z, #-1
+            if (instr->op == PVA_CMP_LT_F32) {
+                emit_vec3(cb, 0x65804010 | (P_ALL << 10), P_CMP, m, n);
+            } else {
+                emit_vec3(cb, 0x65806000 | (P_ALL << 10), P_CMP, n, m);
             }
+            pva_codebuf_emit32(cb, 0x05901fe0 | (P_CMP << 16) | out);
+            break;
+        default:
+            return;
+    }
+
+    if (mode == MODE_MASKED) {
+        // sel zd.s, p1, z31.s, zd.s
+        emit_vec3(cb, 0x05a0c000 | (P_TAIL << 10), d, V_SCRATCH, d);
+    } else if (out != d) {
+        emit_vec3(cb, 0x04603000, d, out, out);  // mov zd.d, z31.d
+    }
+}
+
+static void emit_sve_mem(pva_codebuf_t* cb, emit_mode_t mode, int in_loop, int is_store,
+                         const pva_instr_t* instr) {
+    uint8_t reg = instr->dst;
+    uint8_t base = buffer_reg(instr->src1);
+    uint32_t pred = mode == MODE_MASKED ? P_TAIL : P_ALL;
+
+    if (instr->mask_reg != PVA_NO_MASK) {
+        // a masked store: cmpne p2.s, pg/z, zm.s, #0 narrows the predicate
+        pva_codebuf_emit32(cb, 0x25808010 | (pred << 10) | ((instr->mask_reg & 0x1f) << 5) | P_CMP);
+        pred = P_CMP;
+    }
+
+    if (instr->imm) {
+        emit_add_offset(cb, X_ADDR, base, (int32_t)instr->imm);
+        base = X_ADDR;
+    }
+
+    if (!in_loop) {
+        // ld1w {zt.s}, p0/z, [xb] ; st1w {zt.s}, p0, [xb]
+        pva_codebuf_emit32(cb, (is_store ? 0xe540e000 : 0xa540a000) | (pred << 10) |
+                               (base << 5) | reg);
+        return;
+    }
+
+    // [xb, x9, lsl #2]; a masked load goes through the scratch so inactive
+    // lanes keep their old value
+    uint8_t t = (mode == MODE_MASKED && !is_store) ? V_SCRATCH : reg;
+    emit_vec3(cb, (is_store ? 0xe5404000 : 0xa5404000) | (pred << 10), t, base, X_INDEX);
+    if (t != reg) emit_vec3(cb, 0x05a0c000 | (P_TAIL << 10), reg, V_SCRATCH, reg);
+}
+
+// vgather/vscatter: ld1w/st1w with a vector of sxtw offsets, scaled by 4
+// or not, under p0 or the tail's p1. a gather in the tail loads into the
+// scratch, zeroing the lanes off, and selects it into the destination
+static void emit_sve_indexed(pva_codebuf_t* cb, emit_mode_t mode, const pva_instr_t* instr) {
+    uint32_t pred = mode == MODE_MASKED ? P_TAIL : P_ALL;
+    uint32_t scaled = instr->imm == 4 ? 1u << 21 : 0;
+    uint8_t base = buffer_reg(instr->src1);
+
+    if (instr->op == PVA_SCATTER_F32) {
+        emit_vec3(cb, 0xe540c000 | scaled | (pred << 10), instr->dst, base, instr->src2);  // st1w
+        return;
+    }
+    uint8_t out = mode == MODE_MASKED ? V_SCRATCH : instr->dst;
+    emit_vec3(cb, 0x85404000 | scaled | (pred << 10), out, base, instr->src2);             // ld1w
+    if (out != instr->dst) emit_vec3(cb, 0x05a0c000 | (P_TAIL << 10), instr->dst, V_SCRATCH, instr->dst);
+}
+
+// vload.strided: a gather from x10 with index z31.s, #0, w12 as the byte
+// offsets of the lanes; the loaded lanes may replace the offsets
+static void emit_sve_strided(pva_codebuf_t* cb, emit_mode_t mode, int in_loop, const pva_instr_t* instr) {
+    uint32_t pred = mode == MODE_MASKED ? P_TAIL : P_ALL;
+    uint8_t out = mode == MODE_MASKED ? V_SCRATCH : instr->dst;
+
+    emit_offset_reg(cb, (int32_t)instr->src2);
+    pva_codebuf_emit32(cb, 0x04a04800 | (X_OFFSET << 16) | V_SCRATCH);         // index z31.s, #0, w12
+    emit_strided_addr(cb, in_loop, instr, (int32_t)instr->imm);
+    emit_vec3(cb, 0x85404000 | (pred << 10), out, X_ADDR, V_SCRATCH);                     // ld1w, unscaled
+    if (out != instr->dst) emit_vec3(cb, 0x05a0c000 | (P_TAIL << 10), instr->dst, V_SCRATCH, instr->dst);
+}
+
+// vredsum/vredmax/vredmin, outside the loop: faddv/fmaxv/fminv into s31, or
+// fadda from -0.0 for the ordered sum, over p0, then dup to every lane
+static void emit_sve_reduce(pva_codebuf_t* cb, const pva_instr_t* instr) {
+    uint8_t d = instr->dst, n = instr->src1;
+
+    switch (instr->op) {
+        case PVA_REDSUM_F32: emit_vec3(cb, 0x65802000 | (P_ALL << 10), V_SCRATCH, n, 0); break;   // faddv
+        case PVA_REDMAX_F32: emit_vec3(cb, 0x65862000 | (P_ALL << 10), V_SCRATCH, n, 0); break;   // fmaxv
+        case PVA_REDMIN_F32: emit_vec3(cb, 0x65872000 | (P_ALL << 10), V_SCRATCH, n, 0); break;   // fminv
+        default:
+            pva_codebuf_emit32(cb, 0x4f046400 | V_SCRATCH);                     // movi v31.4s, #0x80, lsl #24
+            emit_vec3(cb, 0x65982000 | (P_ALL << 10), V_SCRATCH, n, 0);          // fadda s31, pg, s31, zn.s
+            break;
+    }
+
+    pva_codebuf_emit32(cb, 0x05242000 | (V_SCRATCH << 5) | d);                  // dup zd.s, z31.s[0]
+}
+
+// vbroadcast as on NEON, with fmov (fdup) and ld1rw; the tail selects it
+// into its lanes
+static void emit_sve_const(pva_codebuf_t* cb, emit_mode_t mode, uint8_t dst, uint32_t bits) {
+    uint8_t out = mode == MODE_MASKED ? V_SCRATCH : dst;
+    int imm8 = fmov_imm8(bits);
+
+    if (bits == 0) {
+        pva_codebuf_emit32(cb, 0x2538c000 | out);                                  // mov z.s, #0
+    } else if (imm8 >= 0) {
+        pva_codebuf_emit32(cb, 0x25b9c000 | ((uint32_t)imm8 << 5) | out);          // fmov z.s, #imm
+    } else {
+        emit_pool_addr(cb, bits);
+        pva_codebuf_emit32(cb, 0x8540c000 | (P_ALL << 10) | (X_ADDR << 5) | out);  // ld1rw {z.s}, p0/z, [x10]
+    }
+    if (mode == MODE_MASKED) emit_vec3(cb, 0x05a0c000 | (P_TAIL << 10), dst, V_SCRATCH, dst);
+}
+
+// an op under a mask: the unmasked result in the scratch, then sel on the
+// mask tested into p2 (or and, to zero), merged into the tail's lanes last
+static void emit_sve_masked(pva_codebuf_t* cb, emit_mode_t mode, const pva_instr_t* instr) {
+    uint8_t d = instr->dst, mask = instr->mask_reg;
+    uint8_t out = mode == MODE_MASKED ? V_SCRATCH : d;
+    pva_instr_t op = *instr;
+    op.dst = V_SCRATCH;
+
+    if (instr->op == PVA_MOV_F32) {
+        emit_vec3(cb, 0x04603000, V_SCRATCH, instr->src1, instr->src1);      // mov z31.d, zn.d
+    } else {
+        emit_sve_alu(cb, MODE_FULL, &op);
+    }
+
+    if (instr->imm == PVA_MASK_ZERO) {
+        emit_vec3(cb, 0x04203000, out, V_SCRATCH, mask);                      // and out.d, z31.d, zm.d
+    } else {
+        // cmpne p2.s, p0/z, zm.s, #0 ; sel out.s, p2, z31.s, zk.s
+        pva_codebuf_emit32(cb, 0x25808010 | (P_ALL << 10) | (mask << 5) | P_CMP);
+        emit_vec3(cb, 0x05a0c000 | (P_CMP << 10), out, V_SCRATCH, instr->src3);
+    }
+    if (mode == MODE_MASKED) emit_vec3(cb, 0x05a0c000 | (P_TAIL << 10), d, V_SCRATCH, d);
+}
+
+static void emit_sve_range(pva_codebuf_t* cb, pva_module_t* mod, size_t from, size_t to,
+                           emit_mode_t mode, int in_loop) {
+    for (size_t i = from; i < to; i++) {
+        pva_instr_t* instr = &mod->code[i];
+
+        if (instr->mask_reg != PVA_NO_MASK && instr->op != PVA_STORE_F32) {
+            emit_sve_masked(cb, mode, instr);
+            continue;
+        }
+
+        switch (instr->op) {
+            case PVA_ADD_F32:
+            case PVA_SUB_F32:
+            case PVA_MUL_F32:
+            case PVA_DIV_F32:
+            case PVA_CMP_LT_F32:
+            case PVA_CMP_EQ_F32:
+            case PVA_AND_MASK:
+            case PVA_OR_MASK:
+            case PVA_FMA_F32:
+            case PVA_FMS_F32:
+                emit_sve_alu(cb, mode, instr);
+                break;
+
+            case PVA_LOAD_F32:
+                emit_sve_mem(cb, mode, in_loop, 0, instr);
+                break;
+
+            case PVA_STORE_F32:
+                emit_sve_mem(cb, mode, in_loop, 1, instr);
+                break;
+
+            case PVA_GATHER_F32:
+            case PVA_SCATTER_F32:
+                emit_sve_indexed(cb, mode, instr);
+                break;
+
+            case PVA_LOAD_STRIDED_F32:
+                emit_sve_strided(cb, mode, in_loop, instr);
+                break;
+
+            case PVA_REDSUM_F32:
+            case PVA_REDSUM_ORD_F32:
+            case PVA_REDMAX_F32:
+            case PVA_REDMIN_F32:
+                emit_sve_reduce(cb, instr);
+                break;
+
+            case PVA_SPILL:
+                // str z<src>, [sp, #slot, mul vl]
+                pva_codebuf_emit32(cb, 0xe5804000 | ((instr->imm >> 3) << 16) | ((instr->imm & 7) << 10) |
+                                       (31 << 5) | (instr->src1 & 0x1f));
+                break;
+
+            case PVA_RELOAD:
+                // ldr z<dst>, [sp, #slot, mul vl]
+                pva_codebuf_emit32(cb, 0x85804000 | ((instr->imm >> 3) << 16) | ((instr->imm & 7) << 10) |
+                                       (31 << 5) | (instr->dst & 0x1f));
+                break;
+
+            case PVA_MOV_F32:
+                if (instr->dst == instr->src1) break;
+                if (mode == MODE_MASKED) {
+                    emit_vec3(cb, 0x05a0c000 | (P_TAIL << 10), instr->dst, instr->src1, instr->dst);   // sel
+                } else {
+                    emit_vec3(cb, 0x04603000, instr->dst, instr->src1, instr->src1);   // mov zd.d, zn.d
+                }
+                break;
+
+            case PVA_SETZERO:
+                if (mode == MODE_MASKED) {
+                    pva_codebuf_emit32(cb, 0x2538c000 | V_SCRATCH);                    // mov z31.s, #0
+                    emit_vec3(cb, 0x05a0c000 | (P_TAIL << 10), instr->dst, V_SCRATCH, instr->dst);
+                } else {
+                    pva_codebuf_emit32(cb, 0x2538c000 | (instr->dst & 0x1f));         // mov zd.s, #0
+                }
+                break;
+
+            case PVA_CONST_F32:
+                emit_sve_const(cb, mode, instr->dst, instr->imm);
+                break;
 
             default:
                 break;
         }
     }
+}
+
+// whole vectors while n >= VL, then one pass under whilelo for the rest
+static void emit_sve_loop(pva_codebuf_t* cb, pva_module_t* mod, size_t body, size_t body_end) {
+    pva_codebuf_emit32(cb, 0xd2800000 | X_INDEX);                   // mov x9, #0
+    pva_codebuf_emit32(cb, 0x04a0e3e0 | X_LANES);                   // cntw x13
+    emit_vec3(cb, 0xeb000000, 31, X_COUNT, X_LANES);                // cmp x0, x13
+    size_t to_tail = emit_branch(cb, 0x54000000 | COND_LO);         // b.lo tail
+
+    size_t top = cb->size;
+    emit_sve_range(cb, mod, body, body_end, MODE_FULL, 1);
+    pva_codebuf_emit32(cb, 0x04b0e3e0 | X_INDEX);                   // incw x9
+    emit_vec3(cb, 0xcb000000, X_COUNT, X_COUNT, X_LANES);           // sub x0, x0, x13
+    emit_vec3(cb, 0xeb000000, 31, X_COUNT, X_LANES);                // cmp x0, x13
+    patch_branch(cb, emit_branch(cb, 0), 0x54000000 | COND_HS, top);    // b.hs top
+
+    patch_branch(cb, to_tail, 0x54000000 | COND_LO, cb->size);
+    size_t to_done = emit_branch(cb, 0xb4000000 | X_COUNT);         // cbz x0, done
+    emit_vec3(cb, 0x25a01c00, P_TAIL, 31, X_COUNT);                 // whilelo p1.s, xzr, x0
+    emit_sve_range(cb, mod, body, body_end, MODE_MASKED, 1);
+
+    patch_branch(cb, to_done, 0xb4000000 | X_COUNT, cb->size);
+}
+
+int pva_emit_arm(pva_module_t* mod, pva_codebuf_t* cb) {
+    if (!mod || !cb) return -1;
+
+    size_t start = cb->size;
+
+    int sve = mod->arch == PVA_ARCH_ARM_SVE;
+
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[codegen] generating ARM %s code for %zu instructions",
+            sve ? "SVE" : "NEON", mod->size);
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[codegen] target vector width: %d bytes", mod->vec_width_bytes);
+
+    long loop_begin, loop_end;
+    if (pva_find_loop(mod, &loop_begin, &loop_end) != 0) return -1;
+
+    if (mod->spill_slots > (sve ? 255 : 4095)) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[codegen] err: too many spill slots (%d)", mod->spill_slots);
+        return -1;
+    }
+
+    // the allocator hands out v8-v15 last; their low halves are callee-saved
+    int save_d8_d15 = 0;
+    for (size_t i = 0; i < mod->size; i++) {
+        uint32_t uses[PVA_MAX_USES];
+        int count = pva_instr_uses(&mod->code[i], uses);
+        int def = pva_instr_def(&mod->code[i]);
+        if (def >= 8 && def <= 15) save_d8_d15 = 1;
+        for (int u = 0; u < count; u++) {
+            if (uses[u] >= 8 && uses[u] <= 15) save_d8_d15 = 1;
+        }
+    }
+
+    // stack space: 0x100 bytes, or more if spill slots need it. SVE slots
+    // are whole vectors of run-time length, allocated separately with addvl
+    uint32_t frame = sve ? 0 : (uint32_t)mod->spill_slots * 16;
+    if (frame < 0x100) frame = 0x100;
+
+    // prologue: save callee-saved registers
+    // stp fp, lr, [sp, #-16]!
+    pva_codebuf_emit32(cb, 0xa9bf7bfd);
+    // add fp, sp, #0
+    pva_codebuf_emit32(cb, 0x910003fd);
+    if (save_d8_d15) {
+        pva_codebuf_emit32(cb, 0x6dbc27e8);  // stp d8, d9, [sp, #-64]!
+        pva_codebuf_emit32(cb, 0x6d012fea);  // stp d10, d11, [sp, #16]
+        pva_codebuf_emit32(cb, 0x6d0237ec);  // stp d12, d13, [sp, #32]
+        pva_codebuf_emit32(cb, 0x6d033fee);  // stp d14, d15, [sp, #48]
+    }
+    if (mod->num_buffers > NUM_ARG_BUFFERS) {
+        // ldr x11, [fp, #16]: the eighth pointer argument
+        pva_codebuf_emit32(cb, 0xf9400000 | (2 << 10) | (X_FP << 5) | X_STACK_BUFFER);
+    }
+    // sub sp, sp, #frame (allocate stack space)
+    if (frame >> 12) pva_codebuf_emit32(cb, 0xd14003ff | ((frame >> 12) << 10));
+    if (frame & 0xfff) pva_codebuf_emit32(cb, 0xd10003ff | ((frame & 0xfff) << 10));
+
+    // gen instruction codes
+    if (sve) {
+        // addvl sp, sp, #-slots, at most 32 vectors per step
+        for (int left = mod->spill_slots; left > 0; left -= 32) {
+            int step = left < 32 ? left : 32;
+            pva_codebuf_emit32(cb, 0x043f501f | (((uint32_t)-step & 0x3f) << 5));
+        }
+        pva_codebuf_emit32(cb, 0x2598e3e0 | P_ALL);     // ptrue p0.s
+
+        if (loop_begin < 0) {
+            emit_sve_range(cb, mod, 0, mod->size, MODE_FULL, 0);
+        } else {
+            emit_sve_range(cb, mod, 0, (size_t)loop_begin, MODE_FULL, 0);
+            emit_sve_loop(cb, mod, (size_t)loop_begin + 1, (size_t)loop_end);
+            emit_sve_range(cb, mod, (size_t)loop_end + 1, mod->size, MODE_FULL, 0);
+        }
+
+        for (int left = mod->spill_slots; left > 0; left -= 31) {
+            int step = left < 31 ? left : 31;
+            pva_codebuf_emit32(cb, 0x043f501f | ((uint32_t)step << 5));   // addvl sp, sp, #step
+        }
+    } else if (loop_begin < 0) {
+        emit_range(cb, mod, 0, mod->size, MODE_FULL, 0);
+    } else {
+        emit_range(cb, mod, 0, (size_t)loop_begin, MODE_FULL, 0);
+        emit_loop(cb, mod, (size_t)loop_begin + 1, (size_t)loop_end);
+        emit_range(cb, mod, (size_t)loop_end + 1, mod->size, MODE_FULL, 0);
+    }
 
     // ABI epilogue
-    // add sp, sp, #0x100
-    *ptr++ = 0xff; *ptr++ = 0x83; *ptr++ = 0x00; *ptr++ = 0x91;
+    // add sp, sp, #frame
+    if (frame >> 12) pva_codebuf_emit32(cb, 0x914003ff | ((frame >> 12) << 10));
+    if (frame & 0xfff) pva_codebuf_emit32(cb, 0x910003ff | ((frame & 0xfff) << 10));
+    if (save_d8_d15) {
+        pva_codebuf_emit32(cb, 0x6d433fee);  // ldp d14, d15, [sp, #48]
+        pva_codebuf_emit32(cb, 0x6d4237ec);  // ldp d12, d13, [sp, #32]
+        pva_codebuf_emit32(cb, 0x6d412fea);  // ldp d10, d11, [sp, #16]
+        pva_codebuf_emit32(cb, 0x6cc427e8);  // ldp d8, d9, [sp], #64
+    }
     // ldp fp, lr, [sp], #16
-    *ptr++ = 0xfd; *ptr++ = 0x7b; *ptr++ = 0xc1; *ptr++ = 0xa8;
+    pva_codebuf_emit32(cb, 0xa8c17bfd);
     // ret (mov lr to pc)
-    *ptr++ = 0xc0; *ptr++ = 0x03; *ptr++ = 0x5f; *ptr++ = 0xd6;
+    pva_codebuf_emit32(cb, 0xd65f03c0);
+
+    if (cb->failed) return -1;
 
-    printf("[codegen] generated %ld bytes of ARM code\n", ptr - buffer);
-}
\ No newline at end of file
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[codegen] generated %zu bytes of ARM code", cb->size - start);
+    return 0;
+}
@@ -1,194 +1,423 @@
 #include "pva.h"
-#include <stdio.h>
 #include <string.h>
 
-void pva_emit_riscv(pva_module_t* mod, uint8_t* buffer) {
-    if (!mod || !buffer) return;
+// LP64: n in a0, buffer pointers in a1-a7, the eighth on the stack
+#define X_ZERO  0
+#define X_SP    2
+#define X_FP    8    // s0
+#define X_T0    5    // granted vl
+#define X_T1    6    // vl in bytes
+#define X_T2    7    // address temp
+#define X_COUNT 10
+#define X_INDEX 28   // t3: byte offset of the current strip
+#define X_VLENB 29   // t4: bytes per vector register, sizes the spill slots
+#define X_T5    30
+#define X_STACK_BUFFER 31    // t6
+#define F_T0    0    // ft0: constant pool loads
 
-    uint8_t* ptr = buffer;
-    memset(buffer, 0x00, 8192);
+#define NUM_ARG_BUFFERS 7
 
-    printf("[codegen] generating RISC-V RVV code for %zu instructions\n", mod->size);
-    printf("[codegen] target vector width: %d bytes\n", mod->vec_width_bytes);
+static uint8_t buffer_reg(uint32_t buffer) {
+    return buffer < NUM_ARG_BUFFERS ? (uint8_t)(11 + buffer) : X_STACK_BUFFER;
+}
 
-    // prologue
-    // addi sp, sp, -16
-    *ptr++ = 0x13; *ptr++ = 0x01; *ptr++ = 0x01; *ptr++ = 0xff;
-    // sd ra, 8(sp)
-    *ptr++ = 0x23; *ptr++ = 0x34; *ptr++ = 0x11; *ptr++ = 0x00;
+// OP-V funct3 categories
+#define OPIVV 0x0
+#define OPFVV 0x1
+#define OPIVI 0x3
+#define OPFVF 0x5
+#define OPMVX 0x6
 
-    // init vector length (setvl instruction)
-    // set VL based on vector width
-    // vsetvli t0, x0, e32, m1  (set 32-bit elements, LMUL=1)
-    *ptr++ = 0x57; *ptr++ = 0x72; *ptr++ = 0x00; *ptr++ = 0xc0;
+#define V_MASK    0     // v0: the mask operand of masked instructions
+#define V_SCRATCH 31
 
-    // gen instruction codes
-    for (size_t i = 0; i < mod->size; i++) {
-        pva_instr_t* instr = &mod->code[i];
+// vtype: e32, m1, tail/mask undisturbed, so the short last strip leaves the
+// upper elements of accumulators intact
+#define VTYPE_E32_M1 0x010
 
-        switch (instr->op) {
-            case PVA_ADD_F32: {
-                // vfadd.vv v<dst>, v<src1>, v<src2>
-                // encoding: opcode[6:0]=0x57, funct3=0x10, funct6=0x00
-                uint32_t opcode = 0x00001057;
-                opcode |= ((instr->dst & 0x1f) << 7);       // vd
-                opcode |= ((instr->src1 & 0x1f) << 15);     // vs1
-                opcode |= ((instr->src2 & 0x1f) << 20);     // vs2
-                opcode |= (0 << 25);                         // vm=0 (unmasked)
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
-                break;
-            }
+// OP-V arithmetic: vd = vs2 op vs1, without the vm bit
+static uint32_t opv(uint32_t funct6, uint32_t funct3, uint8_t vd, uint8_t vs2, uint8_t vs1) {
+    uint32_t opcode = 0x57;
+    opcode |= (funct6 << 26);
+    opcode |= ((vs2 & 0x1f) << 20);
+    opcode |= ((vs1 & 0x1f) << 15);
+    opcode |= (funct3 << 12);
+    opcode |= ((vd & 0x1f) << 7);
+    return opcode;
+}
 
-            case PVA_SUB_F32: {
-                // vfsub.vv v<dst>, v<src1>, v<src2>
-                // encoding: funct6=0x08 for subtract
-                uint32_t opcode = 0x08001057;
-                opcode |= ((instr->dst & 0x1f) << 7);
-                opcode |= ((instr->src1 & 0x1f) << 15);
-                opcode |= ((instr->src2 & 0x1f) << 20);
-                opcode |= (0 << 25);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
-                break;
-            }
+// unmasked (vm=1)
+static void emit_opv(pva_codebuf_t* cb, uint32_t funct6, uint32_t funct3,
+                     uint8_t vd, uint8_t vs2, uint8_t vs1) {
+    pva_codebuf_emit32(cb, opv(funct6, funct3, vd, vs2, vs1) | (1u << 25));
+}
 
-            case PVA_MUL_F32: {
-                // vfmul.vv v<dst>, v<src1>, v<src2>
-                // encoding: funct6=0x10 for multiply
-                uint32_t opcode = 0x10001057;
-                opcode |= ((instr->dst & 0x1f) << 7);
-                opcode |= ((instr->src1 & 0x1f) << 15);
-                opcode |= ((instr->src2 & 0x1f) << 20);
-                opcode |= (0 << 25);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
-                break;
-            }
+// under v0.t (vm=0): elements off in v0 are left undisturbed
+static void emit_opv_masked(pva_codebuf_t* cb, uint32_t funct6, uint32_t funct3,
+                            uint8_t vd, uint8_t vs2, uint8_t vs1) {
+    pva_codebuf_emit32(cb, opv(funct6, funct3, vd, vs2, vs1));
+}
 
-            case PVA_DIV_F32: {
-                // vfdiv.vv v<dst>, v<src1>, v<src2>
-                // encoding: funct6=0x18 for divide
-                uint32_t opcode = 0x18001057;
-                opcode |= ((instr->dst & 0x1f) << 7);
-                opcode |= ((instr->src1 & 0x1f) << 15);
-                opcode |= ((instr->src2 & 0x1f) << 20);
-                opcode |= (0 << 25);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
-                break;
-            }
+static void emit_vsetvli(pva_codebuf_t* cb, uint8_t rd, uint8_t rs1, uint32_t vtype) {
+    pva_codebuf_emit32(cb, (vtype << 20) | (rs1 << 15) | (0x7 << 12) | (rd << 7) | 0x57);
+}
 
-            case PVA_LOAD_F32: {
-                // vle32.v v<dst>, (x1)
-                // unit-stride load encoding
-                uint32_t opcode = 0x06000007;  // vle32.v base
-                opcode |= ((instr->dst & 0x1f) << 7);
-                opcode |= (1 << 20);  // x1 register
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
-                break;
-            }
+// R-type integer op (add: funct7=0x00, sub: funct7=0x20, mul: funct7=0x01)
+static void emit_op(pva_codebuf_t* cb, uint32_t funct7, uint8_t rd, uint8_t rs1, uint8_t rs2) {
+    pva_codebuf_emit32(cb, (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (rd << 7) | 0x33);
+}
 
-            case PVA_STORE_F32: {
-                // vse32.v v<src>, (x1)
-                // unit-stride store encoding
-                uint32_t opcode = 0x04000027;  // vse32.v base
-                opcode |= ((instr->dst & 0x1f) << 7);
-                opcode |= (1 << 20);  // x1 register
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
-                break;
+// I-type OP-IMM (addi: funct3=0, slli: funct3=1)
+static void emit_opimm(pva_codebuf_t* cb, uint32_t funct3, uint8_t rd, uint8_t rs1, int32_t imm) {
+    pva_codebuf_emit32(cb, (((uint32_t)imm & 0xfff) << 20) | (rs1 << 15) | (funct3 << 12) |
+                           (rd << 7) | 0x13);
+}
+
+// rd = rs1 + offset; large offsets go through t5
+static void emit_add_offset(pva_codebuf_t* cb, uint8_t rd, uint8_t rs1, int32_t offset) {
+    if (offset >= -2048 && offset < 2048) {
+        emit_opimm(cb, 0x0, rd, rs1, offset);                  // addi
+        return;
+    }
+    int32_t lo = (int32_t)((uint32_t)offset << 20) >> 20;
+    uint32_t hi = ((uint32_t)offset - (uint32_t)lo) & 0xfffff000;
+    pva_codebuf_emit32(cb, hi | (X_T5 << 7) | 0x37);           // lui t5, hi
+    pva_codebuf_emit32(cb, (((uint32_t)lo & 0xfff) << 20) | (X_T5 << 15) | (X_T5 << 7) | 0x1b);  // addiw
+    emit_op(cb, 0x00, rd, rs1, X_T5);                          // add rd, rs1, t5
+}
+
+// beq/bne rs1, x0 placeholder, target patched by patch_branch
+static size_t emit_branch(pva_codebuf_t* cb) {
+    size_t at = cb->size;
+    pva_codebuf_emit32(cb, 0);
+    return at;
+}
+
+static void patch_branch(pva_codebuf_t* cb, size_t at, uint32_t funct3, uint8_t rs1, size_t target) {
+    uint32_t imm = (uint32_t)((long)target - (long)at);
+    uint32_t opcode = 0x63 | (funct3 << 12) | (rs1 << 15);
+    opcode |= ((imm >> 12) & 0x1) << 31;
+    opcode |= ((imm >> 5) & 0x3f) << 25;
+    opcode |= ((imm >> 1) & 0xf) << 8;
+    opcode |= ((imm >> 11) & 0x1) << 7;
+    pva_codebuf_patch32(cb, at, opcode);
+}
+
+// t2 = sp + slot * vlenb
+static void emit_slot_addr(pva_codebuf_t* cb, uint32_t slot) {
+    emit_opimm(cb, 0x0, X_T5, X_ZERO, (int32_t)slot);  // li t5, slot
+    emit_op(cb, 0x01, X_T5, X_T5, X_VLENB);             // mul t5, t5, t4
+    emit_op(cb, 0x00, X_T2, X_SP, X_T5);                // add t2, sp, t5
+}
+
+static void emit_instr(pva_codebuf_t* cb, const pva_instr_t* instr, int in_loop) {
+    switch (instr->op) {
+        case PVA_ADD_F32:
+            // vfadd.vv v<dst>, v<src1>, v<src2>
+            emit_opv(cb, 0x00, OPFVV, instr->dst, instr->src1, instr->src2);
+            break;
+
+        case PVA_SUB_F32:
+            // vfsub.vv v<dst>, v<src1>, v<src2>
+            emit_opv(cb, 0x02, OPFVV, instr->dst, instr->src1, instr->src2);
+            break;
+
+        case PVA_MUL_F32:
+            // vfmul.vv v<dst>, v<src1>, v<src2>
+            emit_opv(cb, 0x24, OPFVV, instr->dst, instr->src1, instr->src2);
+            break;
+
+        case PVA_DIV_F32:
+            // vfdiv.vv v<dst>, v<src1>, v<src2>
+            emit_opv(cb, 0x20, OPFVV, instr->dst, instr->src1, instr->src2);
+            break;
+
+        case PVA_FMA_F32:
+        case PVA_FMS_F32: {
+            // vfmacc/vfnmsac.vv accumulate into vd (vd = +-(vs1 * vs2) + vd);
+            // vfmadd/vfnmsub.vv overwrite a factor (vd = +-(vs1 * vd) + vs2)
+            int fms = instr->op == PVA_FMS_F32;
+            uint8_t d = instr->dst, a = instr->src1, b = instr->src2, c = instr->src3;
+            if (d == c) {
+                emit_opv(cb, fms ? 0x2f : 0x2c, OPFVV, d, b, a);
+            } else if (d == a || d == b) {
+                emit_opv(cb, fms ? 0x2b : 0x28, OPFVV, d, c, d == a ? b : a);
+            } else {
+                emit_opv(cb, 0x17, OPIVV, d, 0, c);        // vmv.v.v v<dst>, v<src3>
+                emit_opv(cb, fms ? 0x2f : 0x2c, OPFVV, d, b, a);
             }
+            break;
+        }
 
-            case PVA_SETZERO: {
-                // vmv.v.x v<dst>, x0 (move immediate/scalar to vector)
-                // uses x0 (zero) as source
-                uint32_t opcode = 0x40005057;
-                opcode |= ((instr->dst & 0x1f) << 7);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
-                break;
+        case PVA_LOAD_F32:
+        case PVA_STORE_F32: {
+            // vle32.v/vse32.v v<reg>, (buffer + t3 + offset)
+            uint8_t base = buffer_reg(instr->src1);
+            if (in_loop) {
+                emit_op(cb, 0x00, X_T2, base, X_INDEX);
+                base = X_T2;
             }
+            if (instr->imm) {
+                emit_add_offset(cb, X_T2, base, (int32_t)instr->imm);
+                base = X_T2;
+            }
+            uint32_t opcode = instr->op == PVA_LOAD_F32 ? 0x07 : 0x27;
+            if (instr->mask_reg == PVA_NO_MASK) opcode |= (1u << 25);   // vm=1, else under v0.t
+            opcode |= (base << 15);
+            opcode |= (0x6 << 12);              // width: 32-bit elements
+            opcode |= ((instr->dst & 0x1f) << 7);
+            pva_codebuf_emit32(cb, opcode);
+            break;
+        }
 
-            case PVA_CMP_LT_F32: {
-                // vmflt.vv v<dst>, v<src1>, v<src2>
-                // floating-point less-than comparison
-                uint32_t opcode = 0x6e005057;
-                opcode |= ((instr->dst & 0x1f) << 7);
-                opcode |= ((instr->src1 & 0x1f) << 15);
-                opcode |= ((instr->src2 & 0x1f) << 20);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
-                break;
+        case PVA_GATHER_F32:
+        case PVA_SCATTER_F32: {
+            // vluxei32.v/vsoxei32.v v<reg>, (buffer), v<index>: the index holds
+            // byte offsets, so a scale of 4 shifts it into v31 first. the
+            // ordered store keeps the last of several lanes to one address
+            uint8_t index = instr->src2;
+            if (instr->imm == 4) {
+                emit_opv(cb, 0x25, OPIVI, V_SCRATCH, index, 2);     // vsll.vi v31, v<index>, 2
+                index = V_SCRATCH;
             }
+            uint32_t opcode = instr->op == PVA_GATHER_F32 ? 0x07 | (0x1 << 26) : 0x27 | (0x3 << 26);
+            opcode |= (1u << 25) | ((uint32_t)index << 20) | ((uint32_t)buffer_reg(instr->src1) << 15);
+            opcode |= (0x6 << 12) | ((instr->dst & 0x1f) << 7);
+            pva_codebuf_emit32(cb, opcode);
+            break;
+        }
 
-            case PVA_AND_MASK: {
-                // vand.vv v<dst>, v<src1>, v<src2>
-                // logical AND for masks
-                uint32_t opcode = 0x24001057;
-                opcode |= ((instr->dst & 0x1f) << 7);
-                opcode |= ((instr->src1 & 0x1f) << 15);
-                opcode |= ((instr->src2 & 0x1f) << 20);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
-                break;
+        case PVA_LOAD_STRIDED_F32: {
+            // vlse32.v v<dst>, (buffer + t3 * stride / 4 + offset), t5 = stride
+            int32_t stride = (int32_t)instr->src2;
+            uint8_t base = buffer_reg(instr->src1);
+            if (in_loop) {
+                emit_add_offset(cb, X_T5, X_ZERO, stride / 4);
+                emit_op(cb, 0x01, X_T2, X_INDEX, X_T5);             // mul t2, t3, t5
+                emit_op(cb, 0x00, X_T2, X_T2, base);
+                base = X_T2;
             }
+            if (instr->imm) {
+                emit_add_offset(cb, X_T2, base, (int32_t)instr->imm);
+                base = X_T2;
+            }
+            emit_add_offset(cb, X_T5, X_ZERO, stride);
+            pva_codebuf_emit32(cb, 0x08000007 | (1u << 25) | (X_T5 << 20) | ((uint32_t)base << 15) |
+                                   (0x6 << 12) | ((instr->dst & 0x1f) << 7));
+            break;
+        }
+
+        case PVA_SPILL:
+            // vs1r.v v<src>, (t2): whole register, independent of vl
+            emit_slot_addr(cb, instr->imm);
+            pva_codebuf_emit32(cb, 0x02800027 | (X_T2 << 15) | ((instr->src1 & 0x1f) << 7));
+            break;
+
+        case PVA_RELOAD:
+            // vl1re32.v v<dst>, (t2)
+            emit_slot_addr(cb, instr->imm);
+            pva_codebuf_emit32(cb, 0x02806007 | (X_T2 << 15) | ((instr->dst & 0x1f) << 7));
+            break;
+
+        case PVA_MOV_F32:
+            // vmv.v.v v<dst>, v<src1>
+            emit_opv(cb, 0x17, OPIVV, instr->dst, 0, instr->src1);
+            break;
+
+        case PVA_REDSUM_F32:
+        case PVA_REDSUM_ORD_F32:
+            // vfredusum/vfredosum.vs v31, v<src1>, v31 from -0.0 in v31[0], over
+            // the whole register outside the loop, then vrgather.vi v<dst>, v31, 0
+            pva_codebuf_emit32(cb, 0x80000037 | (X_T5 << 7));              // lui t5, 0x80000
+            emit_opv(cb, 0x10, OPMVX, V_SCRATCH, 0, X_T5);                 // vmv.s.x v31, t5
+            emit_opv(cb, instr->op == PVA_REDSUM_F32 ? 0x01 : 0x03, OPFVV, V_SCRATCH, instr->src1, V_SCRATCH);
+            emit_opv(cb, 0x0c, OPIVI, instr->dst, V_SCRATCH, 0);
+            break;
 
-            case PVA_OR_MASK: {
-                // vor.vv v<dst>, v<src1>, v<src2>
-                // logical OR for masks
-                uint32_t opcode = 0x28001057;
-                opcode |= ((instr->dst & 0x1f) << 7);
-                opcode |= ((instr->src1 & 0x1f) << 15);
-                opcode |= ((instr->src2 & 0x1f) << 20);
-                
-                *ptr++ = (opcode >> 0) & 0xff;
-                *ptr++ = (opcode >> 8) & 0xff;
-                *ptr++ = (opcode >> 16) & 0xff;
-                *ptr++ = (opcode >> 24) & 0xff;
+        case PVA_REDMAX_F32:
+        case PVA_REDMIN_F32:
+            // vfredmax/vfredmin.vs v31, v<src1>, v<src1> ; vrgather.vi v<dst>, v31, 0
+            emit_opv(cb, instr->op == PVA_REDMAX_F32 ? 0x07 : 0x05, OPFVV, V_SCRATCH, instr->src1, instr->src1);
+            emit_opv(cb, 0x0c, OPIVI, instr->dst, V_SCRATCH, 0);
+            break;
+
+        case PVA_SETZERO:
+            // vmv.v.i v<dst>, 0
+            emit_opv(cb, 0x17, OPIVI, instr->dst, 0, 0);
+            break;
+
+        case PVA_CONST_F32: {
+            if (instr->imm == 0) {
+                emit_opv(cb, 0x17, OPIVI, instr->dst, 0, 0);       // +0.0: vmv.v.i v<dst>, 0
                 break;
             }
+            // auipc t5 ; flw ft0, from the constant pool ; vfmv.v.f v<dst>, ft0
+            uint32_t bits = instr->imm;
+            size_t at = pva_codebuf_rodata(cb, &bits, 4, 4);
+            size_t hi = cb->size;
+            pva_codebuf_reloc(cb, PVA_RELOC_RISCV_PCREL_HI20, hi, at, 0, 0);
+            pva_codebuf_emit32(cb, (X_T5 << 7) | 0x17);
+            pva_codebuf_reloc(cb, PVA_RELOC_RISCV_PCREL_LO12, cb->size, at, 0, hi);
+            pva_codebuf_emit32(cb, (X_T5 << 15) | (0x2 << 12) | (F_T0 << 7) | 0x07);
+            emit_opv(cb, 0x17, OPFVF, instr->dst, 0, F_T0);
+            break;
+        }
 
-            default:
-                break;
+        case PVA_CMP_LT_F32:
+        case PVA_CMP_EQ_F32:
+            // vmflt/vmfeq.vv set one bit per element; like every other
+            // target, pva wants all-ones elements:
+            // vmflt.vv v0, ... ; vmv.v.i v<dst>, 0 ; vmerge.vim v<dst>, v<dst>, -1, v0
+            emit_opv(cb, instr->op == PVA_CMP_LT_F32 ? 0x1b : 0x18, OPFVV, V_MASK, instr->src1, instr->src2);
+            emit_opv(cb, 0x17, OPIVI, instr->dst, 0, 0);
+            emit_opv_masked(cb, 0x17, OPIVI, instr->dst, instr->dst, 0x1f);
+            break;
+
+        case PVA_AND_MASK:
+            // vand.vv v<dst>, v<src1>, v<src2>
+            emit_opv(cb, 0x09, OPIVV, instr->dst, instr->src1, instr->src2);
+            break;
+
+        case PVA_OR_MASK:
+            // vor.vv v<dst>, v<src1>, v<src2>
+            emit_opv(cb, 0x0a, OPIVV, instr->dst, instr->src1, instr->src2);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// an op under a mask, which vmsne.vi turns into v0. where the destination
+// already holds what the masked-off elements keep, the op itself runs under
+// v0.t; otherwise the unmasked result goes to the scratch and vmerge (or
+// vand, to zero) selects it
+static void emit_masked(pva_codebuf_t* cb, const pva_instr_t* instr, int in_loop) {
+    uint8_t d = instr->dst, keep = instr->src3, mask = instr->mask_reg;
+
+    if (instr->imm == PVA_MASK_ZERO && instr->op != PVA_STORE_F32) {
+        pva_instr_t op = *instr;
+        op.dst = V_SCRATCH;
+        op.mask_reg = PVA_NO_MASK;
+        emit_instr(cb, &op, in_loop);
+        emit_opv(cb, 0x09, OPIVV, d, V_SCRATCH, mask);         // vand.vv v<dst>, v31, v<mask>
+        return;
+    }
+
+    emit_opv(cb, 0x19, OPIVI, V_MASK, mask, 0);                // vmsne.vi v0, v<mask>, 0
+    if (d == keep || instr->op == PVA_STORE_F32) {
+        switch (instr->op) {
+            case PVA_ADD_F32: emit_opv_masked(cb, 0x00, OPFVV, d, instr->src1, instr->src2); return;
+            case PVA_SUB_F32: emit_opv_masked(cb, 0x02, OPFVV, d, instr->src1, instr->src2); return;
+            case PVA_MUL_F32: emit_opv_masked(cb, 0x24, OPFVV, d, instr->src1, instr->src2); return;
+            case PVA_DIV_F32: emit_opv_masked(cb, 0x20, OPFVV, d, instr->src1, instr->src2); return;
+            case PVA_FMA_F32: emit_opv_masked(cb, 0x2c, OPFVV, d, instr->src2, instr->src1); return;
+            case PVA_FMS_F32: emit_opv_masked(cb, 0x2f, OPFVV, d, instr->src2, instr->src1); return;
+            case PVA_MOV_F32: emit_opv_masked(cb, 0x17, OPIVV, d, d, instr->src1); return;   // vmerge.vvm
+            default: emit_instr(cb, instr, in_loop); return;                                  // vse32.v, v0.t
+        }
+    }
+
+    pva_instr_t op = *instr;
+    op.dst = V_SCRATCH;
+    op.mask_reg = PVA_NO_MASK;
+    emit_instr(cb, &op, in_loop);
+    emit_opv_masked(cb, 0x17, OPIVV, d, keep, V_SCRATCH);    // vmerge.vvm v<dst>, v<keep>, v31, v0
+}
+
+static void emit_range(pva_codebuf_t* cb, pva_module_t* mod, size_t from, size_t to, int in_loop) {
+    for (size_t i = from; i < to; i++) {
+        if (mod->code[i].mask_reg != PVA_NO_MASK) {
+            emit_masked(cb, &mod->code[i], in_loop);
+        } else {
+            emit_instr(cb, &mod->code[i], in_loop);
         }
     }
+}
+
+// strip-mined loop: vsetvli grants vl <= remaining elements each trip, so
+// the remainder needs no separate tail
+static void emit_loop(pva_codebuf_t* cb, pva_module_t* mod, size_t body, size_t body_end) {
+    emit_opimm(cb, 0x0, X_INDEX, X_ZERO, 0);           // li t3, 0
+    size_t to_done = emit_branch(cb);                  // beqz a0, done
+
+    size_t top = cb->size;
+    emit_vsetvli(cb, X_T0, X_COUNT, VTYPE_E32_M1);     // vsetvli t0, a0, e32, m1, tu, mu
+    emit_range(cb, mod, body, body_end, 1);
+    emit_opimm(cb, 0x1, X_T1, X_T0, 2);                // slli t1, t0, 2
+    emit_op(cb, 0x00, X_INDEX, X_INDEX, X_T1);         // add t3, t3, t1
+    emit_op(cb, 0x20, X_COUNT, X_COUNT, X_T0);         // sub a0, a0, t0
+    patch_branch(cb, emit_branch(cb), 0x1, X_COUNT, top);  // bnez a0, top
+
+    patch_branch(cb, to_done, 0x0, X_COUNT, cb->size);
+    emit_vsetvli(cb, X_T0, X_ZERO, VTYPE_E32_M1);      // back to vl = VLMAX
+}
+
+int pva_emit_riscv(pva_module_t* mod, pva_codebuf_t* cb) {
+    if (!mod || !cb) return -1;
+
+    size_t start = cb->size;
+
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[codegen] generating RISC-V RVV code for %zu instructions", mod->size);
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[codegen] target vector width: %d bytes", mod->vec_width_bytes);
+
+    long loop_begin, loop_end;
+    if (pva_find_loop(mod, &loop_begin, &loop_end) != 0) return -1;
+
+    if (mod->spill_slots > 2047) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[codegen] err: too many spill slots (%d)", mod->spill_slots);
+        return -1;
+    }
+
+    // prologue
+    // addi sp, sp, -16
+    pva_codebuf_emit32(cb, 0xff010113);
+    // sd ra, 8(sp)
+    pva_codebuf_emit32(cb, 0x00113423);
+    // sd s0, 0(sp)
+    pva_codebuf_emit32(cb, 0x00813023);
+    // mv s0, sp
+    emit_opimm(cb, 0x0, X_FP, X_SP, 0);
+
+    if (mod->spill_slots > 0) {
+        // spill slots are whole vector registers: sp -= spill_slots * vlenb
+        pva_codebuf_emit32(cb, 0xc2202073 | (X_VLENB << 7));    // csrr t4, vlenb
+        emit_opimm(cb, 0x0, X_T5, X_ZERO, mod->spill_slots);   // li t5, slots
+        emit_op(cb, 0x01, X_T5, X_T5, X_VLENB);                 // mul t5, t5, t4
+        emit_op(cb, 0x20, X_SP, X_SP, X_T5);                    // sub sp, sp, t5
+    }
+
+    if (mod->num_buffers > NUM_ARG_BUFFERS) {
+        // ld t6, 16(s0): the eighth pointer argument
+        pva_codebuf_emit32(cb, (16 << 20) | (X_FP << 15) | (0x3 << 12) | (X_STACK_BUFFER << 7) | 0x03);
+    }
+
+    // init vector length: vsetvli t0, x0, e32, m1 (vl = VLMAX)
+    emit_vsetvli(cb, X_T0, X_ZERO, VTYPE_E32_M1);
+
+    // gen instruction codes
+    if (loop_begin < 0) {
+        emit_range(cb, mod, 0, mod->size, 0);
+    } else {
+        emit_range(cb, mod, 0, (size_t)loop_begin, 0);
+        emit_loop(cb, mod, (size_t)loop_begin + 1, (size_t)loop_end);
+        emit_range(cb, mod, (size_t)loop_end + 1, mod->size, 0);
+    }
 
     // epilogue
+    // mv sp, s0
+    emit_opimm(cb, 0x0, X_SP, X_FP, 0);
+    // ld s0, 0(sp)
+    pva_codebuf_emit32(cb, 0x00013403);
     // ld ra, 8(sp)
-    *ptr++ = 0x83; *ptr++ = 0x30; *ptr++ = 0x81; *ptr++ = 0x00;
+    pva_codebuf_emit32(cb, 0x00813083);
     // addi sp, sp, 16
-    *ptr++ = 0x13; *ptr++ = 0x01; *ptr++ = 0x01; *ptr++ = 0x01;
+    pva_codebuf_emit32(cb, 0x01010113);
     // jalr x0, x1, 0 (ret)
-    *ptr++ = 0x67; *ptr++ = 0x80; *ptr++ = 0x00; *ptr++ = 0x00;
+    pva_codebuf_emit32(cb, 0x00008067);
+
+    if (cb->failed) return -1;
 
-    printf("[codegen] generated %ld bytes of RISC-V RVV code\n", ptr - buffer);
-}
\ No newline at end of file
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[codegen] generated %zu bytes of RISC-V RVV code", cb->size - start);
+    return 0;
+}
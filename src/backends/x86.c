@@ -1,246 +1,1281 @@
 #include "pva.h"
-#include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 
-#define MAX_REGS_SSE 16
-#define MAX_REGS_AVX2 16
-#define MAX_REGS_AVX512 32
-#define FULL_MASK 0xFFFF
+// general purpose registers
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSP 4
+#define RBP 5
+#define RSI 6
+#define RDI 7
+#define R8  8
+#define R9  9
+#define R10 10
+#define R11 11
+#define R12 12
+#define RIP 16      // as an x86_mem_t base: disp32 from the next instruction
 
-static void write_bytes(uint8_t** buf, const uint8_t* data, size_t len) {
-    memcpy(*buf, data, len);
-    *buf += len;
+// fixed register roles (System V: n in rdi, buffer pointers after it)
+#define REG_COUNT RDI
+#define REG_INDEX RAX   // byte offset of the current loop iteration
+#define REG_TMP   R11
+
+// buffer i lives in buffer_regs[i]. the first five arrive in argument
+// registers; the rest are passed on the stack and loaded by the prologue,
+// rbx and r12 being callee-saved
+#define NUM_ARG_BUFFERS 5
+static const int buffer_regs[PVA_MAX_BUFFERS] = {RSI, RDX, RCX, R8, R9, R10, RBX, R12};
+
+// vector scratch: xmm15/ymm15 on 16-register targets, zmm31 on AVX-512.
+// pva_regalloc never hands these out, nor xmm14 on SSE, whose two-operand
+// forms need a second one for masked ops
+#define SCRATCH_SSE 15
+#define SCRATCH2_SSE 14
+#define SCRATCH_AVX512 31
+
+// vgatherdps' all-ones mask on AVX2. ymm14 is the last register regalloc
+// reloads spilled operands into, one per operand from ymm11 up, and the
+// ops that use it have no more than two
+#define GATHER_MASK_AVX2 14
+
+// AVX-512 opmasks: k1 holds the active lanes of the tail, k2 those of a
+// masked op within the tail, and k3-k7 comparison results
+#define TAIL_MASK 1
+#define EXEC_MASK 2
+#define FIRST_KMASK 3
+#define NUM_KMASKS 5
+
+// vcmpps predicates
+#define CMP_EQ_OQ 0x00
+#define CMP_LT_OS 0x01
+
+enum { ENC_SSE, ENC_VEX, ENC_EVEX };
+enum { MAP_0F = 1, MAP_0F38 = 2, MAP_0F3A = 3 };
+enum { PP_NONE = 0, PP_66 = 1, PP_F3 = 2, PP_F2 = 3 };
+
+// how one IR instruction is lowered
+typedef enum {
+    MODE_FULL,      // whole vector
+    MODE_LANE0,     // lane 0 only, other lanes preserved (SSE/AVX2 tail)
+    MODE_MASKED     // lanes active in k1 only (AVX-512 tail)
+} emit_mode_t;
+
+typedef struct {
+    int enc;
+    int map;
+    int pp;
+    int w;
+    int len;        // VEX.L or EVEX.L'L
+    int mask;       // EVEX.aaa
+    int zeroing;    // EVEX.z
+    int scalar;     // EVEX memory operand is one element, so disp8 scales by 4
+} x86_enc_t;
+
+typedef struct {
+    int base;
+    int index;      // -1 for none; a vector register for vgather/vscatter
+    int32_t disp;
+    int shift;      // index scaled by 1 << shift
+} x86_mem_t;
+
+// which vector register's mask each of k3-k7 holds, so a mask feeding
+// several AVX-512 ops is tested into an opmask once. only good within one
+// straight run of code; emit_range starts with it empty
+typedef struct {
+    int reg[NUM_KMASKS];    // -1 when free
+    int next;               // the next one taken when none is free
+} kmask_cache_t;
+
+static void write_bytes(pva_codebuf_t* cb, const uint8_t* data, size_t len) {
+    pva_codebuf_emit(cb, data, len);
 }
 
-// emit EVEX prefix for AVX512 instructions with register bits and mask
-static void emit_evex_prefix(uint8_t** pbuf, uint8_t p0, uint8_t p1, uint8_t p2,
-                             uint8_t r, uint8_t x, uint8_t b, uint8_t r2,
-                             uint8_t mask, uint8_t zeroing, uint8_t vector_length) {
-    uint8_t evex[4];
-    evex[0] = 0x62;
-    evex[1] = ((~r & 1) << 7) | ((~x & 1) << 6) | ((~b & 1) << 5) | (p0 & 0x1F);
-    evex[2] = ((~r2 & 1) << 7) | (p1 & 0x7F);
-    evex[3] = ((mask & 0xF) & 0x0F)         // mask in bits 0-3
-              | ((zeroing & 1) << 4)        // zeroing/merging bit
-              | ((vector_length & 3) << 5) // vector length bits
-              | 0x08;                      // EVEX bit
+// ModRM (+SIB +disp) for a register or memory r/m operand. disp_scale is the
+// EVEX disp8*N compression factor, 1 for legacy/VEX encodings
+static void emit_modrm_operand(pva_codebuf_t* cb, int reg, int rm_reg,
+                               const x86_mem_t* mem, int disp_scale) {
+    if (!mem) {
+        pva_codebuf_emit8(cb, 0xC0 | ((reg & 7) << 3) | (rm_reg & 7));
+        return;
+    }
+
+    if (mem->base == RIP) {
+        pva_codebuf_emit8(cb, ((reg & 7) << 3) | RBP);     // mod 00, r/m 101
+        pva_codebuf_emit32(cb, (uint32_t)mem->disp);
+        return;
+    }
+
+    int mod;
+    int32_t disp = mem->disp;
+    if (disp == 0 && (mem->base & 7) != RBP) {
+        mod = 0;
+    } else if (disp % disp_scale == 0 && disp / disp_scale >= -128 && disp / disp_scale <= 127) {
+        mod = 1;
+        disp /= disp_scale;
+    } else {
+        mod = 2;
+    }
 
-    write_bytes(pbuf, evex, 4);
+    if (mem->index < 0 && (mem->base & 7) != RSP) {
+        pva_codebuf_emit8(cb, (mod << 6) | ((reg & 7) << 3) | (mem->base & 7));
+    } else {
+        int index = mem->index < 0 ? RSP : mem->index;  // 100 = no index
+        pva_codebuf_emit8(cb, (mod << 6) | ((reg & 7) << 3) | RSP);
+        pva_codebuf_emit8(cb, (mem->shift << 6) | ((index & 7) << 3) | (mem->base & 7));
+    }
+
+    if (mod == 1) {
+        pva_codebuf_emit8(cb, (uint8_t)(int8_t)disp);
+    } else if (mod == 2) {
+        pva_codebuf_emit32(cb, (uint32_t)disp);
+    }
 }
 
-// emit ModRM byte for register encoding
-static void emit_modrm(uint8_t** pbuf, uint8_t reg, uint8_t rm) {
-    uint8_t modrm = 0xC0 | ((reg & 0x7) << 3) | (rm & 0x7);
-    write_bytes(pbuf, &modrm, 1);
+// emit a vector instruction: prefix, opcode and operands. `reg` is ModRM.reg,
+// `vvvv` the extra VEX/EVEX source (ignored for SSE), and the r/m operand is
+// either rm_reg or mem. any imm8 is appended by the caller
+static void emit_vec(pva_codebuf_t* cb, const x86_enc_t* e, uint8_t opcode,
+                     int reg, int vvvv, int rm_reg, const x86_mem_t* mem) {
+    int rex_r = (reg >> 3) & 1;
+    int rex_x = mem ? (mem->index >= 0 ? (mem->index >> 3) & 1 : 0) : (rm_reg >> 4) & 1;
+    int rex_b = mem ? (mem->base >> 3) & 1 : (rm_reg >> 3) & 1;
+    int disp_scale = 1;
+
+    if (e->enc == ENC_SSE) {
+        static const uint8_t pp_byte[4] = {0, 0x66, 0xF3, 0xF2};
+        if (e->pp) pva_codebuf_emit8(cb, pp_byte[e->pp]);
+        if (e->w || rex_r || rex_x || rex_b) {
+            pva_codebuf_emit8(cb, 0x40 | (e->w << 3) | (rex_r << 2) | (rex_x << 1) | rex_b);
+        }
+        pva_codebuf_emit8(cb, 0x0F);
+        if (e->map == MAP_0F38) pva_codebuf_emit8(cb, 0x38);
+        if (e->map == MAP_0F3A) pva_codebuf_emit8(cb, 0x3A);
+    } else if (e->enc == ENC_VEX) {
+        if (e->map == MAP_0F && !e->w && !rex_x && !rex_b) {
+            uint8_t vex[2] = {0xC5, (uint8_t)((!rex_r << 7) | ((~vvvv & 0xF) << 3) |
+                                              (e->len << 2) | e->pp)};
+            write_bytes(cb, vex, 2);
+        } else {
+            uint8_t vex[3] = {0xC4,
+                              (uint8_t)((!rex_r << 7) | (!rex_x << 6) | (!rex_b << 5) | e->map),
+                              (uint8_t)((e->w << 7) | ((~vvvv & 0xF) << 3) | (e->len << 2) | e->pp)};
+            write_bytes(cb, vex, 3);
+        }
+    } else {
+        int r_hi = (reg >> 4) & 1;
+        int v_hi = (vvvv >> 4) & 1;
+        uint8_t evex[4];
+        evex[0] = 0x62;
+        evex[1] = (!rex_r << 7) | (!rex_x << 6) | (!rex_b << 5) | (!r_hi << 4) | e->map;
+        evex[2] = (e->w << 7) | ((~vvvv & 0xF) << 3) | 0x04 | e->pp;
+        evex[3] = (e->zeroing << 7) | (e->len << 5) | (!v_hi << 3) | (e->mask & 7);
+        write_bytes(cb, evex, 4);
+        disp_scale = e->scalar ? 4 : 16 << e->len;  // full-vector memory operand unless scalar
+    }
+
+    pva_codebuf_emit8(cb, opcode);
+    emit_modrm_operand(cb, reg, rm_reg, mem, disp_scale);
 }
 
-// helper to encode prefixes and opcode for AVX2 instructions
-static void emit_avx2_instr(uint8_t** pbuf, uint8_t opcode, uint8_t dst, uint8_t src1, uint8_t src2) {
-    // VEX prefix: 0xC5 0xF4 fixed for this instruction variant
-    uint8_t vex[2] = {0xC5, 0xF4};
-    write_bytes(pbuf, vex, 2);
+static x86_enc_t enc_for(int vec_width, emit_mode_t mode) {
+    x86_enc_t e = {ENC_SSE, MAP_0F, PP_NONE, 0, 0, 0, 0, 0};
+    if (vec_width == 64) {
+        e.enc = ENC_EVEX;
+        e.len = 2;
+        if (mode == MODE_MASKED) e.mask = TAIL_MASK;
+    } else if (vec_width == 32) {
+        e.enc = ENC_VEX;
+        e.len = 1;
+    }
+    return e;
+}
 
-    write_bytes(pbuf, &opcode, 1);
+static void kmask_forget(kmask_cache_t* km, uint32_t reg) {
+    for (int k = 0; k < NUM_KMASKS; k++) {
+        if (km->reg[k] == (int)reg) km->reg[k] = -1;
+    }
+}
 
-    uint8_t modrm = 0xC0 | ((src2 & 0x7) << 3) | (dst & 0x7);
-    write_bytes(pbuf, &modrm, 1);
+// an opmask that will hold reg's lanes
+static int kmask_claim(kmask_cache_t* km, uint32_t reg) {
+    kmask_forget(km, reg);
+    int k = km->next;
+    for (int f = 0; f < NUM_KMASKS; f++) {
+        if (km->reg[f] < 0) {
+            k = f;
+            break;
+        }
+    }
+    km->next = (k + 1) % NUM_KMASKS;
+    km->reg[k] = (int)reg;
+    return FIRST_KMASK + k;
 }
 
-static void emit_sse_addps(uint8_t** pbuf) {
-    uint8_t instr[3] = {0x0F, 0x58, 0xC1};
-    write_bytes(pbuf, instr, 3);
+// the opmask holding reg's lanes: vptestmd k, reg, reg unless one does
+static int kmask_get(pva_codebuf_t* cb, kmask_cache_t* km, uint32_t reg) {
+    for (int k = 0; k < NUM_KMASKS; k++) {
+        if (km->reg[k] == (int)reg) return FIRST_KMASK + k;
+    }
+    int k = kmask_claim(km, reg);
+    x86_enc_t e = enc_for(64, MODE_FULL);
+    e.map = MAP_0F38;
+    e.pp = PP_66;
+    emit_vec(cb, &e, 0x27, k, reg, reg, NULL);
+    return k;
 }
 
-static void emit_sse_subps(uint8_t** pbuf) {
-    uint8_t instr[3] = {0x0F, 0x5C, 0xC1};
-    write_bytes(pbuf, instr, 3);
+// REX.W-prefixed op with a register r/m operand
+static void emit_gpr_rr(pva_codebuf_t* cb, uint8_t opcode, int reg, int rm) {
+    uint8_t instr[3] = {(uint8_t)(0x48 | (((reg >> 3) & 1) << 2) | ((rm >> 3) & 1)),
+                        opcode,
+                        (uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7))};
+    write_bytes(cb, instr, 3);
 }
 
-static void emit_sse_mulps(uint8_t** pbuf) {
-    uint8_t instr[3] = {0x0F, 0x59, 0xC1};
-    write_bytes(pbuf, instr, 3);
+// imul reg, rm, imm on 64-bit registers
+static void emit_gpr_imul(pva_codebuf_t* cb, int reg, int rm, int32_t imm) {
+    pva_codebuf_emit8(cb, 0x48 | (((reg >> 3) & 1) << 2) | ((rm >> 3) & 1));
+    pva_codebuf_emit8(cb, imm >= -128 && imm <= 127 ? 0x6B : 0x69);
+    pva_codebuf_emit8(cb, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+    if (imm >= -128 && imm <= 127) {
+        pva_codebuf_emit8(cb, (uint8_t)(int8_t)imm);
+    } else {
+        pva_codebuf_emit32(cb, (uint32_t)imm);
+    }
 }
 
-static void emit_sse_divps(uint8_t** pbuf) {
-    uint8_t instr[3] = {0x0F, 0x5E, 0xC1};
-    write_bytes(pbuf, instr, 3);
+// mov reg32, [mem], which zero-extends into the whole register
+static void emit_gpr_load32(pva_codebuf_t* cb, int reg, const x86_mem_t* mem) {
+    int rex = (((reg >> 3) & 1) << 2) | ((mem->base >> 3) & 1);
+    if (mem->index >= 0) rex |= ((mem->index >> 3) & 1) << 1;
+    if (rex) pva_codebuf_emit8(cb, 0x40 | rex);
+    pva_codebuf_emit8(cb, 0x8B);
+    emit_modrm_operand(cb, reg, 0, mem, 1);
 }
 
-static void emit_sse_setzero(uint8_t** pbuf) {
-    uint8_t instr[3] = {0x0F, 0x57, 0xC0};
-    write_bytes(pbuf, instr, 3);
+// group-1 ALU op (add=0, sub=5, cmp=7) on a 64-bit register with an immediate
+static void emit_gpr_imm(pva_codebuf_t* cb, int ext, int rm, int32_t imm) {
+    pva_codebuf_emit8(cb, 0x48 | ((rm >> 3) & 1));
+    if (imm >= -128 && imm <= 127) {
+        pva_codebuf_emit8(cb, 0x83);
+        pva_codebuf_emit8(cb, 0xC0 | (ext << 3) | (rm & 7));
+        pva_codebuf_emit8(cb, (uint8_t)(int8_t)imm);
+    } else {
+        pva_codebuf_emit8(cb, 0x81);
+        pva_codebuf_emit8(cb, 0xC0 | (ext << 3) | (rm & 7));
+        pva_codebuf_emit32(cb, (uint32_t)imm);
+    }
 }
 
-static void emit_avx512_instr(uint8_t** pbuf, uint8_t opcode,
-                              uint8_t dst, uint8_t src1, uint8_t src2,
-                              uint8_t mask) {
-    uint8_t r = (dst >> 3) & 1;
-    uint8_t x = 0;
-    uint8_t b = (src2 >> 3) & 1;
-    uint8_t r2 = (src1 >> 4) & 1;
+// jcc rel32 (cc = 0x82 jb, 0x83 jae, 0x84 je, 0x85 jne); returns the
+// offset of the displacement for patch_rel32
+static size_t emit_jcc(pva_codebuf_t* cb, uint8_t cc) {
+    uint8_t instr[2] = {0x0F, cc};
+    write_bytes(cb, instr, 2);
+    size_t at = cb->size;
+    pva_codebuf_emit32(cb, 0);
+    return at;
+}
 
-    uint8_t vector_length = 2; 
-    uint8_t zeroing = 0;      
+static void patch_rel32(pva_codebuf_t* cb, size_t at, size_t target) {
+    pva_codebuf_patch32(cb, at, (uint32_t)(int32_t)((long)target - (long)(at + 4)));
+}
 
-    emit_evex_prefix(pbuf, 0x7D, 0x48, opcode, r, x, b, r2, mask, zeroing, vector_length);
-    write_bytes(pbuf, &opcode, 1);
-    emit_modrm(pbuf, dst & 7, src2 & 7);
+// frame: at least 32 bytes, grown to hold the register allocator's spill
+// slots at [rbp - (slot + 1) * width]
+static int frame_size(const pva_module_t* mod) {
+    int frame = mod->spill_slots * mod->vec_width_bytes;
+    frame = (frame + 15) & ~15;
+    return frame < 32 ? 32 : frame;
 }
 
-// emit AVX512 load/store using EVEX + opcode + ModRM
-static void emit_avx512_load(uint8_t** pbuf, uint8_t dst, uint8_t base_reg, uint8_t mask) {
-    uint8_t r = (dst >> 3) & 1;
-    uint8_t x = 0;
-    uint8_t b = (base_reg >> 3) & 1;
-    uint8_t r2 = 0;
+// callee-saved registers holding stack-passed buffers, pushed after rbp
+static int saved_gprs(const pva_module_t* mod) {
+    return mod->num_buffers > 6 ? mod->num_buffers - 6 : 0;
+}
 
-    uint8_t vector_length = 2;
-    uint8_t zeroing = 0;
+static void emit_push_pop(pva_codebuf_t* cb, uint8_t opcode, int reg) {
+    if (reg >= 8) pva_codebuf_emit8(cb, 0x41);
+    pva_codebuf_emit8(cb, opcode | (reg & 7));
+}
 
-    emit_evex_prefix(pbuf, 0x7D, 0x48, 0x10, r, x, b, r2, mask, zeroing, vector_length);
+static void emit_prologue(pva_codebuf_t* cb, const pva_module_t* mod) {
+    int saved = saved_gprs(mod);
 
-    uint8_t opcode = 0x10;
-    write_bytes(pbuf, &opcode, 1);
+    pva_codebuf_emit8(cb, 0x55);                                // push rbp
+    for (int i = 0; i < saved; i++) emit_push_pop(cb, 0x50, buffer_regs[6 + i]);
+    uint8_t set_frame[] = {0x48, 0x89, 0xe5};                   // mov rbp, rsp
+    write_bytes(cb, set_frame, sizeof(set_frame));
+    emit_gpr_imm(cb, 5, RSP, frame_size(mod));                  // sub rsp, frame
 
-    uint8_t modrm = (dst & 7) << 3 | (base_reg & 7);
-    write_bytes(pbuf, &modrm, 1);
+    // mov reg, [rbp + 16 + 8 * (saved + i)]: stack arguments sit above the
+    // return address and the pushed registers
+    for (int i = NUM_ARG_BUFFERS; i < mod->num_buffers; i++) {
+        int reg = buffer_regs[i];
+        uint8_t load[] = {(uint8_t)(0x48 | (((reg >> 3) & 1) << 2)), 0x8B,
+                          (uint8_t)(0x45 | ((reg & 7) << 3)),
+                          (uint8_t)(16 + 8 * (saved + i - NUM_ARG_BUFFERS))};
+        write_bytes(cb, load, sizeof(load));
+    }
 }
 
-static void emit_avx512_store(uint8_t** pbuf, uint8_t src, uint8_t base_reg, uint8_t mask) {
-    uint8_t r = (src >> 3) & 1;
-    uint8_t x = 0;
-    uint8_t b = (base_reg >> 3) & 1;
-    uint8_t r2 = 0;
+static void emit_epilogue(pva_codebuf_t* cb, const pva_module_t* mod) {
+    if (mod->vec_width_bytes > 16) {
+        uint8_t vzeroupper[] = {0xc5, 0xf8, 0x77};  // avoid SSE transition stalls in the caller
+        write_bytes(cb, vzeroupper, sizeof(vzeroupper));
+    }
+    uint8_t restore_sp[] = {0x48, 0x89, 0xec};      // mov rsp, rbp
+    write_bytes(cb, restore_sp, sizeof(restore_sp));
+    for (int i = saved_gprs(mod) - 1; i >= 0; i--) emit_push_pop(cb, 0x58, buffer_regs[6 + i]);
+    uint8_t epilogue[] = {
+        0x5d,                   // pop rbp
+        0xc3                    // ret
+    };
+    write_bytes(cb, epilogue, sizeof(epilogue));
+}
 
-    uint8_t vector_length = 2;
-    uint8_t zeroing = 0;
+// SSE has destructive two-operand forms: dst = dst op src
+static void emit_sse_binop(pva_codebuf_t* cb, uint8_t opcode, int commutative, int imm,
+                           uint8_t dst, uint8_t src1, uint8_t src2) {
+    x86_enc_t e = enc_for(16, MODE_FULL);
+    int out = dst;
 
-    emit_evex_prefix(pbuf, 0x7D, 0x48, 0x11, r, x, b, r2, mask, zeroing, vector_length);
+    if (dst == src2 && dst != src1) {
+        if (commutative) {
+            // dst = src2 op src1
+            src2 = src1;
+            src1 = dst;
+        } else {
+            out = SCRATCH_SSE;
+        }
+    }
 
-    uint8_t opcode = 0x11;
-    write_bytes(pbuf, &opcode, 1);
+    if (out != src1) emit_vec(cb, &e, 0x28, out, 0, src1, NULL);  // movaps
+    emit_vec(cb, &e, opcode, out, 0, src2, NULL);
+    if (imm >= 0) pva_codebuf_emit8(cb, (uint8_t)imm);
+    if (out != dst) emit_vec(cb, &e, 0x28, dst, 0, out, NULL);
+}
 
-    uint8_t modrm = (src & 7) << 3 | (base_reg & 7);
-    write_bytes(pbuf, &modrm, 1);
+// merge lane 0 of the scratch register into dst (blendps/vblendps imm 1)
+static void emit_blend_lane0(pva_codebuf_t* cb, int vec_width, uint8_t dst) {
+    x86_enc_t e = enc_for(vec_width, MODE_FULL);
+    e.map = MAP_0F3A;
+    e.pp = PP_66;
+    emit_vec(cb, &e, 0x0C, dst, dst, SCRATCH_SSE, NULL);
+    pva_codebuf_emit8(cb, 0x01);
 }
 
-// for AVX2 and SSE, we do not handle masked loads/stores - add later 
+// arithmetic, compares and bitwise ops
+static void emit_alu(pva_codebuf_t* cb, int vec_width, emit_mode_t mode,
+                     const pva_instr_t* instr, kmask_cache_t* km) {
+    uint8_t opcode = 0;
+    int commutative = 0;
+    int pred = -1;
 
-static void emit_prologue(uint8_t** pbuf) {
-    uint8_t prologue[] = {
-        0x55,                   // push rbp
-        0x48, 0x89, 0xe5,       // mov rbp, rsp
-        0x48, 0x83, 0xec, 0x20  // sub rsp, 32
-    };
-    write_bytes(pbuf, prologue, sizeof(prologue));
+    switch (instr->op) {
+        case PVA_ADD_F32: opcode = 0x58; commutative = 1; break;
+        case PVA_SUB_F32: opcode = 0x5C; break;
+        case PVA_MUL_F32: opcode = 0x59; commutative = 1; break;
+        case PVA_DIV_F32: opcode = 0x5E; break;
+        case PVA_AND_MASK: opcode = 0x54; commutative = 1; break;
+        case PVA_OR_MASK: opcode = 0x56; commutative = 1; break;
+        case PVA_CMP_LT_F32: opcode = 0xC2; pred = CMP_LT_OS; break;
+        case PVA_CMP_EQ_F32: opcode = 0xC2; pred = CMP_EQ_OQ; commutative = 1; break;
+        default: return;
+    }
+
+    if (vec_width == 64) {
+        x86_enc_t e = enc_for(64, mode);
+
+        if (pred >= 0) {
+            // compare into an opmask that masked ops can use as it is, then
+            // expand to all-ones lanes: vpternlogd dst{k}{z}, dst, dst, 0xff
+            uint32_t out = mode == MODE_MASKED ? SCRATCH_AVX512 : instr->dst;
+            int k = kmask_claim(km, instr->dst);
+            emit_vec(cb, &e, 0xC2, k, instr->src1, instr->src2, NULL);
+            pva_codebuf_emit8(cb, (uint8_t)pred);
+
+            x86_enc_t tern = enc_for(64, MODE_FULL);
+            tern.map = MAP_0F3A;
+            tern.pp = PP_66;
+            tern.mask = k;
+            tern.zeroing = 1;
+            emit_vec(cb, &tern, 0x25, out, out, out, NULL);
+            pva_codebuf_emit8(cb, 0xFF);
+
+            if (out != instr->dst) {
+                emit_vec(cb, &e, 0x28, instr->dst, 0, out, NULL);  // vmovaps dst{k1}, tmp
+            }
+            return;
+        }
+
+        if (instr->op == PVA_AND_MASK || instr->op == PVA_OR_MASK) {
+            // vpandd/vpord: vandps/vorps on zmm need AVX512DQ
+            e.pp = PP_66;
+            opcode = instr->op == PVA_AND_MASK ? 0xDB : 0xEB;
+        }
+        emit_vec(cb, &e, opcode, instr->dst, instr->src1, instr->src2, NULL);
+        return;
+    }
+
+    if (mode == MODE_LANE0) {
+        // full-width op into scratch, then merge lane 0 only
+        if (vec_width == 32) {
+            x86_enc_t e = enc_for(32, MODE_FULL);
+            emit_vec(cb, &e, opcode, SCRATCH_SSE, instr->src1, instr->src2, NULL);
+            if (pred >= 0) pva_codebuf_emit8(cb, (uint8_t)pred);
+        } else {
+            emit_sse_binop(cb, opcode, 0, pred, SCRATCH_SSE, instr->src1, instr->src2);
+        }
+        emit_blend_lane0(cb, vec_width, instr->dst);
+        return;
+    }
+
+    if (vec_width == 32) {
+        x86_enc_t e = enc_for(32, MODE_FULL);
+        emit_vec(cb, &e, opcode, instr->dst, instr->src1, instr->src2, NULL);
+        if (pred >= 0) pva_codebuf_emit8(cb, (uint8_t)pred);
+    } else {
+        emit_sse_binop(cb, opcode, commutative, pred, instr->dst, instr->src1, instr->src2);
+    }
 }
 
-static void emit_epilogue(uint8_t** pbuf) {
-    uint8_t epilogue[] = {
-        0x48, 0x89, 0xec,       // mov rsp, rbp
-        0x5d,                   // pop rbp
-        0xc3                    // ret
-    };
-    write_bytes(pbuf, epilogue, sizeof(epilogue));
+// fma/fms. FMA3 only has destructive forms: 231 accumulates into the
+// addend (dst = src1 * src2 + dst), 213 into a factor (dst = src1 * dst +
+// src2). SSE has no FMA, so it multiplies into the scratch and adds
+static void emit_fma(pva_codebuf_t* cb, int vec_width, emit_mode_t mode,
+                     const pva_instr_t* instr) {
+    int negate = instr->op == PVA_FMS_F32;
+    uint8_t dst = instr->dst, a = instr->src1, b = instr->src2, c = instr->src3;
+
+    if (vec_width == 16) {
+        x86_enc_t e = enc_for(16, MODE_FULL);
+        uint8_t op = negate ? 0x5C : 0x58;
+        emit_sse_binop(cb, 0x59, 1, -1, SCRATCH_SSE, a, b);    // mulps scratch = a * b
+
+        if (mode == MODE_LANE0) {
+            // movss/addss/subss register forms leave lanes 1-3 alone
+            e.pp = PP_F3;
+            if (dst != c) emit_vec(cb, &e, 0x10, dst, 0, c, NULL);
+        } else if (dst != c) {
+            emit_vec(cb, &e, 0x28, dst, 0, c, NULL);             // movaps dst, c
+        }
+        emit_vec(cb, &e, op, dst, 0, SCRATCH_SSE, NULL);
+        return;
+    }
+
+    x86_enc_t e = enc_for(vec_width, mode);
+    uint8_t out = dst;
+    if (mode == MODE_LANE0) {
+        // full-width into scratch, then merge lane 0 only
+        e = enc_for(vec_width, MODE_FULL);
+        out = SCRATCH_SSE;
+    }
+
+    x86_enc_t fma = e;
+    fma.map = MAP_0F38;
+    fma.pp = PP_66;
+    if (out == c) {
+        emit_vec(cb, &fma, negate ? 0xBC : 0xB8, out, a, b, NULL);   // vf(n)madd231ps
+    } else if (out == a || out == b) {
+        emit_vec(cb, &fma, negate ? 0xAC : 0xA8, out, out == a ? b : a, c, NULL);  // vf(n)madd213ps
+    } else {
+        emit_vec(cb, &e, 0x28, out, 0, c, NULL);                       // vmovaps out, c
+        emit_vec(cb, &fma, negate ? 0xBC : 0xB8, out, a, b, NULL);
+    }
+
+    if (out != dst) emit_blend_lane0(cb, vec_width, dst);
+}
+
+static void emit_load(pva_codebuf_t* cb, int vec_width, emit_mode_t mode,
+                      uint8_t dst, const x86_mem_t* mem) {
+    x86_enc_t e = enc_for(vec_width, mode);
+
+    if (mode == MODE_LANE0) {
+        // movss scratch, [mem] then merge lane 0
+        e.pp = PP_F3;
+        e.len = 0;
+        emit_vec(cb, &e, 0x10, SCRATCH_SSE, 0, 0, mem);
+        emit_blend_lane0(cb, vec_width, dst);
+        return;
+    }
+
+    emit_vec(cb, &e, 0x10, dst, 0, 0, mem);  // movups/vmovups (masked in the AVX-512 tail)
+}
+
+static void emit_store(pva_codebuf_t* cb, int vec_width, emit_mode_t mode,
+                       uint8_t src, const x86_mem_t* mem) {
+    x86_enc_t e = enc_for(vec_width, mode);
+
+    if (mode == MODE_LANE0) {
+        e.pp = PP_F3;
+        e.len = 0;
+    }
+    emit_vec(cb, &e, 0x11, src, 0, 0, mem);
+}
+
+// register copy; the SSE/AVX2 tail only moves lane 0 (blendps imm 1)
+static void emit_mov(pva_codebuf_t* cb, int vec_width, emit_mode_t mode, uint8_t dst, uint8_t src) {
+    if (dst == src) return;
+
+    if (mode == MODE_LANE0) {
+        x86_enc_t e = enc_for(vec_width, MODE_FULL);
+        e.map = MAP_0F3A;
+        e.pp = PP_66;
+        emit_vec(cb, &e, 0x0C, dst, dst, src, NULL);
+        pva_codebuf_emit8(cb, 0x01);
+        return;
+    }
+
+    x86_enc_t e = enc_for(vec_width, mode);
+    emit_vec(cb, &e, 0x28, dst, 0, src, NULL);  // movaps/vmovaps (merge-masked in the AVX-512 tail)
+}
+
+static void emit_setzero(pva_codebuf_t* cb, int vec_width, emit_mode_t mode, uint8_t dst) {
+    x86_enc_t e = enc_for(vec_width, mode);
+
+    if (vec_width == 64) {
+        e.pp = PP_66;
+        emit_vec(cb, &e, 0xEF, dst, dst, dst, NULL);  // vpxord
+        return;
+    }
+
+    if (mode == MODE_LANE0) {
+        emit_vec(cb, &e, 0x57, SCRATCH_SSE, SCRATCH_SSE, SCRATCH_SSE, NULL);
+        emit_blend_lane0(cb, vec_width, dst);
+        return;
+    }
+    emit_vec(cb, &e, 0x57, dst, dst, dst, NULL);  // xorps/vxorps
+}
+
+// vbroadcast: +0.0 is a zeroing idiom, anything else comes from the
+// constant pool. AVX2/AVX-512 broadcast a single float (under k1 in the
+// tail); SSE loads a 16-byte splat of it, and the lane-0 tail one float
+static void emit_const(pva_codebuf_t* cb, int vec_width, emit_mode_t mode, uint8_t dst, uint32_t bits) {
+    if (bits == 0) {
+        emit_setzero(cb, vec_width, mode, dst);
+        return;
+    }
+
+    x86_enc_t e = enc_for(vec_width, mode);
+    x86_mem_t pool = {RIP, -1, 0, 0};
+    size_t at;
+    if (mode == MODE_LANE0) {
+        at = pva_codebuf_rodata(cb, &bits, 4, 4);
+        e.pp = PP_F3;
+        e.len = 0;
+        emit_vec(cb, &e, 0x10, SCRATCH_SSE, 0, 0, &pool);   // movss scratch, [rip + c]
+    } else if (vec_width == 16) {
+        uint32_t splat[4] = {bits, bits, bits, bits};
+        at = pva_codebuf_rodata(cb, splat, sizeof(splat), 16);
+        emit_vec(cb, &e, 0x28, dst, 0, 0, &pool);           // movaps dst, [rip + c]
+    } else {
+        at = pva_codebuf_rodata(cb, &bits, 4, 4);
+        e.map = MAP_0F38;
+        e.pp = PP_66;
+        e.scalar = 1;
+        emit_vec(cb, &e, 0x18, dst, 0, 0, &pool);           // vbroadcastss dst, [rip + c]
+    }
+    pva_codebuf_reloc(cb, PVA_RELOC_X86_PC32, cb->size - 4, at, -4, 0);
+    if (mode == MODE_LANE0) emit_blend_lane0(cb, vec_width, dst);
+}
+
+// an op under a mask. AVX-512 masks natively where the destination
+// already holds what the lanes off in the mask keep, or outside the tail
+// when they are zeroed; otherwise the unmasked result goes to the scratch
+// and is selected from there with vblendmps, vblendvps or, on SSE,
+// ((r ^ keep) & mask) ^ keep
+static void emit_masked(pva_codebuf_t* cb, int vec_width, emit_mode_t mode, const pva_instr_t* instr,
+                        kmask_cache_t* km) {
+    int zero = instr->imm == PVA_MASK_ZERO;
+    int fused = instr->op == PVA_FMA_F32 || instr->op == PVA_FMS_F32;
+    uint8_t dst = instr->dst, keep = instr->src3, mask = instr->mask_reg;
+
+    if (vec_width == 64) {
+        int k = kmask_get(cb, km, mask);
+        int active = k;
+        if (mode == MODE_MASKED) {
+            x86_enc_t kand = {ENC_VEX, MAP_0F, PP_NONE, 0, 1, 0, 0, 0};
+            emit_vec(cb, &kand, 0x41, EXEC_MASK, TAIL_MASK, k, NULL);  // kandw k2, k1, k
+            active = EXEC_MASK;
+        }
+
+        x86_enc_t e = enc_for(64, MODE_FULL);
+        e.mask = active;
+        e.zeroing = zero;
+        if (zero ? mode == MODE_FULL && !fused : dst == keep) {
+            switch (instr->op) {
+                case PVA_ADD_F32: emit_vec(cb, &e, 0x58, dst, instr->src1, instr->src2, NULL); return;
+                case PVA_SUB_F32: emit_vec(cb, &e, 0x5C, dst, instr->src1, instr->src2, NULL); return;
+                case PVA_MUL_F32: emit_vec(cb, &e, 0x59, dst, instr->src1, instr->src2, NULL); return;
+                case PVA_DIV_F32: emit_vec(cb, &e, 0x5E, dst, instr->src1, instr->src2, NULL); return;
+                case PVA_MOV_F32: emit_vec(cb, &e, 0x28, dst, 0, instr->src1, NULL); return;
+                default:
+                    // vf(n)madd231ps dst{k}, src1, src2 accumulates into the addend
+                    e.map = MAP_0F38;
+                    e.pp = PP_66;
+                    emit_vec(cb, &e, instr->op == PVA_FMS_F32 ? 0xBC : 0xB8, dst, instr->src1, instr->src2, NULL);
+                    return;
+            }
+        }
+    }
+
+    int scratch = vec_width == 64 ? SCRATCH_AVX512 : SCRATCH_SSE;
+    pva_instr_t op = *instr;
+    op.dst = scratch;
+    op.mask_reg = PVA_NO_MASK;
+    if (vec_width == 16 && fused) {
+        // the product into the second scratch, the sum into the first
+        x86_enc_t e = enc_for(16, MODE_FULL);
+        emit_sse_binop(cb, 0x59, 1, -1, SCRATCH2_SSE, instr->src1, instr->src2);
+        emit_vec(cb, &e, 0x28, scratch, 0, instr->src3, NULL);
+        emit_vec(cb, &e, instr->op == PVA_FMS_F32 ? 0x5C : 0x58, scratch, 0, SCRATCH2_SSE, NULL);
+    } else if (fused) {
+        emit_fma(cb, vec_width, MODE_FULL, &op);
+    } else if (instr->op == PVA_MOV_F32) {
+        emit_mov(cb, vec_width, MODE_FULL, scratch, instr->src1);
+    } else {
+        emit_alu(cb, vec_width, MODE_FULL, &op, km);
+    }
+
+    x86_enc_t e = enc_for(vec_width, MODE_FULL);
+    int out = mode == MODE_FULL ? dst : scratch;
+    if (vec_width == 64) {
+        e.mask = kmask_get(cb, km, mask);
+        if (zero) {
+            e.zeroing = 1;
+            emit_vec(cb, &e, 0x28, out, 0, scratch, NULL);             // vmovaps out{k}{z}, r
+        } else {
+            e.map = MAP_0F38;
+            e.pp = PP_66;
+            emit_vec(cb, &e, 0x65, out, keep, scratch, NULL);          // vblendmps out{k}, keep, r
+        }
+    } else if (vec_width == 32) {
+        if (zero) {
+            emit_vec(cb, &e, 0x54, out, scratch, mask, NULL);          // vandps out, r, mask
+        } else {
+            e.map = MAP_0F3A;
+            e.pp = PP_66;
+            emit_vec(cb, &e, 0x4A, out, keep, scratch, NULL);          // vblendvps out, keep, r, mask
+            pva_codebuf_emit8(cb, (uint8_t)(mask << 4));
+        }
+    } else {
+        out = scratch;
+        if (!zero) emit_vec(cb, &e, 0x57, scratch, 0, keep, NULL);     // xorps
+        emit_vec(cb, &e, 0x54, scratch, 0, mask, NULL);                // andps
+        if (!zero) emit_vec(cb, &e, 0x57, scratch, 0, keep, NULL);
+    }
+
+    if (out == dst) return;
+    if (mode == MODE_LANE0) {
+        emit_blend_lane0(cb, vec_width, dst);
+    } else {
+        emit_mov(cb, vec_width, mode, dst, (uint8_t)out);               // merge-masked by k1 in the tail
+    }
+}
+
+// vstore under a mask: vmovups{k} on AVX-512 and vmaskmovps on AVX2. SSE
+// and the lane-at-a-time tail read what is there and write it back with
+// the masked-on lanes replaced
+static void emit_masked_store(pva_codebuf_t* cb, int vec_width, emit_mode_t mode, const pva_instr_t* instr,
+                              const x86_mem_t* mem, kmask_cache_t* km) {
+    uint8_t src = instr->dst, mask = instr->mask_reg;
+
+    if (vec_width == 64) {
+        x86_enc_t e = enc_for(64, MODE_FULL);
+        e.mask = kmask_get(cb, km, mask);
+        if (mode == MODE_MASKED) {
+            x86_enc_t kand = {ENC_VEX, MAP_0F, PP_NONE, 0, 1, 0, 0, 0};
+            emit_vec(cb, &kand, 0x41, EXEC_MASK, TAIL_MASK, e.mask, NULL);
+            e.mask = EXEC_MASK;
+        }
+        emit_vec(cb, &e, 0x11, src, 0, 0, mem);
+        return;
+    }
+
+    x86_enc_t e = enc_for(vec_width, MODE_FULL);
+    if (vec_width == 32 && mode == MODE_FULL) {
+        e.map = MAP_0F38;
+        e.pp = PP_66;
+        emit_vec(cb, &e, 0x2E, src, mask, 0, mem);    // vmaskmovps [mem], mask, src
+        return;
+    }
+
+    x86_enc_t move = e;
+    if (mode == MODE_LANE0) {
+        move.pp = PP_F3;    // movss
+        move.len = 0;
+    }
+    emit_vec(cb, &move, 0x10, SCRATCH_SSE, 0, 0, mem);
+    if (vec_width == 32) {
+        e.len = 0;
+        e.map = MAP_0F3A;
+        e.pp = PP_66;
+        emit_vec(cb, &e, 0x4A, SCRATCH_SSE, SCRATCH_SSE, src, NULL);   // vblendvps
+        pva_codebuf_emit8(cb, (uint8_t)(mask << 4));
+    } else {
+        emit_vec(cb, &e, 0x28, SCRATCH2_SSE, 0, src, NULL);             // movaps
+        emit_vec(cb, &e, 0x57, SCRATCH2_SSE, 0, SCRATCH_SSE, NULL);     // xorps
+        emit_vec(cb, &e, 0x54, SCRATCH2_SSE, 0, mask, NULL);            // andps
+        emit_vec(cb, &e, 0x57, SCRATCH_SSE, 0, SCRATCH2_SSE, NULL);
+    }
+    emit_vec(cb, &move, 0x11, SCRATCH_SSE, 0, 0, mem);
 }
 
-void pva_emit_x86(pva_module_t* mod, uint8_t* buffer) {
-    if (!mod || !buffer) return;
+// vredsum/vredmax/vredmin, always on a whole vector since reductions stay
+// out of loops: halves folded onto each other, 128-bit blocks with
+// vperm2f128 or vshuff32x4 and then lanes with vpermilps (pshufd on SSE),
+// so every lane ends up with the result. the ordered sum goes lane by lane
+// instead, through the red zone below rsp (kernels are leaf functions)
+static void emit_reduce(pva_codebuf_t* cb, int vec_width, const pva_instr_t* instr) {
+    uint8_t dst = instr->dst, src = instr->src1;
+    uint8_t op = instr->op == PVA_REDMAX_F32 ? 0x5F : instr->op == PVA_REDMIN_F32 ? 0x5D : 0x58;
+
+    int scratch = vec_width == 64 ? SCRATCH_AVX512 : SCRATCH_SSE;
+    x86_enc_t e = enc_for(vec_width, MODE_FULL);
+    x86_enc_t shuf = e;
+    shuf.pp = PP_66;
+    shuf.map = MAP_0F3A;
+
+    if (instr->op != PVA_REDSUM_ORD_F32) {
+        if (vec_width == 16) {
+            shuf.map = MAP_0F;
+            emit_vec(cb, &shuf, 0x70, scratch, 0, src, NULL);         // pshufd s, src, 0xb1
+            pva_codebuf_emit8(cb, 0xB1);
+            emit_vec(cb, &e, op, scratch, 0, src, NULL);
+            emit_vec(cb, &shuf, 0x70, dst, 0, scratch, NULL);         // pshufd dst, s, 0x4e
+            pva_codebuf_emit8(cb, 0x4E);
+            emit_vec(cb, &e, op, dst, 0, scratch, NULL);
+            return;
+        }
+
+        // vperm2f128 s, src, src, 1 or vshuff32x4 s, src, src, 0x4e
+        emit_vec(cb, &shuf, vec_width == 64 ? 0x23 : 0x06, scratch, src, src, NULL);
+        pva_codebuf_emit8(cb, vec_width == 64 ? 0x4E : 0x01);
+        emit_vec(cb, &e, op, scratch, scratch, src, NULL);
+        if (vec_width == 64) {
+            emit_vec(cb, &shuf, 0x23, dst, scratch, scratch, NULL);   // vshuff32x4 dst, s, s, 0xb1
+            pva_codebuf_emit8(cb, 0xB1);
+            emit_vec(cb, &e, op, scratch, scratch, dst, NULL);
+        }
+        emit_vec(cb, &shuf, 0x04, dst, 0, scratch, NULL);             // vpermilps dst, s, 0x4e
+        pva_codebuf_emit8(cb, 0x4E);
+        emit_vec(cb, &e, op, scratch, scratch, dst, NULL);
+        emit_vec(cb, &shuf, 0x04, dst, 0, scratch, NULL);             // vpermilps dst, s, 0xb1
+        pva_codebuf_emit8(cb, 0xB1);
+        emit_vec(cb, &e, op, dst, dst, scratch, NULL);
+        return;
+    }
+
+    x86_mem_t red = {RSP, -1, -vec_width, 0};
+    emit_vec(cb, &e, 0x11, src, 0, 0, &red);                              // movups [rsp - width], v
+    x86_enc_t ss = e;
+    ss.pp = PP_F3;
+    ss.len = 0;
+    ss.scalar = 1;
+    emit_vec(cb, &ss, 0x10, scratch, 0, 0, &red);                         // movss s, [rsp - width]
+    for (int lane = 1; lane < vec_width / 4; lane++) {
+        red.disp += 4;
+        emit_vec(cb, &ss, op, scratch, scratch, 0, &red);
+    }
 
-    uint8_t* ptr = buffer;
-    memset(buffer, 0x90, 8192); // fill with NOPs
+    if (vec_width == 16) {
+        e.pp = PP_66;
+        emit_vec(cb, &e, 0x70, dst, 0, scratch, NULL);                    // pshufd dst, s, 0
+        pva_codebuf_emit8(cb, 0);
+        return;
+    }
+    e.pp = PP_66;
+    e.map = MAP_0F38;
+    emit_vec(cb, &e, 0x18, dst, 0, scratch, NULL);                        // vbroadcastss dst, s
+}
 
-    printf("[codegen] generating x86 code for %zu instructions\n", mod->size);
-    printf("[codegen] target vector width: %d bytes\n", mod->vec_width_bytes);
+// k2 = the lanes an AVX-512 gather or scatter may touch: all of them, or
+// k1's in the tail. the instruction clears it as it goes
+static void emit_exec_mask(pva_codebuf_t* cb, emit_mode_t mode) {
+    x86_enc_t k = {ENC_VEX, MAP_0F, PP_NONE, 0, 0, 0, 0, 0};
+    if (mode == MODE_MASKED) {
+        emit_vec(cb, &k, 0x90, EXEC_MASK, 0, TAIL_MASK, NULL);            // kmovw k2, k1
+    } else {
+        k.len = 1;
+        emit_vec(cb, &k, 0x46, EXEC_MASK, EXEC_MASK, EXEC_MASK, NULL);    // kxnorw k2, k2, k2
+    }
+}
+
+// vgatherdps dst, [base + index + disp] over every lane of an AVX2 or
+// AVX-512 vector; index must not be dst
+static void emit_gather(pva_codebuf_t* cb, int vec_width, emit_mode_t mode, uint8_t dst,
+                        const x86_mem_t* mem) {
+    x86_enc_t e = enc_for(vec_width, MODE_FULL);
+    e.map = MAP_0F38;
+    e.pp = PP_66;
+    if (vec_width == 64) {
+        emit_exec_mask(cb, mode);
+        e.mask = EXEC_MASK;
+        e.scalar = 1;
+        emit_vec(cb, &e, 0x92, dst, mem->index & 16, 0, mem);   // vgatherdps dst{k2}, [mem]
+        return;
+    }
+    x86_enc_t ones = e;
+    ones.map = MAP_0F;
+    emit_vec(cb, &ones, 0x76, GATHER_MASK_AVX2, GATHER_MASK_AVX2, GATHER_MASK_AVX2, NULL);  // vpcmpeqd
+    emit_vec(cb, &e, 0x92, dst, GATHER_MASK_AVX2, 0, mem);      // vgatherdps dst, [mem], ymm14
+}
+
+// vgather/vscatter. AVX2 and AVX-512 gather natively and AVX-512 scatters
+// natively; otherwise it goes a lane at a time, the element's index in
+// r11: taken from lane 0 in the lane-0 tail, and from a copy of the
+// index vector in the red zone (next to one of the values, for a scatter)
+// elsewhere. lanes are stored in order, so the last of several to the
+// same element wins as with vscatterdps
+static void emit_indexed(pva_codebuf_t* cb, int vec_width, emit_mode_t mode, const pva_instr_t* instr) {
+    int gather = instr->op == PVA_GATHER_F32;
+    uint8_t val = instr->dst, idx = instr->src2;
+    int base = buffer_regs[instr->src1];
+    int shift = instr->imm == 4 ? 2 : 0;
+
+    if (mode != MODE_LANE0 && (vec_width == 64 || (vec_width == 32 && gather))) {
+        if (gather && val == idx) {
+            uint8_t scratch = vec_width == 64 ? SCRATCH_AVX512 : SCRATCH_SSE;
+            emit_mov(cb, vec_width, MODE_FULL, scratch, idx);
+            idx = scratch;
+        }
+        x86_mem_t mem = {base, idx, 0, shift};
+        if (gather) {
+            emit_gather(cb, vec_width, mode, val, &mem);
+            return;
+        }
+        emit_exec_mask(cb, mode);
+        x86_enc_t e = enc_for(64, MODE_FULL);
+        e.map = MAP_0F38;
+        e.pp = PP_66;
+        e.mask = EXEC_MASK;
+        e.scalar = 1;
+        emit_vec(cb, &e, 0xA2, val, idx & 16, 0, &mem);          // vscatterdps [mem]{k2}, val
+        return;
+    }
+
+    x86_mem_t elem = {base, REG_TMP, 0, shift};
+    if (mode == MODE_LANE0) {
+        x86_enc_t e = enc_for(vec_width, MODE_FULL);
+        e.pp = PP_66;
+        e.len = 0;
+        emit_vec(cb, &e, 0x7E, idx, 0, REG_TMP, NULL);            // movd r11d, idx
+        if (gather) {
+            emit_load(cb, vec_width, MODE_LANE0, val, &elem);
+        } else {
+            emit_store(cb, vec_width, MODE_LANE0, val, &elem);
+        }
+        return;
+    }
+
+    x86_enc_t e = enc_for(vec_width, MODE_FULL);
+    x86_enc_t ss = e;
+    ss.pp = PP_F3;
+    ss.len = 0;
+    x86_enc_t insert = e;
+    insert.map = MAP_0F3A;
+    insert.pp = PP_66;
+    x86_mem_t indices = {RSP, -1, -vec_width, 0};
+    x86_mem_t values = {RSP, -1, -2 * vec_width, 0};
+    emit_vec(cb, &e, 0x11, idx, 0, 0, &indices);                  // movups [rsp - width], idx
+    if (!gather) emit_vec(cb, &e, 0x11, val, 0, 0, &values);
+    for (int lane = 0; lane < vec_width / 4; lane++) {
+        emit_gpr_load32(cb, REG_TMP, &indices);                   // mov r11d, [rsp - width + 4 * lane]
+        if (gather) {
+            emit_vec(cb, &insert, 0x21, val, val, 0, &elem);      // insertps val, [elem], lane << 4
+            pva_codebuf_emit8(cb, (uint8_t)(lane << 4));
+        } else {
+            emit_vec(cb, &ss, 0x10, SCRATCH_SSE, 0, 0, &values);  // movss s, [rsp - 2 * width + 4 * lane]
+            emit_vec(cb, &ss, 0x11, SCRATCH_SSE, 0, 0, &elem);
+        }
+        indices.disp += 4;
+        values.disp += 4;
+    }
+}
 
-    emit_prologue(&ptr);
+// vload.strided: r11 = buffer + j * stride, j being the element rax
+// stands for (0 outside the loop), so lane i is at [r11 + disp + i *
+// stride]. AVX2 and AVX-512 gather with the lane offsets as the index, a
+// vector from the constant pool; SSE inserts one lane at a time and the
+// lane-0 tail loads one float
+static void emit_strided(pva_codebuf_t* cb, int vec_width, emit_mode_t mode, const pva_instr_t* instr,
+                         int in_loop) {
+    int32_t stride = (int32_t)instr->src2;
+    int lanes = vec_width / 4;
+    int base = buffer_regs[instr->src1];
 
-    for (size_t i = 0; i < mod->size; i++) {
+    if (in_loop) {
+        emit_gpr_imul(cb, REG_TMP, REG_INDEX, stride / 4);       // imul r11, rax, stride / 4
+        emit_gpr_rr(cb, 0x01, base, REG_TMP);                    // add r11, base
+    } else {
+        emit_gpr_rr(cb, 0x89, base, REG_TMP);                    // mov r11, base
+    }
+    x86_mem_t mem = {REG_TMP, -1, (int32_t)instr->imm + (int32_t)instr->vec_offset * lanes * stride, 0};
+
+    if (mode == MODE_LANE0) {
+        emit_load(cb, vec_width, MODE_LANE0, instr->dst, &mem);
+        return;
+    }
+    if (vec_width == 16) {
+        x86_enc_t insert = enc_for(16, MODE_FULL);
+        insert.map = MAP_0F3A;
+        insert.pp = PP_66;
+        for (int lane = 0; lane < lanes; lane++) {
+            emit_vec(cb, &insert, 0x21, instr->dst, 0, 0, &mem);  // insertps dst, [mem], lane << 4
+            pva_codebuf_emit8(cb, (uint8_t)(lane << 4));
+            mem.disp += stride;
+        }
+        return;
+    }
+
+    int32_t offsets[16];
+    for (int lane = 0; lane < lanes; lane++) offsets[lane] = lane * stride;
+    size_t at = pva_codebuf_rodata(cb, offsets, (size_t)vec_width, (size_t)vec_width);
+    uint8_t scratch = vec_width == 64 ? SCRATCH_AVX512 : SCRATCH_SSE;
+    x86_enc_t e = enc_for(vec_width, MODE_FULL);
+    x86_mem_t pool = {RIP, -1, 0, 0};
+    emit_vec(cb, &e, 0x10, scratch, 0, 0, &pool);                // vmovups s, [rip + offsets]
+    pva_codebuf_reloc(cb, PVA_RELOC_X86_PC32, cb->size - 4, at, -4, 0);
+    mem.index = scratch;
+    emit_gather(cb, vec_width, mode, instr->dst, &mem);
+}
+
+static void emit_range(pva_codebuf_t* cb, pva_module_t* mod, size_t from, size_t to,
+                       emit_mode_t mode, int in_loop) {
+    kmask_cache_t km;
+    memset(&km, 0xff, sizeof(km.reg));
+    km.next = 0;
+
+    for (size_t i = from; i < to; i++) {
         pva_instr_t* instr = &mod->code[i];
 
+        int def = pva_instr_def(instr);
+        if (def >= 0) kmask_forget(&km, (uint32_t)def);
+        if (instr->mask_reg != PVA_NO_MASK && instr->op != PVA_STORE_F32) {
+            emit_masked(cb, mod->vec_width_bytes, mode, instr, &km);
+            continue;
+        }
+
         switch (instr->op) {
             case PVA_ADD_F32:
-                if (mod->vec_width_bytes == 64) { // AVX512
-                    emit_avx512_instr(&ptr, 0x58, instr->dst, instr->src1, instr->src2, FULL_MASK);
-                } else if (mod->vec_width_bytes == 32) { // AVX2/AVX
-                    emit_avx2_instr(&ptr, 0x58, instr->dst, instr->src1, instr->src2);
-                } else { // SSE
-                    emit_sse_addps(&ptr);
-                }
+            case PVA_SUB_F32:
+            case PVA_MUL_F32:
+            case PVA_DIV_F32:
+            case PVA_CMP_LT_F32:
+            case PVA_CMP_EQ_F32:
+            case PVA_AND_MASK:
+            case PVA_OR_MASK:
+                emit_alu(cb, mod->vec_width_bytes, mode, instr, &km);
                 break;
 
-            case PVA_SUB_F32:
-                if (mod->vec_width_bytes == 64) {
-                    emit_avx512_instr(&ptr, 0x5C, instr->dst, instr->src1, instr->src2, FULL_MASK);
-                } else if (mod->vec_width_bytes == 32) {
-                    emit_avx2_instr(&ptr, 0x5C, instr->dst, instr->src1, instr->src2);
-                } else {
-                    emit_sse_subps(&ptr);
-                }
+            case PVA_FMA_F32:
+            case PVA_FMS_F32:
+                emit_fma(cb, mod->vec_width_bytes, mode, instr);
                 break;
 
-            case PVA_MUL_F32:
-                if (mod->vec_width_bytes == 64) {
-                    emit_avx512_instr(&ptr, 0x59, instr->dst, instr->src1, instr->src2, FULL_MASK);
-                } else if (mod->vec_width_bytes == 32) {
-                    emit_avx2_instr(&ptr, 0x59, instr->dst, instr->src1, instr->src2);
+            case PVA_LOAD_F32:
+            case PVA_STORE_F32: {
+                // [buffer + index + offset]
+                x86_mem_t mem = {buffer_regs[instr->src1], in_loop ? REG_INDEX : -1,
+                                 (int32_t)(instr->imm + instr->vec_offset * mod->vec_width_bytes), 0};
+                if (instr->op == PVA_LOAD_F32) {
+                    emit_load(cb, mod->vec_width_bytes, mode, instr->dst, &mem);
+                } else if (instr->mask_reg != PVA_NO_MASK) {
+                    emit_masked_store(cb, mod->vec_width_bytes, mode, instr, &mem, &km);
                 } else {
-                    emit_sse_mulps(&ptr);
+                    emit_store(cb, mod->vec_width_bytes, mode, instr->dst, &mem);
                 }
                 break;
+            }
 
-            case PVA_DIV_F32:
-                if (mod->vec_width_bytes == 64) {
-                    emit_avx512_instr(&ptr, 0x5E, instr->dst, instr->src1, instr->src2, FULL_MASK);
-                } else if (mod->vec_width_bytes == 32) {
-                    emit_avx2_instr(&ptr, 0x5E, instr->dst, instr->src1, instr->src2);
-                } else {
-                    // SSE divps - you can implement similarly
-                }
+            case PVA_GATHER_F32:
+            case PVA_SCATTER_F32:
+                emit_indexed(cb, mod->vec_width_bytes, mode, instr);
                 break;
 
-            case PVA_LOAD_F32:
-                if (mod->vec_width_bytes == 64) {
-                    emit_avx512_load(&ptr, instr->dst, instr->src1, FULL_MASK);
-                } else if (mod->vec_width_bytes == 32 || mod->vec_width_bytes == 16) {
-                    // simplified: Use movaps xmm registers with fixed offsets.
-                    // extend to dynamic addressing lats
-                    // ex: opcode movaps xmm0, [rsi]
-                    uint8_t opcode[] = {0x0F, 0x28, 0x06}; // SSE movaps xmm0, [rsi]
-                    write_bytes(&ptr, opcode, 3);
-                }
+            case PVA_LOAD_STRIDED_F32:
+                emit_strided(cb, mod->vec_width_bytes, mode, instr, in_loop);
                 break;
 
-            case PVA_STORE_F32:
-                if (mod->vec_width_bytes == 64) {
-                    emit_avx512_store(&ptr, instr->src1, instr->dst, FULL_MASK);
-                } else if (mod->vec_width_bytes == 32 || mod->vec_width_bytes == 16) {
-                    // simplified
-                    uint8_t opcode[] = {0x0F, 0x29, 0x06}; // SSE movaps [rsi], xmm0
-                    write_bytes(&ptr, opcode, 3);
-                }
+            case PVA_REDSUM_F32:
+            case PVA_REDSUM_ORD_F32:
+            case PVA_REDMAX_F32:
+            case PVA_REDMIN_F32:
+                emit_reduce(cb, mod->vec_width_bytes, instr);
                 break;
 
             case PVA_SETZERO:
-                if (mod->vec_width_bytes == 64) {
-                    uint8_t setzero[] = {0x62, 0xf2, 0x7d, 0x48, 0x57, 0xc0}; // vxorps zmm0,zmm0,zmm0
-                    write_bytes(&ptr, setzero, 6);
-                } else if (mod->vec_width_bytes == 32) {
-                    uint8_t setzero[] = {0xc5, 0xf4, 0x57, 0xc0}; // vxorps ymm0,ymm0,ymm0
-                    write_bytes(&ptr, setzero, 4);
+                emit_setzero(cb, mod->vec_width_bytes, mode, instr->dst);
+                break;
+
+            case PVA_CONST_F32:
+                emit_const(cb, mod->vec_width_bytes, mode, instr->dst, instr->imm);
+                break;
+
+            case PVA_MOV_F32:
+                emit_mov(cb, mod->vec_width_bytes, mode, instr->dst, instr->src1);
+                break;
+
+            case PVA_SPILL:
+            case PVA_RELOAD: {
+                // always the whole register, also inside the tail
+                x86_mem_t slot = {RBP, -1, -(int32_t)((instr->imm + 1) * mod->vec_width_bytes), 0};
+                if (instr->op == PVA_SPILL) {
+                    emit_store(cb, mod->vec_width_bytes, MODE_FULL, instr->src1, &slot);
                 } else {
-                    emit_sse_setzero(&ptr);
+                    emit_load(cb, mod->vec_width_bytes, MODE_FULL, instr->dst, &slot);
                 }
                 break;
+            }
 
             default:
-                // ignore unsupported instructions for now
                 break;
         }
     }
+}
+
+// loop over n elements: whole vectors first, then the remainder either under
+// an opmask (AVX-512) or one element at a time in lane 0 (SSE/AVX2). an
+// unrolled body runs whole while `factor` vectors are left, then its first
+// copy takes over
+static void emit_loop(pva_codebuf_t* cb, pva_module_t* mod, size_t body, size_t body_end) {
+    int lanes = mod->vec_width_bytes / 4;
+
+    // xor eax, eax
+    uint8_t clear_index[] = {0x31, 0xC0};
+    write_bytes(cb, clear_index, sizeof(clear_index));
+
+    size_t split = body_end;
+    int factor = 1;
+    for (size_t i = body; i < body_end; i++) {
+        if (mod->code[i].op == PVA_LOOP_SPLIT) {
+            split = i;
+            factor = (int)mod->code[i].imm;
+        }
+    }
+
+    if (factor > 1) {
+        emit_gpr_imm(cb, 7, REG_COUNT, factor * lanes);     // cmp rdi, factor * lanes
+        size_t to_rest = emit_jcc(cb, 0x82);                // jb rest
+
+        size_t unrolled_top = cb->size;
+        emit_range(cb, mod, body, body_end, MODE_FULL, 1);
+        emit_gpr_imm(cb, 0, REG_INDEX, factor * mod->vec_width_bytes);
+        emit_gpr_imm(cb, 5, REG_COUNT, factor * lanes);
+        emit_gpr_imm(cb, 7, REG_COUNT, factor * lanes);
+        patch_rel32(cb, emit_jcc(cb, 0x83), unrolled_top);  // jae unrolled_top
+
+        patch_rel32(cb, to_rest, cb->size);
+        body_end = split;
+    }
+
+    emit_gpr_imm(cb, 7, REG_COUNT, lanes);          // cmp rdi, lanes
+    size_t to_tail = emit_jcc(cb, 0x82);            // jb tail
+
+    size_t top = cb->size;
+    emit_range(cb, mod, body, body_end, MODE_FULL, 1);
+    emit_gpr_imm(cb, 0, REG_INDEX, mod->vec_width_bytes);  // add rax, width
+    emit_gpr_imm(cb, 5, REG_COUNT, lanes);                 // sub rdi, lanes
+    emit_gpr_imm(cb, 7, REG_COUNT, lanes);                 // cmp rdi, lanes
+    patch_rel32(cb, emit_jcc(cb, 0x83), top);              // jae top
+
+    patch_rel32(cb, to_tail, cb->size);
+    emit_gpr_rr(cb, 0x85, REG_COUNT, REG_COUNT);    // test rdi, rdi
+    size_t to_done = emit_jcc(cb, 0x84);            // jz done
+
+    if (mod->vec_width_bytes == 64) {
+        // k1 = (1 << rdi) - 1
+        uint8_t all_ones[] = {0x41, 0xBB, 0xFF, 0xFF, 0xFF, 0xFF};  // mov r11d, -1
+        write_bytes(cb, all_ones, sizeof(all_ones));
+
+        x86_enc_t bzhi = {ENC_VEX, MAP_0F38, PP_NONE, 0, 0, 0, 0, 0};
+        emit_vec(cb, &bzhi, 0xF5, REG_TMP, REG_COUNT, REG_TMP, NULL);  // bzhi r11d, r11d, edi
+
+        x86_enc_t kmov = {ENC_VEX, MAP_0F, PP_NONE, 0, 0, 0, 0, 0};
+        emit_vec(cb, &kmov, 0x92, TAIL_MASK, 0, REG_TMP, NULL);        // kmovw k1, r11d
+
+        emit_range(cb, mod, body, body_end, MODE_MASKED, 1);
+    } else {
+        size_t tail_top = cb->size;
+        emit_range(cb, mod, body, body_end, MODE_LANE0, 1);
+        emit_gpr_imm(cb, 0, REG_INDEX, 4);          // add rax, 4
+        uint8_t dec_count[] = {0x48, 0xFF, 0xCF};   // dec rdi
+        write_bytes(cb, dec_count, sizeof(dec_count));
+        patch_rel32(cb, emit_jcc(cb, 0x85), tail_top);  // jnz tail_top
+    }
+
+    patch_rel32(cb, to_done, cb->size);
+}
+
+int pva_emit_x86(pva_module_t* mod, pva_codebuf_t* cb) {
+    if (!mod || !cb) return -1;
+
+    size_t start = cb->size;
+
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[codegen] generating x86 code for %zu instructions", mod->size);
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[codegen] target vector width: %d bytes", mod->vec_width_bytes);
+
+    long loop_begin, loop_end;
+    if (pva_find_loop(mod, &loop_begin, &loop_end) != 0) return -1;
+
+    emit_prologue(cb, mod);
+
+    if (loop_begin < 0) {
+        emit_range(cb, mod, 0, mod->size, MODE_FULL, 0);
+    } else {
+        emit_range(cb, mod, 0, (size_t)loop_begin, MODE_FULL, 0);
+        emit_loop(cb, mod, (size_t)loop_begin + 1, (size_t)loop_end);
+        emit_range(cb, mod, (size_t)loop_end + 1, mod->size, MODE_FULL, 0);
+    }
+
+    emit_epilogue(cb, mod);
+
+    if (cb->failed) return -1;
+
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[codegen] generated %zu bytes of code", cb->size - start);
+    return 0;
+}
+
+
+// resolver for fat output: cpuid/xgetbv, then lea rax of the best variant.
+// the AVX-512 tail mask comes from bzhi, so that tier also needs BMI2; the
+// SSE tier blends and inserts with SSE4.1, and without it rax is 0.
+// fixups[] receive the rel32 fields of the AVX-512, AVX2 and SSE leas
+static void emit_resolver(pva_codebuf_t* cb, size_t fixups[3]) {
+    uint8_t max_leaf[] = {
+        0x53,                                   // push rbx
+        0x31, 0xc0,                             // xor eax, eax
+        0x0f, 0xa2,                             // cpuid
+        0x83, 0xf8, 0x07,                       // cmp eax, 7
+    };
+    write_bytes(cb, max_leaf, sizeof(max_leaf));
+    size_t to_sse_leaf = emit_jcc(cb, 0x82);    // jb sse
+
+    uint8_t features[] = {
+        0xb8, 0x07, 0x00, 0x00, 0x00,           // mov eax, 7
+        0x31, 0xc9,                             // xor ecx, ecx
+        0x0f, 0xa2,                             // cpuid
+        0x41, 0x89, 0xd8,                       // mov r8d, ebx
+        0xb8, 0x01, 0x00, 0x00, 0x00,           // mov eax, 1
+        0x0f, 0xa2,                             // cpuid
+        0x81, 0xe1, 0x00, 0x10, 0x00, 0x18,     // and ecx, OSXSAVE | AVX | FMA
+        0x81, 0xf9, 0x00, 0x10, 0x00, 0x18,     // cmp ecx, OSXSAVE | AVX | FMA
+    };
+    write_bytes(cb, features, sizeof(features));
+    size_t to_sse_os = emit_jcc(cb, 0x85);      // jne sse
+
+    uint8_t avx512_state[] = {
+        0x31, 0xc9,                             // xor ecx, ecx
+        0x0f, 0x01, 0xd0,                       // xgetbv
+        0x89, 0xc1,                             // mov ecx, eax
+        0x81, 0xe1, 0xe6, 0x00, 0x00, 0x00,     // and ecx, 0xe6 (XMM, YMM, opmask, ZMM)
+        0x81, 0xf9, 0xe6, 0x00, 0x00, 0x00,     // cmp ecx, 0xe6
+    };
+    write_bytes(cb, avx512_state, sizeof(avx512_state));
+    size_t to_avx2_state = emit_jcc(cb, 0x85);  // jne avx2
+
+    uint8_t avx512f[] = {
+        0x44, 0x89, 0xc1,                       // mov ecx, r8d
+        0x81, 0xe1, 0x00, 0x01, 0x01, 0x00,     // and ecx, AVX512F | BMI2
+        0x81, 0xf9, 0x00, 0x01, 0x01, 0x00,     // cmp ecx, AVX512F | BMI2
+    };
+    write_bytes(cb, avx512f, sizeof(avx512f));
+    size_t to_avx2_cpu = emit_jcc(cb, 0x85);    // jne avx2
+
+    uint8_t lea[] = {0x48, 0x8d, 0x05};         // lea rax, [rip + rel32]
+    write_bytes(cb, lea, sizeof(lea));
+    fixups[0] = cb->size;
+    pva_codebuf_emit32(cb, 0);
+    pva_codebuf_emit8(cb, 0xe9);                // jmp done
+    size_t to_done_avx512 = cb->size;
+    pva_codebuf_emit32(cb, 0);
+
+    patch_rel32(cb, to_avx2_state, cb->size);
+    patch_rel32(cb, to_avx2_cpu, cb->size);
+    uint8_t avx2_state[] = {
+        0x83, 0xe0, 0x06,                       // and eax, 6 (XMM, YMM)
+        0x83, 0xf8, 0x06,                       // cmp eax, 6
+    };
+    write_bytes(cb, avx2_state, sizeof(avx2_state));
+    size_t to_sse_state = emit_jcc(cb, 0x85);   // jne sse
+    uint8_t avx2[] = {0x41, 0xf7, 0xc0, 0x20, 0x00, 0x00, 0x00};     // test r8d, AVX2
+    write_bytes(cb, avx2, sizeof(avx2));
+    size_t to_sse_cpu = emit_jcc(cb, 0x84);     // jz sse
+
+    write_bytes(cb, lea, sizeof(lea));
+    fixups[1] = cb->size;
+    pva_codebuf_emit32(cb, 0);
+    pva_codebuf_emit8(cb, 0xe9);                // jmp done
+    size_t to_done_avx2 = cb->size;
+    pva_codebuf_emit32(cb, 0);
+
+    patch_rel32(cb, to_sse_leaf, cb->size);
+    patch_rel32(cb, to_sse_os, cb->size);
+    patch_rel32(cb, to_sse_state, cb->size);
+    patch_rel32(cb, to_sse_cpu, cb->size);
+    uint8_t sse41[] = {
+        0xb8, 0x01, 0x00, 0x00, 0x00,           // mov eax, 1
+        0x0f, 0xa2,                             // cpuid
+        0xf7, 0xc1, 0x00, 0x00, 0x08, 0x00,     // test ecx, SSE4.1
+    };
+    write_bytes(cb, sse41, sizeof(sse41));
+    size_t to_none = emit_jcc(cb, 0x84);        // jz none
+    write_bytes(cb, lea, sizeof(lea));
+    fixups[2] = cb->size;
+    pva_codebuf_emit32(cb, 0);
+    pva_codebuf_emit8(cb, 0xe9);                // jmp done
+    size_t to_done_sse = cb->size;
+    pva_codebuf_emit32(cb, 0);
+
+    patch_rel32(cb, to_none, cb->size);
+    uint8_t none[] = {0x31, 0xc0};              // xor eax, eax
+    write_bytes(cb, none, sizeof(none));
+
+    patch_rel32(cb, to_done_avx512, cb->size);
+    patch_rel32(cb, to_done_avx2, cb->size);
+    patch_rel32(cb, to_done_sse, cb->size);
+    uint8_t done[] = {
+        0x5b,                                   // pop rbx
+        0xc3                                    // ret
+    };
+    write_bytes(cb, done, sizeof(done));
+}
+
+int pva_emit_x86_fat(pva_module_t* mod, pva_codebuf_t* cb, size_t offsets[3]) {
+    if (!mod || !cb) return -1;
+    if (mod->fp_contract) {
+        pva_log(mod, PVA_DIAG_WARNING, 0, "[codegen] warning: fat kernel optimized with fp_contract on; "
+                "its sse variant rounds contracted ops differently");
+    }
+
+    static const pva_arch_t tiers[3] = {PVA_ARCH_X86_AVX512, PVA_ARCH_X86_AVX2, PVA_ARCH_X86_SSE};
+    static const int widths[3] = {64, 32, 16};
+
+    size_t start = cb->size;
+    size_t fixups[3];
+    emit_resolver(cb, fixups);
+
+    for (int t = 0; t < 3; t++) {
+        // variants start on a cache line, padded with int3
+        while ((cb->size - start) & 63) pva_codebuf_emit8(cb, 0xcc);
+
+        pva_module_t variant = *mod;
+        variant.arch = tiers[t];
+        variant.vec_width_bytes = widths[t];
+
+        size_t at = cb->size;
+        if (pva_emit(&variant, cb) != 0) return -1;
+        patch_rel32(cb, fixups[t], at);
+        if (offsets) offsets[t] = at - start;
+    }
 
-    emit_epilogue(&ptr);
+    if (cb->failed) return -1;
 
-    printf("[codegen] generated %ld bytes of code\n", ptr - buffer);
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[codegen] fat kernel: %zu bytes (resolver, avx512, avx2, sse)",
+            cb->size - start);
+    return 0;
 }
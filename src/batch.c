@@ -0,0 +1,309 @@
+#include "pva.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glob.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// --batch: every input compiled for every target, one job per pair, on a
+// fixed pool of threads. a job owns its module from parse to output, so
+// jobs share nothing but the queue index; what they report is collected
+// per job and printed in job order once all are done
+
+typedef struct {
+    const char* input;
+    pva_arch_t arch;
+    int vec_width_bytes;
+    char* output;
+    int failed;
+    size_t instrs;
+    size_t code_size;
+    double ms;
+    char* log;          // the job's warnings and errors, one per line
+    size_t log_size, log_capacity;
+} batch_job_t;
+
+typedef struct {
+    const pva_batch_t* batch;
+    batch_job_t* jobs;
+    size_t num_jobs;
+    size_t next;        // the first job no thread has taken yet
+} batch_pool_t;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void job_report(const pva_diag_t* diag, void* user) {
+    batch_job_t* job = user;
+    size_t len = strlen(diag->message);
+    if (job->log_size + len + 2 > job->log_capacity) {
+        size_t capacity = job->log_capacity ? job->log_capacity * 2 : 256;
+        while (capacity < job->log_size + len + 2) capacity *= 2;
+        char* grown = realloc(job->log, capacity);
+        if (!grown) return;
+        job->log = grown;
+        job->log_capacity = capacity;
+    }
+    memcpy(job->log + job->log_size, diag->message, len);
+    job->log_size += len;
+    job->log[job->log_size++] = '\n';
+    job->log[job->log_size] = 0;
+}
+
+static int write_code(const char* path, const pva_module_t* mod, pva_codebuf_t* cb) {
+    if (pva_codebuf_link(cb) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "err: failed to resolve constant pool references");
+        return -1;
+    }
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "err: failed to open output file: %s", strerror(errno));
+        return -1;
+    }
+    size_t written = fwrite(cb->data, 1, cb->size, fp);
+    if (fclose(fp) != 0 || written != cb->size) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "err: failed to write '%s'", path);
+        return -1;
+    }
+    return 0;
+}
+
+// the command line's pipeline for one input and target, output included
+static int run_job(const pva_batch_t* batch, batch_job_t* job) {
+    pva_diag_sink_t diag = {job_report, job, PVA_DIAG_WARNING};
+    pva_module_t* mod = pva_parse_file_diag(job->input, 1, &diag);
+    if (!mod) return -1;
+    mod->arch = job->arch;
+    mod->vec_width_bytes = job->vec_width_bytes;
+    if (batch->fp_contract >= 0) mod->fp_contract = batch->fp_contract;
+    if (batch->unroll) mod->unroll = batch->unroll;
+
+    pva_optimize(mod);
+    job->instrs = mod->size;
+
+    pva_codebuf_t cb;
+    if (pva_codebuf_init(&cb, 4096) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "err: memory alloc failed");
+        pva_free(mod);
+        return -1;
+    }
+    int ret = pva_emit(mod, &cb);
+    job->code_size = cb.size;
+    if (ret == 0 && batch->object) {
+        // out/kernel.avx2.o defines kernel(), declared in out/kernel.avx2.h
+        char name[PVA_MAX_BUFFER_NAME];
+        pva_symbol_from_path(job->output, name, sizeof(name));
+        size_t len = strlen(job->output);
+        char* header = malloc(len + 1);
+        if (header) {
+            memcpy(header, job->output, len + 1);
+            strcpy(header + len - 1, "h");
+            ret = pva_write_elf(job->output, mod, &cb, name, NULL);
+            if (ret == 0) ret = pva_write_header(header, mod, name, 0);
+            free(header);
+        } else {
+            pva_log(mod, PVA_DIAG_ERROR, 0, "err: memory alloc failed");
+            ret = -1;
+        }
+    } else if (ret == 0) {
+        ret = write_code(job->output, mod, &cb);
+    }
+    pva_codebuf_free(&cb);
+    pva_free(mod);
+    return ret;
+}
+
+static void* batch_worker(void* arg) {
+    batch_pool_t* pool = arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (i >= pool->num_jobs) return NULL;
+        batch_job_t* job = &pool->jobs[i];
+        double start = now_ms();
+        job->failed = run_job(pool->batch, job) != 0;
+        job->ms = now_ms() - start;
+    }
+}
+
+typedef struct {
+    char** paths;
+    size_t count, capacity;
+} input_list_t;
+
+static int add_input(input_list_t* list, const char* path) {
+    if (list->count >= list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        char** paths = realloc(list->paths, capacity * sizeof(char*));
+        if (!paths) return -1;
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+    list->paths[list->count] = malloc(strlen(path) + 1);
+    if (!list->paths[list->count]) return -1;
+    strcpy(list->paths[list->count++], path);
+    return 0;
+}
+
+// a path, or a glob pattern that must match something
+static int add_pattern(input_list_t* list, const char* pattern) {
+    if (!strpbrk(pattern, "*?[")) return add_input(list, pattern);
+
+    glob_t g;
+    int ret = glob(pattern, 0, NULL, &g);
+    if (ret == GLOB_NOMATCH) {
+        fprintf(stderr, "[batch] err: no inputs match '%s'\n", pattern);
+        return -1;
+    }
+    for (size_t i = 0; i < g.gl_pathc && ret == 0; i++) ret = add_input(list, g.gl_pathv[i]);
+    globfree(&g);
+    if (ret != 0) fprintf(stderr, "[batch] err: memory alloc failed\n");
+    return ret != 0 ? -1 : 0;
+}
+
+// @manifest: one path or pattern per line; blank lines and '#' comments
+// are skipped, and relative entries are taken as given, from the working
+// directory
+static int add_manifest(input_list_t* list, const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "[batch] err: failed to open manifest '%s'\n", path);
+        return -1;
+    }
+    char line[4096];
+    int ret = 0;
+    while (ret == 0 && fgets(line, sizeof(line), fp)) {
+        char* entry = line;
+        while (*entry == ' ' || *entry == '\t') entry++;
+        char* end = entry + strcspn(entry, "#\r\n");
+        while (end > entry && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        *end = 0;
+        if (*entry) ret = add_pattern(list, entry);
+    }
+    fclose(fp);
+    return ret;
+}
+
+// out_dir/<stem>.<target>.bin, or .o: the stem is the input's file name
+// without its extension
+static char* output_path(const pva_batch_t* batch, const char* input, pva_arch_t arch) {
+    const char* base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+    const char* dot = strrchr(base, '.');
+    int stem = dot && dot != base ? (int)(dot - base) : (int)strlen(base);
+    const char* ext = batch->object ? "o" : "bin";
+    const char* target = pva_arch_name(arch);
+
+    size_t size = strlen(batch->out_dir) + (size_t)stem + strlen(target) + 8;
+    char* path = malloc(size);
+    if (path) snprintf(path, size, "%s/%.*s.%s.%s", batch->out_dir, stem, base, target, ext);
+    return path;
+}
+
+static void print_summary(const batch_job_t* jobs, size_t num_jobs) {
+    for (size_t i = 0; i < num_jobs; i++) {
+        const batch_job_t* job = &jobs[i];
+        if (job->failed) {
+            fflush(stdout);
+            fprintf(stderr, "[batch] FAILED %s (%s)\n", job->input, pva_arch_name(job->arch));
+            if (job->log_size) fputs(job->log, stderr);
+        } else {
+            printf("[batch] %s -> %s: %zu instructions, %zu bytes, %.1f ms\n", job->input, job->output,
+                   job->instrs, job->code_size, job->ms);
+            if (job->log_size) fputs(job->log, stdout);
+        }
+    }
+}
+
+int pva_batch_compile(const pva_batch_t* batch) {
+    double start = now_ms();
+    input_list_t inputs = {0};
+    int ret = 0;
+    for (int i = 0; i < batch->num_inputs && ret == 0; i++) {
+        const char* arg = batch->inputs[i];
+        ret = arg[0] == '@' ? add_manifest(&inputs, arg + 1) : add_pattern(&inputs, arg);
+    }
+    if (ret == 0 && inputs.count == 0) {
+        fprintf(stderr, "[batch] err: no inputs\n");
+        ret = -1;
+    }
+
+    // outputs are named by stem, so two inputs may not share one
+    for (size_t i = 0; i < inputs.count && ret == 0; i++) {
+        char* a = output_path(batch, inputs.paths[i], PVA_ARCH_UNKNOWN);
+        for (size_t k = 0; k < i && a && ret == 0; k++) {
+            char* b = output_path(batch, inputs.paths[k], PVA_ARCH_UNKNOWN);
+            if (b && strcmp(a, b) == 0) {
+                fprintf(stderr, "[batch] err: %s and %s would write the same outputs\n", inputs.paths[k],
+                        inputs.paths[i]);
+                ret = -1;
+            }
+            free(b);
+        }
+        free(a);
+    }
+
+    if (ret == 0 && mkdir(batch->out_dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "[batch] err: cannot create output directory %s: %s\n", batch->out_dir,
+                strerror(errno));
+        ret = -1;
+    }
+
+    size_t num_jobs = inputs.count * (size_t)batch->num_targets;
+    batch_job_t* jobs = ret == 0 ? calloc(num_jobs, sizeof(batch_job_t)) : NULL;
+    if (ret == 0 && !jobs) {
+        fprintf(stderr, "[batch] err: memory alloc failed\n");
+        ret = -1;
+    }
+    for (size_t i = 0; i < num_jobs && ret == 0; i++) {
+        batch_job_t* job = &jobs[i];
+        job->input = inputs.paths[i / batch->num_targets];
+        job->arch = batch->targets[i % batch->num_targets];
+        pva_arch_from_name(pva_arch_name(job->arch), &job->vec_width_bytes);
+        job->output = output_path(batch, job->input, job->arch);
+        if (!job->output) {
+            fprintf(stderr, "[batch] err: memory alloc failed\n");
+            ret = -1;
+        }
+    }
+
+    int threads = 0;
+    size_t failed = 0;
+    if (ret == 0) {
+        // the caller's thread works the queue too; the pool is never
+        // larger than the batch
+        batch_pool_t pool = {batch, jobs, num_jobs, 0};
+        int pool_size = batch->threads < 1 ? 1 : batch->threads;
+        if ((size_t)pool_size > num_jobs) pool_size = (int)num_jobs;
+        pthread_t* workers = malloc((size_t)pool_size * sizeof(pthread_t));
+        threads = 1;
+        for (int i = 1; i < pool_size && workers; i++) {
+            if (pthread_create(&workers[threads], NULL, batch_worker, &pool) != 0) break;
+            threads++;
+        }
+        batch_worker(&pool);
+        for (int i = 1; i < threads; i++) pthread_join(workers[i], NULL);
+        free(workers);
+
+        print_summary(jobs, num_jobs);
+        for (size_t i = 0; i < num_jobs; i++) failed += jobs[i].failed;
+        printf("\n[batch] %zu jobs (%zu inputs x %d targets) on %d threads: %zu compiled, %zu failed, "
+               "%.1f ms\n", num_jobs, inputs.count, batch->num_targets, threads, num_jobs - failed, failed,
+               now_ms() - start);
+        if (failed) ret = -1;
+    }
+
+    for (size_t i = 0; jobs && i < num_jobs; i++) {
+        free(jobs[i].output);
+        free(jobs[i].log);
+    }
+    free(jobs);
+    for (size_t i = 0; i < inputs.count; i++) free(inputs.paths[i]);
+    free(inputs.paths);
+    return ret;
+}
@@ -0,0 +1,480 @@
+#include "pva.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+#if defined(__SHA__) && defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+// compile cache: one file per key, <dir>/<sha256 hex>.pvac, holding the
+// backend's output before the constant pool is linked (so both the raw
+// blob and the ELF object can be written from it) and the parts of the
+// module the writers read. entries are written to a temporary name and
+// renamed into place, so readers only ever see whole files. every hit
+// touches the entry's mtime, and eviction removes the oldest first
+
+#define PVAC_MAGIC "PVAC"
+#define PVAC_VERSION 2      // entry layout; the key covers PVA_VERSION
+#define PVAC_SUFFIX ".pvac"
+#define PVAC_TMP_SUFFIX ".tmp"
+// a writer renames its temporary file within moments; one this many
+// seconds old belongs to a process that died first
+#define PVAC_TMP_MAX_AGE 3600
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t reloc_size;        // sizeof(pva_reloc_t)
+    uint32_t arch;
+    int32_t vec_width_bytes;
+    int32_t spill_slots;
+    uint32_t num_buffers;
+    uint32_t fat;
+    uint64_t fat_offsets[3];
+    uint64_t code_size, rodata_size, num_relocs;
+    uint32_t has_loop, splittable, walked;  // pva_kernel_info, for pva_run
+    uint32_t reserved;
+} pvac_header_t;
+
+// SHA-256 (FIPS 180-4)
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    size_t fill;
+} sha256_t;
+
+static const uint32_t sha256_k[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#if defined(__SHA__) && defined(__SSE4_1__)
+// the x86 SHA extensions: two rounds per sha256rnds2 on the state split
+// into ABEF/CDGH halves, with the message schedule four words at a time
+static void sha256_blocks(uint32_t state[8], const uint8_t* p, size_t count) {
+    const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bll, 0x0405060700010203ll);
+    __m128i dcba = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i hgfe = _mm_loadu_si128((const __m128i*)&state[4]);
+    __m128i cdab = _mm_shuffle_epi32(dcba, 0xb1);
+    __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1b);
+    __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+    __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xf0);
+
+    for (; count; count--, p += 64) {
+        __m128i abef_in = abef, cdgh_in = cdgh;
+        __m128i w[4];
+        // unrolled, the w[] indices are constants and w stays in registers
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; g++) {
+            __m128i* cur = &w[g % 4];
+            if (g < 4) *cur = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16 * g)), swap);
+            __m128i msg = _mm_add_epi32(*cur, _mm_loadu_si128((const __m128i*)&sha256_k[4 * g]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+            if (g >= 3 && g <= 14) {
+                __m128i* next = &w[(g + 1) % 4];
+                *next = _mm_add_epi32(*next, _mm_alignr_epi8(*cur, w[(g + 3) % 4], 4));
+                *next = _mm_sha256msg2_epu32(*next, *cur);
+            }
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0e));
+            if (g >= 1 && g <= 12) w[(g + 3) % 4] = _mm_sha256msg1_epu32(w[(g + 3) % 4], *cur);
+        }
+        abef = _mm_add_epi32(abef, abef_in);
+        cdgh = _mm_add_epi32(cdgh, cdgh_in);
+    }
+
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+    _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(feba, dchg, 0xf0));
+    _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+#else
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_blocks(uint32_t state[8], const uint8_t* p, size_t count) {
+    for (; count; count--, p += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+                   (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) +
+                          sha256_k[i] + w[i];
+            uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+#endif
+
+static void sha256_init(sha256_t* sha) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(sha->state, iv, sizeof(iv));
+    sha->length = 0;
+    sha->fill = 0;
+}
+
+static void sha256_update(sha256_t* sha, const void* data, size_t len) {
+    const uint8_t* p = data;
+    sha->length += len;
+    if (sha->fill) {
+        size_t take = 64 - sha->fill < len ? 64 - sha->fill : len;
+        memcpy(sha->block + sha->fill, p, take);
+        sha->fill += take;
+        p += take;
+        len -= take;
+        if (sha->fill < 64) return;
+        sha256_blocks(sha->state, sha->block, 1);
+        sha->fill = 0;
+    }
+    sha256_blocks(sha->state, p, len / 64);
+    p += len / 64 * 64;
+    len %= 64;
+    memcpy(sha->block, p, len);
+    sha->fill = len;
+}
+
+static void sha256_final(sha256_t* sha, uint8_t digest[32]) {
+    uint64_t bits = sha->length * 8;
+    uint8_t pad[72] = {0x80};
+    size_t pad_len = (sha->fill < 56 ? 56 : 120) - sha->fill;
+    for (int i = 0; i < 8; i++) pad[pad_len + i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha256_update(sha, pad, pad_len + 8);
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = (uint8_t)(sha->state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(sha->state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(sha->state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)sha->state[i];
+    }
+}
+
+static void sha256_int(sha256_t* sha, int64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++) bytes[i] = (uint8_t)((uint64_t)value >> (8 * i));
+    sha256_update(sha, bytes, sizeof(bytes));
+}
+
+int pva_cache_key(pva_cache_key_t* key, const char* input, const pva_cache_options_t* opts) {
+    int fd = open(input, O_RDONLY);
+    if (fd < 0) return -1;
+
+    sha256_t sha;
+    sha256_init(&sha);
+    sha256_update(&sha, "pva " PVA_VERSION, sizeof("pva " PVA_VERSION));
+    sha256_int(&sha, PVAC_VERSION);
+    sha256_int(&sha, opts->arch);
+    sha256_int(&sha, opts->vec_width_bytes);
+    sha256_int(&sha, opts->target_given);
+    sha256_int(&sha, opts->fp_contract);
+    sha256_int(&sha, opts->unroll);
+    sha256_int(&sha, opts->fat);
+    sha256_int(&sha, opts->load_ir);
+
+    uint8_t buf[1 << 14];
+    for (;;) {
+        ssize_t got = read(fd, buf, sizeof(buf));
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            close(fd);
+            return -1;
+        }
+        if (got == 0) break;
+        sha256_update(&sha, buf, (size_t)got);
+    }
+    close(fd);
+
+    uint8_t digest[32];
+    sha256_final(&sha, digest);
+    for (int i = 0; i < 32; i++) snprintf(&key->hex[2 * i], 3, "%02x", digest[i]);
+    return 0;
+}
+
+static void entry_path(char* path, size_t size, const pva_cache_t* cache, const pva_cache_key_t* key) {
+    snprintf(path, size, "%s/%s%s", cache->dir, key->hex, PVAC_SUFFIX);
+}
+
+static int read_all(int fd, void* data, size_t len) {
+    uint8_t* p = data;
+    while (len) {
+        ssize_t got = read(fd, p, len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return -1;
+        p += got;
+        len -= (size_t)got;
+    }
+    return 0;
+}
+
+int pva_cache_load(const pva_cache_t* cache, const pva_cache_key_t* key, const char* filename,
+                   pva_module_t** mod_out, pva_codebuf_t* cb, size_t fat_offsets[3],
+                   pva_kernel_info_t* info) {
+    pva_module_t reporter = {.diag = cache->diag};
+    char path[4096];
+    entry_path(path, sizeof(path), cache, key);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    pvac_header_t hdr;
+    struct stat st;
+    pva_module_t* mod = NULL;
+    memset(cb, 0, sizeof(*cb));
+    if (fstat(fd, &st) != 0 || read_all(fd, &hdr, sizeof(hdr)) != 0 ||
+        memcmp(hdr.magic, PVAC_MAGIC, 4) != 0 || hdr.version != PVAC_VERSION ||
+        hdr.reloc_size != sizeof(pva_reloc_t) || hdr.num_buffers > PVA_MAX_BUFFERS ||
+        hdr.code_size > (uint64_t)st.st_size || hdr.rodata_size > (uint64_t)st.st_size ||
+        hdr.num_relocs > (uint64_t)st.st_size / sizeof(pva_reloc_t) ||
+        sizeof(hdr) + (uint64_t)hdr.num_buffers * PVA_MAX_BUFFER_NAME + hdr.code_size +
+                hdr.rodata_size + hdr.num_relocs * sizeof(pva_reloc_t) != (uint64_t)st.st_size) {
+        goto fail;
+    }
+
+    mod = calloc(1, sizeof(pva_module_t));
+    if (!mod || pva_codebuf_init(cb, hdr.code_size) != 0) goto fail;
+    mod->filename = malloc(strlen(filename) + 1);
+    cb->rodata = malloc(hdr.rodata_size ? hdr.rodata_size : 1);
+    cb->relocs = malloc(hdr.num_relocs ? hdr.num_relocs * sizeof(pva_reloc_t) : 1);
+    if (!mod->filename || !cb->rodata || !cb->relocs) goto fail;
+    strcpy(mod->filename, filename);
+    mod->diag = cache->diag;
+    mod->arch = (pva_arch_t)hdr.arch;
+    mod->vec_width_bytes = hdr.vec_width_bytes;
+    mod->spill_slots = hdr.spill_slots;
+    mod->num_buffers = (int)hdr.num_buffers;
+    cb->size = hdr.code_size;
+    cb->rodata_size = cb->rodata_capacity = hdr.rodata_size;
+    cb->num_relocs = cb->reloc_capacity = hdr.num_relocs;
+    if (read_all(fd, mod->buffers, (size_t)mod->num_buffers * PVA_MAX_BUFFER_NAME) != 0 ||
+        read_all(fd, cb->data, cb->size) != 0 || read_all(fd, cb->rodata, cb->rodata_size) != 0 ||
+        read_all(fd, cb->relocs, cb->num_relocs * sizeof(pva_reloc_t)) != 0) {
+        goto fail;
+    }
+    for (int b = 0; b < mod->num_buffers; b++) mod->buffers[b][PVA_MAX_BUFFER_NAME - 1] = 0;
+    for (size_t r = 0; r < cb->num_relocs; r++) {
+        if (cb->relocs[r].offset > cb->size || cb->relocs[r].target > cb->rodata_size) goto fail;
+    }
+    // the resolver starts the code, then each variant in turn
+    if (hdr.fat > 1) goto fail;
+    for (int t = 0; t < 3 && hdr.fat; t++) {
+        if (hdr.fat_offsets[t] <= (t ? hdr.fat_offsets[t - 1] : 0) || hdr.fat_offsets[t] >= hdr.code_size) {
+            goto fail;
+        }
+    }
+    if (fat_offsets) {
+        for (int t = 0; t < 3; t++) fat_offsets[t] = hdr.fat_offsets[t];
+    }
+    if (info) {
+        info->num_buffers = mod->num_buffers;
+        info->vec_width_bytes = mod->vec_width_bytes;
+        info->has_loop = hdr.has_loop != 0;
+        info->splittable = hdr.splittable != 0;
+        info->walked = hdr.walked;
+    }
+    close(fd);
+
+    // a hit makes the entry the most recently used
+    utimensat(AT_FDCWD, path, NULL, 0);
+    pva_log(&reporter, PVA_DIAG_NOTE, 0, "[cache] hit: %s", path);
+    *mod_out = mod;
+    return 0;
+
+fail:
+    close(fd);
+    pva_codebuf_free(cb);
+    pva_free(mod);
+    pva_log(&reporter, PVA_DIAG_WARNING, 0, "[cache] warning: ignoring unreadable entry %s", path);
+    return -1;
+}
+
+// mkdir -p
+static int make_dirs(const char* dir) {
+    char path[4096];
+    if (snprintf(path, sizeof(path), "%s", dir) >= (int)sizeof(path)) return -1;
+    for (char* p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = 0;
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return mkdir(path, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+typedef struct {
+    char name[80];
+    off_t size;
+    struct timespec used;
+} cache_file_t;
+
+static int older_first(const void* a, const void* b) {
+    const struct timespec* x = &((const cache_file_t*)a)->used;
+    const struct timespec* y = &((const cache_file_t*)b)->used;
+    if (x->tv_sec != y->tv_sec) return x->tv_sec < y->tv_sec ? -1 : 1;
+    return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+// drop the least recently used entries until the rest fit in max_bytes,
+// and temporary files a writer left behind when it died before the rename
+static void evict(const pva_cache_t* cache) {
+    pva_module_t reporter = {.diag = cache->diag};
+    DIR* dir = opendir(cache->dir);
+    if (!dir) return;
+
+    cache_file_t* files = NULL;
+    size_t count = 0, capacity = 0;
+    uint64_t total = 0;
+    struct dirent* ent;
+    size_t swept = 0;
+    time_t now = time(NULL);
+    while ((ent = readdir(dir))) {
+        size_t len = strlen(ent->d_name);
+        size_t suffix = sizeof(PVAC_SUFFIX) - 1;
+        struct stat tmp_st;
+        if (ent->d_name[0] == '.' && len > sizeof(PVAC_TMP_SUFFIX) &&
+            strcmp(ent->d_name + len - (sizeof(PVAC_TMP_SUFFIX) - 1), PVAC_TMP_SUFFIX) == 0 &&
+            fstatat(dirfd(dir), ent->d_name, &tmp_st, 0) == 0 && S_ISREG(tmp_st.st_mode) &&
+            now - tmp_st.st_mtime > PVAC_TMP_MAX_AGE &&
+            unlinkat(dirfd(dir), ent->d_name, 0) == 0) {
+            swept++;
+            continue;
+        }
+        if (len <= suffix || len >= sizeof(files->name) ||
+            strcmp(ent->d_name + len - suffix, PVAC_SUFFIX) != 0) {
+            continue;
+        }
+        struct stat st;
+        if (fstatat(dirfd(dir), ent->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            cache_file_t* grown = realloc(files, capacity * sizeof(cache_file_t));
+            if (!grown) break;
+            files = grown;
+        }
+        strcpy(files[count].name, ent->d_name);
+        files[count].size = st.st_size;
+        files[count].used = st.st_mtim;
+        total += (uint64_t)st.st_size;
+        count++;
+    }
+
+    if (total > cache->max_bytes) {
+        qsort(files, count, sizeof(cache_file_t), older_first);
+        size_t evicted = 0;
+        for (size_t i = 0; i < count && total > cache->max_bytes; i++) {
+            if (unlinkat(dirfd(dir), files[i].name, 0) != 0) continue;
+            total -= (uint64_t)files[i].size;
+            evicted++;
+        }
+        pva_log(&reporter, PVA_DIAG_NOTE, 0, "[cache] evicted %zu entr%s, %llu bytes remain", evicted,
+                evicted == 1 ? "y" : "ies", (unsigned long long)total);
+    }
+    if (swept) {
+        pva_log(&reporter, PVA_DIAG_NOTE, 0, "[cache] removed %zu abandoned temporary file%s", swept,
+                swept == 1 ? "" : "s");
+    }
+    free(files);
+    closedir(dir);
+}
+
+int pva_cache_store(const pva_cache_t* cache, const pva_cache_key_t* key, const pva_module_t* mod,
+                    const pva_codebuf_t* cb, const size_t fat_offsets[3]) {
+    pva_module_t reporter = {.diag = cache->diag};
+    if (cb->failed || make_dirs(cache->dir) != 0) {
+        pva_log(&reporter, PVA_DIAG_WARNING, 0, "[cache] warning: cannot use cache directory %s", cache->dir);
+        return -1;
+    }
+
+    pvac_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PVAC_MAGIC, 4);
+    hdr.version = PVAC_VERSION;
+    hdr.reloc_size = sizeof(pva_reloc_t);
+    hdr.arch = (uint32_t)mod->arch;
+    hdr.vec_width_bytes = mod->vec_width_bytes;
+    hdr.spill_slots = mod->spill_slots;
+    hdr.num_buffers = (uint32_t)mod->num_buffers;
+    hdr.fat = fat_offsets != NULL;
+    for (int t = 0; t < 3 && fat_offsets; t++) hdr.fat_offsets[t] = fat_offsets[t];
+    hdr.code_size = cb->size;
+    hdr.rodata_size = cb->rodata_size;
+    hdr.num_relocs = cb->num_relocs;
+    pva_kernel_info_t info;
+    if (pva_kernel_info(mod, &info) == 0) {
+        hdr.has_loop = (uint32_t)info.has_loop;
+        hdr.splittable = (uint32_t)info.splittable;
+        hdr.walked = info.walked;
+    }
+
+    // one that would evict everything else and then itself is not kept
+    uint64_t entry_size = sizeof(hdr) + (uint64_t)mod->num_buffers * PVA_MAX_BUFFER_NAME +
+                          hdr.code_size + hdr.rodata_size + hdr.num_relocs * sizeof(pva_reloc_t);
+    if (entry_size > cache->max_bytes) {
+        pva_log(&reporter, PVA_DIAG_NOTE, 0, "[cache] %llu bytes of code exceed the cache size, not stored",
+                (unsigned long long)entry_size);
+        return 0;
+    }
+
+    // unique per process and call, so concurrent writers never share one
+    static unsigned serial;
+    unsigned unique = __atomic_fetch_add(&serial, 1, __ATOMIC_RELAXED);
+    char path[4096], tmp[4096];
+    entry_path(path, sizeof(path), cache, key);
+    snprintf(tmp, sizeof(tmp), "%s/.%s.%ld.%u" PVAC_TMP_SUFFIX, cache->dir, key->hex, (long)getpid(), unique);
+
+    FILE* fp = fopen(tmp, "wb");
+    if (!fp) {
+        pva_log(&reporter, PVA_DIAG_WARNING, 0, "[cache] warning: cannot write %s", tmp);
+        return -1;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(mod->buffers, PVA_MAX_BUFFER_NAME, (size_t)mod->num_buffers, fp);
+    fwrite(cb->data, 1, cb->size, fp);
+    if (cb->rodata_size) fwrite(cb->rodata, 1, cb->rodata_size, fp);
+    if (cb->num_relocs) fwrite(cb->relocs, sizeof(pva_reloc_t), cb->num_relocs, fp);
+    int failed = ferror(fp) || fflush(fp) != 0 || fsync(fileno(fp)) != 0;
+    if (fclose(fp) != 0 || failed || rename(tmp, path) != 0) {
+        pva_log(&reporter, PVA_DIAG_WARNING, 0, "[cache] warning: cannot write %s", path);
+        unlink(tmp);
+        return -1;
+    }
+    pva_log(&reporter, PVA_DIAG_NOTE, 0, "[cache] stored: %s", path);
+
+    evict(cache);
+    return 0;
+}
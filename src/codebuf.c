@@ -0,0 +1,188 @@
+#include "pva.h"
+#include <stdlib.h>
+#include <string.h>
+
+int pva_codebuf_init(pva_codebuf_t* cb, size_t initial_capacity) {
+    memset(cb, 0, sizeof(*cb));
+    if (initial_capacity < 64) initial_capacity = 64;
+
+    cb->data = malloc(initial_capacity);
+    if (!cb->data) {
+        cb->failed = 1;
+        return -1;
+    }
+    cb->capacity = initial_capacity;
+    return 0;
+}
+
+void pva_codebuf_free(pva_codebuf_t* cb) {
+    if (!cb) return;
+    free(cb->data);
+    free(cb->rodata);
+    free(cb->relocs);
+    memset(cb, 0, sizeof(*cb));
+}
+
+// make room for `extra` more bytes, doubling so appends stay amortized O(1)
+int pva_codebuf_reserve(pva_codebuf_t* cb, size_t extra) {
+    if (cb->failed) return -1;
+    if (cb->size + extra <= cb->capacity) return 0;
+
+    size_t new_capacity = cb->capacity ? cb->capacity : 64;
+    while (new_capacity < cb->size + extra) {
+        if (new_capacity > SIZE_MAX / 2) {
+            cb->failed = 1;
+            return -1;
+        }
+        new_capacity *= 2;
+    }
+
+    uint8_t* new_data = realloc(cb->data, new_capacity);
+    if (!new_data) {
+        cb->failed = 1;
+        return -1;
+    }
+
+    cb->data = new_data;
+    cb->capacity = new_capacity;
+    return 0;
+}
+
+void pva_codebuf_emit(pva_codebuf_t* cb, const void* data, size_t len) {
+    if (pva_codebuf_reserve(cb, len) != 0) return;
+    memcpy(cb->data + cb->size, data, len);
+    cb->size += len;
+}
+
+void pva_codebuf_emit8(pva_codebuf_t* cb, uint8_t byte) {
+    if (pva_codebuf_reserve(cb, 1) != 0) return;
+    cb->data[cb->size++] = byte;
+}
+
+// little-endian 32-bit word (one ARM/RISC-V instruction)
+void pva_codebuf_emit32(pva_codebuf_t* cb, uint32_t word) {
+    if (pva_codebuf_reserve(cb, 4) != 0) return;
+    cb->data[cb->size++] = (word >> 0) & 0xff;
+    cb->data[cb->size++] = (word >> 8) & 0xff;
+    cb->data[cb->size++] = (word >> 16) & 0xff;
+    cb->data[cb->size++] = (word >> 24) & 0xff;
+}
+
+// overwrite an already emitted 32-bit field (branch displacements)
+void pva_codebuf_patch32(pva_codebuf_t* cb, size_t offset, uint32_t word) {
+    if (cb->failed || offset + 4 > cb->size) return;
+    cb->data[offset + 0] = (word >> 0) & 0xff;
+    cb->data[offset + 1] = (word >> 8) & 0xff;
+    cb->data[offset + 2] = (word >> 16) & 0xff;
+    cb->data[offset + 3] = (word >> 24) & 0xff;
+}
+
+
+// append len bytes to the constant pool, unless the pool already holds
+// them at that alignment; returns their pool offset
+size_t pva_codebuf_rodata(pva_codebuf_t* cb, const void* data, size_t len, size_t align) {
+    if (cb->failed) return 0;
+
+    for (size_t at = 0; at + len <= cb->rodata_size; at += align) {
+        if (memcmp(cb->rodata + at, data, len) == 0) return at;
+    }
+
+    size_t offset = (cb->rodata_size + align - 1) & ~(align - 1);
+    if (offset + len > cb->rodata_capacity) {
+        size_t new_capacity = cb->rodata_capacity ? cb->rodata_capacity : 64;
+        while (new_capacity < offset + len) new_capacity *= 2;
+        uint8_t* new_rodata = realloc(cb->rodata, new_capacity);
+        if (!new_rodata) {
+            cb->failed = 1;
+            return 0;
+        }
+        cb->rodata = new_rodata;
+        cb->rodata_capacity = new_capacity;
+    }
+
+    memset(cb->rodata + cb->rodata_size, 0, offset - cb->rodata_size);
+    memcpy(cb->rodata + offset, data, len);
+    cb->rodata_size = offset + len;
+    return offset;
+}
+
+void pva_codebuf_reloc(pva_codebuf_t* cb, pva_reloc_kind_t kind, size_t offset,
+                       size_t target, int32_t addend, size_t pair) {
+    if (cb->failed) return;
+
+    if (cb->num_relocs >= cb->reloc_capacity) {
+        size_t new_capacity = cb->reloc_capacity ? cb->reloc_capacity * 2 : 16;
+        pva_reloc_t* new_relocs = realloc(cb->relocs, new_capacity * sizeof(pva_reloc_t));
+        if (!new_relocs) {
+            cb->failed = 1;
+            return;
+        }
+        cb->relocs = new_relocs;
+        cb->reloc_capacity = new_capacity;
+    }
+
+    pva_reloc_t* r = &cb->relocs[cb->num_relocs++];
+    r->kind = kind;
+    r->offset = offset;
+    r->target = target;
+    r->addend = addend;
+    r->pair = pair;
+}
+
+static uint32_t read32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// for raw and JIT output: append the constant pool after the code and
+// resolve every reference to it. the result is position independent, so
+// adrp (page-relative) is rewritten to adr and its lo12 add to #0
+int pva_codebuf_link(pva_codebuf_t* cb) {
+    if (cb->failed) return -1;
+    if (cb->rodata_size == 0 && cb->num_relocs == 0) return 0;
+
+    size_t pool = (cb->size + PVA_RODATA_ALIGN - 1) & ~(size_t)(PVA_RODATA_ALIGN - 1);
+    if (pva_codebuf_reserve(cb, pool - cb->size + cb->rodata_size) != 0) return -1;
+    memset(cb->data + cb->size, 0, pool - cb->size);
+    memcpy(cb->data + pool, cb->rodata, cb->rodata_size);
+    size_t code_size = cb->size;
+    cb->size = pool + cb->rodata_size;
+
+    for (size_t i = 0; i < cb->num_relocs; i++) {
+        const pva_reloc_t* r = &cb->relocs[i];
+        if (r->offset + 4 > code_size) return -1;
+        uint32_t insn = read32(cb->data + r->offset);
+        int64_t disp;
+
+        switch (r->kind) {
+            case PVA_RELOC_X86_PC32:
+                disp = (int64_t)(pool + r->target) + r->addend - (int64_t)r->offset;
+                insn = (uint32_t)(int32_t)disp;
+                break;
+            case PVA_RELOC_ARM_ADR_PAGE:
+                // adrp -> adr xd, target (+-1 MiB)
+                disp = (int64_t)(pool + r->target) + r->addend - (int64_t)r->offset;
+                if (disp < -(1 << 20) || disp >= (1 << 20)) return -1;
+                insn &= 0x1f;
+                insn |= 0x10000000 | (((uint32_t)disp & 0x3) << 29) | ((((uint32_t)disp >> 2) & 0x7ffff) << 5);
+                break;
+            case PVA_RELOC_ARM_ADD_LO12:
+                insn &= ~(0xfffu << 10);
+                break;
+            case PVA_RELOC_RISCV_PCREL_HI20:
+                disp = (int64_t)(pool + r->target) + r->addend - (int64_t)r->offset;
+                insn = (insn & 0xfff) | (((uint32_t)disp + 0x800) & 0xfffff000);
+                break;
+            case PVA_RELOC_RISCV_PCREL_LO12:
+                disp = (int64_t)(pool + r->target) + r->addend - (int64_t)r->pair;
+                insn = (insn & 0xfffff) | (((uint32_t)disp & 0xfff) << 20);
+                break;
+            default:
+                return -1;
+        }
+        pva_codebuf_patch32(cb, r->offset, insn);
+    }
+
+    cb->rodata_size = 0;
+    cb->num_relocs = 0;
+    return 0;
+}
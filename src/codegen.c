@@ -0,0 +1,77 @@
+#include "pva.h"
+#include <stdlib.h>
+#include <string.h>
+
+// allocate registers and pick the backend matching mod->arch. allocation
+// runs on a copy, so mod keeps its virtual registers and can be emitted
+// again for another target
+int pva_emit(pva_module_t* mod, pva_codebuf_t* cb) {
+    if (!mod || !cb) return -1;
+    long begin, end;
+    if (pva_find_loop(mod, &begin, &end) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[codegen] err: loop_begin/loop_end do not pair up, or nest");
+        return -1;
+    }
+
+    pva_module_t lowered = *mod;
+    lowered.code_map = NULL;
+    lowered.code_map_size = 0;
+    lowered.capacity = mod->size ? mod->size : 1;
+    lowered.code = malloc(lowered.capacity * sizeof(pva_instr_t));
+    if (!lowered.code) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "err: memory alloc failed");
+        return -1;
+    }
+    memcpy(lowered.code, mod->code, mod->size * sizeof(pva_instr_t));
+
+    pva_timer_begin(mod->timer, "register allocation", lowered.size);
+    int ret = pva_regalloc(&lowered);
+    pva_timer_end(mod->timer, lowered.size);
+    if (ret == 0) {
+        pva_timer_begin(mod->timer, "code generation", lowered.size);
+        switch (lowered.arch) {
+            case PVA_ARCH_X86_AVX512:
+            case PVA_ARCH_X86_AVX2:
+            case PVA_ARCH_X86_SSE:
+                ret = pva_emit_x86(&lowered, cb);
+                break;
+            case PVA_ARCH_ARM_SVE:
+            case PVA_ARCH_ARM_NEON:
+                ret = pva_emit_arm(&lowered, cb);
+                break;
+            case PVA_ARCH_RISCV_RVV:
+                ret = pva_emit_riscv(&lowered, cb);
+                break;
+            default:
+                pva_log(mod, PVA_DIAG_ERROR, 0, "err: unsupported or unknown architecture");
+                ret = -1;
+        }
+        pva_timer_end(mod->timer, PVA_TIMER_NONE);
+        // the code buffer stops growing at its first failed allocation
+        if (cb->failed) pva_log(mod, PVA_DIAG_ERROR, 0, "[codegen] err: code buffer alloc failed");
+    }
+
+    free(lowered.code);
+    return ret;
+}
+
+// locate the loop_begin/loop_end pair; both are -1 when the kernel has no
+// loop. only one non-nested loop per kernel is supported, and -1 means the
+// markers do not pair up. silent, as every pass asks: the parser reports
+// bad markers, and pva_optimize/pva_emit refuse modules that still have them
+int pva_find_loop(const pva_module_t* mod, long* begin, long* end) {
+    *begin = -1;
+    *end = -1;
+
+    for (size_t i = 0; i < mod->size; i++) {
+        if (mod->code[i].op == PVA_LOOP_BEGIN) {
+            if (*begin >= 0) return -1;
+            *begin = (long)i;
+        } else if (mod->code[i].op == PVA_LOOP_END) {
+            if (*begin < 0 || *end >= 0) return -1;
+            *end = (long)i;
+        }
+    }
+
+    return *begin >= 0 && *end < 0 ? -1 : 0;
+}
@@ -0,0 +1,101 @@
+#include "pva.h"
+#include <string.h>
+
+// stands between the stages and the caller's handler (if any), counting
+// errors: a source the parser recovered from still fails to compile
+typedef struct {
+    pva_diag_fn fn;
+    void* user;
+    pva_diag_level_t level;
+    int errors;
+} compile_diag_t;
+
+static void diag_discard(const pva_diag_t* diag, void* user) {
+    (void)diag;
+    (void)user;
+}
+
+static void compile_report(const pva_diag_t* diag, void* user) {
+    compile_diag_t* report = user;
+    if (diag->level == PVA_DIAG_ERROR) report->errors++;
+    if (report->fn && diag->level >= report->level) report->fn(diag, report->user);
+}
+
+void pva_options_init(pva_options_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->arch = PVA_ARCH_UNKNOWN;
+    opts->fp_contract = -1;
+    opts->diag_level = PVA_DIAG_NOTE;
+}
+
+// the command line's pipeline without its files: parse, optimize, emit and
+// link. on failure out is left empty and the errors went to the handler
+int pva_compile_source(const char* source, size_t size, const pva_options_t* opts, pva_compiled_t* out) {
+    memset(out, 0, sizeof(*out));
+    compile_diag_t report = {opts->diag, opts->diag_user, opts->diag_level, 0};
+    // errors always reach compile_report to be counted; notes and warnings
+    // nobody asked for are dropped unformatted
+    pva_diag_level_t level = opts->diag && opts->diag_level < PVA_DIAG_ERROR ? opts->diag_level : PVA_DIAG_ERROR;
+    pva_diag_sink_t diag = {compile_report, &report, level};
+
+    pva_module_t* mod = pva_parse_source(source, size, "<source>", &diag);
+    if (!mod) return -1;
+    if (report.errors) {
+        pva_free(mod);
+        return -1;
+    }
+
+    int vec_width = opts->vec_width_bytes;
+    pva_arch_t arch = opts->arch;
+    if (arch == PVA_ARCH_UNKNOWN) {
+        arch = pva_detect_arch(&vec_width);
+    } else if (vec_width == 0) {
+        pva_arch_from_name(pva_arch_name(arch), &vec_width);
+    }
+    mod->arch = arch;
+    mod->vec_width_bytes = vec_width;
+    if (opts->fp_contract >= 0) mod->fp_contract = opts->fp_contract;
+    if (opts->unroll) mod->unroll = opts->unroll;
+
+    // optimize returns nothing and emit may succeed after an error was
+    // reported, so the count decides after each of them too
+    pva_optimize(mod);
+    if (report.errors) {
+        pva_free(mod);
+        return -1;
+    }
+
+    pva_codebuf_t cb;
+    if (pva_codebuf_init(&cb, 4096) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[codegen] err: memory alloc failed");
+        pva_free(mod);
+        return -1;
+    }
+    int ret = pva_emit(mod, &cb);
+    if (ret == 0 && pva_codebuf_link(&cb) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[codegen] err: failed to link the constant pool");
+        ret = -1;
+    }
+    if (ret != 0 || report.errors) {
+        pva_codebuf_free(&cb);
+        pva_free(mod);
+        return -1;
+    }
+
+    out->code = cb;
+    out->arch = mod->arch;
+    out->vec_width_bytes = mod->vec_width_bytes;
+    memcpy(out->buffers, mod->buffers, sizeof(out->buffers));
+    out->num_buffers = mod->num_buffers;
+    pva_kernel_info(mod, &out->info);
+    // pva_jit_load reports to the caller's handler, or stays silent too
+    out->diag = (pva_diag_sink_t){opts->diag ? opts->diag : diag_discard, opts->diag_user, opts->diag_level};
+    pva_free(mod);
+    return 0;
+}
+
+void pva_compiled_free(pva_compiled_t* compiled) {
+    if (!compiled) return;
+    pva_codebuf_free(&compiled->code);
+    memset(compiled, 0, sizeof(*compiled));
+}
@@ -1,8 +1,8 @@
 #include "pva.h"
 #include <cpuid.h>
 #include <string.h>
-#include <stdio.h>
 
+// the best target this CPU runs; silent, callers report what was found
 pva_arch_t pva_detect_arch(int* vec_width_bytes) {
     unsigned int eax, ebx, ecx, edx;
 
@@ -19,52 +19,89 @@ pva_arch_t pva_detect_arch(int* vec_width_bytes) {
         return PVA_ARCH_UNKNOWN;
     }
 
-    // check for AVX-512 Foundation
+    // AVX state must be enabled by the OS (OSXSAVE + AVX, then XCR0)
+    unsigned int xcr0 = 0;
+    if ((ecx & (1 << 27)) && (ecx & (1 << 28))) {
+        unsigned int xcr0_hi;
+        __asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+    }
+
+    unsigned int ebx7 = 0;
     if (__get_cpuid_max(0, NULL) >= 7) {
-        unsigned int eax7, ebx7, ecx7, edx7;
+        unsigned int eax7, ecx7, edx7;
         __cpuid_count(7, 0, eax7, ebx7, ecx7, edx7);
-        
-        if (ebx7 & (1 << 16)) {  // AVX-512F
-            *vec_width_bytes = 64;
-            printf("[detect_arch] detected AVX-512 support\n");
-            return PVA_ARCH_X86_AVX512;
-        }
     }
 
-    // check for AVX2
-    if (ecx & (1 << 5)) {
+    // check for AVX-512 Foundation: XMM, YMM, opmask and ZMM state, plus
+    // BMI2 (leaf 7, ebx bit 8) for the bzhi building the tail mask
+    if ((ebx7 & (1 << 16)) && (ebx7 & (1 << 8)) && (xcr0 & 0xe6) == 0xe6) {
+        *vec_width_bytes = 64;
+        return PVA_ARCH_X86_AVX512;
+    }
+
+    // check for AVX2 (leaf 7, ebx bit 5) with FMA3 (leaf 1, ecx bit 12)
+    if ((ebx7 & (1 << 5)) && (ecx & (1 << 12)) && (xcr0 & 0x6) == 0x6) {
         *vec_width_bytes = 32;
-        printf("[detect_arch] detected AVX2 support\n");
         return PVA_ARCH_X86_AVX2;
     }
 
-    // default to SSE
+    // SSE, which blends and inserts with SSE4.1 (leaf 1, ecx bit 19)
+    if (!(ecx & (1 << 19))) {
+        *vec_width_bytes = 4;
+        return PVA_ARCH_UNKNOWN;
+    }
     *vec_width_bytes = 16;
-    printf("[detect_arch] detected SSE4.2 support\n");
     return PVA_ARCH_X86_SSE;
 
 #elif defined(__aarch64__)
     // ARM64 
     #ifdef __ARM_FEATURE_SVE
         *vec_width_bytes = 16;
-        printf("[detect_arch] detected ARM SVE support\n");
         return PVA_ARCH_ARM_SVE;
     #else
         *vec_width_bytes = 16;
-        printf("[detect_arch] detected ARM NEON support\n");
         return PVA_ARCH_ARM_NEON;
     #endif
 
 #elif defined(__riscv)
     // RISC-V 
     *vec_width_bytes = 32;
-    printf("[detect_arch] detected RISC-V RVV support\n");
     return PVA_ARCH_RISCV_RVV;
 
 #else
     // unknown 
     *vec_width_bytes = 4;
-    printf("[detect_arch] unknown architecture, using scalar fallback\n");
     return PVA_ARCH_UNKNOWN;
 #endif
-}
\ No newline at end of file
+}
+
+static const struct {
+    const char* name;
+    pva_arch_t arch;
+    int vec_width_bytes;
+} targets[] = {
+    {"sse", PVA_ARCH_X86_SSE, 16},
+    {"avx2", PVA_ARCH_X86_AVX2, 32},
+    {"avx512", PVA_ARCH_X86_AVX512, 64},
+    {"neon", PVA_ARCH_ARM_NEON, 16},
+    {"sve", PVA_ARCH_ARM_SVE, 16},      // minimum, the code is vector-length agnostic
+    {"rvv", PVA_ARCH_RISCV_RVV, 32},
+};
+
+// --target= names, for cross-compiling without looking at the host
+pva_arch_t pva_arch_from_name(const char* name, int* vec_width_bytes) {
+    for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+        if (strcmp(name, targets[i].name) == 0) {
+            *vec_width_bytes = targets[i].vec_width_bytes;
+            return targets[i].arch;
+        }
+    }
+    return PVA_ARCH_UNKNOWN;
+}
+
+const char* pva_arch_name(pva_arch_t arch) {
+    for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+        if (targets[i].arch == arch) return targets[i].name;
+    }
+    return "unknown";
+}
@@ -0,0 +1,30 @@
+#include "pva.h"
+#include <stdio.h>
+#include <stdarg.h>
+
+const pva_diag_sink_t* pva_diag_or_print(const pva_diag_sink_t* diag) {
+    static const pva_diag_sink_t print = {NULL, NULL, PVA_DIAG_NOTE};
+    return diag ? diag : &print;
+}
+
+// one line from a stage about mod (NULL when there is none yet). a
+// handler receives it formatted; messages below the sink's level cost
+// only the comparison
+void pva_log(const pva_module_t* mod, pva_diag_level_t level, int line, const char* fmt, ...) {
+    const pva_diag_sink_t* sink = mod ? &mod->diag : NULL;
+    if (sink && level < sink->level) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    if (sink && sink->fn) {
+        char text[512];
+        vsnprintf(text, sizeof(text), fmt, ap);
+        pva_diag_t diag = {level, line, text};
+        sink->fn(&diag, sink->user);
+    } else {
+        FILE* out = level == PVA_DIAG_NOTE ? stdout : stderr;
+        vfprintf(out, fmt, ap);
+        fputc('\n', out);
+    }
+    va_end(ap);
+}
@@ -0,0 +1,434 @@
+#include "pva.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// minimal ELF64 relocatable writer: .text, an optional .rodata constant
+// pool with .rela.text against it, and one global function symbol
+
+#define EM_X86_64   62
+#define EM_AARCH64  183
+#define EM_RISCV    243
+
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB   2
+#define SHT_STRTAB   3
+#define SHT_RELA     4
+
+#define SHF_ALLOC     0x2
+#define SHF_EXECINSTR 0x4
+#define SHF_INFO_LINK 0x40
+
+#define STB_LOCAL  0
+#define STB_GLOBAL 1
+#define STT_NOTYPE  0
+#define STT_FUNC    2
+#define STT_SECTION 3
+#define STT_GNU_IFUNC 10
+
+#define ELFOSABI_GNU 3
+#define EF_RISCV_FLOAT_ABI_DOUBLE 0x4
+
+#define R_X86_64_PC32            2
+#define R_AARCH64_ADR_PREL_PG_HI21 275
+#define R_AARCH64_ADD_ABS_LO12_NC  277
+#define R_RISCV_PCREL_HI20       23
+#define R_RISCV_PCREL_LO12_I     24
+
+typedef struct {
+    uint8_t  e_ident[16];
+    uint16_t e_type, e_machine;
+    uint32_t e_version;
+    uint64_t e_entry, e_phoff, e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize, e_phentsize, e_phnum, e_shentsize, e_shnum, e_shstrndx;
+} elf64_ehdr_t;
+
+typedef struct {
+    uint32_t sh_name, sh_type;
+    uint64_t sh_flags, sh_addr, sh_offset, sh_size;
+    uint32_t sh_link, sh_info;
+    uint64_t sh_addralign, sh_entsize;
+} elf64_shdr_t;
+
+typedef struct {
+    uint32_t st_name;
+    uint8_t  st_info, st_other;
+    uint16_t st_shndx;
+    uint64_t st_value, st_size;
+} elf64_sym_t;
+
+typedef struct {
+    uint64_t r_offset, r_info;
+    int64_t  r_addend;
+} elf64_rela_t;
+
+enum { SEC_NULL, SEC_TEXT, SEC_RODATA, SEC_RELA, SEC_SYMTAB, SEC_STRTAB, SEC_SHSTRTAB, SEC_NOTE, SEC_COUNT };
+
+static const char shstrtab[] =
+    "\0.text\0.rodata\0.rela.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+static const uint32_t shstr_offsets[SEC_COUNT] = {0, 1, 7, 15, 26, 34, 42, 52};
+
+typedef struct {
+    elf64_sym_t* syms;
+    size_t count, capacity;
+    char* strtab;
+    size_t strtab_size, strtab_capacity;
+    int failed;
+} symbols_t;
+
+static uint32_t add_string(symbols_t* s, const char* str) {
+    size_t len = strlen(str) + 1;
+    if (s->strtab_size + len > s->strtab_capacity) {
+        size_t new_capacity = s->strtab_capacity ? s->strtab_capacity * 2 : 256;
+        while (new_capacity < s->strtab_size + len) new_capacity *= 2;
+        char* new_strtab = realloc(s->strtab, new_capacity);
+        if (!new_strtab) {
+            s->failed = 1;
+            return 0;
+        }
+        s->strtab = new_strtab;
+        s->strtab_capacity = new_capacity;
+    }
+    uint32_t offset = (uint32_t)s->strtab_size;
+    memcpy(s->strtab + offset, str, len);
+    s->strtab_size += len;
+    return offset;
+}
+
+static size_t add_symbol(symbols_t* s, const char* name, int bind, int type, int shndx,
+                         uint64_t value, uint64_t size) {
+    if (s->count >= s->capacity) {
+        size_t new_capacity = s->capacity ? s->capacity * 2 : 16;
+        elf64_sym_t* new_syms = realloc(s->syms, new_capacity * sizeof(elf64_sym_t));
+        if (!new_syms) {
+            s->failed = 1;
+            return 0;
+        }
+        s->syms = new_syms;
+        s->capacity = new_capacity;
+    }
+    elf64_sym_t* sym = &s->syms[s->count];
+    memset(sym, 0, sizeof(*sym));
+    sym->st_name = name ? add_string(s, name) : 0;
+    sym->st_info = (uint8_t)((bind << 4) | type);
+    sym->st_shndx = (uint16_t)shndx;
+    sym->st_value = value;
+    sym->st_size = size;
+    return s->count++;
+}
+
+static int elf_machine(pva_arch_t arch) {
+    switch (arch) {
+        case PVA_ARCH_X86_SSE:
+        case PVA_ARCH_X86_AVX2:
+        case PVA_ARCH_X86_AVX512:
+            return EM_X86_64;
+        case PVA_ARCH_ARM_NEON:
+        case PVA_ARCH_ARM_SVE:
+            return EM_AARCH64;
+        case PVA_ARCH_RISCV_RVV:
+            return EM_RISCV;
+        default:
+            return 0;
+    }
+}
+
+static uint32_t reloc_type(pva_reloc_kind_t kind) {
+    switch (kind) {
+        case PVA_RELOC_X86_PC32: return R_X86_64_PC32;
+        case PVA_RELOC_ARM_ADR_PAGE: return R_AARCH64_ADR_PREL_PG_HI21;
+        case PVA_RELOC_ARM_ADD_LO12: return R_AARCH64_ADD_ABS_LO12_NC;
+        case PVA_RELOC_RISCV_PCREL_HI20: return R_RISCV_PCREL_HI20;
+        case PVA_RELOC_RISCV_PCREL_LO12: return R_RISCV_PCREL_LO12_I;
+        default: return 0;
+    }
+}
+
+static int write_padded(FILE* fp, const void* data, size_t len, size_t* pos, size_t align) {
+    static const uint8_t zeros[64];
+    size_t pad = (align - (*pos % align)) % align;
+    if (pad && fwrite(zeros, 1, pad, fp) != pad) return -1;
+    *pos += pad;
+    if (len && fwrite(data, 1, len, fp) != len) return -1;
+    *pos += len;
+    return 0;
+}
+
+// words the generated header cannot use as names: C and C++ keywords,
+// and the types the prototype itself spells
+static const char* const reserved_words[] = {
+    "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case",
+    "catch", "char", "char16_t", "char32_t", "class", "compl", "const", "const_cast", "constexpr",
+    "continue", "decltype", "default", "delete", "do", "double", "dynamic_cast", "else", "enum",
+    "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if", "inline", "int",
+    "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+    "or_eq", "private", "protected", "public", "register", "reinterpret_cast", "restrict", "return",
+    "short", "signed", "size_t", "sizeof", "static", "static_assert", "static_cast", "struct", "switch",
+    "template", "this", "thread_local", "throw", "true", "try", "typedef", "typeid", "typename", "union",
+    "unsigned", "using", "virtual", "void", "volatile", "wchar_t", "while", "xor", "xor_eq",
+};
+
+static int reserved_word(const char* name) {
+    for (size_t i = 0; i < sizeof(reserved_words) / sizeof(reserved_words[0]); i++) {
+        if (strcmp(name, reserved_words[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// the kernel's symbol: the file name up to its first '.', with anything
+// a C identifier cannot hold replaced by '_': build/my-kernel.o -> my_kernel.
+// a keyword gets a trailing '_': int.pva -> int_
+void pva_symbol_from_path(const char* path, char* name, size_t size) {
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+
+    size_t len = 0;
+    if (*base >= '0' && *base <= '9') name[len++] = '_';
+    for (const char* c = base; *c && *c != '.' && len + 1 < size; c++) {
+        int ok = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9');
+        name[len++] = ok ? *c : '_';
+    }
+    if (len == 0) name[len++] = '_';
+    name[len] = 0;
+    if (reserved_word(name) && len + 1 < size) strcpy(name + len, "_");
+}
+
+int pva_write_elf(const char* path, const pva_module_t* mod, const pva_codebuf_t* cb,
+                  const char* name, const size_t fat_offsets[3]) {
+    int machine = elf_machine(mod->arch);
+    if (!machine) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[elf] err: unsupported architecture");
+        return -1;
+    }
+
+    symbols_t s = {0};
+    add_string(&s, "");
+    add_symbol(&s, NULL, STB_LOCAL, STT_NOTYPE, 0, 0, 0);
+    add_symbol(&s, NULL, STB_LOCAL, STT_SECTION, SEC_TEXT, 0, 0);
+    size_t rodata_sym = add_symbol(&s, NULL, STB_LOCAL, STT_SECTION, SEC_RODATA, 0, 0);
+
+    // R_RISCV_PCREL_LO12_I points at its auipc through a local label
+    size_t* pair_syms = calloc(cb->num_relocs ? cb->num_relocs : 1, sizeof(size_t));
+    if (!pair_syms) s.failed = 1;
+    for (size_t i = 0; i < cb->num_relocs && !s.failed; i++) {
+        if (cb->relocs[i].kind != PVA_RELOC_RISCV_PCREL_LO12) continue;
+        char label[32];
+        snprintf(label, sizeof(label), ".Lpcrel_hi%zu", i);
+        pair_syms[i] = add_symbol(&s, label, STB_LOCAL, STT_NOTYPE, SEC_TEXT, cb->relocs[i].pair, 0);
+    }
+
+    size_t first_global = s.count;
+    if (fat_offsets) {
+        // the resolver at offset 0 runs once when the symbol is bound
+        add_symbol(&s, name, STB_GLOBAL, STT_GNU_IFUNC, SEC_TEXT, 0, fat_offsets[0]);
+        static const char* tiers[3] = {"avx512", "avx2", "sse"};
+        for (int t = 0; t < 3; t++) {
+            char variant[PVA_MAX_BUFFER_NAME + 16];
+            snprintf(variant, sizeof(variant), "%s_%s", name, tiers[t]);
+            size_t end = t < 2 ? fat_offsets[t + 1] : cb->size;
+            add_symbol(&s, variant, STB_GLOBAL, STT_FUNC, SEC_TEXT, fat_offsets[t],
+                       end - fat_offsets[t]);
+        }
+    } else {
+        add_symbol(&s, name, STB_GLOBAL, STT_FUNC, SEC_TEXT, 0, cb->size);
+    }
+
+    elf64_rela_t* rela = calloc(cb->num_relocs ? cb->num_relocs : 1, sizeof(elf64_rela_t));
+    if (!rela) s.failed = 1;
+    for (size_t i = 0; i < cb->num_relocs && !s.failed; i++) {
+        const pva_reloc_t* r = &cb->relocs[i];
+        rela[i].r_offset = r->offset;
+        if (r->kind == PVA_RELOC_RISCV_PCREL_LO12) {
+            rela[i].r_info = ((uint64_t)pair_syms[i] << 32) | reloc_type(r->kind);
+            rela[i].r_addend = 0;
+        } else {
+            rela[i].r_info = ((uint64_t)rodata_sym << 32) | reloc_type(r->kind);
+            rela[i].r_addend = (int64_t)r->target + r->addend;
+        }
+    }
+
+    if (s.failed) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[elf] err: memory alloc failed");
+        free(pair_syms);
+        free(rela);
+        free(s.syms);
+        free(s.strtab);
+        return -1;
+    }
+
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[elf] err: failed to open output file: %s", strerror(errno));
+        free(pair_syms);
+        free(rela);
+        free(s.syms);
+        free(s.strtab);
+        return -1;
+    }
+
+    elf64_shdr_t sh[SEC_COUNT];
+    memset(sh, 0, sizeof(sh));
+    for (int i = 0; i < SEC_COUNT; i++) sh[i].sh_name = shstr_offsets[i];
+
+    size_t pos = sizeof(elf64_ehdr_t);
+    int err = fseek(fp, (long)pos, SEEK_SET);
+
+    err |= write_padded(fp, cb->data, cb->size, &pos, 64);
+    sh[SEC_TEXT].sh_type = SHT_PROGBITS;
+    sh[SEC_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    sh[SEC_TEXT].sh_offset = pos - cb->size;
+    sh[SEC_TEXT].sh_size = cb->size;
+    sh[SEC_TEXT].sh_addralign = 64;
+
+    err |= write_padded(fp, cb->rodata, cb->rodata_size, &pos, PVA_RODATA_ALIGN);
+    sh[SEC_RODATA].sh_type = SHT_PROGBITS;
+    sh[SEC_RODATA].sh_flags = SHF_ALLOC;
+    sh[SEC_RODATA].sh_offset = pos - cb->rodata_size;
+    sh[SEC_RODATA].sh_size = cb->rodata_size;
+    sh[SEC_RODATA].sh_addralign = PVA_RODATA_ALIGN;
+
+    size_t rela_size = cb->num_relocs * sizeof(elf64_rela_t);
+    err |= write_padded(fp, rela, rela_size, &pos, 8);
+    sh[SEC_RELA].sh_type = SHT_RELA;
+    sh[SEC_RELA].sh_flags = SHF_INFO_LINK;
+    sh[SEC_RELA].sh_offset = pos - rela_size;
+    sh[SEC_RELA].sh_size = rela_size;
+    sh[SEC_RELA].sh_link = SEC_SYMTAB;
+    sh[SEC_RELA].sh_info = SEC_TEXT;
+    sh[SEC_RELA].sh_addralign = 8;
+    sh[SEC_RELA].sh_entsize = sizeof(elf64_rela_t);
+
+    size_t symtab_size = s.count * sizeof(elf64_sym_t);
+    err |= write_padded(fp, s.syms, symtab_size, &pos, 8);
+    sh[SEC_SYMTAB].sh_type = SHT_SYMTAB;
+    sh[SEC_SYMTAB].sh_offset = pos - symtab_size;
+    sh[SEC_SYMTAB].sh_size = symtab_size;
+    sh[SEC_SYMTAB].sh_link = SEC_STRTAB;
+    sh[SEC_SYMTAB].sh_info = (uint32_t)first_global;
+    sh[SEC_SYMTAB].sh_addralign = 8;
+    sh[SEC_SYMTAB].sh_entsize = sizeof(elf64_sym_t);
+
+    err |= write_padded(fp, s.strtab, s.strtab_size, &pos, 1);
+    sh[SEC_STRTAB].sh_type = SHT_STRTAB;
+    sh[SEC_STRTAB].sh_offset = pos - s.strtab_size;
+    sh[SEC_STRTAB].sh_size = s.strtab_size;
+    sh[SEC_STRTAB].sh_addralign = 1;
+
+    err |= write_padded(fp, shstrtab, sizeof(shstrtab), &pos, 1);
+    sh[SEC_SHSTRTAB].sh_type = SHT_STRTAB;
+    sh[SEC_SHSTRTAB].sh_offset = pos - sizeof(shstrtab);
+    sh[SEC_SHSTRTAB].sh_size = sizeof(shstrtab);
+    sh[SEC_SHSTRTAB].sh_addralign = 1;
+
+    // empty, marks the stack non-executable
+    sh[SEC_NOTE].sh_type = SHT_PROGBITS;
+    sh[SEC_NOTE].sh_offset = pos;
+    sh[SEC_NOTE].sh_addralign = 1;
+
+    err |= write_padded(fp, sh, sizeof(sh), &pos, 8);
+    size_t shoff = pos - sizeof(sh);
+
+    elf64_ehdr_t eh;
+    memset(&eh, 0, sizeof(eh));
+    memcpy(eh.e_ident, "\x7f" "ELF", 4);
+    eh.e_ident[4] = 2;                  // ELFCLASS64
+    eh.e_ident[5] = 1;                  // little endian
+    eh.e_ident[6] = 1;                  // EV_CURRENT
+    eh.e_ident[7] = fat_offsets ? ELFOSABI_GNU : 0;
+    eh.e_type = 1;                      // ET_REL
+    eh.e_machine = (uint16_t)machine;
+    eh.e_version = 1;
+    eh.e_shoff = shoff;
+    eh.e_flags = machine == EM_RISCV ? EF_RISCV_FLOAT_ABI_DOUBLE : 0;
+    eh.e_ehsize = sizeof(elf64_ehdr_t);
+    eh.e_shentsize = sizeof(elf64_shdr_t);
+    eh.e_shnum = SEC_COUNT;
+    eh.e_shstrndx = SEC_SHSTRTAB;
+
+    err |= fseek(fp, 0, SEEK_SET);
+    if (fwrite(&eh, sizeof(eh), 1, fp) != 1) err = -1;
+    if (fclose(fp) != 0) err = -1;
+
+    free(pair_syms);
+    free(rela);
+    free(s.syms);
+    free(s.strtab);
+
+    if (err) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[elf] err: failed to write '%s'", path);
+        return -1;
+    }
+
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[elf] wrote %s: %zu bytes of code, %zu bytes of constants, %zu relocations",
+            path, cb->size, cb->rodata_size, cb->num_relocs);
+    return 0;
+}
+
+// buffer b's parameter name. n (the element count), keywords and names
+// the implementation reserves (a leading '_') get a buf_ prefix, plus
+// '_' until they clash with no other buffer; size holds the worst case
+static void param_name(const pva_module_t* mod, int b, char* out, size_t size) {
+    const char* name = mod->buffers[b];
+    if (strcmp(name, "n") != 0 && name[0] != '_' && !reserved_word(name)) {
+        snprintf(out, size, "%s", name);
+        return;
+    }
+    snprintf(out, size, "buf_%s", name);
+    for (int i = 0; i < mod->num_buffers; i++) {
+        if (strcmp(mod->buffers[i], out) == 0) {
+            strcat(out, "_");
+            i = -1;
+        }
+    }
+}
+
+// C prototype for the kernel, one pointer parameter per named buffer
+int pva_write_header(const char* path, const pva_module_t* mod, const char* name, int fat) {
+    FILE* fp = fopen(path, "w");
+    if (!fp) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[elf] err: failed to open header file: %s", strerror(errno));
+        return -1;
+    }
+
+    char guard[PVA_MAX_BUFFER_NAME + 16];
+    snprintf(guard, sizeof(guard), "PVA_%s_H", name);
+    for (char* c = guard; *c; c++) {
+        if (*c >= 'a' && *c <= 'z') *c = (char)(*c - 'a' + 'A');
+    }
+
+    fprintf(fp, "// generated by pva from %s, do not edit\n", mod->filename);
+    fprintf(fp, "#ifndef %s\n#define %s\n\n#include <stddef.h>\n\n", guard, guard);
+    fprintf(fp, "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n");
+    fprintf(fp, "// processes elements [0, n) of every buffer\n");
+    char params[PVA_MAX_BUFFERS][PVA_MAX_BUFFER_NAME + 4 + PVA_MAX_BUFFERS];
+    for (int i = 0; i < mod->num_buffers; i++) {
+        param_name(mod, i, params[i], sizeof(params[i]));
+        if (strcmp(params[i], mod->buffers[i]) != 0) {
+            fprintf(fp, "// buffer '%s' is parameter %s\n", mod->buffers[i], params[i]);
+        }
+    }
+
+    static const char* tiers[3] = {"avx512", "avx2", "sse"};
+    for (int t = 0; t < (fat ? 4 : 1); t++) {
+        if (t == 0) {
+            fprintf(fp, "void %s(size_t n", name);
+        } else {
+            fprintf(fp, "void %s_%s(size_t n", name, tiers[t - 1]);
+        }
+        for (int i = 0; i < mod->num_buffers; i++) {
+            fprintf(fp, ", float* %s", params[i]);
+        }
+        fprintf(fp, ");\n");
+    }
+
+    fprintf(fp, "\n#ifdef __cplusplus\n}\n#endif\n\n#endif\n");
+
+    if (fclose(fp) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[elf] err: failed to write '%s'", path);
+        return -1;
+    }
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[elf] wrote %s", path);
+    return 0;
+}
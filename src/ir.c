@@ -0,0 +1,173 @@
+#include "pva.h"
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// register written by instr, or -1
+int pva_instr_def(const pva_instr_t* instr) {
+    switch (instr->op) {
+        case PVA_ADD_F32:
+        case PVA_SUB_F32:
+        case PVA_MUL_F32:
+        case PVA_DIV_F32:
+        case PVA_CMP_LT_F32:
+        case PVA_CMP_EQ_F32:
+        case PVA_AND_MASK:
+        case PVA_OR_MASK:
+        case PVA_LOAD_F32:
+        case PVA_SETZERO:
+        case PVA_FMA_F32:
+        case PVA_FMS_F32:
+        case PVA_MOV_F32:
+        case PVA_REDSUM_F32:
+        case PVA_REDSUM_ORD_F32:
+        case PVA_REDMAX_F32:
+        case PVA_REDMIN_F32:
+        case PVA_CONST_F32:
+        case PVA_GATHER_F32:
+        case PVA_LOAD_STRIDED_F32:
+        case PVA_RELOAD:
+            return (int)instr->dst;
+        default:
+            return -1;
+    }
+}
+
+// loop structure markers; straight-line regions end at each of them
+int pva_instr_is_marker(const pva_instr_t* instr) {
+    return instr->op == PVA_LOOP_BEGIN || instr->op == PVA_LOOP_END || instr->op == PVA_LOOP_SPLIT;
+}
+
+// ops that take a mask operand
+int pva_op_maskable(pva_opcode_t op) {
+    switch (op) {
+        case PVA_ADD_F32:
+        case PVA_SUB_F32:
+        case PVA_MUL_F32:
+        case PVA_DIV_F32:
+        case PVA_FMA_F32:
+        case PVA_FMS_F32:
+        case PVA_MOV_F32:
+        case PVA_STORE_F32:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// horizontal reductions. they only appear outside loop_begin/loop_end: in
+// the loop they would reduce whatever lanes one iteration covers, which
+// the vector width and each target's tail decide
+int pva_op_reduction(pva_opcode_t op) {
+    return op == PVA_REDSUM_F32 || op == PVA_REDSUM_ORD_F32 || op == PVA_REDMAX_F32 ||
+           op == PVA_REDMIN_F32;
+}
+
+// ops that access a buffer, whose index is in src1
+int pva_op_memory(pva_opcode_t op) {
+    switch (op) {
+        case PVA_LOAD_F32:
+        case PVA_STORE_F32:
+        case PVA_GATHER_F32:
+        case PVA_SCATTER_F32:
+        case PVA_LOAD_STRIDED_F32:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// the operand fields instr reads registers from, so passes can rewrite
+// them in place; returns how many were written to fields[]. a masked op
+// also reads its mask and, unless it zeroes, the value the lanes off in
+// the mask keep
+int pva_instr_use_fields(pva_instr_t* instr, uint32_t* fields[PVA_MAX_USES]) {
+    int count;
+    switch (instr->op) {
+        case PVA_ADD_F32:
+        case PVA_SUB_F32:
+        case PVA_MUL_F32:
+        case PVA_DIV_F32:
+        case PVA_CMP_LT_F32:
+        case PVA_CMP_EQ_F32:
+        case PVA_AND_MASK:
+        case PVA_OR_MASK:
+            fields[0] = &instr->src1;
+            fields[1] = &instr->src2;
+            count = 2;
+            break;
+        case PVA_FMA_F32:
+        case PVA_FMS_F32:
+            fields[0] = &instr->src1;
+            fields[1] = &instr->src2;
+            fields[2] = &instr->src3;
+            count = 3;
+            break;
+        case PVA_STORE_F32:
+            fields[0] = &instr->dst;
+            count = 1;
+            break;
+        case PVA_GATHER_F32:
+            fields[0] = &instr->src2;
+            count = 1;
+            break;
+        case PVA_SCATTER_F32:
+            fields[0] = &instr->dst;
+            fields[1] = &instr->src2;
+            count = 2;
+            break;
+        case PVA_MOV_F32:
+        case PVA_REDSUM_F32:
+        case PVA_REDSUM_ORD_F32:
+        case PVA_REDMAX_F32:
+        case PVA_REDMIN_F32:
+        case PVA_SPILL:
+            fields[0] = &instr->src1;
+            count = 1;
+            break;
+        default:
+            return 0;
+    }
+
+    if (instr->mask_reg == PVA_NO_MASK || !pva_op_maskable(instr->op)) return count;
+    int merges = instr->op != PVA_STORE_F32 && instr->imm != PVA_MASK_ZERO;
+    if (merges && instr->op != PVA_FMA_F32 && instr->op != PVA_FMS_F32) fields[count++] = &instr->src3;
+    fields[count++] = &instr->mask_reg;
+    return count;
+}
+
+// registers read by instr; returns how many were written to uses[]
+int pva_instr_uses(const pva_instr_t* instr, uint32_t uses[PVA_MAX_USES]) {
+    uint32_t* fields[PVA_MAX_USES];
+    int count = pva_instr_use_fields((pva_instr_t*)instr, fields);
+    for (int u = 0; u < count; u++) uses[u] = *fields[u];
+    return count;
+}
+
+// one past the highest register number referenced
+uint32_t pva_module_num_regs(const pva_module_t* mod) {
+    uint32_t n = 0;
+    uint32_t uses[PVA_MAX_USES];
+
+    for (size_t i = 0; i < mod->size; i++) {
+        int def = pva_instr_def(&mod->code[i]);
+        if (def >= 0 && (uint32_t)def + 1 > n) n = (uint32_t)def + 1;
+
+        int count = pva_instr_uses(&mod->code[i], uses);
+        for (int u = 0; u < count; u++) {
+            if (uses[u] + 1 > n) n = uses[u] + 1;
+        }
+    }
+    return n;
+}
+
+// installs a pass's new instruction array, releasing the old one: freed
+// from the heap, or unmapped when it was a loaded .pvab file's
+void pva_module_replace_code(pva_module_t* mod, pva_instr_t* code, size_t size, size_t capacity) {
+    if (mod->code_map) munmap(mod->code_map, mod->code_map_size);
+    else free(mod->code);
+    mod->code_map = NULL;
+    mod->code_map_size = 0;
+    mod->code = code;
+    mod->size = size;
+    mod->capacity = capacity;
+}
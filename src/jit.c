@@ -0,0 +1,173 @@
+#include "pva.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// only the backend for the machine we are running on can be executed
+static int arch_is_host(pva_arch_t arch) {
+#if defined(__x86_64__)
+    return arch == PVA_ARCH_X86_SSE || arch == PVA_ARCH_X86_AVX2 ||
+           arch == PVA_ARCH_X86_AVX512;
+#elif defined(__aarch64__)
+    return arch == PVA_ARCH_ARM_NEON || arch == PVA_ARCH_ARM_SVE;
+#elif defined(__riscv)
+    return arch == PVA_ARCH_RISCV_RVV;
+#else
+    (void)arch;
+    return 0;
+#endif
+}
+
+// copies linked code into an executable mapping, reporting through mod
+static pva_jit_kernel_t* jit_map(const uint8_t* code, size_t code_size, const pva_module_t* mod,
+                                 const pva_kernel_info_t* info) {
+    pva_jit_kernel_t* kernel = calloc(1, sizeof(pva_jit_kernel_t));
+    if (!kernel) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[jit] err: memory alloc failed");
+        return NULL;
+    }
+
+    // map writable, copy, then flip to read+exec so the page is never W and X at once
+    long page = sysconf(_SC_PAGESIZE);
+    size_t map_size = (code_size + page - 1) & ~(size_t)(page - 1);
+
+    void* mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[jit] err: mmap failed: %s", strerror(errno));
+        free(kernel);
+        return NULL;
+    }
+
+    memcpy(mem, code, code_size);
+
+    if (mprotect(mem, map_size, PROT_READ | PROT_EXEC) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[jit] err: mprotect failed: %s", strerror(errno));
+        munmap(mem, map_size);
+        free(kernel);
+        return NULL;
+    }
+
+    // no-op on x86, required on ARM/RISC-V after writing code
+    __builtin___clear_cache((char*)mem, (char*)mem + code_size);
+
+    kernel->mem = mem;
+    kernel->mem_size = map_size;
+    kernel->code_size = code_size;
+    kernel->arch = mod->arch;
+    kernel->info = *info;
+    kernel->fn = (pva_kernel_fn)mem;
+
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[jit] mapped %zu bytes of code at %p", code_size, mem);
+    return kernel;
+}
+
+// links cb's constant pool and maps the result; cb is released either way
+static pva_jit_kernel_t* jit_finish(pva_codebuf_t* cb, const pva_module_t* mod,
+                                    const pva_kernel_info_t* info) {
+    pva_jit_kernel_t* kernel = NULL;
+    if (pva_codebuf_link(cb) == 0) kernel = jit_map(cb->data, cb->size, mod, info);
+    else pva_log(mod, PVA_DIAG_ERROR, 0, "[jit] err: memory alloc failed");
+    pva_codebuf_free(cb);
+    return kernel;
+}
+
+// optimize mod and emit it into cb, constant pool not yet linked
+static int jit_emit(pva_module_t* mod, pva_codebuf_t* cb) {
+    if (mod->arch == PVA_ARCH_UNKNOWN) {
+        int vec_width = 0;
+        mod->arch = pva_detect_arch(&vec_width);
+        mod->vec_width_bytes = vec_width;
+    }
+
+    if (!arch_is_host(mod->arch)) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[jit] err: target is not executable on this host");
+        return -1;
+    }
+
+    pva_optimize(mod);
+
+    if (pva_codebuf_init(cb, 4096) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[jit] err: memory alloc failed");
+        return -1;
+    }
+    if (pva_emit(mod, cb) != 0) {
+        pva_codebuf_free(cb);
+        return -1;
+    }
+    return 0;
+}
+
+pva_jit_kernel_t* pva_jit_compile(pva_module_t* mod) {
+    if (!mod) return NULL;
+
+    pva_codebuf_t cb;
+    pva_kernel_info_t info;
+    if (jit_emit(mod, &cb) != 0) return NULL;
+    pva_kernel_info(mod, &info);
+    return jit_finish(&cb, mod, &info);
+}
+
+// the key matches `pva <path> --cache-dir=...` without further options, so
+// the command line can fill the cache ahead of time
+pva_jit_kernel_t* pva_jit_compile_file_diag(const char* path, const pva_cache_t* cache,
+                                            const pva_diag_sink_t* diag) {
+    diag = pva_diag_or_print(diag);
+    pva_cache_t reporting;
+    if (cache) {
+        reporting = *cache;
+        reporting.diag = *diag;
+        cache = &reporting;
+    }
+    int vec_width = 0;
+    pva_arch_t arch = pva_detect_arch(&vec_width);
+    pva_cache_options_t opts = {arch, vec_width, 0, -1, 0, 0, 0};
+    pva_cache_key_t key;
+    pva_codebuf_t cb;
+    pva_kernel_info_t info;
+    pva_module_t* mod = NULL;
+
+    int keyed = cache && cache->dir && pva_cache_key(&key, path, &opts) == 0;
+    if (keyed && pva_cache_load(cache, &key, path, &mod, &cb, NULL, &info) == 0) {
+        pva_jit_kernel_t* kernel = jit_finish(&cb, mod, &info);
+        pva_free(mod);
+        return kernel;
+    }
+
+    mod = pva_parse_file_diag(path, 1, diag);
+    if (!mod) return NULL;
+    mod->arch = arch;
+    mod->vec_width_bytes = vec_width;
+    if (jit_emit(mod, &cb) != 0) {
+        pva_free(mod);
+        return NULL;
+    }
+    if (keyed) pva_cache_store(cache, &key, mod, &cb, NULL);
+    pva_kernel_info(mod, &info);
+    pva_jit_kernel_t* kernel = jit_finish(&cb, mod, &info);
+    pva_free(mod);
+    return kernel;
+}
+
+// reports through the cache's sink, which prints unless set
+pva_jit_kernel_t* pva_jit_compile_file(const char* path, const pva_cache_t* cache) {
+    static const pva_diag_sink_t print = {NULL, NULL, PVA_DIAG_NOTE};
+    return pva_jit_compile_file_diag(path, cache, cache ? &cache->diag : &print);
+}
+
+pva_jit_kernel_t* pva_jit_load(const pva_compiled_t* compiled) {
+    pva_module_t reporter = {.arch = compiled->arch, .diag = compiled->diag};
+    if (!arch_is_host(compiled->arch)) {
+        pva_log(&reporter, PVA_DIAG_ERROR, 0, "[jit] err: target is not executable on this host");
+        return NULL;
+    }
+    return jit_map(compiled->code.data, compiled->code.size, &reporter, &compiled->info);
+}
+
+void pva_jit_release(pva_jit_kernel_t* kernel) {
+    if (!kernel) return;
+    if (kernel->mem) munmap(kernel->mem, kernel->mem_size);
+    free(kernel);
+}
@@ -0,0 +1,250 @@
+#include "pva.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// liveness is solved over use sites, (instruction, operand) pairs, instead
+// of registers: the sites still reachable where a register is written are
+// exactly the reads of that value, which gives the def-use chains with no
+// extra analysis. register liveness is the projection of the site sets
+
+#define SITE(i, u) ((size_t)(i) * PVA_MAX_USES + (size_t)(u))
+#define NO_REG UINT32_MAX
+#define NO_SITE SIZE_MAX
+
+static void set_block(pva_block_t* block, size_t begin, size_t end, int succ0, int succ1) {
+    block->begin = begin;
+    block->end = end;
+    block->succ[0] = succ0;
+    block->succ[1] = succ1;
+}
+
+static int find_blocks(pva_liveness_t* live, const pva_module_t* mod) {
+    long begin, end;
+    if (pva_find_loop(mod, &begin, &end) != 0) return -1;
+
+    if (begin < 0) {
+        set_block(&live->blocks[0], 0, mod->size, -1, -1);
+        live->num_blocks = 1;
+        return 0;
+    }
+    // entry -> body or straight to the exit; body -> body or exit
+    set_block(&live->blocks[0], 0, (size_t)begin, 1, 2);
+    set_block(&live->blocks[1], (size_t)begin + 1, (size_t)end, 1, 2);
+    set_block(&live->blocks[2], (size_t)end + 1, mod->size, -1, -1);
+    live->num_blocks = 3;
+    return 0;
+}
+
+static int test_bit(const uint64_t* set, size_t bit) {
+    return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void set_bit(uint64_t* set, size_t bit) {
+    set[bit / 64] |= 1ull << (bit % 64);
+}
+
+static void clear_bit(uint64_t* set, size_t bit) {
+    set[bit / 64] &= ~(1ull << (bit % 64));
+}
+
+typedef struct {
+    size_t def, use;
+} chain_link_t;
+
+int pva_liveness_build(pva_liveness_t* live, const pva_module_t* mod) {
+    memset(live, 0, sizeof(*live));
+    if (find_blocks(live, mod) != 0) return -1;
+
+    int nb = live->num_blocks;
+    uint32_t nregs = pva_module_num_regs(mod);
+    size_t nsites = mod->size * PVA_MAX_USES;
+    size_t words = nsites / 64 + 1;
+    live->num_regs = nregs;
+    live->reg_words = nregs / 64 + 1;
+
+    uint32_t* site_reg = malloc((nsites ? nsites : 1) * sizeof(uint32_t));
+    size_t* reg_start = calloc((size_t)nregs + 1, sizeof(size_t));
+    size_t* reg_sites = malloc((nsites ? nsites : 1) * sizeof(size_t));
+    uint8_t* defined = malloc(nregs ? nregs : 1);
+    size_t* pending = malloc(((size_t)nregs + 1) * sizeof(size_t));
+    size_t* next_pending = malloc((nsites ? nsites : 1) * sizeof(size_t));
+    uint64_t* gen = calloc(nb * words, sizeof(uint64_t));
+    uint64_t* kill = calloc(nb * words, sizeof(uint64_t));
+    uint64_t* in = calloc(nb * words, sizeof(uint64_t));
+    uint64_t* out = calloc(nb * words, sizeof(uint64_t));
+    chain_link_t* links = NULL;
+    size_t num_links = 0, link_capacity = 0;
+    live->live_in = calloc(nb * live->reg_words, sizeof(uint64_t));
+    live->live_out = calloc(nb * live->reg_words, sizeof(uint64_t));
+    live->use_start = calloc(mod->size + 1, sizeof(size_t));
+    int result = -1;
+    if (!site_reg || !reg_start || !reg_sites || !defined || !pending || !next_pending || !gen ||
+        !kill || !in || !out ||
+        !live->live_in || !live->live_out || !live->use_start) {
+        goto out;
+    }
+
+    // which register every site reads, and the sites of every register
+    uint32_t uses[PVA_MAX_USES];
+    for (size_t i = 0; i < mod->size; i++) {
+        int count = pva_instr_uses(&mod->code[i], uses);
+        for (int u = 0; u < PVA_MAX_USES; u++) {
+            site_reg[SITE(i, u)] = u < count ? uses[u] : NO_REG;
+            if (u < count) reg_start[uses[u] + 1]++;
+        }
+    }
+    for (uint32_t r = 0; r < nregs; r++) reg_start[r + 1] += reg_start[r];
+    {
+        size_t* fill = malloc(((size_t)nregs + 1) * sizeof(size_t));
+        if (!fill) goto out;
+        memcpy(fill, reg_start, ((size_t)nregs + 1) * sizeof(size_t));
+        for (size_t s = 0; s < nsites; s++) {
+            if (site_reg[s] != NO_REG) reg_sites[fill[site_reg[s]]++] = s;
+        }
+        free(fill);
+    }
+
+    // gen: sites read before the block writes them; kill: every site of a
+    // register the block writes
+    for (int b = 0; b < nb; b++) {
+        const pva_block_t* block = &live->blocks[b];
+        memset(defined, 0, nregs ? nregs : 1);
+        for (size_t i = block->begin; i < block->end; i++) {
+            for (int u = 0; u < PVA_MAX_USES; u++) {
+                uint32_t r = site_reg[SITE(i, u)];
+                if (r != NO_REG && !defined[r]) set_bit(&gen[b * words], SITE(i, u));
+            }
+            int def = pva_instr_def(&mod->code[i]);
+            if (def >= 0) defined[def] = 1;
+        }
+        for (uint32_t r = 0; r < nregs; r++) {
+            if (!defined[r]) continue;
+            for (size_t k = reg_start[r]; k < reg_start[r + 1]; k++) set_bit(&kill[b * words], reg_sites[k]);
+        }
+    }
+
+    // backward dataflow to a fixpoint: out = U in[succ], in = gen | (out & ~kill)
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int b = nb - 1; b >= 0; b--) {
+            uint64_t* bout = &out[b * words];
+            uint64_t* bin = &in[b * words];
+            for (int k = 0; k < 2; k++) {
+                int succ = live->blocks[b].succ[k];
+                if (succ < 0) continue;
+                for (size_t w = 0; w < words; w++) bout[w] |= in[succ * words + w];
+            }
+            for (size_t w = 0; w < words; w++) {
+                uint64_t next = gen[b * words + w] | (bout[w] & ~kill[b * words + w]);
+                if (next != bin[w]) {
+                    bin[w] = next;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    // walk each block backwards from its live-out sites; a write claims the
+    // reachable sites of its register, then its own reads become reachable.
+    // the reachable sites of every register are also kept on a list, so a
+    // write visits only those and not every read of a reused register
+    for (int b = 0; b < nb; b++) {
+        const pva_block_t* block = &live->blocks[b];
+        uint64_t* cur = &out[b * words];    // consumed, `in` keeps the result
+
+        for (uint32_t r = 0; r < nregs; r++) pending[r] = NO_SITE;
+        for (size_t s = nsites; s-- > 0;) {
+            if (site_reg[s] == NO_REG) continue;
+            if (test_bit(&in[b * words], s)) set_bit(&live->live_in[b * live->reg_words], site_reg[s]);
+            if (test_bit(cur, s)) {
+                set_bit(&live->live_out[b * live->reg_words], site_reg[s]);
+                next_pending[s] = pending[site_reg[s]];
+                pending[site_reg[s]] = s;
+            }
+        }
+
+        for (size_t i = block->end; i-- > block->begin;) {
+            int def = pva_instr_def(&mod->code[i]);
+            if (def >= 0) {
+                size_t s = pending[def];
+                pending[def] = NO_SITE;
+                for (; s != NO_SITE; s = next_pending[s]) {
+                    clear_bit(cur, s);
+                    // two reads of the register by one instruction link once
+                    if (num_links > 0 && links[num_links - 1].def == i &&
+                        links[num_links - 1].use == s / PVA_MAX_USES) {
+                        continue;
+                    }
+                    if (num_links >= link_capacity) {
+                        size_t new_capacity = link_capacity ? link_capacity * 2 : 64;
+                        chain_link_t* new_links = realloc(links, new_capacity * sizeof(chain_link_t));
+                        if (!new_links) goto out;
+                        links = new_links;
+                        link_capacity = new_capacity;
+                    }
+                    links[num_links].def = i;
+                    links[num_links].use = s / PVA_MAX_USES;
+                    num_links++;
+                }
+            }
+            for (int u = 0; u < PVA_MAX_USES; u++) {
+                size_t s = SITE(i, u);
+                if (site_reg[s] == NO_REG || test_bit(cur, s)) continue;
+                set_bit(cur, s);
+                next_pending[s] = pending[site_reg[s]];
+                pending[site_reg[s]] = s;
+            }
+        }
+    }
+
+    live->use_sites = malloc((num_links ? num_links : 1) * sizeof(size_t));
+    if (!live->use_sites) goto out;
+    for (size_t l = 0; l < num_links; l++) live->use_start[links[l].def + 1]++;
+    for (size_t i = 0; i < mod->size; i++) live->use_start[i + 1] += live->use_start[i];
+    {
+        size_t* fill = malloc((mod->size + 1) * sizeof(size_t));
+        if (!fill) goto out;
+        memcpy(fill, live->use_start, (mod->size + 1) * sizeof(size_t));
+        for (size_t l = 0; l < num_links; l++) live->use_sites[fill[links[l].def]++] = links[l].use;
+        free(fill);
+    }
+    result = 0;
+
+out:
+    free(site_reg);
+    free(reg_start);
+    free(reg_sites);
+    free(defined);
+    free(pending);
+    free(next_pending);
+    free(gen);
+    free(kill);
+    free(in);
+    free(out);
+    free(links);
+    if (result != 0) pva_liveness_free(live);
+    return result;
+}
+
+int pva_live_in(const pva_liveness_t* live, int block, uint32_t reg) {
+    if (reg >= live->num_regs) return 0;
+    return test_bit(&live->live_in[block * live->reg_words], reg);
+}
+
+int pva_live_out(const pva_liveness_t* live, int block, uint32_t reg) {
+    if (reg >= live->num_regs) return 0;
+    return test_bit(&live->live_out[block * live->reg_words], reg);
+}
+
+void pva_liveness_free(pva_liveness_t* live) {
+    free(live->live_in);
+    free(live->live_out);
+    free(live->use_start);
+    free(live->use_sites);
+    live->live_in = NULL;
+    live->live_out = NULL;
+    live->use_start = NULL;
+    live->use_sites = NULL;
+}
@@ -2,31 +2,350 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s input.pva -o output.bin [-c] [--target=<name>] [--fat] [-ffp-contract=<mode>] [--unroll=<n>] [--time-passes] [-j[n]] [--emit-ir] [--load-ir] [--cache-dir=<dir>]\n", prog);
+    fprintf(stderr, "  -c         ELF object plus a C header instead of a raw code blob\n");
+    fprintf(stderr, "  --target=  sse, avx2, avx512, neon, sve or rvv (default: this CPU)\n");
+    fprintf(stderr, "  --fat      all x86 tiers in one kernel, picked by cpuid at load time;\n");
+    fprintf(stderr, "             implies -ffp-contract=off so every tier rounds the same\n");
+    fprintf(stderr, "  -ffp-contract=fast|off  fuse vmul+vadd/vsub into FMA (default: fast)\n");
+    fprintf(stderr, "  --unroll=  loop unroll factor, 1 to disable (default: picked per target);\n");
+    fprintf(stderr, "             reductions are split across that many accumulators\n");
+    fprintf(stderr, "  --time-passes  wall time, instruction counts and peak memory per stage\n");
+    fprintf(stderr, "  -j[n]      parse large sources on n threads (default n: all cores)\n");
+    fprintf(stderr, "  --emit-ir  write the parsed module to output as binary IR (.pvab)\n");
+    fprintf(stderr, "  --load-ir  input is a .pvab file; its target and options apply unless given\n");
+    fprintf(stderr, "  --cache-dir=<dir>  reuse code compiled before from the same input and\n");
+    fprintf(stderr, "             options (default: $PVA_CACHE_DIR, unset disables the cache)\n");
+    fprintf(stderr, "  --cache-size=<MiB>  evict least recently used entries past this (default: %d)\n",
+            PVA_CACHE_DEFAULT_MB);
+    fprintf(stderr, "  --batch    compile every input (paths, globs or @manifest files) into the\n");
+    fprintf(stderr, "             directory given by -o, one job per input and target on -j threads\n");
+    fprintf(stderr, "             (default: all cores); the cache and --fat are not used\n");
+    fprintf(stderr, "  --targets=<a,b,...>  --batch targets (default: --target, else this CPU)\n");
+    fprintf(stderr, "example: %s mandelbrot.pva -o mandelbrot.bin --target=avx2\n", prog);
+    fprintf(stderr, "         %s mandelbrot.pva -c -o mandelbrot.o  (defines mandelbrot())\n", prog);
+    fprintf(stderr, "         %s mandelbrot.pva --emit-ir -o mandelbrot.pvab\n", prog);
+    fprintf(stderr, "         %s --batch 'kernels/*.pva' --targets=sse,avx2,avx512 -c -o out\n", prog);
+}
+
+// --targets=: comma separated, each named once
+static int parse_targets(const char* list, pva_arch_t* targets, int max) {
+    int count = 0;
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        char name[16];
+        int vec_width;
+        if (len >= sizeof(name) || count >= max) return -1;
+        memcpy(name, list, len);
+        name[len] = 0;
+        pva_arch_t arch = pva_arch_from_name(name, &vec_width);
+        if (arch == PVA_ARCH_UNKNOWN) {
+            fprintf(stderr, "err: unknown target '%s'\n", name);
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            if (targets[i] == arch) return -1;
+        }
+        targets[count++] = arch;
+        list += len;
+        if (*list == ',') list++;
+    }
+    return count;
+}
+
+// pva_detect_arch, reporting what it found
+static pva_arch_t detect_target(int* vec_width) {
+    pva_arch_t arch = pva_detect_arch(vec_width);
+    switch (arch) {
+        case PVA_ARCH_X86_AVX512: printf("[detect_arch] detected AVX-512 support\n"); break;
+        case PVA_ARCH_X86_AVX2: printf("[detect_arch] detected AVX2 support\n"); break;
+        case PVA_ARCH_X86_SSE: printf("[detect_arch] detected SSE4.2 support\n"); break;
+        case PVA_ARCH_ARM_SVE: printf("[detect_arch] detected ARM SVE support\n"); break;
+        case PVA_ARCH_ARM_NEON: printf("[detect_arch] detected ARM NEON support\n"); break;
+        case PVA_ARCH_RISCV_RVV: printf("[detect_arch] detected RISC-V RVV support\n"); break;
+        default: printf("[detect_arch] unknown architecture, using scalar fallback\n");
+    }
+    return arch;
+}
+
+// the raw code blob, or with -c an ELF object plus its header; cached
+// builds have no instruction count to report
+static int write_output(const char* output, int object, int fat, pva_module_t* mod,
+                        pva_codebuf_t* cb, const size_t fat_offsets[3], int cached) {
+    if (object) {
+        char name[PVA_MAX_BUFFER_NAME];
+        pva_symbol_from_path(output, name, sizeof(name));
+
+        // header next to the object: out/kernel.o -> out/kernel.h
+        size_t len = strlen(output);
+        char* header = malloc(len + 3);
+        if (!header) {
+            fprintf(stderr, "err: memory alloc failed\n");
+            return -1;
+        }
+        strcpy(header, output);
+        char* dot = strrchr(header, '.');
+        if (!dot || strchr(dot, '/')) dot = header + len;
+        strcpy(dot, ".h");
+
+        int ret = pva_write_elf(output, mod, cb, name, fat ? fat_offsets : NULL);
+        if (ret == 0) ret = pva_write_header(header, mod, name, fat);
+
+        if (ret == 0) {
+            printf("\ncompiled successfully!\n");
+            printf("    object: %s (symbol %s, %zu bytes of code)\n", output, name, cb->size);
+            printf("    header: %s\n", header);
+            if (cached) printf("    from cache\n");
+            else printf("    instructions: %zu\n", mod->size);
+        }
+        free(header);
+        return ret;
+    }
+
+    if (pva_codebuf_link(cb) != 0) {
+        fprintf(stderr, "err: failed to resolve constant pool references\n");
+        return -1;
+    }
+
+    FILE* outfp = fopen(output, "wb");
+    if (!outfp) {
+        perror("err: failed to open output file");
+        return -1;
+    }
+
+    size_t written = fwrite(cb->data, 1, cb->size, outfp);
+    fclose(outfp);
+
+    printf("\ncompiled successfully!\n");
+    printf("    output: %s (%zu bytes)\n", output, written);
+    if (cached) printf("    from cache\n");
+    else printf("    instructions: %zu\n", mod->size);
+    return 0;
+}
 
 int main(int argc, char** argv) {
-    if (argc < 4 || strcmp(argv[2], "-o") != 0) {
-        fprintf(stderr, "usage: %s input.pva -o output.bin\n", argv[0]);
-        fprintf(stderr, "example: %s mandelbrot.pva -o mandelbrot.bin\n", argv[0]);
+    const char* input = NULL;
+    const char* output = NULL;
+    const char* target = NULL;
+    int fat = 0;
+    int object = 0;
+    int fp_contract = -1;   // -1, and unroll 0: keep the module's own
+    int unroll = 0;
+    int time_passes = 0;
+    int jobs = 0;           // -j, 0 when not given
+    int emit_ir = 0;
+    int load_ir = 0;
+    pva_cache_t cache = {getenv("PVA_CACHE_DIR"), (uint64_t)PVA_CACHE_DEFAULT_MB << 20,
+                         {NULL, NULL, PVA_DIAG_NOTE}};
+    int batch = 0;
+    const char* target_list = NULL;
+    const char** inputs = malloc((size_t)argc * sizeof(char*));
+    int num_inputs = 0;
+    if (!inputs) {
+        fprintf(stderr, "err: memory alloc failed\n");
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strncmp(argv[i], "--target=", 9) == 0) {
+            target = argv[i] + 9;
+        } else if (strcmp(argv[i], "--fat") == 0) {
+            fat = 1;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            object = 1;
+        } else if (strcmp(argv[i], "-ffp-contract=fast") == 0 || strcmp(argv[i], "-ffp-contract=on") == 0) {
+            fp_contract = 1;
+        } else if (strcmp(argv[i], "-ffp-contract=off") == 0) {
+            fp_contract = 0;
+        } else if (strncmp(argv[i], "--unroll=", 9) == 0) {
+            char* end;
+            long factor = strtol(argv[i] + 9, &end, 10);
+            if (*end || factor < 1 || factor > PVA_MAX_UNROLL) {
+                fprintf(stderr, "err: --unroll takes 1 to %d\n", PVA_MAX_UNROLL);
+                return 1;
+            }
+            unroll = (int)factor;
+        } else if (strcmp(argv[i], "--emit-ir") == 0) {
+            emit_ir = 1;
+        } else if (strcmp(argv[i], "--load-ir") == 0) {
+            load_ir = 1;
+        } else if (strncmp(argv[i], "--cache-dir=", 12) == 0) {
+            cache.dir = argv[i][12] ? argv[i] + 12 : NULL;
+        } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+            char* end;
+            unsigned long long mb = strtoull(argv[i] + 13, &end, 10);
+            if (*end || argv[i][13] == 0 || mb == 0 || mb > (UINT64_MAX >> 20)) {
+                fprintf(stderr, "err: --cache-size takes a positive number of MiB\n");
+                return 1;
+            }
+            cache.max_bytes = (uint64_t)mb << 20;
+        } else if (strcmp(argv[i], "--time-passes") == 0) {
+            time_passes = 1;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            long n = sysconf(_SC_NPROCESSORS_ONLN);
+            if (argv[i][2]) {
+                char* end;
+                n = strtol(argv[i] + 2, &end, 10);
+                if (*end || n < 1 || n > PVA_MAX_JOBS) {
+                    fprintf(stderr, "err: -j takes 1 to %d\n", PVA_MAX_JOBS);
+                    return 1;
+                }
+            }
+            jobs = n < 1 ? 1 : n > PVA_MAX_JOBS ? PVA_MAX_JOBS : (int)n;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = 1;
+        } else if (strncmp(argv[i], "--targets=", 10) == 0) {
+            target_list = argv[i] + 10;
+        } else if (argv[i][0] != '-') {
+            inputs[num_inputs++] = argv[i];
+        } else {
+            usage(argv[0]);
+            free(inputs);
+            return 1;
+        }
+    }
+
+    if (batch) {
+        pva_arch_t targets[PVA_ARCH_RISCV_RVV + 1];
+        int num_targets = 1;
+        int vec_width;
+        if (target_list) {
+            num_targets = parse_targets(target_list, targets, PVA_ARCH_RISCV_RVV + 1);
+        } else if (target) {
+            targets[0] = pva_arch_from_name(target, &vec_width);
+            if (targets[0] == PVA_ARCH_UNKNOWN) num_targets = -1;
+        } else {
+            targets[0] = detect_target(&vec_width);
+        }
+        if (num_targets < 1 || !output || fat || emit_ir || load_ir || time_passes) {
+            if (num_targets < 1) fprintf(stderr, "err: --targets takes distinct target names\n");
+            usage(argv[0]);
+            free(inputs);
+            return 1;
+        }
+        pva_batch_t opts = {inputs, num_inputs, targets, num_targets, output, object, fp_contract, unroll,
+                            jobs ? jobs : (int)sysconf(_SC_NPROCESSORS_ONLN)};
+        int ret = pva_batch_compile(&opts);
+        free(inputs);
+        return ret != 0;
+    }
+
+    input = num_inputs == 1 ? inputs[0] : NULL;
+    free(inputs);
+    if (!input || !output || target_list) {
+        usage(argv[0]);
         return 1;
     }
+    if (jobs == 0) jobs = 1;
+
+    // check support
+    int vec_width = 0;
+    pva_arch_t arch;
+    if (target) {
+        arch = pva_arch_from_name(target, &vec_width);
+        if (arch == PVA_ARCH_UNKNOWN) {
+            fprintf(stderr, "err: unknown target '%s'\n", target);
+            usage(argv[0]);
+            return 1;
+        }
+        if (fat && arch != PVA_ARCH_X86_SSE && arch != PVA_ARCH_X86_AVX2 &&
+            arch != PVA_ARCH_X86_AVX512) {
+            fprintf(stderr, "err: --fat only covers the x86 targets\n");
+            return 1;
+        }
+    } else if (fat) {
+        arch = PVA_ARCH_X86_AVX512;
+        vec_width = 64;
+    } else if (!load_ir) {
+        arch = detect_target(&vec_width);
+    } else {
+        arch = PVA_ARCH_UNKNOWN;    // the one the .pvab file records
+    }
+
+    // parse source file, or map binary IR
+    pva_timer_t timer = {0};
+    pva_timer_t* timing = time_passes ? &timer : NULL;
 
-    printf("[parser] parsing: %s\n", argv[1]);
+    // a cache hit stands in for parsing, optimization and code generation
+    pva_cache_key_t key;
+    if (emit_ir) cache.dir = NULL;
+    if (cache.dir) {
+        pva_cache_options_t opts = {arch, vec_width, target != NULL, fp_contract, unroll, fat, load_ir};
+        if (opts.arch == PVA_ARCH_UNKNOWN) opts.arch = detect_target(&opts.vec_width_bytes);
 
-    // parse source file
-    pva_module_t* mod = pva_parse_file(argv[1]);
+        pva_timer_begin(timing, "cache lookup", PVA_TIMER_NONE);
+        pva_module_t* cached = NULL;
+        pva_codebuf_t cb;
+        size_t fat_offsets[3];
+        if (pva_cache_key(&key, input, &opts) != 0) cache.dir = NULL;
+        int hit = cache.dir && pva_cache_load(&cache, &key, input, &cached, &cb, fat_offsets, NULL) == 0;
+        pva_timer_end(timing, PVA_TIMER_NONE);
+
+        if (hit) {
+            pva_timer_report(timing);
+            int ret = write_output(output, object, fat, cached, &cb, fat_offsets, 1);
+            pva_codebuf_free(&cb);
+            pva_free(cached);
+            return ret != 0;
+        }
+    }
+
+    pva_module_t* mod;
+    if (load_ir) {
+        printf("[ir] loading: %s\n", input);
+        pva_timer_begin(timing, "load ir", PVA_TIMER_NONE);
+        mod = pva_load_ir(input);
+    } else {
+        printf("[parser] parsing: %s\n", input);
+        pva_timer_begin(timing, "parse", PVA_TIMER_NONE);
+        mod = pva_parse_file_parallel(input, jobs);
+    }
     if (!mod) {
-        fprintf(stderr, "err: failed to parse %s\n", argv[1]);
+        fprintf(stderr, "err: failed to %s %s\n", load_ir ? "load" : "parse", input);
         return 1;
     }
+    pva_timer_end(timing, mod->size);
+    mod->timer = timing;
 
     printf("parser]     parsed %zu instructions\n\n", mod->size);
 
-    // check support
-    int vec_width = 0;
-    mod->arch = pva_detect_arch(&vec_width);
+    // without --target a loaded module keeps the one it was written for
+    if (load_ir && arch == PVA_ARCH_UNKNOWN) {
+        if (mod->arch != PVA_ARCH_UNKNOWN) {
+            arch = mod->arch;
+            vec_width = mod->vec_width_bytes;
+        } else {
+            arch = detect_target(&vec_width);
+        }
+    }
+    mod->arch = arch;
     mod->vec_width_bytes = vec_width;
+    if (fp_contract >= 0) mod->fp_contract = fp_contract;
+    if (unroll) mod->unroll = unroll;
+    // SSE has no FMA, so a contracted op would round differently there than
+    // on the other tiers, and the result would depend on the CPU
+    if (fat && mod->fp_contract) {
+        if (fp_contract == 1) fprintf(stderr, "warning: --fat turns -ffp-contract off\n");
+        mod->fp_contract = 0;
+    }
 
-    printf("CPU architecture:\n");
+    if (emit_ir) {
+        int ret = pva_write_ir(output, mod);
+        pva_timer_report(timing);
+        if (ret == 0) {
+            printf("\nwrote IR successfully!\n");
+            printf("    output: %s (%s, %zu instructions)\n", output, pva_arch_name(mod->arch), mod->size);
+        }
+        pva_free(mod);
+        return ret != 0;
+    }
+
+    printf("%s:\n", fat ? "target architecture (fat, best of)" : "target architecture");
     switch (mod->arch) {
         case PVA_ARCH_X86_AVX512:
             printf("  target: x86-64 AVX-512\n");
@@ -62,42 +381,31 @@ int main(int argc, char** argv) {
     }
 
     // apply IR optimizations
+    printf("\n");
     pva_optimize(mod);
 
     // gen binary output
     printf("\n");
-    uint8_t buffer[8192] = {0};
-
-    if (mod->arch == PVA_ARCH_X86_AVX512 || 
-        mod->arch == PVA_ARCH_X86_AVX2 || 
-        mod->arch == PVA_ARCH_X86_SSE) {
-        pva_emit_x86(mod, buffer);
-    } else if (mod->arch == PVA_ARCH_ARM_SVE || 
-               mod->arch == PVA_ARCH_ARM_NEON) {
-        pva_emit_arm(mod, buffer);
-    } else if (mod->arch == PVA_ARCH_RISCV_RVV) {
-        pva_emit_riscv(mod, buffer);
-    } else {
-        fprintf(stderr, "err: unsupported or unknown architecture\n");
+    pva_codebuf_t cb;
+    if (pva_codebuf_init(&cb, 4096) != 0) {
+        fprintf(stderr, "err: memory alloc failed\n");
         pva_free(mod);
         return 1;
     }
 
-    // output
-    FILE* outfp = fopen(argv[3], "wb");
-    if (!outfp) {
-        perror("err: failed to open output file");
+    size_t fat_offsets[3];
+    int ret = fat ? pva_emit_x86_fat(mod, &cb, fat_offsets) : pva_emit(mod, &cb);
+    if (ret != 0) {
+        pva_codebuf_free(&cb);
         pva_free(mod);
         return 1;
     }
+    pva_timer_report(timing);
 
-    size_t written = fwrite(buffer, 1, sizeof(buffer), outfp);
-    fclose(outfp);
-
-    printf("\ncompiled successfully!\n");
-    printf("    output: %s (%zu bytes)\n", argv[3], written);
-    printf("    instructions: %zu\n", mod->size);
+    if (cache.dir) pva_cache_store(&cache, &key, mod, &cb, fat ? fat_offsets : NULL);
 
+    ret = write_output(output, object, fat, mod, &cb, fat_offsets, 0);
+    pva_codebuf_free(&cb);
     pva_free(mod);
-    return 0;
-}
\ No newline at end of file
+    return ret != 0;
+}
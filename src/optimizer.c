@@ -1,218 +1,482 @@
 #include "pva.h"
-#include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 
 // uhh not too ready
 
-typedef struct {
-    pva_opcode_t op;
-    uint8_t src1;
-    uint8_t src2;
-} instr_key_t;
+// automatic unrolling stops here; more copies rarely pay for the code size
+#define AUTO_UNROLL_MAX 4
 
-typedef struct {
-    int start_idx;
-    int length;
-    pva_opcode_t pattern[3];  // LOAD COMPUTE STORE
-} FusiblePattern;
+static int target_has_fma(pva_arch_t arch) {
+    // the SSE tier predates FMA3; everything else fuses natively
+    return arch != PVA_ARCH_X86_SSE && arch != PVA_ARCH_UNKNOWN;
+}
 
-static int find_fusible_patterns(pva_module_t* mod, FusiblePattern* patterns, int max_patterns) {
-    int count = 0;
-    
-    for (size_t i = 0; i < mod->size - 2 && count < max_patterns; i++) {
-        // pattern: LOAD -> COMPUTE -> STORE
-        if (mod->code[i].op == PVA_LOAD_F32 &&
-            (mod->code[i+1].op >= PVA_ADD_F32 && mod->code[i+1].op <= PVA_DIV_F32) &&
-            mod->code[i+2].op == PVA_STORE_F32) {
-            
-            // check data flow: LOAD dst must match COMPUTE src1
-            if (mod->code[i].dst == mod->code[i+1].src1 ||
-                mod->code[i].dst == mod->code[i+1].src2) {
-                
-                patterns[count].start_idx = i;
-                patterns[count].length = 3;
-                patterns[count].pattern[0] = PVA_LOAD_F32;
-                patterns[count].pattern[1] = mod->code[i+1].op;
-                patterns[count].pattern[2] = PVA_STORE_F32;
-                count++;
+// contract t = a * b followed by the only use of t, c + t / t + c / c - t,
+// into one fma/fms. the product moves down to the add, so a and b must not
+// be redefined in between and no loop marker may separate the two
+static void contract_multiply_add(pva_module_t* mod) {
+    uint32_t nregs = pva_module_num_regs(mod);
+    size_t n_alloc = nregs ? nregs : 1;
+    int* defs = calloc(n_alloc, sizeof(int));
+    int* uses_left = calloc(n_alloc, sizeof(int));
+    long* last_def = malloc(n_alloc * sizeof(long));
+    if (!defs || !uses_left || !last_def) {
+        free(defs);
+        free(uses_left);
+        free(last_def);
+        return;
+    }
+
+    uint32_t uses[PVA_MAX_USES];
+    for (size_t i = 0; i < mod->size; i++) {
+        int def = pva_instr_def(&mod->code[i]);
+        if (def >= 0) defs[def]++;
+        int count = pva_instr_uses(&mod->code[i], uses);
+        for (int u = 0; u < count; u++) uses_left[uses[u]]++;
+    }
+    for (uint32_t r = 0; r < nregs; r++) last_def[r] = -1;
+
+    long last_marker = -1;
+    int contracted = 0;
+
+    for (size_t j = 0; j < mod->size; j++) {
+        pva_instr_t* instr = &mod->code[j];
+
+        if (pva_instr_is_marker(instr)) {
+            last_marker = (long)j;
+            continue;
+        }
+
+        if ((instr->op == PVA_ADD_F32 || instr->op == PVA_SUB_F32) && instr->mask_reg == PVA_NO_MASK) {
+            // sub can only absorb its subtrahend: c - a * b
+            for (int k = instr->op == PVA_ADD_F32 ? 0 : 1; k < 2; k++) {
+                uint32_t t = k == 0 ? instr->src1 : instr->src2;
+                uint32_t c = k == 0 ? instr->src2 : instr->src1;
+                if (defs[t] != 1 || uses_left[t] != 1 || last_def[t] <= last_marker) continue;
+
+                pva_instr_t* mul = &mod->code[last_def[t]];
+                if (mul->op != PVA_MUL_F32 || mul->mask_reg != PVA_NO_MASK) continue;
+                if (last_def[mul->src1] > last_def[t] || last_def[mul->src2] > last_def[t]) continue;
+
+                instr->op = instr->op == PVA_ADD_F32 ? PVA_FMA_F32 : PVA_FMS_F32;
+                instr->src1 = mul->src1;
+                instr->src2 = mul->src2;
+                instr->src3 = c;
+                mul->op = PVA_NOP;
+                contracted++;
+                break;
             }
         }
+
+        int def = pva_instr_def(instr);
+        if (def >= 0) last_def[def] = (long)j;
+    }
+
+    size_t write_idx = 0;
+    for (size_t i = 0; i < mod->size; i++) {
+        if (mod->code[i].op != PVA_NOP) mod->code[write_idx++] = mod->code[i];
+    }
+    mod->size = write_idx;
+
+    free(defs);
+    free(uses_left);
+    free(last_def);
+
+    if (contracted > 0) {
+        pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer]     contracted %d multiply-adds", contracted);
     }
-    
-    return count;
 }
 
+// mark and sweep over def-use chains: stores and loop markers are roots,
+// and a definition lives if one of its uses does. values feeding only each
+// other around the back edge (a dead accumulator) are never marked
 static void eliminate_dead_code(pva_module_t* mod) {
-    // track which registers are actually used
-    int reg_used[16] = {0};
-    
-    // mark registers used in output operations
+    pva_liveness_t live;
+    if (pva_liveness_build(&live, mod) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[optimizer] err: liveness analysis failed");
+        return;
+    }
+
+    uint8_t* keep = calloc(mod->size ? mod->size : 1, 1);
+    if (!keep) {
+        pva_liveness_free(&live);
+        return;
+    }
     for (size_t i = 0; i < mod->size; i++) {
-        if (mod->code[i].op == PVA_STORE_F32) {
-            reg_used[mod->code[i].dst] = 1;
-        }
+        keep[i] = mod->code[i].op == PVA_STORE_F32 || mod->code[i].op == PVA_SCATTER_F32 ||
+                  pva_instr_is_marker(&mod->code[i]);
     }
-    
-    // backtrack to find dependencies
+
+    // uses point backwards only through the loop, so a few sweeps settle
     int changed = 1;
     while (changed) {
         changed = 0;
-        for (int i = (int)mod->size - 1; i >= 0; i--) {
-            if (reg_used[mod->code[i].dst]) {
-                // If destination is used, mark sources as used
-                if (mod->code[i].src1 < 16) {
-                    if (!reg_used[mod->code[i].src1]) {
-                        reg_used[mod->code[i].src1] = 1;
-                        changed = 1;
-                    }
-                }
-                if (mod->code[i].src2 < 16) {
-                    if (!reg_used[mod->code[i].src2]) {
-                        reg_used[mod->code[i].src2] = 1;
-                        changed = 1;
-                    }
+        for (size_t i = mod->size; i-- > 0;) {
+            if (keep[i] || pva_instr_def(&mod->code[i]) < 0) continue;
+            for (size_t k = live.use_start[i]; k < live.use_start[i + 1]; k++) {
+                if (keep[live.use_sites[k]]) {
+                    keep[i] = 1;
+                    changed = 1;
+                    break;
                 }
             }
         }
     }
-    
-    // remopve instructions whose destinations are never used
+
     size_t write_idx = 0;
     int removed = 0;
-    
     for (size_t i = 0; i < mod->size; i++) {
-        int is_dead = 0;
-        
-        // STORE and LOAD always keep (side effects)
-        if (mod->code[i].op != PVA_STORE_F32 && mod->code[i].op != PVA_LOAD_F32) {
-            if (!reg_used[mod->code[i].dst]) {
-                is_dead = 1;
-                removed++;
-            }
-        }
-        
-        if (!is_dead) {
+        if (keep[i]) {
             mod->code[write_idx++] = mod->code[i];
+        } else {
+            removed++;
         }
     }
-    
     mod->size = write_idx;
-    
+
+    free(keep);
+    pva_liveness_free(&live);
+
     if (removed > 0) {
-        printf("[optimizer]     removed %d dead code instructions\n", removed);
+        pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer]     removed %d dead code instructions", removed);
     }
 }
 
+// SSA round trip: value numbering removes recomputed values and copies
+static void number_values(pva_module_t* mod) {
+    pva_ssa_t ssa;
+    if (pva_ssa_build(mod, &ssa) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[optimizer] err: SSA construction failed");
+        return;
+    }
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer]     %u SSA values, %zu loop phis", ssa.num_names, ssa.num_phis);
 
-#define HASH_TABLE_SIZE 1024
+    int removed = pva_gvn(mod, &ssa);
+    if (pva_ssa_destroy(mod, &ssa) != 0 || removed < 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[optimizer] err: value numbering failed");
+        return;
+    }
+    if (removed > 0) {
+        pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer]     removed %d redundant values", removed);
+    }
+}
 
-static size_t hash_instr_key(const instr_key_t *key) {
-    return (key->op * 31 + key->src1 * 17 + key->src2) % HASH_TABLE_SIZE;
+// longest chain of true dependencies in mod->code[begin, end)
+static int region_chain(pva_module_t* mod, size_t begin, size_t end) {
+    pva_dag_t dag;
+    if (end <= begin || pva_dag_build(&dag, mod, begin, end) != 0) return 0;
+    int chain = pva_dag_longest_chain(&dag);
+    pva_dag_free(&dag);
+    return chain;
 }
 
-void combine_commutative_ops(pva_module_t* mod) {
-    int combined = 0;
-    pva_instr_t *hash_table[HASH_TABLE_SIZE];
-    memset(hash_table, 0, sizeof(hash_table));
+// longest chain of true dependencies in any straight-line region
+int calculate_instruction_level_parallelism(pva_module_t* mod) {
+    int max_chain = 0;
+    size_t begin = 0;
 
-    for (size_t i = 0; i < mod->size; i++) {
-        pva_instr_t *instr = &mod->code[i];
+    for (size_t i = 0; i <= mod->size; i++) {
+        if (i < mod->size && !pva_instr_is_marker(&mod->code[i])) continue;
+        int chain = region_chain(mod, begin, i);
+        if (chain > max_chain) max_chain = chain;
+        begin = i + 1;
+    }
 
-        if (instr->op != PVA_ADD_F32 && instr->op != PVA_MUL_F32)
-            continue;
+    return max_chain;
+}
 
-        instr_key_t key1 = {instr->op, instr->src1, instr->src2};
-        instr_key_t key2 = {instr->op, instr->src2, instr->src1}; // commutative order
+// acc = acc + x, acc - x, a * b + acc or acc - a * b, with acc read nowhere
+// else in the instruction. under a mask the lanes off in it must keep acc
+static int accumulates(const pva_instr_t* instr, uint32_t acc) {
+    if (instr->dst != acc) return 0;
+    if (instr->mask_reg != PVA_NO_MASK &&
+        (instr->imm == PVA_MASK_ZERO || instr->src3 != acc || instr->mask_reg == acc)) {
+        return 0;
+    }
+    switch (instr->op) {
+        case PVA_ADD_F32: return (instr->src1 == acc) != (instr->src2 == acc);
+        case PVA_SUB_F32: return instr->src1 == acc && instr->src2 != acc;
+        case PVA_FMA_F32:
+        case PVA_FMS_F32: return instr->src3 == acc && instr->src1 != acc && instr->src2 != acc;
+        default: return 0;
+    }
+}
 
-        size_t h1 = hash_instr_key(&key1);
-        size_t h2 = hash_instr_key(&key2);
+// copies k > 0 of the body rename everything the body writes: temporaries
+// get fresh registers, accumulators get an independent chain each.
+// values carried to the next iteration or read after the loop keep their
+// register so the first copy can also run on its own
+typedef struct {
+    uint32_t nregs;
+    uint8_t* is_acc;
+    uint8_t* renamed;
+    uint32_t* maps;     // register r in copy k: maps[k * nregs + r]
+    int num_accs, num_renamed, live_through;
+} unroll_plan_t;
+
+static void free_plan(unroll_plan_t* plan) {
+    free(plan->is_acc);
+    free(plan->renamed);
+    free(plan->maps);
+}
 
-        pva_instr_t *found = NULL;
+static int plan_unroll(pva_module_t* mod, long begin, long end, unroll_plan_t* plan) {
+    pva_liveness_t live;
+    if (pva_liveness_build(&live, mod) != 0) return -1;
+
+    uint32_t nregs = pva_module_num_regs(mod);
+    size_t n_alloc = nregs ? nregs : 1;
+    plan->nregs = nregs;
+    plan->is_acc = calloc(n_alloc, 1);
+    plan->renamed = calloc(n_alloc, 1);
+    plan->maps = NULL;
+    uint8_t* defined = calloc(n_alloc, 1);
+    uint8_t* other_use = calloc(n_alloc, 1);
+    if (!plan->is_acc || !plan->renamed || !defined || !other_use) {
+        free_plan(plan);
+        free(defined);
+        free(other_use);
+        pva_liveness_free(&live);
+        return -1;
+    }
 
-        if (hash_table[h1] &&
-            ((hash_table[h1]->src1 == instr->src1 && hash_table[h1]->src2 == instr->src2) ||
-             (hash_table[h1]->src1 == instr->src2 && hash_table[h1]->src2 == instr->src1)) ) {
-            found = hash_table[h1];
-        } else if (hash_table[h2] &&
-            ((hash_table[h2]->src1 == instr->src1 && hash_table[h2]->src2 == instr->src2) ||
-             (hash_table[h2]->src1 == instr->src2 && hash_table[h2]->src2 == instr->src1)) ) {
-            found = hash_table[h2];
+    uint32_t uses[PVA_MAX_USES];
+    for (long i = begin + 1; i < end; i++) {
+        const pva_instr_t* instr = &mod->code[i];
+        int def = pva_instr_def(instr);
+        int acc_update = def >= 0 && accumulates(instr, (uint32_t)def);
+        int count = pva_instr_uses(instr, uses);
+        for (int u = 0; u < count; u++) {
+            if (!acc_update || uses[u] != (uint32_t)def) other_use[uses[u]] = 1;
         }
-
-        if (found) {
-            // replace result register with existing computed register
-            instr->op = PVA_NOP; // mark as removed
-            instr->dst = 0;
-            instr->src1 = 0;
-            instr->src2 = 0;
-            combined++;
-        } else {
-            // insert into hash table
-            hash_table[h1] = instr;
+        if (def >= 0) {
+            defined[def] = 1;
+            if (!acc_update) other_use[def] = 1;
         }
     }
 
-    if (combined > 0) {
-        printf("[optimizer] found and removed %d common subexpressions\n", combined);
+    plan->num_accs = plan->num_renamed = plan->live_through = 0;
+    for (uint32_t r = 0; r < nregs; r++) {
+        if (pva_live_in(&live, 1, r) && !defined[r]) plan->live_through++;
+        if (!defined[r]) continue;
+        if (pva_live_in(&live, 1, r) && !other_use[r]) {
+            plan->is_acc[r] = 1;
+            plan->num_accs++;
+        } else if (!pva_live_out(&live, 1, r)) {
+            plan->renamed[r] = 1;
+            plan->num_renamed++;
+        }
     }
+
+    free(defined);
+    free(other_use);
+    pva_liveness_free(&live);
+    return 0;
 }
 
-int calculate_instruction_level_parallelism(pva_module_t* mod) {
-    int max_chain = 0;
-    int current_chain = 1;
-    int last_dst = -1;
+// enough independent chains to cover the FP latency: a body whose longest
+// chain is `chain` out of `len` instructions overlaps len / chain of them
+// by itself. bounded by what fits in registers without spilling
+static int pick_unroll_factor(pva_module_t* mod, long begin, long end, const unroll_plan_t* plan) {
+    int len = (int)(end - begin - 1);
+    int chain = region_chain(mod, (size_t)begin + 1, (size_t)end);
+    if (len <= 0 || chain <= 0 || plan->num_accs == 0) return 1;
+
+    int want = (pva_sched_fp_parallelism(mod->arch) * chain + len - 1) / len;
+    int per_copy = plan->num_accs + plan->num_renamed;
+    int fit = (pva_regalloc_num_regs(mod->arch) - plan->live_through) / (per_copy ? per_copy : 1);
+    int factor = want < fit ? want : fit;
+    if (factor > AUTO_UNROLL_MAX) factor = AUTO_UNROLL_MAX;
+    return factor < 1 ? 1 : factor;
+}
 
-    for (size_t i = 0; i < mod->size; i++) {
-        int has_dependency = 0;
+static void emit_op(pva_instr_t* code, size_t* size, pva_opcode_t op, uint32_t dst, uint32_t src1,
+                    uint32_t src2) {
+    pva_instr_t instr = {0};
+    instr.op = op;
+    instr.dst = dst;
+    instr.src1 = src1;
+    instr.src2 = src2;
+    instr.mask_reg = PVA_NO_MASK;
+    code[(*size)++] = instr;
+}
 
-        if (last_dst >= 0 &&
-            (mod->code[i].src1 == last_dst || mod->code[i].src2 == last_dst)) {
-            has_dependency = 1;
-        }
+static int unroll_loop(pva_module_t* mod) {
+    long begin, end;
+    if (pva_find_loop(mod, &begin, &end) != 0 || begin < 0 || end - begin < 2) return 0;
 
-        if (has_dependency) {
-            current_chain++;
+    if (mod->arch == PVA_ARCH_ARM_SVE || mod->arch == PVA_ARCH_RISCV_RVV) {
+        // copies would sit one run-time vector length apart
+        if (mod->unroll > 1) {
+            pva_log(mod, PVA_DIAG_WARNING, 0, "[optimizer] warning: --unroll=%d ignored, %s vectors are "
+                    "scalable and not unrolled", mod->unroll, pva_arch_name(mod->arch));
         } else {
-            if (current_chain > max_chain) max_chain = current_chain;
-            current_chain = 1;
+            pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer]     no unrolling for scalable vectors");
         }
+        return 0;
+    }
 
-        last_dst = mod->code[i].dst;
+    if (mod->unroll == 1) return 0;
+    unroll_plan_t plan;
+    if (plan_unroll(mod, begin, end, &plan) != 0) return -1;
+    int factor = mod->unroll ? mod->unroll : pick_unroll_factor(mod, begin, end, &plan);
+    if (factor == 1) {
+        free_plan(&plan);
+        return 0;
     }
 
-    if (current_chain > max_chain) max_chain = current_chain;
-    return max_chain;
+    size_t body = (size_t)(end - begin - 1);
+    size_t new_size = mod->size + body * (factor - 1) + 1 + 2 * (size_t)plan.num_accs * (factor + 1);
+    pva_instr_t* code = malloc(new_size * sizeof(pva_instr_t));
+    plan.maps = malloc((size_t)factor * (plan.nregs ? plan.nregs : 1) * sizeof(uint32_t));
+    if (!code || !plan.maps) {
+        free(code);
+        free_plan(&plan);
+        return -1;
+    }
+
+    uint32_t next = plan.nregs;
+    for (int k = 0; k < factor; k++) {
+        for (uint32_t r = 0; r < plan.nregs; r++) {
+            int fresh = k > 0 && (plan.is_acc[r] || plan.renamed[r]);
+            plan.maps[(size_t)k * plan.nregs + r] = fresh ? next++ : r;
+        }
+    }
+
+    size_t n = 0;
+    memcpy(code, mod->code, (size_t)begin * sizeof(pva_instr_t));
+    n = (size_t)begin;
+
+    // the extra chains start from zero, the original keeps the entry value
+    for (uint32_t r = 0; r < plan.nregs; r++) {
+        if (!plan.is_acc[r]) continue;
+        for (int k = 1; k < factor; k++) emit_op(code, &n, PVA_SETZERO, plan.maps[(size_t)k * plan.nregs + r], 0, 0);
+    }
+
+    code[n++] = mod->code[begin];
+    for (int k = 0; k < factor; k++) {
+        const uint32_t* map = &plan.maps[(size_t)k * plan.nregs];
+        for (long i = begin + 1; i < end; i++) {
+            pva_instr_t instr = mod->code[i];
+            uint32_t* fields[PVA_MAX_USES];
+            int count = pva_instr_use_fields(&instr, fields);
+            for (int u = 0; u < count; u++) *fields[u] = map[*fields[u]];
+            if (pva_instr_def(&instr) >= 0) instr.dst = map[instr.dst];
+            if (instr.op == PVA_LOAD_F32 || instr.op == PVA_STORE_F32 || instr.op == PVA_LOAD_STRIDED_F32) {
+                instr.vec_offset += (uint32_t)k;
+            }
+            code[n++] = instr;
+        }
+        if (k == 0) {
+            pva_instr_t split = {0};
+            split.op = PVA_LOOP_SPLIT;
+            split.imm = (uint32_t)factor;
+            split.mask_reg = PVA_NO_MASK;
+            code[n++] = split;
+        }
+    }
+    code[n++] = mod->code[end];
+
+    // fold the extra chains pairwise, then into the original register as
+    // acc - (0 - sum): a plain add would turn an entry value of -0 into +0
+    // when the unrolled loop never ran and the extra chains are still zero
+    for (uint32_t r = 0; r < plan.nregs; r++) {
+        if (!plan.is_acc[r]) continue;
+        for (int stride = 1; 1 + stride < factor; stride *= 2) {
+            for (int k = 1; k + stride < factor; k += 2 * stride) {
+                uint32_t into = plan.maps[(size_t)k * plan.nregs + r];
+                emit_op(code, &n, PVA_ADD_F32, into, into, plan.maps[(size_t)(k + stride) * plan.nregs + r]);
+            }
+        }
+        uint32_t negated = next++;
+        emit_op(code, &n, PVA_SETZERO, negated, 0, 0);
+        emit_op(code, &n, PVA_SUB_F32, negated, negated, plan.maps[plan.nregs + r]);
+        emit_op(code, &n, PVA_SUB_F32, r, r, negated);
+    }
+
+    memcpy(&code[n], &mod->code[end + 1], (mod->size - (size_t)end - 1) * sizeof(pva_instr_t));
+    n += mod->size - (size_t)end - 1;
+
+    pva_module_replace_code(mod, code, n, new_size);
+
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer]     unrolled loop %dx, %d accumulator%s split", factor,
+            plan.num_accs, plan.num_accs == 1 ? "" : "s");
+    free_plan(&plan);
+    return 0;
 }
 
+// rewrite a * 2.0 as a + a, the constant being a vconst that is the only
+// definition of its register and comes before the multiply
 void strength_reduce(pva_module_t* mod) {
-    int reductions = 0;
+    uint32_t nregs = pva_module_num_regs(mod);
+    size_t n_alloc = nregs ? nregs : 1;
+    int* defs = calloc(n_alloc, sizeof(int));
+    long* last_def = malloc(n_alloc * sizeof(long));
+    if (!defs || !last_def) {
+        free(defs);
+        free(last_def);
+        return;
+    }
 
     for (size_t i = 0; i < mod->size; i++) {
-        pva_instr_t *instr = &mod->code[i];
-        
-        // skull emoji
-        if (instr->op == PVA_MUL_F32 && instr->imm == 2) {
-            // replace vmul dst, src, #2 with vadd dst, src, src
-            instr->op = PVA_ADD_F32;
-            instr->src2 = instr->src1;
-            instr->imm = 0;
-            reductions++;
+        int def = pva_instr_def(&mod->code[i]);
+        if (def >= 0) defs[def]++;
+    }
+    for (uint32_t r = 0; r < nregs; r++) last_def[r] = -1;
+
+    float two = 2.0f;
+    uint32_t two_bits;
+    memcpy(&two_bits, &two, sizeof(two_bits));
+
+    int reductions = 0;
+    for (size_t i = 0; i < mod->size; i++) {
+        pva_instr_t* instr = &mod->code[i];
+
+        if (instr->op == PVA_MUL_F32) {
+            // a mask and its merge source carry over to the add unchanged
+            for (int k = 0; k < 2; k++) {
+                uint32_t c = k == 0 ? instr->src2 : instr->src1;
+                uint32_t x = k == 0 ? instr->src1 : instr->src2;
+                if (defs[c] != 1 || last_def[c] < 0) continue;
+                const pva_instr_t* konst = &mod->code[last_def[c]];
+                if (konst->op != PVA_CONST_F32 || konst->imm != two_bits) continue;
+
+                instr->op = PVA_ADD_F32;
+                instr->src1 = x;
+                instr->src2 = x;
+                reductions++;
+                break;
+            }
         }
+
+        int def = pva_instr_def(instr);
+        if (def >= 0) last_def[def] = (long)i;
     }
+    free(defs);
+    free(last_def);
 
     if (reductions > 0) {
-        printf("[optimizer] applied %d strength reductions\n", reductions);
+        pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] applied %d strength reductions", reductions);
     }
 }
 
 void pva_optimize(pva_module_t* mod) {
     if (!mod || mod->size == 0) return;
+    // the parser rejects these; a module built or loaded otherwise is left
+    // for pva_emit to refuse
+    long begin, end;
+    if (pva_find_loop(mod, &begin, &end) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[optimizer] err: loop_begin/loop_end do not pair up, or nest");
+        return;
+    }
 
-    printf("\n[optimizer] starting optimization pass...\n");
-    printf("[optimizer] input: %zu instructions\n", mod->size);
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] starting optimization pass...");
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] input: %zu instructions", mod->size);
 
     // Pass 1: remove NOPs
-    printf("[optimizer] pass 1: removing NOPs...\n");
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] pass 1: removing NOPs...");
+    pva_timer_begin(mod->timer, "NOP removal", mod->size);
     size_t write_idx = 0;
     int nop_count = 0;
     
@@ -226,34 +490,57 @@ void pva_optimize(pva_module_t* mod) {
     
     mod->size = write_idx;
     if (nop_count > 0) {
-        printf("[optimizer]     removed %d NOPs\n", nop_count);
+        pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer]     removed %d NOPs", nop_count);
     }
+    pva_timer_end(mod->timer, mod->size);
 
     // Pass 2: dead code elimination
-    printf("[optimizer] pass 2: dead code elimination...\n");
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] pass 2: dead code elimination...");
+    pva_timer_begin(mod->timer, "dead code elimination", mod->size);
     eliminate_dead_code(mod);
-
-    // Pass 3: detect fusible patterns
-    printf("[optimizer] pass 3: instruction fusion analysis...\n");
-    FusiblePattern patterns[256];
-    int pattern_count = find_fusible_patterns(mod, patterns, 256);
-    if (pattern_count > 0) {
-        printf("[optimizer]     found %d fusible patterns (LOAD->COMPUTE->STORE)\n", pattern_count);
+    pva_timer_end(mod->timer, mod->size);
+
+    // Pass 3: global value numbering in SSA form
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] pass 3: global value numbering...");
+    pva_timer_begin(mod->timer, "global value numbering", mod->size);
+    number_values(mod);
+    pva_timer_end(mod->timer, mod->size);
+
+    // Pass 4: fuse vmul into the vadd/vsub consuming it
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] pass 4: multiply-add contraction...");
+    pva_timer_begin(mod->timer, "multiply-add contraction", mod->size);
+    if (mod->fp_contract && target_has_fma(mod->arch)) {
+        contract_multiply_add(mod);
     }
-
-    // Pass 4: common subexpression elimination 
-    printf("[optimizer] pass 4: common subexpression elimination?...\n");
-    combine_commutative_ops(mod);
+    pva_timer_end(mod->timer, mod->size);
 
     // Pass 5: instruction level parallelism analysis
-    printf("[optimizer] pass 5: parallelism analysis...\n");
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] pass 5: parallelism analysis...");
+    pva_timer_begin(mod->timer, "parallelism analysis", mod->size);
     int max_chain = calculate_instruction_level_parallelism(mod);
-    printf("[optimizer]   max dependency chain: %d instructions\n", max_chain);
+    pva_timer_end(mod->timer, mod->size);
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer]   max dependency chain: %d instructions", max_chain);
+
+    // Pass 6: unroll the loop into independent accumulator chains
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] pass 6: loop unrolling...");
+    pva_timer_begin(mod->timer, "loop unrolling", mod->size);
+    if (unroll_loop(mod) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[optimizer] err: loop unrolling failed");
+    }
+    pva_timer_end(mod->timer, mod->size);
 
-    // Pass 6: strength reduction 
-    printf("[optimizer] pass 6: strength reduction...\n");
+    // Pass 7: strength reduction 
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] pass 7: strength reduction...");
+    pva_timer_begin(mod->timer, "strength reduction", mod->size);
     strength_reduce(mod);
+    pva_timer_end(mod->timer, mod->size);
+
+    // Pass 8: list scheduling against the target's latencies
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] pass 8: instruction scheduling...");
+    pva_timer_begin(mod->timer, "instruction scheduling", mod->size);
+    pva_schedule(mod);
+    pva_timer_end(mod->timer, mod->size);
 
-    printf("[optimizer] optimization complete!\n");
-    printf("[optimizer] output: %zu instructions\n", mod->size);
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] optimization complete!");
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer] output: %zu instructions", mod->size);
 }
\ No newline at end of file
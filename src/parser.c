@@ -2,92 +2,531 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// the source is read in place, followed by at least SCAN_PAD zero bytes:
+// the terminator, and slack so the scanners below can always load a whole
+// vector without checking where the input ends
+#define SCAN_PAD 64
 
+typedef struct {
+    char* data;
+    size_t size;
+    size_t map_size;    // 0 when data came from malloc
+} pva_source_t;
+
+// regular files are mapped over an anonymous reservation one padding
+// larger, so the bytes after the file read as zero without a copy. pipes
+// and other streams, or a failed mapping, are read into memory instead
+static int source_open(pva_source_t* src, const char* filename) {
+    memset(src, 0, sizeof(*src));
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        long page = sysconf(_SC_PAGESIZE);
+        size_t size = (size_t)st.st_size;
+        size_t map_size = (size + SCAN_PAD + page - 1) & ~(size_t)(page - 1);
+        char* base = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base != MAP_FAILED) {
+            if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED) {
+                madvise(base, size, MADV_SEQUENTIAL);
+                close(fd);
+                src->data = base;
+                src->size = size;
+                src->map_size = map_size;
+                return 0;
+            }
+            munmap(base, map_size);
+        }
+    }
+
+    size_t capacity = 1 << 16;
+    src->data = malloc(capacity + SCAN_PAD);
+    while (src->data) {
+        ssize_t got = read(fd, src->data + src->size, capacity - src->size);
+        if (got < 0) break;
+        if (got == 0) {
+            memset(src->data + src->size, 0, SCAN_PAD);
+            close(fd);
+            return 0;
+        }
+        src->size += (size_t)got;
+        if (src->size == capacity) {
+            capacity *= 2;
+            char* grown = realloc(src->data, capacity + SCAN_PAD);
+            if (!grown) break;
+            src->data = grown;
+        }
+    }
+    free(src->data);
+    src->data = NULL;
+    close(fd);
+    return -1;
+}
+
+static void source_close(pva_source_t* src) {
+    if (src->map_size) munmap(src->data, src->map_size);
+    else free(src->data);
+    src->data = NULL;
+}
+
+// byte-class scanning, a whole vector of bytes per step. the stop sets
+// all include the zero terminator, so a scan never runs past the input
+#if defined(__AVX2__)
+#define SCAN_WIDTH 32
+typedef __m256i scan_vec_t;
+#define scan_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define scan_eq(v, c) _mm256_cmpeq_epi8((v), _mm256_set1_epi8(c))
+#define scan_or(a, b) _mm256_or_si256((a), (b))
+#define scan_mask(v) ((uint32_t)_mm256_movemask_epi8(v))
+// unsigned v <= ' ': every blank, the newline and the terminator
+#define scan_le_space(v) _mm256_cmpeq_epi8(_mm256_min_epu8((v), _mm256_set1_epi8(' ')), (v))
+#elif defined(__SSE2__)
+#define SCAN_WIDTH 16
+typedef __m128i scan_vec_t;
+#define scan_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define scan_eq(v, c) _mm_cmpeq_epi8((v), _mm_set1_epi8(c))
+#define scan_or(a, b) _mm_or_si128((a), (b))
+#define scan_mask(v) ((uint32_t)_mm_movemask_epi8(v))
+#define scan_le_space(v) _mm_cmpeq_epi8(_mm_min_epu8((v), _mm_set1_epi8(' ')), (v))
+#endif
+
+// first '\n' or terminator at or after p
+static const char* scan_newline(const char* p) {
+#ifdef SCAN_WIDTH
+    for (;; p += SCAN_WIDTH) {
+        scan_vec_t v = scan_load(p);
+        uint32_t hit = scan_mask(scan_or(scan_eq(v, '\n'), scan_eq(v, 0)));
+        if (hit) return p + __builtin_ctz(hit);
+    }
+#else
+    while (*p && *p != '\n') p++;
+    return p;
+#endif
+}
+
+// end of the instruction text on the line at p: the first '\n', '#' or
+// terminator
+static const char* scan_line(const char* p) {
+#ifdef SCAN_WIDTH
+    for (;; p += SCAN_WIDTH) {
+        scan_vec_t v = scan_load(p);
+        uint32_t hit = scan_mask(scan_or(scan_or(scan_eq(v, '\n'), scan_eq(v, '#')), scan_eq(v, 0)));
+        if (hit) return p + __builtin_ctz(hit);
+    }
+#else
+    while (*p && *p != '\n' && *p != '#') p++;
+    return p;
+#endif
+}
+
+// end of the token at p: the first blank, control byte, ',', a bracket or
+// a brace (a token never reaches past its line, '#' and '\n' end it too)
+static const char* scan_token(const char* p) {
+#ifdef SCAN_WIDTH
+    for (;; p += SCAN_WIDTH) {
+        scan_vec_t v = scan_load(p);
+        scan_vec_t punct = scan_or(scan_or(scan_eq(v, ','), scan_eq(v, '[')),
+                                   scan_or(scan_eq(v, ']'), scan_eq(v, '#')));
+        punct = scan_or(punct, scan_or(scan_eq(v, '{'), scan_eq(v, '}')));
+        uint32_t hit = scan_mask(scan_or(scan_le_space(v), punct));
+        if (hit) return p + __builtin_ctz(hit);
+    }
+#else
+    while ((unsigned char)*p > ' ' && *p != ',' && *p != '[' && *p != ']' && *p != '#' && *p != '{' &&
+           *p != '}') {
+        p++;
+    }
+    return p;
+#endif
+}
+
+// one line's instruction text, [pos, end)
 typedef struct {
     const char *input;
-    int pos;
-    int line;
-    int col;
+    size_t pos;
+    size_t end;
 } pva_lexer_t;
 
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int is_name_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || is_digit(c) || c == '_';
+}
+
+// a '#' between a comma and a number is an immediate (vbroadcast r1,
+// #-0.5), any other starts a comment. text is where the line begins
+static int is_immediate(const char *text, const char *hash) {
+    const char *c = hash;
+    while (c > text && is_blank(c[-1])) c--;
+    if (c == text || c[-1] != ',') return 0;
+    const char *p = hash + 1;
+    if (*p == '+' || *p == '-') p++;
+    if (*p == '.') p++;
+    return is_digit(*p);
+}
+
 static void lexer_skip_whitespace(pva_lexer_t *lex) {
-    while (lex->input[lex->pos] && isspace(lex->input[lex->pos])) {
-        if (lex->input[lex->pos] == '\n') {
-            lex->line++;
-            lex->col = 0;
-        } else {
-            lex->col++;
-        }
-        lex->pos++;
-    }
+    while (lex->pos < lex->end && is_blank(lex->input[lex->pos])) lex->pos++;
 }
 
+// next character on the line, 0 at its end
 static int lexer_peek(pva_lexer_t *lex) {
     lexer_skip_whitespace(lex);
-    return lex->input[lex->pos];
+    return lex->pos < lex->end ? lex->input[lex->pos] : 0;
 }
 
-static char* lexer_read_token(pva_lexer_t *lex, char *buffer, int max_len) {
+// the token at the cursor, in place; its length is 0 at the end of the line
+static const char* lexer_read_token(pva_lexer_t *lex, size_t *len) {
     lexer_skip_whitespace(lex);
-    
-    int i = 0;
-    while (i < max_len - 1 && lex->input[lex->pos] && 
-           !isspace(lex->input[lex->pos]) && 
-           lex->input[lex->pos] != ',' &&
-           lex->input[lex->pos] != '[' &&
-           lex->input[lex->pos] != ']' &&
-           lex->input[lex->pos] != '#') {
-        buffer[i++] = lex->input[lex->pos++];
-        lex->col++;
+    const char *token = &lex->input[lex->pos];
+    size_t token_end = (size_t)(scan_token(token) - lex->input);
+    if (token_end > lex->end) token_end = lex->end;
+    *len = token_end - lex->pos;
+    lex->pos = token_end;
+    return token;
+}
+
+// virtual registers: r0, r1, ... with no upper bound besides int range,
+// the register allocator maps them onto the target
+static int parse_register(const char *token, size_t len) {
+    if (len < 2 || token[0] != 'r') return -1;
+
+    unsigned long reg = 0;
+    for (size_t i = 1; i < len; i++) {
+        if (!is_digit(token[i])) return -1;
+        reg = reg * 10 + (unsigned long)(token[i] - '0');
+        if (reg >= PVA_MAX_REGS) return -1;
     }
-    buffer[i] = 0;
-    return buffer;
+    return (int)reg;
 }
 
 static int lexer_read_register(pva_lexer_t *lex) {
-    char token[16];
-    lexer_read_token(lex, token, sizeof(token));
-    
-    if (token[0] != 'r') return -1;
-    if (!isdigit(token[1])) return -1;
-    
-    int reg = atoi(&token[1]);
-    if (reg < 0 || reg > 15) return -1;
-    
-    return reg;
-}
-
-static pva_opcode_t map_opcode(const char *opname) {
-    if (strcmp(opname, "vadd") == 0) return PVA_ADD_F32;
-    if (strcmp(opname, "vsub") == 0) return PVA_SUB_F32;
-    if (strcmp(opname, "vmul") == 0) return PVA_MUL_F32;
-    if (strcmp(opname, "vdiv") == 0) return PVA_DIV_F32;
-    if (strcmp(opname, "vload") == 0) return PVA_LOAD_F32;
-    if (strcmp(opname, "vstore") == 0) return PVA_STORE_F32;
-    if (strcmp(opname, "vlt") == 0) return PVA_CMP_LT_F32;
-    if (strcmp(opname, "veq") == 0) return PVA_CMP_EQ_F32;
-    if (strcmp(opname, "vand") == 0) return PVA_AND_MASK;
-    if (strcmp(opname, "vor") == 0) return PVA_OR_MASK;
-    if (strcmp(opname, "vzero") == 0) return PVA_SETZERO;
-    if (strcmp(opname, "loop_begin") == 0) return PVA_LOOP_BEGIN;
-    if (strcmp(opname, "loop_end") == 0) return PVA_LOOP_END;
-    return PVA_NOP;
-}
-
-static pva_instr_t parse_instruction_line(pva_lexer_t *lex, int line_num) {
+    size_t len;
+    const char *token = lexer_read_token(lex, &len);
+    return parse_register(token, len);
+}
+
+// distinct buffer names one chunk may use; the module's PVA_MAX_BUFFERS
+// is applied when the chunks are merged, in first-use order
+#define CHUNK_MAX_NAMES 64
+
+// loop_begin, loop_end, and the reductions that may not sit between them
+typedef struct {
+    int line;
+    pva_opcode_t op;
+    size_t index;       // the instruction's slot in the chunk's code
+} pva_loop_mark_t;
+
+typedef struct {
+    int line;
+    size_t offset;      // into the chunk's diag_text
+} pva_chunk_diag_t;
+
+// a run of whole lines parsed on its own: -j splits the source into
+// several, a sequential parse is one. buffer operands hold an index into
+// the chunk's names until the merge renumbers them
+typedef struct {
+    const char *begin, *end;
+    int first_line;
+    size_t lines;
+    pva_instr_t *code;  // the chunk's slice of the module's code
+    size_t size;
+    char names[CHUNK_MAX_NAMES][PVA_MAX_BUFFER_NAME];
+    int name_lines[CHUNK_MAX_NAMES];    // first use, for the merge's diagnostics
+    int num_names;
+    pva_loop_mark_t *loops;
+    size_t num_loops, loop_capacity;
+    size_t newlines;
+    int truncated;      // the input ends inside this chunk
+    int errors;
+    int failed;         // out of memory
+    pva_chunk_diag_t *diags;
+    size_t num_diags, diag_capacity;
+    char *diag_text;    // the messages, each with its terminator
+    size_t diag_size, diag_text_capacity;
+} pva_chunk_t;
+
+// reports on the chunk's behalf. the messages are kept until the merge
+// hands them to the module's sink, so they come out in source order
+// whichever chunk finished first
+static void chunk_error(pva_chunk_t *chunk, int line_num, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+static void chunk_error(pva_chunk_t *chunk, int line_num, const char *fmt, ...) {
+    char text[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+    if (len < 0) return;
+    if ((size_t)len >= sizeof(text)) len = sizeof(text) - 1;
+
+    if (chunk->num_diags >= chunk->diag_capacity) {
+        size_t capacity = chunk->diag_capacity ? chunk->diag_capacity * 2 : 16;
+        pva_chunk_diag_t *diags = realloc(chunk->diags, capacity * sizeof(pva_chunk_diag_t));
+        if (!diags) {
+            chunk->failed = 1;
+            return;
+        }
+        chunk->diags = diags;
+        chunk->diag_capacity = capacity;
+    }
+    if (chunk->diag_size + (size_t)len + 1 > chunk->diag_text_capacity) {
+        size_t capacity = chunk->diag_text_capacity ? chunk->diag_text_capacity * 2 : 1024;
+        while (capacity < chunk->diag_size + (size_t)len + 1) capacity *= 2;
+        char *grown = realloc(chunk->diag_text, capacity);
+        if (!grown) {
+            chunk->failed = 1;
+            return;
+        }
+        chunk->diag_text = grown;
+        chunk->diag_text_capacity = capacity;
+    }
+    chunk->diags[chunk->num_diags].line = line_num;
+    chunk->diags[chunk->num_diags].offset = chunk->diag_size;
+    chunk->num_diags++;
+    memcpy(chunk->diag_text + chunk->diag_size, text, (size_t)len + 1);
+    chunk->diag_size += (size_t)len + 1;
+}
+
+// chunk-local index for name, registering it on first use
+static int lookup_buffer(pva_chunk_t *chunk, const char *name, int line_num) {
+    for (int i = 0; i < chunk->num_names; i++) {
+        if (strcmp(chunk->names[i], name) == 0) return i;
+    }
+    if (chunk->num_names >= CHUNK_MAX_NAMES) {
+        chunk_error(chunk, line_num, "[parser] line %d: too many buffer names (max %d)", line_num,
+                    CHUNK_MAX_NAMES);
+        return -1;
+    }
+    strcpy(chunk->names[chunk->num_names], name);
+    chunk->name_lines[chunk->num_names] = line_num;
+    return chunk->num_names++;
+}
+
+// '[' and the buffer name after it; returns the chunk-local buffer index
+static int lexer_read_buffer(pva_lexer_t *lex, pva_chunk_t *chunk, int line_num) {
+    if (lexer_peek(lex) != '[') {
+        chunk_error(chunk, line_num, "[parser] line %d: expected '[buffer]'", line_num);
+        return -1;
+    }
+    lex->pos++;
+
+    char name[PVA_MAX_BUFFER_NAME];
+    lexer_skip_whitespace(lex);
+    int len = 0;
+    while (lex->pos < lex->end && is_name_char(lex->input[lex->pos])) {
+        if (len == PVA_MAX_BUFFER_NAME - 1) {
+            chunk_error(chunk, line_num, "[parser] line %d: buffer name too long", line_num);
+            return -1;
+        }
+        name[len++] = lex->input[lex->pos++];
+    }
+    name[len] = 0;
+    if (len == 0 || is_digit(name[0])) {
+        chunk_error(chunk, line_num, "[parser] line %d: expected buffer name", line_num);
+        return -1;
+    }
+    return lookup_buffer(chunk, name, line_num);
+}
+
+static int lexer_read_close(pva_lexer_t *lex, pva_chunk_t *chunk, int line_num) {
+    if (lexer_peek(lex) != ']') {
+        chunk_error(chunk, line_num, "[parser] line %d: expected ']'", line_num);
+        return -1;
+    }
+    lex->pos++;
+    return 0;
+}
+
+// decimal, or hex after an explicit 0x; a leading zero is not octal
+static long parse_integer(const char *p, char **end) {
+    const char *digits = (*p == '-' || *p == '+') ? p + 1 : p;
+    int hex = digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X');
+    return strtol(p, end, hex ? 16 : 10);
+}
+
+// memory operand: [name], [name + offset] or [name - offset], offset in bytes
+static int lexer_read_address(pva_lexer_t *lex, pva_chunk_t *chunk, pva_instr_t *instr, int line_num) {
+    int buffer = lexer_read_buffer(lex, chunk, line_num);
+    if (buffer < 0) return -1;
+
+    long offset = 0;
+    int c = lexer_peek(lex);
+    if (c == '+' || c == '-') {
+        lex->pos++;
+        lexer_skip_whitespace(lex);
+        char *end = NULL;
+        if (lex->pos < lex->end && is_digit(lex->input[lex->pos])) {
+            offset = parse_integer(&lex->input[lex->pos], &end);
+        }
+        if (!end || offset > INT32_MAX) {
+            chunk_error(chunk, line_num, "[parser] line %d: expected byte offset", line_num);
+            return -1;
+        }
+        lex->pos = (size_t)(end - lex->input);
+        if (c == '-') offset = -offset;
+    }
+    if (lexer_read_close(lex, chunk, line_num) != 0) return -1;
+
+    instr->src1 = (uint32_t)buffer;
+    instr->imm = (uint32_t)(int32_t)offset;
+    return 0;
+}
+
+// indexed operand of vgather/vscatter: [name + rN] or [name + rN*4], the
+// register holding one element (or byte) index per lane
+static int lexer_read_indexed(pva_lexer_t *lex, pva_chunk_t *chunk, pva_instr_t *instr, int line_num) {
+    int buffer = lexer_read_buffer(lex, chunk, line_num);
+    if (buffer < 0) return -1;
+
+    int reg = -1;
+    if (lexer_peek(lex) == '+') {
+        lex->pos++;
+        lexer_skip_whitespace(lex);
+        size_t start = lex->pos;
+        while (lex->pos < lex->end && is_name_char(lex->input[lex->pos])) lex->pos++;
+        reg = parse_register(&lex->input[start], lex->pos - start);
+    }
+    if (reg < 0) {
+        chunk_error(chunk, line_num, "[parser] line %d: expected '+ register' index", line_num);
+        return -1;
+    }
+
+    uint32_t scale = 1;
+    if (lexer_peek(lex) == '*') {
+        lex->pos++;
+        lexer_skip_whitespace(lex);
+        scale = lex->pos < lex->end ? (uint32_t)(lex->input[lex->pos++] - '0') : 0;
+        if ((scale != 1 && scale != 4) || (lex->pos < lex->end && is_name_char(lex->input[lex->pos]))) {
+            chunk_error(chunk, line_num, "[parser] line %d: index scale must be 1 or 4", line_num);
+            return -1;
+        }
+    }
+    if (lexer_read_close(lex, chunk, line_num) != 0) return -1;
+
+    instr->src1 = (uint32_t)buffer;
+    instr->src2 = (uint32_t)reg;
+    instr->imm = scale;
+    return 0;
+}
+
+// optional mask after the first operand, AVX-512 style: {rN} names the
+// register a vlt/veq (or vand/vor of them) left the mask in, and a
+// following {z} zeroes the lanes off in it instead of letting them keep
+// the destination's old value
+static int lexer_read_mask(pva_lexer_t *lex, pva_chunk_t *chunk, pva_instr_t *instr, int line_num,
+                           const char *opname, size_t len) {
+    if (lexer_peek(lex) != '{') return 0;
+    if (!pva_op_maskable(instr->op)) {
+        chunk_error(chunk, line_num, "[parser] line %d: '%.*s' takes no mask", line_num, (int)len, opname);
+        return -1;
+    }
+    lex->pos++;
+    int reg = lexer_read_register(lex);
+    if (reg < 0 || lexer_peek(lex) != '}') {
+        chunk_error(chunk, line_num, "[parser] line %d: expected mask register in braces", line_num);
+        return -1;
+    }
+    lex->pos++;
+    instr->mask_reg = (uint32_t)reg;
+
+    if (lexer_peek(lex) != '{') return 0;
+    lex->pos++;
+    size_t zlen;
+    const char *z = lexer_read_token(lex, &zlen);
+    if (zlen != 1 || *z != 'z' || lexer_peek(lex) != '}') {
+        chunk_error(chunk, line_num, "[parser] line %d: expected {z}", line_num);
+        return -1;
+    }
+    lex->pos++;
+    if (instr->op == PVA_STORE_F32) {
+        chunk_error(chunk, line_num, "[parser] line %d: a masked vstore cannot zero", line_num);
+        return -1;
+    }
+    instr->imm = PVA_MASK_ZERO;
+    return 0;
+}
+
+// mnemonics by a perfect hash of their length and second, third and last
+// characters. entries are placed with the same macro, so a new mnemonic
+// that collides shows up as -Woverride-init (part of -Wextra) when
+// building; the multipliers then need picking again
+#define OPCODE_HASH_SIZE 64
+#define OPCODE_HASH(len, c1, c2, last) (((c1) + 3 * (c2) + 6 * (last) + (len)) & (OPCODE_HASH_SIZE - 1))
+#define OPCODE(name, c1, c2, last, op) \
+    [OPCODE_HASH(sizeof(name) - 1, c1, c2, last)] = {name, sizeof(name) - 1, op}
+
+static const struct {
+    const char *name;
+    size_t len;
+    pva_opcode_t op;
+} opcode_table[OPCODE_HASH_SIZE] = {
+    OPCODE("vadd", 'a', 'd', 'd', PVA_ADD_F32),
+    OPCODE("vsub", 's', 'u', 'b', PVA_SUB_F32),
+    OPCODE("vmul", 'm', 'u', 'l', PVA_MUL_F32),
+    OPCODE("vdiv", 'd', 'i', 'v', PVA_DIV_F32),
+    OPCODE("vfma", 'f', 'm', 'a', PVA_FMA_F32),
+    OPCODE("vfms", 'f', 'm', 's', PVA_FMS_F32),
+    OPCODE("vmov", 'm', 'o', 'v', PVA_MOV_F32),
+    OPCODE("vload", 'l', 'o', 'd', PVA_LOAD_F32),
+    OPCODE("vstore", 's', 't', 'e', PVA_STORE_F32),
+    OPCODE("vlt", 'l', 't', 't', PVA_CMP_LT_F32),
+    OPCODE("veq", 'e', 'q', 'q', PVA_CMP_EQ_F32),
+    OPCODE("vand", 'a', 'n', 'd', PVA_AND_MASK),
+    OPCODE("vor", 'o', 'r', 'r', PVA_OR_MASK),
+    OPCODE("vzero", 'z', 'e', 'o', PVA_SETZERO),
+    OPCODE("vredsum", 'r', 'e', 'm', PVA_REDSUM_F32),
+    OPCODE("vredsum.ord", 'r', 'e', 'd', PVA_REDSUM_ORD_F32),
+    OPCODE("vredmax", 'r', 'e', 'x', PVA_REDMAX_F32),
+    OPCODE("vredmin", 'r', 'e', 'n', PVA_REDMIN_F32),
+    OPCODE("vbroadcast", 'b', 'r', 't', PVA_CONST_F32),
+    OPCODE("vconst", 'c', 'o', 't', PVA_CONST_F32),
+    OPCODE("vgather", 'g', 'a', 'r', PVA_GATHER_F32),
+    OPCODE("vscatter", 's', 'c', 'r', PVA_SCATTER_F32),
+    OPCODE("vload.strided", 'l', 'o', 'd', PVA_LOAD_STRIDED_F32),
+    OPCODE("loop_begin", 'o', 'o', 'n', PVA_LOOP_BEGIN),
+    OPCODE("loop_end", 'o', 'o', 'd', PVA_LOOP_END),
+};
+
+static pva_opcode_t map_opcode(const char *opname, size_t len) {
+    if (len < 3) return PVA_NOP;
+    unsigned char c1 = (unsigned char)opname[1], c2 = (unsigned char)opname[2];
+    unsigned char last = (unsigned char)opname[len - 1];
+    size_t slot = OPCODE_HASH(len, c1, c2, last);
+    if (opcode_table[slot].len != len || memcmp(opcode_table[slot].name, opname, len) != 0) return PVA_NOP;
+    return opcode_table[slot].op;
+}
+
+static pva_instr_t parse_instruction_line(pva_lexer_t *lex, pva_chunk_t *chunk, int line_num) {
     pva_instr_t instr = {0};
     instr.op = PVA_NOP;
-    instr.mask_reg = -1;
+    instr.mask_reg = PVA_NO_MASK;
 
-    char opname[32];
-    lexer_read_token(lex, opname, sizeof(opname));
+    size_t len;
+    const char *opname = lexer_read_token(lex, &len);
     
-    if (strlen(opname) == 0) return instr;
+    if (len == 0) return instr;
     
-    pva_opcode_t op = map_opcode(opname);
+    pva_opcode_t op = map_opcode(opname, len);
     if (op == PVA_NOP) {
-        fprintf(stderr, "[parser] line %d: unknown opcode '%s'\n", line_num, opname);
+        chunk_error(chunk, line_num, "[parser] line %d: unknown opcode '%.*s'", line_num, (int)len, opname);
         return instr;
     }
 
@@ -102,20 +541,27 @@ static pva_instr_t parse_instruction_line(pva_lexer_t *lex, int line_num) {
         case PVA_CMP_EQ_F32:
         case PVA_AND_MASK:
         case PVA_OR_MASK: {
-            // format: dst, src1, src2
+            // format: dst, src1, src2 (dst optionally masked: dst{rM} or dst{rM}{z})
 
             int dst = lexer_read_register(lex);
             if (dst < 0) {
-                fprintf(stderr, "[parser] line %d: expected register for destination\n", line_num);
+                chunk_error(chunk, line_num, "[parser] line %d: expected register for destination", line_num);
+                instr.op = PVA_NOP;
                 return instr;
             }
             instr.dst = dst;
+            if (lexer_read_mask(lex, chunk, &instr, line_num, opname, len) != 0) {
+                instr.op = PVA_NOP;
+                return instr;
+            }
+            if (instr.mask_reg != PVA_NO_MASK) instr.src3 = dst;
             
             if (lexer_peek(lex) == ',') lex->pos++;
             
             int src1 = lexer_read_register(lex);
             if (src1 < 0) {
-                fprintf(stderr, "[parser] line %d: expected register for source1\n", line_num);
+                chunk_error(chunk, line_num, "[parser] line %d: expected register for source1", line_num);
+                instr.op = PVA_NOP;
                 return instr;
             }
             instr.src1 = src1;
@@ -124,31 +570,182 @@ static pva_instr_t parse_instruction_line(pva_lexer_t *lex, int line_num) {
             
             int src2 = lexer_read_register(lex);
             if (src2 < 0) {
-                fprintf(stderr, "[parser] line %d: expected register for source2\n", line_num);
+                chunk_error(chunk, line_num, "[parser] line %d: expected register for source2", line_num);
+                instr.op = PVA_NOP;
                 return instr;
             }
             instr.src2 = src2;
             break;
         }
 
+        case PVA_FMA_F32:
+        case PVA_FMS_F32: {
+            // format: dst, src1, src2, src3 (src1 * src2 added to / taken from src3)
+            int regs[4];
+            for (int k = 0; k < 4; k++) {
+                if (k > 0 && lexer_peek(lex) == ',') lex->pos++;
+                regs[k] = lexer_read_register(lex);
+                if (regs[k] < 0) {
+                    chunk_error(chunk, line_num, "[parser] line %d: expected register for operand %d",
+                                line_num, k + 1);
+                    instr.op = PVA_NOP;
+                    return instr;
+                }
+                if (k == 0 && lexer_read_mask(lex, chunk, &instr, line_num, opname, len) != 0) {
+                    instr.op = PVA_NOP;
+                    return instr;
+                }
+            }
+            // the lanes a merging mask leaves off keep the addend
+            if (instr.mask_reg != PVA_NO_MASK && instr.imm != PVA_MASK_ZERO && regs[0] != regs[3]) {
+                chunk_error(chunk, line_num, "[parser] line %d: merge-masked '%.*s' must accumulate into "
+                            "its destination", line_num, (int)len, opname);
+                instr.op = PVA_NOP;
+                return instr;
+            }
+            instr.dst = regs[0];
+            instr.src1 = regs[1];
+            instr.src2 = regs[2];
+            instr.src3 = regs[3];
+            break;
+        }
+
         case PVA_LOAD_F32:
         case PVA_STORE_F32: {
-            // format: reg, [address] or [address], reg
+            // format: reg, [buffer] or reg, [buffer + offset]
             int reg = lexer_read_register(lex);
             if (reg < 0) {
-                fprintf(stderr, "[parser] line %d: expected register\n", line_num);
+                chunk_error(chunk, line_num, "[parser] line %d: expected register", line_num);
+                instr.op = PVA_NOP;
                 return instr;
             }
             instr.dst = reg;
+            if (lexer_read_mask(lex, chunk, &instr, line_num, opname, len) != 0) {
+                instr.op = PVA_NOP;
+                return instr;
+            }
             
             if (lexer_peek(lex) == ',') lex->pos++;
-            if (lexer_peek(lex) == '[') lex->pos++;  // Skip '['
-            
-            // read address (simplified - just skip to ]
-            while (lexer_peek(lex) != ']' && lex->input[lex->pos]) {
-                lex->pos++;
+            if (lexer_read_address(lex, chunk, &instr, line_num) != 0) {
+                instr.op = PVA_NOP;
+                return instr;
+            }
+            break;
+        }
+
+        case PVA_GATHER_F32:
+        case PVA_SCATTER_F32: {
+            // format: reg, [buffer + index] or reg, [buffer + index*4]
+            int reg = lexer_read_register(lex);
+            if (reg < 0) {
+                chunk_error(chunk, line_num, "[parser] line %d: expected register", line_num);
+                instr.op = PVA_NOP;
+                return instr;
+            }
+            instr.dst = reg;
+            if (lexer_peek(lex) == ',') lex->pos++;
+            if (lexer_read_indexed(lex, chunk, &instr, line_num) != 0) {
+                instr.op = PVA_NOP;
+                return instr;
             }
-            if (lexer_peek(lex) == ']') lex->pos++;
+            break;
+        }
+
+        case PVA_LOAD_STRIDED_F32: {
+            // format: dst, [buffer + offset], stride (bytes between lanes)
+            int dst = lexer_read_register(lex);
+            if (dst < 0) {
+                chunk_error(chunk, line_num, "[parser] line %d: expected register", line_num);
+                instr.op = PVA_NOP;
+                return instr;
+            }
+            instr.dst = dst;
+            if (lexer_peek(lex) == ',') lex->pos++;
+            if (lexer_read_address(lex, chunk, &instr, line_num) != 0) {
+                instr.op = PVA_NOP;
+                return instr;
+            }
+            if (lexer_peek(lex) == ',') lex->pos++;
+
+            char *end = NULL;
+            long stride = 0;
+            int c = lexer_peek(lex);
+            if (is_digit(c) || ((c == '-' || c == '+') && is_digit(lex->input[lex->pos + 1]))) {
+                stride = parse_integer(&lex->input[lex->pos], &end);
+            }
+            if (!end || end > lex->input + lex->end || stride % 4 != 0 || stride > PVA_MAX_STRIDE ||
+                stride < -PVA_MAX_STRIDE) {
+                chunk_error(chunk, line_num, "[parser] line %d: stride must be a multiple of 4 bytes up to "
+                            "%d", line_num, PVA_MAX_STRIDE);
+                instr.op = PVA_NOP;
+                return instr;
+            }
+            lex->pos = (size_t)(end - lex->input);
+            instr.src2 = (uint32_t)(int32_t)stride;
+            break;
+        }
+
+        case PVA_MOV_F32: {
+            // format: dst, src
+            int dst = lexer_read_register(lex);
+            if (dst >= 0 && lexer_read_mask(lex, chunk, &instr, line_num, opname, len) != 0) {
+                instr.op = PVA_NOP;
+                return instr;
+            }
+            if (lexer_peek(lex) == ',') lex->pos++;
+            int src = dst < 0 ? -1 : lexer_read_register(lex);
+            if (src < 0) {
+                chunk_error(chunk, line_num, "[parser] line %d: expected two registers", line_num);
+                instr.op = PVA_NOP;
+                return instr;
+            }
+            instr.dst = dst;
+            instr.src1 = src;
+            if (instr.mask_reg != PVA_NO_MASK) instr.src3 = dst;
+            break;
+        }
+
+        case PVA_REDSUM_F32:
+        case PVA_REDSUM_ORD_F32:
+        case PVA_REDMAX_F32:
+        case PVA_REDMIN_F32: {
+            // format: dst, src
+            int dst = lexer_read_register(lex);
+            if (lexer_peek(lex) == ',') lex->pos++;
+            int src = dst < 0 ? -1 : lexer_read_register(lex);
+            if (src < 0) {
+                chunk_error(chunk, line_num, "[parser] line %d: expected two registers", line_num);
+                instr.op = PVA_NOP;
+                return instr;
+            }
+            instr.dst = dst;
+            instr.src1 = src;
+            break;
+        }
+
+        case PVA_CONST_F32: {
+            // format: dst, #imm (a float, in any form strtof reads)
+            int dst = lexer_read_register(lex);
+            if (dst < 0) {
+                chunk_error(chunk, line_num, "[parser] line %d: expected register", line_num);
+                instr.op = PVA_NOP;
+                return instr;
+            }
+            if (lexer_peek(lex) == ',') lex->pos++;
+
+            char *end = NULL;
+            float value = 0.0f;
+            if (lexer_peek(lex) == '#' && is_immediate(lex->input, &lex->input[lex->pos])) {
+                value = strtof(&lex->input[lex->pos + 1], &end);
+            }
+            if (!end || end > lex->input + lex->end) {
+                chunk_error(chunk, line_num, "[parser] line %d: expected #immediate", line_num);
+                instr.op = PVA_NOP;
+                return instr;
+            }
+            lex->pos = (size_t)(end - lex->input);
+            instr.dst = dst;
+            memcpy(&instr.imm, &value, sizeof(value));
             break;
         }
 
@@ -156,7 +753,8 @@ static pva_instr_t parse_instruction_line(pva_lexer_t *lex, int line_num) {
             // format: dst
             int dst = lexer_read_register(lex);
             if (dst < 0) {
-                fprintf(stderr, "[parser] line %d: expected register\n", line_num);
+                chunk_error(chunk, line_num, "[parser] line %d: expected register", line_num);
+                instr.op = PVA_NOP;
                 return instr;
             }
             instr.dst = dst;
@@ -165,7 +763,8 @@ static pva_instr_t parse_instruction_line(pva_lexer_t *lex, int line_num) {
 
         case PVA_LOOP_BEGIN:
         case PVA_LOOP_END:
-            // :skull: enjoy
+            // no operands: the body runs once per vector over the n elements
+            // passed to the kernel, the backend adds the remainder handling
             break;
 
         default:
@@ -175,120 +774,325 @@ static pva_instr_t parse_instruction_line(pva_lexer_t *lex, int line_num) {
     return instr;
 }
 
-pva_module_t* pva_parse_file(const char* filename) {
-    FILE* fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "[parser] err: failed to open file '%s'\n", filename);
-        return NULL;
+// smallest piece of source worth a thread of its own
+#define PARSE_MIN_CHUNK (1 << 20)
+
+// phase one: where each chunk's lines start numbering, and how many
+// instructions it can hold at most. a zero byte before the end of the
+// file ends the input there, as it always has
+static void* count_lines(void* arg) {
+    pva_chunk_t *chunk = arg;
+    const char *p = chunk->begin, *line = p;
+    size_t newlines = 0;
+    while (p < chunk->end) {
+        p = scan_newline(p);
+        if (!*p) break;
+        newlines++;
+        line = ++p;
+    }
+    if (p < chunk->end) {
+        chunk->end = p;
+        chunk->truncated = 1;
+    }
+    chunk->newlines = newlines;
+    chunk->lines = newlines + (p > line);
+    return NULL;
+}
+
+static int add_loop_mark(pva_chunk_t *chunk, int line, pva_opcode_t op) {
+    if (chunk->num_loops >= chunk->loop_capacity) {
+        size_t capacity = chunk->loop_capacity ? chunk->loop_capacity * 2 : 4;
+        pva_loop_mark_t *loops = realloc(chunk->loops, capacity * sizeof(pva_loop_mark_t));
+        if (!loops) return -1;
+        chunk->loops = loops;
+        chunk->loop_capacity = capacity;
     }
+    chunk->loops[chunk->num_loops].line = line;
+    chunk->loops[chunk->num_loops].op = op;
+    chunk->loops[chunk->num_loops].index = chunk->size;
+    chunk->num_loops++;
+    return 0;
+}
 
-    fseek(fp, 0, SEEK_END);
-    long fsize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+// phase two: every line into the chunk's slice of the module's code,
+// which has one slot per line so it never grows
+static void* parse_chunk(void* arg) {
+    pva_chunk_t *chunk = arg;
+    const char *input = chunk->begin;
+    const char *line = input;
+    for (int line_num = chunk->first_line; line < chunk->end; line_num++) {
+        // the instruction ends at a comment, the line at its newline
+        const char *text_end = scan_line(line);
+        while (*text_end == '#' && is_immediate(line, text_end)) text_end = scan_line(text_end + 1);
+        const char *line_end = *text_end == '#' ? scan_newline(text_end) : text_end;
+        pva_lexer_t lex = {input, (size_t)(line - input), (size_t)(text_end - input)};
+        line = *line_end ? line_end + 1 : line_end;
 
-    char *source = malloc(fsize + 1);
-    if (!source) {
-        fprintf(stderr, "[parser] err: memory alloc failed\n");
-        fclose(fp);
-        return NULL;
+        // skip empty and comment-only lines
+        if (!lexer_peek(&lex)) continue;
+
+        // parse instruction
+        pva_instr_t instr = parse_instruction_line(&lex, chunk, line_num);
+        
+        if (instr.op == PVA_NOP) {
+            chunk->errors++;
+            continue;
+        }
+
+        // nesting is checked across chunks once they are merged
+        if ((instr.op == PVA_LOOP_BEGIN || instr.op == PVA_LOOP_END || pva_op_reduction(instr.op)) &&
+            add_loop_mark(chunk, line_num, instr.op) != 0) {
+            chunk->failed = 1;
+            return NULL;
+        }
+
+        chunk->code[chunk->size++] = instr;
     }
+    return NULL;
+}
 
-    fread(source, 1, fsize, fp);
-    source[fsize] = 0;
-    fclose(fp);
+// runs fn over every chunk, all but the first on threads of their own; a
+// chunk whose thread cannot start runs on the caller afterwards
+static void run_chunks(void* (*fn)(void*), pva_chunk_t *chunks, int num_chunks) {
+    pthread_t *threads = malloc((size_t)num_chunks * sizeof(pthread_t));
+    char *started = calloc((size_t)num_chunks, 1);
+    for (int i = 1; i < num_chunks && threads && started; i++) {
+        started[i] = pthread_create(&threads[i], NULL, fn, &chunks[i]) == 0;
+    }
+    fn(&chunks[0]);
+    for (int i = 1; i < num_chunks; i++) {
+        if (threads && started && started[i]) pthread_join(threads[i], NULL);
+        else fn(&chunks[i]);
+    }
+    free(threads);
+    free(started);
+}
 
-    pva_module_t* mod = calloc(1, sizeof(pva_module_t));
-    if (!mod) {
-        free(source);
-        return NULL;
+// renumber the chunk's buffer operands into the module's first-use order,
+// dropping instructions on buffers past PVA_MAX_BUFFERS; returns how many
+static int merge_buffers(pva_module_t *mod, pva_chunk_t *chunk) {
+    int map[CHUNK_MAX_NAMES];
+    int identity = 1;
+    for (int i = 0; i < chunk->num_names; i++) {
+        map[i] = -1;
+        for (int b = 0; b < mod->num_buffers && map[i] < 0; b++) {
+            if (strcmp(mod->buffers[b], chunk->names[i]) == 0) map[i] = b;
+        }
+        if (map[i] < 0 && mod->num_buffers < PVA_MAX_BUFFERS) {
+            strcpy(mod->buffers[mod->num_buffers], chunk->names[i]);
+            map[i] = mod->num_buffers++;
+        }
+        if (map[i] < 0) {
+            pva_log(mod, PVA_DIAG_ERROR, chunk->name_lines[i], "[parser] line %d: too many buffers (max %d)",
+                    chunk->name_lines[i], PVA_MAX_BUFFERS);
+        }
+        if (map[i] != i) identity = 0;
     }
+    if (identity) return 0;
 
-    mod->capacity = 1024;
-    mod->code = calloc(mod->capacity, sizeof(pva_instr_t));
-    mod->filename = calloc(strlen(filename) + 1, 1);
-    strcpy(mod->filename, filename);
+    size_t write_idx = 0;
+    int dropped = 0;
+    for (size_t i = 0; i < chunk->size; i++) {
+        pva_instr_t instr = chunk->code[i];
+        if (pva_op_memory(instr.op)) {
+            if (map[instr.src1] < 0) {
+                dropped++;
+                continue;
+            }
+            instr.src1 = (uint32_t)map[instr.src1];
+        }
+        chunk->code[write_idx++] = instr;
+    }
+    chunk->size = write_idx;
+    return dropped;
+}
 
-    if (!mod->code) {
-        free(source);
-        free(mod->filename);
+// every stage of the parse on a source padded the way source_open leaves
+// it, reporting through diag
+static pva_module_t* parse_source(const pva_source_t *src, const char* filename, int jobs,
+                                  const pva_diag_sink_t *diag) {
+    pva_module_t* mod = calloc(1, sizeof(pva_module_t));
+    size_t max_chunks = src->size / PARSE_MIN_CHUNK + 1;
+    int num_chunks = jobs < 1 ? 1 : (size_t)jobs < max_chunks ? jobs : (int)max_chunks;
+    pva_chunk_t *chunks = calloc((size_t)num_chunks, sizeof(pva_chunk_t));
+    if (!mod || !chunks) {
+        pva_module_t reporter = {.diag = *diag};
+        pva_log(&reporter, PVA_DIAG_ERROR, 0, "[parser] err: memory alloc failed");
         free(mod);
+        free(chunks);
         return NULL;
     }
 
-    pva_lexer_t lex = {source, 0, 1, 0};
-    int errors = 0;
+    mod->diag = *diag;
+    mod->fp_contract = 1;
+    mod->filename = calloc(strlen(filename) + 1, 1);
+    if (mod->filename) strcpy(mod->filename, filename);
 
-    while (lex.input[lex.pos]) {
-        lexer_skip_whitespace(&lex);
-        
-        // skip comments
-        if (lex.input[lex.pos] == '#') {
-            while (lex.input[lex.pos] && lex.input[lex.pos] != '\n') {
-                lex.pos++;
+    // split at the first line start past each even share of the bytes
+    const char *input = src->data, *input_end = src->data + src->size;
+    for (int i = 0; i < num_chunks; i++) {
+        chunks[i].begin = i ? chunks[i - 1].end : input;
+        chunks[i].end = input_end;
+        if (i + 1 < num_chunks) {
+            const char *split = input + src->size / num_chunks * (i + 1);
+            if (split > chunks[i].begin) {
+                split = scan_newline(split - 1);
+                chunks[i].end = *split ? split + 1 : split;
+            } else {
+                chunks[i].end = chunks[i].begin;
             }
-            continue;
         }
+    }
 
-        // skip empty lines
-        if (lex.input[lex.pos] == '\n') {
-            lex.pos++;
-            lex.line++;
-            lex.col = 0;
-            continue;
+    run_chunks(count_lines, chunks, num_chunks);
+    // nothing after a zero byte is source
+    int used_chunks = num_chunks;
+    for (int i = 0; i < num_chunks; i++) {
+        if (chunks[i].truncated) {
+            used_chunks = i + 1;
+            break;
         }
+    }
+    size_t lines = 0;
+    for (int i = 0; i < used_chunks; i++) lines += chunks[i].lines;
+    mod->capacity = lines ? lines : 1;
+    mod->code = malloc(mod->capacity * sizeof(pva_instr_t));
+    chunks[0].first_line = 1;
+    size_t offset = 0;
+    for (int i = 0; i < used_chunks && mod->code; i++) {
+        if (i > 0) chunks[i].first_line = chunks[i - 1].first_line + (int)chunks[i - 1].newlines;
+        chunks[i].code = mod->code + offset;
+        offset += chunks[i].lines;
+    }
+    if (mod->code) run_chunks(parse_chunk, chunks, used_chunks);
 
-        if (!lex.input[lex.pos]) break;
-
-        // parse instruction
-        pva_instr_t instr = parse_instruction_line(&lex, lex.line);
-        
-        if (instr.op == PVA_NOP) {
-            errors++;
-            // Skip to next line
-            while (lex.input[lex.pos] && lex.input[lex.pos] != '\n') {
-                lex.pos++;
-            }
-            continue;
+    // diagnostics from the chunks in source order, then the merge's own.
+    // each slice moves down to close the gap its predecessors left
+    int errors = 0;
+    for (int i = 0; i < used_chunks && mod->code; i++) {
+        for (size_t k = 0; k < chunks[i].num_diags; k++) {
+            pva_log(mod, PVA_DIAG_ERROR, chunks[i].diags[k].line, "%s",
+                    chunks[i].diag_text + chunks[i].diags[k].offset);
         }
+        errors += chunks[i].errors + merge_buffers(mod, &chunks[i]);
+        memmove(&mod->code[mod->size], chunks[i].code, chunks[i].size * sizeof(pva_instr_t));
+        mod->size += chunks[i].size;
+    }
 
-        // add to module
-        if (mod->size >= mod->capacity) {
-            mod->capacity *= 2;
-            pva_instr_t *new_code = realloc(mod->code, mod->capacity * sizeof(pva_instr_t));
-            if (!new_code) {
-                fprintf(stderr, "[parser] err: memory alloc failed\n");
-                pva_free(mod);
-                free(source);
-                return NULL;
+    // a reduction in the loop is reported and dropped like any bad line;
+    // markers that do not pair up leave nothing to compile, so they fail
+    // the parse
+    int loop_depth = 0, loop_errors = 0;
+    size_t start = 0, dropped = 0;
+    for (int i = 0; i < used_chunks && mod->code; i++) {
+        for (size_t k = 0; k < chunks[i].num_loops; k++) {
+            const pva_loop_mark_t *mark = &chunks[i].loops[k];
+            if (pva_op_reduction(mark->op)) {
+                if (loop_depth == 0) continue;
+                pva_log(mod, PVA_DIAG_ERROR, mark->line, "[parser] line %d: reductions belong after "
+                        "loop_end, on the accumulated vector", mark->line);
+                mod->code[start + mark->index].op = PVA_NOP;
+                dropped++;
+                errors++;
+            } else if (mark->op == PVA_LOOP_BEGIN && loop_depth++ > 0) {
+                pva_log(mod, PVA_DIAG_ERROR, mark->line, "[parser] line %d: nested loops are not supported",
+                        mark->line);
+                loop_errors++;
+            } else if (mark->op == PVA_LOOP_END && --loop_depth < 0) {
+                pva_log(mod, PVA_DIAG_ERROR, mark->line, "[parser] line %d: loop_end without loop_begin",
+                        mark->line);
+                loop_depth = 0;
+                loop_errors++;
             }
-            mod->code = new_code;
         }
+        start += chunks[i].size;
+    }
+    if (dropped) {
+        size_t kept = 0;
+        for (size_t i = 0; i < mod->size; i++) {
+            if (mod->code[i].op != PVA_NOP) mod->code[kept++] = mod->code[i];
+        }
+        mod->size = kept;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < num_chunks; i++) {
+        failed |= chunks[i].failed;
+        free(chunks[i].loops);
+        free(chunks[i].diags);
+        free(chunks[i].diag_text);
+    }
+    free(chunks);
 
-        mod->code[mod->size++] = instr;
+    if (failed || !mod->code || !mod->filename) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[parser] err: memory alloc failed");
+        pva_free(mod);
+        return NULL;
+    }
 
-        // skip to next line
-        while (lex.input[lex.pos] && lex.input[lex.pos] != '\n') {
-            lex.pos++;
-        }
-        if (lex.input[lex.pos] == '\n') {
-            lex.pos++;
-            lex.line++;
-            lex.col = 0;
-        }
+    if (loop_depth > 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[parser] %s: loop_begin without loop_end", filename);
+        loop_errors++;
+    }
+    if (loop_errors > 0) {
+        pva_free(mod);
+        return NULL;
     }
 
     if (errors > 0) {
-        fprintf(stderr, "[parser] warning: %d parse errors encountered\n", errors);
+        pva_log(mod, PVA_DIAG_WARNING, 0, "[parser] warning: %d parse errors encountered", errors);
+    }
+
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[parser] successfully parsed %zu instructions from: '%s'", mod->size,
+            filename);
+    for (int i = 0; i < mod->num_buffers; i++) {
+        pva_log(mod, PVA_DIAG_NOTE, 0, "[parser]     buffer %d: %s", i, mod->buffers[i]);
+    }
+    return mod;
+}
+
+pva_module_t* pva_parse_file_diag(const char* filename, int jobs, const pva_diag_sink_t* diag) {
+    diag = pva_diag_or_print(diag);
+    pva_source_t src;
+    if (source_open(&src, filename) != 0) {
+        pva_module_t reporter = {.diag = *diag};
+        pva_log(&reporter, PVA_DIAG_ERROR, 0, "[parser] err: failed to open file '%s'", filename);
+        return NULL;
     }
+    pva_module_t* mod = parse_source(&src, filename, jobs, diag);
+    source_close(&src);
+    return mod;
+}
 
-    printf("[parser] successfully parsed %zu instructions from: '%s'\n", mod->size, filename);
-    free(source);
+pva_module_t* pva_parse_file_parallel(const char* filename, int jobs) {
+    static const pva_diag_sink_t print = {NULL, NULL, PVA_DIAG_NOTE};
+    return pva_parse_file_diag(filename, jobs, &print);
+}
+
+// in-memory source: copied once, for the padding the scanners need
+pva_module_t* pva_parse_source(const char* source, size_t size, const char* name,
+                               const pva_diag_sink_t* diag) {
+    diag = pva_diag_or_print(diag);
+    pva_module_t reporter = {.diag = *diag};
+    pva_source_t src = {malloc(size + SCAN_PAD), size, 0};
+    if (!src.data) {
+        pva_log(&reporter, PVA_DIAG_ERROR, 0, "[parser] err: memory alloc failed");
+        return NULL;
+    }
+    memcpy(src.data, source, size);
+    memset(src.data + size, 0, SCAN_PAD);
+    pva_module_t* mod = parse_source(&src, name, 1, diag);
+    source_close(&src);
     return mod;
 }
 
+pva_module_t* pva_parse_file(const char* filename) {
+    return pva_parse_file_parallel(filename, 1);
+}
+
 void pva_free(pva_module_t* mod) {
     if (!mod) return;
-    if (mod->code) free(mod->code);
+    pva_module_replace_code(mod, NULL, 0, 0);
     if (mod->filename) free(mod->filename);
     free(mod);
-}
\ No newline at end of file
+}
@@ -0,0 +1,236 @@
+#include "pva.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// .pvab binary IR: the header, the buffer names (PVA_MAX_BUFFER_NAME bytes
+// each), the source file name with its terminator, zero padding, then the
+// instruction array exactly as pva_instr_t lays it out in memory. the file
+// is written and read in the machine's own byte order and the loader
+// rejects anything else, so a mapped file is the module's code as it is
+
+#define PVAB_MAGIC "PVAB"
+#define PVAB_BYTE_ORDER 0x0102
+#define PVAB_CODE_ALIGN 64  // the array starts on a cache line
+
+typedef struct {
+    char magic[4];
+    uint16_t version;           // PVA_IR_VERSION
+    uint16_t byte_order;        // PVAB_BYTE_ORDER as the writer stored it
+    uint32_t instr_size;        // sizeof(pva_instr_t)
+    uint32_t arch;
+    int32_t vec_width_bytes;
+    int32_t fp_contract;
+    int32_t unroll;
+    int32_t spill_slots;
+    uint32_t num_buffers;
+    uint32_t filename_size;     // including the terminator
+    uint64_t num_instrs;
+    uint64_t code_offset;       // from the start of the file
+} pvab_header_t;
+
+int pva_write_ir(const char* path, const pva_module_t* mod) {
+    const char* filename = mod->filename ? mod->filename : "";
+    pvab_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PVAB_MAGIC, 4);
+    hdr.version = PVA_IR_VERSION;
+    hdr.byte_order = PVAB_BYTE_ORDER;
+    hdr.instr_size = sizeof(pva_instr_t);
+    hdr.arch = (uint32_t)mod->arch;
+    hdr.vec_width_bytes = mod->vec_width_bytes;
+    hdr.fp_contract = mod->fp_contract;
+    hdr.unroll = mod->unroll;
+    hdr.spill_slots = mod->spill_slots;
+    hdr.num_buffers = (uint32_t)mod->num_buffers;
+    hdr.filename_size = (uint32_t)strlen(filename) + 1;
+    hdr.num_instrs = mod->size;
+
+    size_t tables = sizeof(hdr) + (size_t)mod->num_buffers * PVA_MAX_BUFFER_NAME + hdr.filename_size;
+    hdr.code_offset = (tables + PVAB_CODE_ALIGN - 1) & ~(size_t)(PVAB_CODE_ALIGN - 1);
+
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[ir] err: failed to open '%s' for writing", path);
+        return -1;
+    }
+
+    static const uint8_t zeros[PVAB_CODE_ALIGN];
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    for (int b = 0; b < mod->num_buffers; b++) {
+        char name[PVA_MAX_BUFFER_NAME] = {0};
+        strncpy(name, mod->buffers[b], sizeof(name) - 1);
+        fwrite(name, sizeof(name), 1, fp);
+    }
+    fwrite(filename, 1, hdr.filename_size, fp);
+    fwrite(zeros, 1, hdr.code_offset - tables, fp);
+    if (mod->size) fwrite(mod->code, sizeof(pva_instr_t), mod->size, fp);
+
+    int failed = ferror(fp);
+    if (fclose(fp) != 0 || failed) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[ir] err: failed to write '%s'", path);
+        return -1;
+    }
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[ir] wrote %zu instructions to: '%s'", mod->size, path);
+    return 0;
+}
+
+// every register an instruction writes or reads, its mask included, is
+// below PVA_MAX_REGS. dst goes through a copy because pva_instr_def
+// returns an int, which a dst of UINT32_MAX would turn into 'no def'
+static int regs_in_range(const pva_instr_t* instr) {
+    pva_instr_t probe = *instr;
+    probe.dst = 0;
+    if (pva_instr_def(&probe) == 0 && instr->dst >= PVA_MAX_REGS) return 0;
+
+    uint32_t uses[PVA_MAX_USES];
+    int count = pva_instr_uses(instr, uses);
+    for (int u = 0; u < count; u++) {
+        if (uses[u] >= PVA_MAX_REGS) return 0;
+    }
+    return 1;
+}
+
+// the header and tables must describe this file exactly, and every
+// instruction must be one the passes and backends know how to handle
+static int check_ir(const pvab_header_t* hdr, const uint8_t* base, size_t file_size, const char* path,
+                    const pva_module_t* reporter) {
+    const char* problem = NULL;
+    size_t tables = sizeof(*hdr) + (size_t)hdr->num_buffers * PVA_MAX_BUFFER_NAME;
+
+    if (memcmp(hdr->magic, PVAB_MAGIC, 4) != 0) {
+        problem = "not a .pvab file";
+    } else if (hdr->byte_order != PVAB_BYTE_ORDER) {
+        problem = "written on a machine of the other byte order";
+    } else if (hdr->version != PVA_IR_VERSION || hdr->instr_size != sizeof(pva_instr_t)) {
+        pva_log(reporter, PVA_DIAG_ERROR, 0, "[ir] err: %s: IR version %u, this compiler reads version %d",
+                path, hdr->version, PVA_IR_VERSION);
+        return -1;
+    } else if (hdr->arch > PVA_ARCH_RISCV_RVV || hdr->num_buffers > PVA_MAX_BUFFERS ||
+               hdr->filename_size == 0 || tables + hdr->filename_size > hdr->code_offset ||
+               hdr->code_offset % PVAB_CODE_ALIGN != 0 || hdr->code_offset > file_size ||
+               hdr->num_instrs != (file_size - hdr->code_offset) / sizeof(pva_instr_t) ||
+               (file_size - hdr->code_offset) % sizeof(pva_instr_t) != 0 ||
+               base[tables + hdr->filename_size - 1] != 0) {
+        problem = "truncated or corrupt header";
+    }
+    for (uint32_t b = 0; b < hdr->num_buffers && !problem; b++) {
+        const char* name = (const char*)base + sizeof(*hdr) + (size_t)b * PVA_MAX_BUFFER_NAME;
+        if (!memchr(name, 0, PVA_MAX_BUFFER_NAME)) problem = "corrupt buffer table";
+    }
+    if (problem) {
+        pva_log(reporter, PVA_DIAG_ERROR, 0, "[ir] err: %s: %s", path, problem);
+        return -1;
+    }
+
+    // unrolling leaves one split, in the loop, and copy k past it reads
+    // and writes k vectors on; nothing else sets vec_offset
+    const pva_instr_t* code = (const pva_instr_t*)(base + hdr->code_offset);
+    uint32_t factor = 1;
+    for (uint64_t i = 0; i < hdr->num_instrs; i++) {
+        if (code[i].op == PVA_LOOP_SPLIT) factor = code[i].imm;
+    }
+    int in_loop = 0, splits = 0;
+    for (uint64_t i = 0; i < hdr->num_instrs; i++) {
+        if (code[i].op == PVA_LOOP_BEGIN) in_loop = 1;
+        if (code[i].op == PVA_LOOP_END) in_loop = 0;
+        if (code[i].op == PVA_LOOP_SPLIT) splits++;
+        int offsets = in_loop && splits && (code[i].op == PVA_LOAD_F32 || code[i].op == PVA_STORE_F32 ||
+                                            code[i].op == PVA_LOAD_STRIDED_F32);
+        if (code[i].op < PVA_ADD_F32 || code[i].op > PVA_RELOAD ||
+            (in_loop && pva_op_reduction(code[i].op)) ||
+            (code[i].op == PVA_LOOP_SPLIT && (!in_loop || splits > 1 || factor < 2 ||
+                                             factor > PVA_MAX_UNROLL)) ||
+            code[i].vec_offset >= (offsets ? factor : 1) ||
+            (pva_op_memory(code[i].op) && code[i].src1 >= hdr->num_buffers) ||
+            ((code[i].op == PVA_GATHER_F32 || code[i].op == PVA_SCATTER_F32) && code[i].imm != 1 &&
+             code[i].imm != 4) ||
+            (code[i].op == PVA_LOAD_STRIDED_F32 && ((int32_t)code[i].src2 % 4 != 0 ||
+             (int32_t)code[i].src2 > PVA_MAX_STRIDE || (int32_t)code[i].src2 < -PVA_MAX_STRIDE)) ||
+            (code[i].mask_reg != PVA_NO_MASK && !pva_op_maskable(code[i].op)) ||
+            !regs_in_range(&code[i])) {
+            pva_log(reporter, PVA_DIAG_ERROR, 0, "[ir] err: %s: instruction %llu is invalid", path,
+                    (unsigned long long)i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// the file is mapped copy-on-write: passes that rewrite the code in place
+// dirty only the pages they touch, and one that builds a new array
+// unmaps the file through pva_module_replace_code
+pva_module_t* pva_load_ir_diag(const char* path, const pva_diag_sink_t* diag) {
+    diag = pva_diag_or_print(diag);
+    pva_module_t reporter = {.diag = *diag};
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        pva_log(&reporter, PVA_DIAG_ERROR, 0, "[ir] err: failed to open file '%s'", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(pvab_header_t)) {
+        pva_log(&reporter, PVA_DIAG_ERROR, 0, "[ir] err: %s: not a .pvab file", path);
+        close(fd);
+        return NULL;
+    }
+    size_t file_size = (size_t)st.st_size;
+    uint8_t* base = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        pva_log(&reporter, PVA_DIAG_ERROR, 0, "[ir] err: failed to map '%s'", path);
+        return NULL;
+    }
+
+    pvab_header_t hdr;
+    memcpy(&hdr, base, sizeof(hdr));
+    if (check_ir(&hdr, base, file_size, path, &reporter) != 0) {
+        munmap(base, file_size);
+        return NULL;
+    }
+
+    pva_module_t* mod = calloc(1, sizeof(pva_module_t));
+    if (!mod) {
+        pva_log(&reporter, PVA_DIAG_ERROR, 0, "[ir] err: memory alloc failed");
+        munmap(base, file_size);
+        return NULL;
+    }
+    mod->diag = *diag;
+    mod->code = (pva_instr_t*)(base + hdr.code_offset);
+    mod->size = hdr.num_instrs;
+    mod->capacity = hdr.num_instrs;
+    mod->code_map = base;
+    mod->code_map_size = file_size;
+    mod->arch = (pva_arch_t)hdr.arch;
+    mod->vec_width_bytes = hdr.vec_width_bytes;
+    mod->fp_contract = hdr.fp_contract;
+    mod->unroll = hdr.unroll;
+    mod->spill_slots = hdr.spill_slots;
+    mod->num_buffers = (int)hdr.num_buffers;
+    for (int b = 0; b < mod->num_buffers; b++) {
+        strcpy(mod->buffers[b], (const char*)base + sizeof(hdr) + (size_t)b * PVA_MAX_BUFFER_NAME);
+    }
+    const char* filename = (const char*)base + sizeof(hdr) + (size_t)mod->num_buffers * PVA_MAX_BUFFER_NAME;
+    mod->filename = malloc(hdr.filename_size);
+    if (!mod->filename) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[ir] err: memory alloc failed");
+        pva_free(mod);
+        return NULL;
+    }
+    memcpy(mod->filename, filename, hdr.filename_size);
+
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[ir] loaded %zu instructions from: '%s'", mod->size, path);
+    for (int i = 0; i < mod->num_buffers; i++) {
+        pva_log(mod, PVA_DIAG_NOTE, 0, "[ir]     buffer %d: %s", i, mod->buffers[i]);
+    }
+    return mod;
+}
+
+pva_module_t* pva_load_ir(const char* path) {
+    static const pva_diag_sink_t print = {NULL, NULL, PVA_DIAG_NOTE};
+    return pva_load_ir_diag(path, &print);
+}
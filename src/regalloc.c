@@ -0,0 +1,353 @@
+#include "pva.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+// linear scan register allocation (Poletto & Sarkar) over virtual registers.
+// positions are doubled so a register read by instruction i (2i) can be
+// reused by the value it defines (2i+1)
+
+typedef struct {
+    const uint8_t* regs;    // allocatable registers in preference order
+    int count;
+    uint8_t scratch[PVA_MAX_USES];  // reserved for reloading spilled operands
+} regfile_t;
+
+// x86: xmm15/zmm31 stay free for the backend's own scratch use, and on SSE
+// xmm14 as well
+static const uint8_t regs_sse[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+static const uint8_t regs_x86_16[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+static const uint8_t regs_x86_32[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                                      15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26};
+// AAPCS64: v8-v15 are callee-saved, so they come last; v31 is the backend's
+static const uint8_t regs_arm[] = {0, 1, 2, 3, 4, 5, 6, 7, 16, 17, 18, 19, 20, 21, 22,
+                                   23, 24, 25, 26, 8, 9, 10, 11, 12, 13, 14, 15};
+// RVV: v0 is the mask register, v31 the backend's scratch
+static const uint8_t regs_rvv[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                                   15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26};
+
+static int get_regfile(pva_arch_t arch, regfile_t* rf) {
+    switch (arch) {
+        case PVA_ARCH_X86_SSE:
+            rf->regs = regs_sse;
+            rf->count = sizeof(regs_sse);
+            rf->scratch[0] = 10;
+            rf->scratch[1] = 11;
+            rf->scratch[2] = 12;
+            rf->scratch[3] = 13;
+            return 0;
+        case PVA_ARCH_X86_AVX2:
+            rf->regs = regs_x86_16;
+            rf->count = sizeof(regs_x86_16);
+            rf->scratch[0] = 11;
+            rf->scratch[1] = 12;
+            rf->scratch[2] = 13;
+            rf->scratch[3] = 14;
+            return 0;
+        case PVA_ARCH_X86_AVX512:
+            rf->regs = regs_x86_32;
+            rf->count = sizeof(regs_x86_32);
+            rf->scratch[0] = 27;
+            rf->scratch[1] = 28;
+            rf->scratch[2] = 29;
+            rf->scratch[3] = 30;
+            return 0;
+        case PVA_ARCH_ARM_NEON:
+        case PVA_ARCH_ARM_SVE:
+            rf->regs = regs_arm;
+            rf->count = sizeof(regs_arm);
+            rf->scratch[0] = 27;
+            rf->scratch[1] = 28;
+            rf->scratch[2] = 29;
+            rf->scratch[3] = 30;
+            return 0;
+        case PVA_ARCH_RISCV_RVV:
+            rf->regs = regs_rvv;
+            rf->count = sizeof(regs_rvv);
+            rf->scratch[0] = 27;
+            rf->scratch[1] = 28;
+            rf->scratch[2] = 29;
+            rf->scratch[3] = 30;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// registers the allocator can hand out on arch, 0 if unsupported
+int pva_regalloc_num_regs(pva_arch_t arch) {
+    regfile_t rf;
+    return get_regfile(arch, &rf) == 0 ? rf.count : 0;
+}
+
+typedef struct {
+    uint32_t vreg;
+    int start, end;
+} interval_t;
+
+static int cmp_start(const void* a, const void* b) {
+    const interval_t* x = a;
+    const interval_t* y = b;
+    if (x->start != y->start) return x->start < y->start ? -1 : 1;
+    return x->vreg < y->vreg ? -1 : (x->vreg > y->vreg);
+}
+
+// build one interval per referenced register; values live into the loop
+// header are loop-carried and must survive the whole body
+static interval_t* build_intervals(const pva_module_t* mod, uint32_t nregs, int* count) {
+    size_t n_alloc = nregs ? nregs : 1;
+    int* start = malloc(n_alloc * sizeof(int));
+    int* end = malloc(n_alloc * sizeof(int));
+    uint8_t* defined = calloc(n_alloc, 1);
+    interval_t* out = malloc(n_alloc * sizeof(interval_t));
+    if (!start || !end || !defined || !out) {
+        free(start); free(end); free(defined); free(out);
+        return NULL;
+    }
+
+    for (uint32_t r = 0; r < nregs; r++) {
+        start[r] = INT_MAX;
+        end[r] = -1;
+    }
+
+    uint32_t uses[PVA_MAX_USES];
+    for (size_t i = 0; i < mod->size; i++) {
+        int count_uses = pva_instr_uses(&mod->code[i], uses);
+        for (int u = 0; u < count_uses; u++) {
+            int pos = 2 * (int)i;
+            if (pos < start[uses[u]]) start[uses[u]] = pos;
+            if (pos > end[uses[u]]) end[uses[u]] = pos;
+        }
+        int def = pva_instr_def(&mod->code[i]);
+        if (def >= 0) {
+            int pos = 2 * (int)i + 1;
+            if (pos < start[def]) start[def] = pos;
+            if (pos > end[def]) end[def] = pos;
+        }
+    }
+
+    long loop_begin, loop_end;
+    if (pva_find_loop(mod, &loop_begin, &loop_end) == 0 && loop_begin >= 0) {
+        for (long i = loop_begin + 1; i < loop_end; i++) {
+            int count_uses = pva_instr_uses(&mod->code[i], uses);
+            for (int u = 0; u < count_uses; u++) {
+                uint32_t r = uses[u];
+                if (defined[r]) continue;
+                // upward-exposed use: live around the back edge
+                if (start[r] > 2 * (int)loop_begin) start[r] = 2 * (int)loop_begin;
+                if (end[r] < 2 * (int)loop_end + 1) end[r] = 2 * (int)loop_end + 1;
+            }
+            int def = pva_instr_def(&mod->code[i]);
+            if (def >= 0) defined[def] = 1;
+        }
+    }
+
+    int n = 0;
+    for (uint32_t r = 0; r < nregs; r++) {
+        if (end[r] < 0) continue;
+        out[n].vreg = r;
+        out[n].start = start[r];
+        out[n].end = end[r];
+        n++;
+    }
+    qsort(out, n, sizeof(interval_t), cmp_start);
+
+    free(start);
+    free(end);
+    free(defined);
+    *count = n;
+    return out;
+}
+
+static int emit_instr(pva_instr_t** code, size_t* size, size_t* capacity, pva_instr_t instr) {
+    if (*size >= *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 64;
+        pva_instr_t* new_code = realloc(*code, new_capacity * sizeof(pva_instr_t));
+        if (!new_code) return -1;
+        *code = new_code;
+        *capacity = new_capacity;
+    }
+    (*code)[(*size)++] = instr;
+    return 0;
+}
+
+// reload, spill or copy through the scratch registers
+static pva_instr_t scratch_instr(pva_opcode_t op, uint32_t dst, uint32_t src, int slot) {
+    pva_instr_t instr = {0};
+    instr.op = op;
+    instr.dst = dst;
+    instr.src1 = src;
+    instr.imm = (uint32_t)slot;
+    instr.mask_reg = PVA_NO_MASK;
+    return instr;
+}
+
+// rewrite mod in place: virtual registers become physical ones, and every
+// access to a spilled register goes through a reload/spill of a scratch
+int pva_regalloc(pva_module_t* mod) {
+    if (!mod) return -1;
+
+    regfile_t rf;
+    if (get_regfile(mod->arch, &rf) != 0) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[regalloc] err: unsupported architecture");
+        return -1;
+    }
+
+    uint32_t nregs = pva_module_num_regs(mod);
+    int count = 0;
+    interval_t* intervals = build_intervals(mod, nregs, &count);
+    int* phys = malloc((nregs ? nregs : 1) * sizeof(int));       // -1 = spilled
+    int* slot = malloc((nregs ? nregs : 1) * sizeof(int));
+    interval_t** active = malloc((rf.count + 1) * sizeof(interval_t*));
+    if (!intervals || !phys || !slot || !active) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[regalloc] err: memory alloc failed");
+        free(intervals); free(phys); free(slot); free(active);
+        return -1;
+    }
+
+    uint8_t free_regs[64];
+    int num_free = 0;
+    for (int i = rf.count - 1; i >= 0; i--) free_regs[num_free++] = rf.regs[i];
+
+    int num_active = 0;
+    int slots = 0;
+
+    for (int i = 0; i < count; i++) {
+        interval_t* cur = &intervals[i];
+
+        // expire intervals that ended before this one starts
+        int kept = 0;
+        for (int a = 0; a < num_active; a++) {
+            if (active[a]->end < cur->start) {
+                free_regs[num_free++] = (uint8_t)phys[active[a]->vreg];
+            } else {
+                active[kept++] = active[a];
+            }
+        }
+        num_active = kept;
+
+        if (num_free == 0) {
+            // spill whichever of cur and the active intervals ends last
+            interval_t* victim = active[num_active - 1];
+            if (victim->end > cur->end) {
+                phys[cur->vreg] = phys[victim->vreg];
+                phys[victim->vreg] = -1;
+                slot[victim->vreg] = slots++;
+                active[num_active - 1] = cur;
+            } else {
+                phys[cur->vreg] = -1;
+                slot[cur->vreg] = slots++;
+                continue;
+            }
+        } else {
+            phys[cur->vreg] = free_regs[--num_free];
+            active[num_active++] = cur;
+        }
+
+        // keep active sorted by end
+        for (int a = num_active - 1; a > 0 && active[a]->end < active[a - 1]->end; a--) {
+            interval_t* tmp = active[a];
+            active[a] = active[a - 1];
+            active[a - 1] = tmp;
+        }
+    }
+
+    long loop_begin = -1, loop_end = -1;
+    pva_find_loop(mod, &loop_begin, &loop_end);
+
+    pva_instr_t* code = NULL;
+    size_t size = 0, capacity = 0;
+    int failed = 0;
+
+    for (size_t i = 0; i < mod->size && !failed; i++) {
+        pva_instr_t instr = mod->code[i];
+        uint32_t uses[PVA_MAX_USES];
+        int count_uses = pva_instr_uses(&instr, uses);
+        int def = pva_instr_def(&instr);
+
+        // reload spilled sources into scratch registers
+        uint32_t reloaded[PVA_MAX_USES];
+        int num_reloaded = 0;
+        for (int u = 0; u < count_uses; u++) {
+            if (phys[uses[u]] >= 0) continue;
+            int seen = 0;
+            for (int k = 0; k < num_reloaded; k++) seen |= reloaded[k] == uses[u];
+            if (seen) continue;
+
+            failed |= emit_instr(&code, &size, &capacity,
+                                 scratch_instr(PVA_RELOAD, rf.scratch[num_reloaded], 0, slot[uses[u]]));
+            reloaded[num_reloaded++] = uses[u];
+        }
+
+        // the loop tail only writes the active lanes, so a spilled result
+        // must start from its old value or the other lanes reach its slot as
+        // garbage. with every scratch holding a source (an fma), the result
+        // is merged into the old value afterwards instead
+        int merge_def = 0;
+        if (def >= 0 && phys[def] < 0 && (long)i > loop_begin && (long)i < loop_end) {
+            int seen = 0;
+            for (int k = 0; k < num_reloaded; k++) seen |= reloaded[k] == (uint32_t)def;
+            if (!seen && num_reloaded < PVA_MAX_USES) {
+                failed |= emit_instr(&code, &size, &capacity,
+                                     scratch_instr(PVA_RELOAD, rf.scratch[num_reloaded], 0, slot[def]));
+                reloaded[num_reloaded++] = (uint32_t)def;
+            } else if (!seen) {
+                merge_def = 1;
+            }
+        }
+
+        #define MAP_REG(field)                                               \
+            do {                                                             \
+                uint32_t r = (field);                                        \
+                if (phys[r] >= 0) {                                          \
+                    (field) = (uint32_t)phys[r];                             \
+                } else {                                                     \
+                    (field) = rf.scratch[0];                                 \
+                    for (int k = 0; k < num_reloaded; k++)                   \
+                        if (reloaded[k] == r) (field) = rf.scratch[k];       \
+                }                                                            \
+            } while (0)
+
+        uint32_t* fields[PVA_MAX_USES];
+        int count_fields = pva_instr_use_fields(&instr, fields);
+        for (int u = 0; u < count_fields; u++) MAP_REG(*fields[u]);
+        if (def >= 0) MAP_REG(instr.dst);
+        #undef MAP_REG
+
+        failed |= emit_instr(&code, &size, &capacity, instr);
+
+        if (merge_def) {
+            // the sources are dead now: old value into scratch 1, then the
+            // result on top of it through a (lane-merging) copy
+            failed |= emit_instr(&code, &size, &capacity,
+                                 scratch_instr(PVA_RELOAD, rf.scratch[1], 0, slot[def]));
+            failed |= emit_instr(&code, &size, &capacity,
+                                 scratch_instr(PVA_MOV_F32, rf.scratch[1], instr.dst, 0));
+            instr.dst = rf.scratch[1];
+        }
+
+        // write back a spilled result
+        if (def >= 0 && phys[def] < 0) {
+            failed |= emit_instr(&code, &size, &capacity,
+                                 scratch_instr(PVA_SPILL, 0, instr.dst, slot[def]));
+        }
+    }
+
+    free(intervals);
+    free(phys);
+    free(slot);
+    free(active);
+
+    if (failed) {
+        pva_log(mod, PVA_DIAG_ERROR, 0, "[regalloc] err: memory alloc failed");
+        free(code);
+        return -1;
+    }
+
+    pva_module_replace_code(mod, code, size, capacity);
+    mod->spill_slots = slots;
+
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[regalloc] %u virtual registers onto %d physical, %d spilled",
+            nregs, rf.count, slots);
+    return 0;
+}
@@ -0,0 +1,372 @@
+#define _GNU_SOURCE     // pthread_attr_setaffinity_np
+#include "pva.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+// bytes of buffer data one chunk touches, about half of a typical L2
+#define RUN_CHUNK_BYTES (256 << 10)
+// at least this many chunks per thread, so stealing has something to even out
+#define RUN_CHUNKS_PER_THREAD 4
+#define RUN_CACHE_LINE 64
+
+// an iteration may depend on nothing an earlier one did: no register is
+// read in the body before the body writes it, and a buffer the loop stores
+// to is only ever accessed at one offset, so each iteration keeps to its
+// own elements
+static int loop_independent(const pva_module_t* mod, size_t begin, size_t end) {
+    uint32_t nregs = pva_module_num_regs(mod);
+    uint8_t* written = calloc(nregs ? nregs : 1, 1);
+    uint8_t* defined = calloc(nregs ? nregs : 1, 1);
+    if (!written || !defined) {
+        free(written);
+        free(defined);
+        return 0;
+    }
+
+    for (size_t i = begin; i < end; i++) {
+        int def = pva_instr_def(&mod->code[i]);
+        if (def >= 0) defined[def] = 1;
+    }
+
+    int independent = 1;
+    uint32_t offsets[PVA_MAX_BUFFERS], seen = 0, stored = 0, moved = 0;
+    uint32_t uses[PVA_MAX_USES];
+    for (size_t i = begin; i < end && independent; i++) {
+        const pva_instr_t* instr = &mod->code[i];
+        int count = pva_instr_uses(instr, uses);
+        for (int u = 0; u < count; u++) {
+            if (defined[uses[u]] && !written[uses[u]]) independent = 0;
+        }
+        int def = pva_instr_def(instr);
+        if (def >= 0) written[def] = 1;
+
+        if (instr->op != PVA_LOAD_F32 && instr->op != PVA_STORE_F32) continue;
+        uint32_t bit = 1u << instr->src1;
+        if (!(seen & bit)) offsets[instr->src1] = instr->imm;
+        else if (offsets[instr->src1] != instr->imm) moved |= bit;
+        seen |= bit;
+        if (instr->op == PVA_STORE_F32) stored |= bit;
+    }
+    free(written);
+    free(defined);
+    return independent && !(stored & moved);
+}
+
+int pva_kernel_info(const pva_module_t* mod, pva_kernel_info_t* info) {
+    memset(info, 0, sizeof(*info));
+    info->num_buffers = mod->num_buffers;
+    info->vec_width_bytes = mod->vec_width_bytes;
+    if (mod->size && !mod->code) return -1;
+
+    uint32_t outside = 0, fixed = 0;
+    int in_loop = 0, stores_outside = 0, unsplit = 0;
+    size_t begin = 0, end = 0;
+    for (size_t i = 0; i < mod->size; i++) {
+        const pva_instr_t* instr = &mod->code[i];
+        if (instr->op == PVA_LOOP_BEGIN) {
+            in_loop = info->has_loop = 1;
+            begin = i + 1;
+            continue;
+        }
+        if (instr->op == PVA_LOOP_END) {
+            in_loop = 0;
+            end = i;
+            continue;
+        }
+        if (!pva_op_memory(instr->op)) continue;
+        if (instr->op == PVA_GATHER_F32) {
+            fixed |= 1u << instr->src1;
+            continue;
+        }
+        // scattered stores may land in another chunk's range, and a strided
+        // buffer moves stride bytes per element rather than one float
+        unsplit |= instr->op != PVA_LOAD_F32 && instr->op != PVA_STORE_F32;
+        if (in_loop) {
+            info->walked |= 1u << instr->src1;
+        } else {
+            outside |= 1u << instr->src1;
+            stores_outside |= instr->op == PVA_STORE_F32;
+        }
+    }
+
+    // without a loop every call is one vector, wherever the buffers point
+    if (!info->has_loop) {
+        info->walked = outside;
+        info->splittable = info->vec_width_bytes > 0;
+    } else {
+        info->splittable = !(info->walked & outside) && !stores_outside &&
+                          loop_independent(mod, begin, end);
+    }
+    if (unsplit || (info->walked & fixed)) info->splittable = 0;
+    return 0;
+}
+
+// the chunks one thread has yet to run, [next, end) packed into a word so
+// the owner taking from the front and a thief cutting off the back agree
+// through a single compare-and-swap. one per cache line
+typedef struct {
+    uint64_t range;
+} __attribute__((aligned(RUN_CACHE_LINE))) run_queue_t;
+
+typedef struct {
+    pva_pool_t* pool;
+    int index;
+} pool_thread_t;
+
+struct pva_pool {
+    int threads;                // including the one calling pva_run
+    pthread_t* workers;         // threads - 1 of them
+    pool_thread_t* args;
+    run_queue_t* queues;
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    uint64_t generation;        // bumped once per pva_run
+    int busy;                   // workers not yet done with this run
+    int stop;
+    pthread_mutex_t run_lock;
+
+    // the run in progress
+    const pva_jit_kernel_t* kernel;
+    float* buffers[PVA_MAX_BUFFERS];
+    size_t n, chunk;
+};
+
+static uint64_t pack_range(uint32_t next, uint32_t end) {
+    return ((uint64_t)end << 32) | next;
+}
+
+static int queue_take(run_queue_t* q, uint32_t* chunk) {
+    uint64_t range = __atomic_load_n(&q->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t next = (uint32_t)range, end = (uint32_t)(range >> 32);
+        if (next >= end) return 0;
+        if (__atomic_compare_exchange_n(&q->range, &range, pack_range(next + 1, end), 1, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            *chunk = next;
+            return 1;
+        }
+    }
+}
+
+// the back half of the victim's remainder, all of it when one is left
+static int queue_steal(run_queue_t* victim, uint32_t* begin, uint32_t* end) {
+    uint64_t range = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t next = (uint32_t)range, last = (uint32_t)(range >> 32);
+        if (next >= last) return 0;
+        uint32_t mid = next + (last - next) / 2;
+        if (__atomic_compare_exchange_n(&victim->range, &range, pack_range(next, mid), 1, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            *begin = mid;
+            *end = last;
+            return 1;
+        }
+    }
+}
+
+// one chunk: a single call with the walked buffers advanced to its start,
+// or for a loop-less kernel one call per whole vector in it
+static void run_chunk(const pva_pool_t* pool, uint32_t chunk) {
+    const pva_jit_kernel_t* kernel = pool->kernel;
+    const pva_kernel_info_t* info = &kernel->info;
+    size_t lo = (size_t)chunk * pool->chunk;
+    size_t hi = lo + pool->chunk < pool->n ? lo + pool->chunk : pool->n;
+    size_t step = info->has_loop ? hi - lo : (size_t)info->vec_width_bytes / sizeof(float);
+
+    for (size_t at = lo; at + step <= hi && step; at += step) {
+        float* p[PVA_MAX_BUFFERS];
+        for (int b = 0; b < PVA_MAX_BUFFERS; b++) {
+            p[b] = pool->buffers[b] && (info->walked >> b & 1) ? pool->buffers[b] + at : pool->buffers[b];
+        }
+        kernel->fn(step, p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
+    }
+}
+
+// this thread's share, then whatever it can steal; returns once every
+// queue looked empty (chunks taken or stolen are run by whoever holds them)
+static void run_share(pva_pool_t* pool, int self) {
+    run_queue_t* own = &pool->queues[self];
+    for (;;) {
+        uint32_t chunk, begin, end;
+        while (queue_take(own, &chunk)) run_chunk(pool, chunk);
+
+        int stolen = 0;
+        for (int k = 1; k < pool->threads && !stolen; k++) {
+            stolen = queue_steal(&pool->queues[(self + k) % pool->threads], &begin, &end);
+        }
+        if (!stolen) return;
+        __atomic_store_n(&own->range, pack_range(begin, end), __ATOMIC_RELEASE);
+    }
+}
+
+static void* pool_worker(void* arg) {
+    pool_thread_t* thread = arg;
+    pva_pool_t* pool = thread->pool;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->generation == seen) pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_share(pool, thread->index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+pva_pool_t* pva_pool_create(int threads, int pin_cores) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) cores = 1;
+    if (threads <= 0) threads = (int)cores;
+
+    pva_pool_t* pool = calloc(1, sizeof(pva_pool_t));
+    if (!pool) return NULL;
+    pool->workers = calloc((size_t)threads, sizeof(pthread_t));
+    pool->args = calloc((size_t)threads, sizeof(pool_thread_t));
+    pool->queues = aligned_alloc(RUN_CACHE_LINE, (size_t)threads * sizeof(run_queue_t));
+    if (!pool->workers || !pool->args || !pool->queues) {
+        free(pool->workers);
+        free(pool->args);
+        free(pool->queues);
+        free(pool);
+        return NULL;
+    }
+    memset(pool->queues, 0, (size_t)threads * sizeof(run_queue_t));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // the caller is thread 0; a pool that cannot start them all makes do
+    // with the threads it got
+    pool->threads = 1;
+    for (int i = 1; i < threads; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (pin_cores) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(i % cores, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        pool->args[pool->threads].pool = pool;
+        pool->args[pool->threads].index = pool->threads;
+        int ret = pthread_create(&pool->workers[pool->threads], &attr, pool_worker, &pool->args[pool->threads]);
+        pthread_attr_destroy(&attr);
+        if (ret != 0) break;
+        pool->threads++;
+    }
+    return pool;
+}
+
+void pva_pool_destroy(pva_pool_t* pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 1; i < pool->threads; i++) pthread_join(pool->workers[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->run_lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool->args);
+    free(pool->queues);
+    free(pool);
+}
+
+static pva_pool_t* default_pool;
+static pthread_once_t default_pool_once = PTHREAD_ONCE_INIT;
+
+static void default_pool_create(void) {
+    default_pool = pva_pool_create(0, 0);
+}
+
+// whole vectors, with every chunk edge on a cache line of each walked
+// buffer so neighbouring chunks never write the same line
+static size_t chunk_elems(const pva_kernel_info_t* info, size_t n, int threads, size_t requested) {
+    size_t align = info->vec_width_bytes > 0 ? (size_t)info->vec_width_bytes / sizeof(float) : 1;
+    while (align * sizeof(float) % RUN_CACHE_LINE) align *= 2;
+
+    size_t chunk = requested;
+    if (!chunk) {
+        int walked = __builtin_popcount(info->walked);
+        chunk = RUN_CHUNK_BYTES / ((walked ? (size_t)walked : 1) * sizeof(float));
+        size_t share = n / ((size_t)threads * RUN_CHUNKS_PER_THREAD);
+        if (share < chunk) chunk = share;
+    }
+    chunk = (chunk + align - 1) / align * align;
+    if (chunk < align) chunk = align;
+    while ((n + chunk - 1) / chunk > UINT32_MAX) chunk *= 2;
+    return chunk;
+}
+
+int pva_run(const pva_jit_kernel_t* kernel, size_t n, float* const buffers[],
+            const pva_run_options_t* opts) {
+    if (!kernel || !kernel->fn || kernel->info.num_buffers > PVA_MAX_BUFFERS) return -1;
+    const pva_kernel_info_t* info = &kernel->info;
+    if (n == 0) return 0;
+
+    pva_pool_t* pool = opts ? opts->pool : NULL;
+    if (!pool) {
+        pthread_once(&default_pool_once, default_pool_create);
+        pool = default_pool;
+    }
+
+    float* b[PVA_MAX_BUFFERS] = {0};
+    for (int i = 0; i < info->num_buffers; i++) b[i] = buffers[i];
+    if (info->has_loop && (!info->splittable || !pool || pool->threads == 1)) {
+        kernel->fn(n, b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7]);
+        return 0;
+    }
+    size_t lanes = (size_t)info->vec_width_bytes / sizeof(float);
+    if (!info->splittable || (!info->has_loop && (!lanes || n % lanes))) return -1;
+
+    int threads = pool ? pool->threads : 1;
+    size_t chunk = chunk_elems(info, n, threads, opts ? opts->chunk_elems : 0);
+    uint32_t chunks = (uint32_t)((n + chunk - 1) / chunk);
+
+    // loop-less kernels without a pool still go vector by vector
+    if (!pool || threads == 1 || chunks == 1) {
+        pva_pool_t serial = {.threads = 1, .kernel = kernel, .n = n, .chunk = n};
+        memcpy(serial.buffers, b, sizeof(b));
+        run_chunk(&serial, 0);
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->run_lock);
+    pool->kernel = kernel;
+    memcpy(pool->buffers, b, sizeof(b));
+    pool->n = n;
+    pool->chunk = chunk;
+    for (int t = 0; t < threads; t++) {
+        uint32_t begin = (uint32_t)((uint64_t)chunks * t / threads);
+        uint32_t end = (uint32_t)((uint64_t)chunks * (t + 1) / threads);
+        __atomic_store_n(&pool->queues[t].range, pack_range(begin, end), __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busy = threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_share(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->run_lock);
+    return 0;
+}
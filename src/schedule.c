@@ -0,0 +1,452 @@
+#include "pva.h"
+#include <stdlib.h>
+#include <string.h>
+
+// dependency DAG over straight-line regions and a latency-driven list
+// scheduler. loop markers are region boundaries, nothing moves across them
+
+enum { UNIT_FP, UNIT_LOAD, UNIT_STORE, UNIT_COUNT };
+
+typedef struct {
+    int add, mul, fma, div, cmp, logic, load, store, reduce, gather;  // result latency, cycles
+    int div_busy;           // cycles a divide blocks its FP unit
+    int units[UNIT_COUNT];  // pipelines per class
+    int issue_width;
+} sched_model_t;
+
+// rough figures for Skylake-SP, Neoverse N1/V1 and an in-order RVV core
+static const sched_model_t model_x86 = {4, 4, 4, 11, 4, 1, 6, 1, 14, 20, 5, {2, 2, 1}, 4};
+static const sched_model_t model_avx512 = {4, 4, 4, 18, 4, 1, 7, 1, 22, 24, 10, {2, 2, 1}, 4};
+static const sched_model_t model_neon = {2, 3, 4, 10, 2, 1, 6, 1, 6, 12, 7, {2, 2, 1}, 4};
+static const sched_model_t model_sve = {2, 3, 4, 10, 2, 1, 6, 1, 10, 13, 7, {2, 2, 1}, 5};
+static const sched_model_t model_rvv = {4, 4, 5, 20, 4, 2, 4, 1, 12, 16, 20, {1, 1, 1}, 2};
+
+static const sched_model_t* get_model(pva_arch_t arch) {
+    switch (arch) {
+        case PVA_ARCH_X86_AVX512: return &model_avx512;
+        case PVA_ARCH_ARM_NEON: return &model_neon;
+        case PVA_ARCH_ARM_SVE: return &model_sve;
+        case PVA_ARCH_RISCV_RVV: return &model_rvv;
+        default: return &model_x86;
+    }
+}
+
+static int op_latency(const sched_model_t* m, pva_opcode_t op) {
+    switch (op) {
+        case PVA_ADD_F32:
+        case PVA_SUB_F32: return m->add;
+        case PVA_MUL_F32: return m->mul;
+        case PVA_FMA_F32:
+        case PVA_FMS_F32: return m->fma;
+        case PVA_DIV_F32: return m->div;
+        case PVA_CMP_LT_F32:
+        case PVA_CMP_EQ_F32: return m->cmp;
+        case PVA_LOAD_F32:
+        case PVA_CONST_F32: return m->load;
+        case PVA_GATHER_F32:
+        case PVA_LOAD_STRIDED_F32: return m->gather;
+        case PVA_STORE_F32:
+        case PVA_SCATTER_F32: return m->store;
+        case PVA_REDSUM_F32:
+        case PVA_REDSUM_ORD_F32:
+        case PVA_REDMAX_F32:
+        case PVA_REDMIN_F32: return m->reduce;
+        default: return m->logic;
+    }
+}
+
+static int is_load(pva_opcode_t op) {
+    return op == PVA_LOAD_F32 || op == PVA_GATHER_F32 || op == PVA_LOAD_STRIDED_F32;
+}
+
+static int is_store(pva_opcode_t op) {
+    return op == PVA_STORE_F32 || op == PVA_SCATTER_F32;
+}
+
+static int op_unit(pva_opcode_t op) {
+    if (is_load(op) || op == PVA_CONST_F32) return UNIT_LOAD;
+    if (is_store(op)) return UNIT_STORE;
+    return UNIT_FP;
+}
+
+static int add_edge(pva_dag_t* dag, uint32_t from, uint32_t to, int latency, pva_dep_kind_t kind) {
+    if (dag->num_edges >= dag->edge_capacity) {
+        size_t new_capacity = dag->edge_capacity ? dag->edge_capacity * 2 : 256;
+        pva_dep_t* new_edges = realloc(dag->edges, new_capacity * sizeof(pva_dep_t));
+        if (!new_edges) return -1;
+        dag->edges = new_edges;
+        dag->edge_capacity = new_capacity;
+    }
+    pva_dep_t* e = &dag->edges[dag->num_edges++];
+    e->from = from;
+    e->to = to;
+    e->latency = latency;
+    e->kind = kind;
+    return 0;
+}
+
+// edges are discovered grouped by their target; regroup them by source
+static int build_successors(pva_dag_t* dag) {
+    dag->succ_start = calloc(dag->count + 1, sizeof(size_t));
+    dag->succ = malloc((dag->num_edges ? dag->num_edges : 1) * sizeof(pva_dep_t));
+    if (!dag->succ_start || !dag->succ) return -1;
+
+    for (size_t e = 0; e < dag->num_edges; e++) dag->succ_start[dag->edges[e].from + 1]++;
+    for (size_t i = 0; i < dag->count; i++) dag->succ_start[i + 1] += dag->succ_start[i];
+
+    size_t* fill = malloc((dag->count ? dag->count : 1) * sizeof(size_t));
+    if (!fill) return -1;
+    memcpy(fill, dag->succ_start, dag->count * sizeof(size_t));
+    for (size_t e = 0; e < dag->num_edges; e++) {
+        dag->succ[fill[dag->edges[e].from]++] = dag->edges[e];
+    }
+    free(fill);
+    return 0;
+}
+
+// RAW, WAR and WAW edges on registers plus memory ordering. buffers may
+// alias, so loads stay behind the last store and stores behind every
+// load since then
+int pva_dag_build(pva_dag_t* dag, const pva_module_t* mod, size_t begin, size_t end) {
+    memset(dag, 0, sizeof(*dag));
+    dag->begin = begin;
+    dag->count = end - begin;
+
+    const sched_model_t* model = get_model(mod->arch);
+    uint32_t nregs = pva_module_num_regs(mod);
+    size_t n = dag->count ? dag->count : 1;
+
+    long* last_def = malloc((nregs ? nregs : 1) * sizeof(long));
+    long* reader_head = malloc((nregs ? nregs : 1) * sizeof(long));
+    long* reader_next = malloc(n * PVA_MAX_USES * sizeof(long));    // per use slot
+    long* load_next = malloc(n * sizeof(long));
+    dag->latency = malloc(n * sizeof(int));
+    dag->num_preds = calloc(n, sizeof(uint32_t));
+    if (!last_def || !reader_head || !reader_next || !load_next || !dag->latency || !dag->num_preds) {
+        goto fail;
+    }
+
+    for (uint32_t r = 0; r < nregs; r++) {
+        last_def[r] = -1;
+        reader_head[r] = -1;
+    }
+    long last_store = -1;
+    long loads_head = -1;
+
+    for (size_t j = 0; j < dag->count; j++) {
+        const pva_instr_t* instr = &mod->code[begin + j];
+        dag->latency[j] = op_latency(model, instr->op);
+
+        uint32_t uses[PVA_MAX_USES];
+        int count = pva_instr_uses(instr, uses);
+        for (int u = 0; u < count; u++) {
+            uint32_t r = uses[u];
+            if (last_def[r] >= 0 &&
+                add_edge(dag, (uint32_t)last_def[r], (uint32_t)j, dag->latency[last_def[r]], PVA_DEP_RAW) != 0) {
+                goto fail;
+            }
+            // remember the reader; the slot index encodes node and operand
+            long slot = (long)j * PVA_MAX_USES + u;
+            reader_next[slot] = reader_head[r];
+            reader_head[r] = slot;
+        }
+
+        int def = pva_instr_def(instr);
+        if (def >= 0) {
+            if (last_def[def] >= 0 && add_edge(dag, (uint32_t)last_def[def], (uint32_t)j, 1, PVA_DEP_WAW) != 0) {
+                goto fail;
+            }
+            for (long slot = reader_head[def]; slot >= 0; slot = reader_next[slot]) {
+                uint32_t reader = (uint32_t)(slot / PVA_MAX_USES);
+                if (reader != j && add_edge(dag, reader, (uint32_t)j, 0, PVA_DEP_WAR) != 0) goto fail;
+            }
+            reader_head[def] = -1;
+            last_def[def] = (long)j;
+        }
+
+        if (is_load(instr->op)) {
+            if (last_store >= 0 && add_edge(dag, (uint32_t)last_store, (uint32_t)j, 1, PVA_DEP_MEM) != 0) goto fail;
+            load_next[j] = loads_head;
+            loads_head = (long)j;
+        } else if (is_store(instr->op)) {
+            if (last_store >= 0 && add_edge(dag, (uint32_t)last_store, (uint32_t)j, 1, PVA_DEP_MEM) != 0) goto fail;
+            for (long l = loads_head; l >= 0; l = load_next[l]) {
+                if (add_edge(dag, (uint32_t)l, (uint32_t)j, 0, PVA_DEP_MEM) != 0) goto fail;
+            }
+            loads_head = -1;
+            last_store = (long)j;
+        }
+    }
+
+    for (size_t e = 0; e < dag->num_edges; e++) dag->num_preds[dag->edges[e].to]++;
+    if (build_successors(dag) != 0) goto fail;
+
+    free(last_def);
+    free(reader_head);
+    free(reader_next);
+    free(load_next);
+    return 0;
+
+fail:
+    free(last_def);
+    free(reader_head);
+    free(reader_next);
+    free(load_next);
+    pva_dag_free(dag);
+    return -1;
+}
+
+void pva_dag_free(pva_dag_t* dag) {
+    free(dag->edges);
+    free(dag->succ_start);
+    free(dag->succ);
+    free(dag->latency);
+    free(dag->num_preds);
+    memset(dag, 0, sizeof(*dag));
+}
+
+// longest path to the end of the region, in cycles including the node itself
+static int* compute_heights(const pva_dag_t* dag) {
+    int* height = malloc((dag->count ? dag->count : 1) * sizeof(int));
+    if (!height) return NULL;
+
+    // edges always point forward, so reverse index order is topological
+    for (size_t i = dag->count; i-- > 0;) {
+        int h = dag->latency[i];
+        for (size_t e = dag->succ_start[i]; e < dag->succ_start[i + 1]; e++) {
+            int through = dag->succ[e].latency + height[dag->succ[e].to];
+            if (through > h) h = through;
+        }
+        height[i] = h;
+    }
+    return height;
+}
+
+// length of the longest chain of true (RAW) dependencies, in instructions
+int pva_dag_longest_chain(const pva_dag_t* dag) {
+    int* chain = malloc((dag->count ? dag->count : 1) * sizeof(int));
+    if (!chain) return 0;
+
+    int longest = 0;
+    for (size_t i = dag->count; i-- > 0;) {
+        int c = 1;
+        for (size_t e = dag->succ_start[i]; e < dag->succ_start[i + 1]; e++) {
+            const pva_dep_t* d = &dag->succ[e];
+            if (d->kind == PVA_DEP_RAW && chain[d->to] + 1 > c) {
+                c = chain[d->to] + 1;
+            }
+        }
+        chain[i] = c;
+        if (c > longest) longest = c;
+    }
+    free(chain);
+    return longest;
+}
+
+// binary max-heap of node indices, ordered by key then by lower index
+typedef struct {
+    uint32_t* items;
+    size_t size;
+    const int* key;
+} heap_t;
+
+static int heap_before(const heap_t* h, uint32_t a, uint32_t b) {
+    if (h->key[a] != h->key[b]) return h->key[a] > h->key[b];
+    return a < b;
+}
+
+static void heap_push(heap_t* h, uint32_t node) {
+    size_t i = h->size++;
+    h->items[i] = node;
+    while (i > 0 && heap_before(h, h->items[i], h->items[(i - 1) / 2])) {
+        uint32_t tmp = h->items[i];
+        h->items[i] = h->items[(i - 1) / 2];
+        h->items[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+static uint32_t heap_pop(heap_t* h) {
+    uint32_t top = h->items[0];
+    h->items[0] = h->items[--h->size];
+    size_t i = 0;
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, best = i;
+        if (l < h->size && heap_before(h, h->items[l], h->items[best])) best = l;
+        if (r < h->size && heap_before(h, h->items[r], h->items[best])) best = r;
+        if (best == i) break;
+        uint32_t tmp = h->items[i];
+        h->items[i] = h->items[best];
+        h->items[best] = tmp;
+        i = best;
+    }
+    return top;
+}
+
+// nodes further than `window` past the oldest unscheduled one wait, so
+// hoisting cannot stretch live ranges (and register pressure) unboundedly.
+// a window of 1 replays source order through the same model
+#define SCHED_WINDOW 64
+
+// cycle-by-cycle list scheduling: each cycle issue the ready nodes with
+// the greatest height, within the issue width and per-unit limits.
+// order[] receives region-relative node indices; returns the cycle count
+static long list_schedule(const pva_dag_t* dag, const pva_module_t* mod, size_t window, uint32_t* order) {
+    const sched_model_t* model = get_model(mod->arch);
+    size_t n = dag->count;
+    if (n == 0) return 0;
+
+    int* height = compute_heights(dag);
+    int* neg_ready = malloc(n * sizeof(int));      // min-heap on earliest start
+    long* earliest = calloc(n, sizeof(long));
+    uint32_t* preds_left = malloc(n * sizeof(uint32_t));
+    uint8_t* done = calloc(n, 1);
+    uint32_t* deferred = malloc(n * sizeof(uint32_t));
+    heap_t ready = {malloc(n * sizeof(uint32_t)), 0, height};
+    heap_t waiting = {malloc(n * sizeof(uint32_t)), 0, neg_ready};
+    long cycles = -1;
+
+    if (!height || !neg_ready || !earliest || !preds_left || !done || !deferred ||
+        !ready.items || !waiting.items) {
+        goto out;
+    }
+    memcpy(preds_left, dag->num_preds, n * sizeof(uint32_t));
+
+    size_t admitted = 0;    // nodes [0, admitted) may be scheduled
+    size_t oldest = 0;      // first node not yet scheduled
+    size_t emitted = 0;
+    long cycle = 0;
+    long unit_free[UNIT_COUNT][8] = {{0}};    // cycle each pipeline frees up
+
+    while (emitted < n) {
+        size_t limit = oldest + window < n ? oldest + window : n;
+        for (; admitted < limit; admitted++) {
+            if (preds_left[admitted] == 0) {
+                neg_ready[admitted] = -(int)earliest[admitted];
+                heap_push(&waiting, (uint32_t)admitted);
+            }
+        }
+
+        // move everything whose operands are available by now
+        while (waiting.size > 0 && -neg_ready[waiting.items[0]] <= cycle) {
+            heap_push(&ready, heap_pop(&waiting));
+        }
+
+        int issued = 0;
+        size_t num_deferred = 0;
+        while (ready.size > 0 && issued < model->issue_width) {
+            uint32_t node = heap_pop(&ready);
+            pva_opcode_t op = mod->code[dag->begin + node].op;
+            int unit = op_unit(op);
+
+            int pipe = -1;
+            for (int p = 0; p < model->units[unit]; p++) {
+                if (unit_free[unit][p] <= cycle) {
+                    pipe = p;
+                    break;
+                }
+            }
+            if (pipe < 0) {
+                deferred[num_deferred++] = node;
+                continue;
+            }
+
+            unit_free[unit][pipe] = cycle + (op == PVA_DIV_F32 ? model->div_busy : 1);
+            order[emitted++] = node;
+            done[node] = 1;
+            issued++;
+
+            for (size_t e = dag->succ_start[node]; e < dag->succ_start[node + 1]; e++) {
+                const pva_dep_t* d = &dag->succ[e];
+                if (cycle + d->latency > earliest[d->to]) earliest[d->to] = cycle + d->latency;
+                if (--preds_left[d->to] == 0 && d->to < admitted) {
+                    neg_ready[d->to] = -(int)earliest[d->to];
+                    heap_push(&waiting, d->to);
+                }
+            }
+        }
+        for (size_t i = 0; i < num_deferred; i++) heap_push(&ready, deferred[i]);
+
+        while (oldest < n && done[oldest]) oldest++;
+        cycle++;
+    }
+
+    // the last results still have to land
+    cycles = cycle;
+    for (size_t i = 0; i < n; i++) {
+        if (earliest[i] + dag->latency[i] > cycles) cycles = earliest[i] + dag->latency[i];
+    }
+
+out:
+    free(height);
+    free(neg_ready);
+    free(earliest);
+    free(preds_left);
+    free(done);
+    free(deferred);
+    free(ready.items);
+    free(waiting.items);
+    return cycles;
+}
+
+// reorder one region in place and add its estimated cycle counts, source
+// order and scheduled, to *before and *after
+static int schedule_region(pva_module_t* mod, size_t begin, size_t end, long* before, long* after) {
+    pva_dag_t dag;
+    if (end - begin < 2) return 0;
+    if (pva_dag_build(&dag, mod, begin, end) != 0) return -1;
+
+    size_t n = dag.count;
+    uint32_t* order = malloc(n * sizeof(uint32_t));
+    pva_instr_t* copy = malloc(n * sizeof(pva_instr_t));
+    if (!order || !copy) {
+        free(order);
+        free(copy);
+        pva_dag_free(&dag);
+        return -1;
+    }
+
+    long in_order = list_schedule(&dag, mod, 1, order);
+    long scheduled = list_schedule(&dag, mod, SCHED_WINDOW, order);
+
+    // the model is greedy; keep source order when it does not win
+    if (scheduled >= 0 && in_order >= 0 && scheduled < in_order) {
+        memcpy(copy, &mod->code[begin], n * sizeof(pva_instr_t));
+        for (size_t i = 0; i < n; i++) mod->code[begin + i] = copy[order[i]];
+    } else {
+        scheduled = in_order;
+    }
+    *before += in_order;
+    *after += scheduled;
+
+    free(order);
+    free(copy);
+    pva_dag_free(&dag);
+    return scheduled < 0 ? -1 : 0;
+}
+
+// independent FP operations it takes to keep the target busy: one per FP
+// pipe for every cycle of add latency
+int pva_sched_fp_parallelism(pva_arch_t arch) {
+    const sched_model_t* m = get_model(arch);
+    return m->add * m->units[UNIT_FP];
+}
+
+int pva_schedule(pva_module_t* mod) {
+    if (!mod) return -1;
+
+    long before = 0, after = 0;
+    size_t begin = 0;
+    for (size_t i = 0; i <= mod->size; i++) {
+        if (i < mod->size && !pva_instr_is_marker(&mod->code[i])) continue;
+        if (schedule_region(mod, begin, i, &before, &after) != 0) {
+            pva_log(mod, PVA_DIAG_ERROR, 0, "[optimizer] err: scheduling failed");
+            return -1;
+        }
+        begin = i + 1;
+    }
+
+    pva_log(mod, PVA_DIAG_NOTE, 0, "[optimizer]     estimated %ld cycles in source order, %ld scheduled",
+            before, after);
+    return 0;
+}
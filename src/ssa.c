@@ -0,0 +1,524 @@
+#include "pva.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// SSA for kernels with at most one loop. the CFG is entry -> header ->
+// body -> header, header -> exit; the header holds no code, only the phis
+// merging a value from before the loop with the one the body left behind.
+// the exit is reached from the header, so code after loop_end sees the
+// phis too and needs none of its own
+
+#define NO_NAME UINT32_MAX
+
+// a variable needs a header phi if the body defines it and the body or the
+// exit may read it before writing it (pruned SSA)
+static uint8_t* place_phis(const pva_module_t* mod, uint32_t nvars, long begin, long end) {
+    uint8_t* needs = calloc(nvars ? nvars : 1, 1);
+    uint8_t* defined = calloc(nvars ? nvars : 1, 1);
+    uint8_t* exposed = calloc(nvars ? nvars : 1, 1);
+    if (!needs || !defined || !exposed) {
+        free(needs);
+        free(defined);
+        free(exposed);
+        return NULL;
+    }
+
+    uint32_t uses[PVA_MAX_USES];
+    for (int pass = 0; pass < 2; pass++) {
+        size_t from = pass == 0 ? (size_t)begin + 1 : (size_t)end + 1;
+        size_t to = pass == 0 ? (size_t)end : mod->size;
+        memset(defined, 0, nvars);
+
+        for (size_t i = from; i < to; i++) {
+            int count = pva_instr_uses(&mod->code[i], uses);
+            for (int u = 0; u < count; u++) {
+                if (!defined[uses[u]]) exposed[uses[u]] = 1;
+            }
+            int def = pva_instr_def(&mod->code[i]);
+            if (def >= 0) {
+                defined[def] = 1;
+                if (pass == 0) needs[def] = 1;
+            }
+        }
+    }
+
+    for (uint32_t v = 0; v < nvars; v++) needs[v] &= exposed[v];
+    free(defined);
+    free(exposed);
+    return needs;
+}
+
+static int add_phi(pva_ssa_t* ssa, pva_phi_t phi) {
+    if (ssa->num_phis >= ssa->phi_capacity) {
+        size_t new_capacity = ssa->phi_capacity ? ssa->phi_capacity * 2 : 16;
+        pva_phi_t* new_phis = realloc(ssa->phis, new_capacity * sizeof(pva_phi_t));
+        if (!new_phis) return -1;
+        ssa->phis = new_phis;
+        ssa->phi_capacity = new_capacity;
+    }
+    ssa->phis[ssa->num_phis++] = phi;
+    return 0;
+}
+
+// rename every definition to a fresh register and every use to the one
+// reaching it. a read with no definition before it gets a name of its own
+// that nothing defines (the register was never written)
+int pva_ssa_build(pva_module_t* mod, pva_ssa_t* ssa) {
+    memset(ssa, 0, sizeof(*ssa));
+
+    long begin, end;
+    if (pva_find_loop(mod, &begin, &end) != 0) return -1;
+
+    uint32_t nvars = pva_module_num_regs(mod);
+    uint32_t* current = malloc((nvars ? nvars : 1) * sizeof(uint32_t));
+    uint8_t* needs_phi = begin >= 0 ? place_phis(mod, nvars, begin, end) : NULL;
+    if (!current || (begin >= 0 && !needs_phi)) {
+        free(current);
+        free(needs_phi);
+        return -1;
+    }
+    for (uint32_t v = 0; v < nvars; v++) current[v] = NO_NAME;
+
+    uint32_t next = 0;
+    uint32_t* fields[PVA_MAX_USES];
+
+    for (size_t i = 0; i < mod->size; i++) {
+        pva_instr_t* instr = &mod->code[i];
+
+        if ((long)i == begin) {
+            for (uint32_t v = 0; v < nvars; v++) {
+                if (!needs_phi[v]) continue;
+                pva_phi_t phi = {v, next++, current[v], NO_NAME};
+                if (add_phi(ssa, phi) != 0) goto fail;
+                current[v] = phi.dst;
+            }
+        } else if ((long)i == end) {
+            // leaving through the header: the phis are what follows sees
+            for (size_t p = 0; p < ssa->num_phis; p++) {
+                ssa->phis[p].back = current[ssa->phis[p].var];
+                current[ssa->phis[p].var] = ssa->phis[p].dst;
+            }
+        }
+
+        int count = pva_instr_use_fields(instr, fields);
+        for (int u = 0; u < count; u++) {
+            uint32_t v = *fields[u];
+            if (current[v] == NO_NAME) current[v] = next++;
+            *fields[u] = current[v];
+        }
+
+        int def = pva_instr_def(instr);
+        if (def >= 0) {
+            instr->dst = next++;
+            current[def] = instr->dst;
+        }
+    }
+
+    ssa->num_names = next;
+    free(current);
+    free(needs_phi);
+    return 0;
+
+fail:
+    free(current);
+    free(needs_phi);
+    pva_ssa_free(ssa);
+    return -1;
+}
+
+void pva_ssa_free(pva_ssa_t* ssa) {
+    free(ssa->phis);
+    memset(ssa, 0, sizeof(*ssa));
+}
+
+// hash-based value numbering over the dominator tree entry -> header ->
+// {body, exit}. an instruction computing a value that already has a name
+// is dropped and its uses take the earlier name; so is an unmasked vmov,
+// whose uses take its source (copy propagation). loads number like pure
+// ops within one stretch of code with no store or loop boundary in between
+
+typedef struct {
+    pva_opcode_t op;
+    uint32_t a, b, c, d, mask, imm, epoch;
+} value_key_t;
+
+typedef struct {
+    value_key_t key;
+    uint32_t name;
+    int used;
+} value_slot_t;
+
+typedef struct {
+    value_slot_t* slots;
+    size_t mask;
+} value_table_t;
+
+static int is_commutative(pva_opcode_t op) {
+    return op == PVA_ADD_F32 || op == PVA_MUL_F32 || op == PVA_CMP_EQ_F32 ||
+           op == PVA_AND_MASK || op == PVA_OR_MASK || op == PVA_FMA_F32 || op == PVA_FMS_F32;
+}
+
+static int is_pure(pva_opcode_t op) {
+    switch (op) {
+        case PVA_ADD_F32:
+        case PVA_SUB_F32:
+        case PVA_MUL_F32:
+        case PVA_DIV_F32:
+        case PVA_CMP_LT_F32:
+        case PVA_CMP_EQ_F32:
+        case PVA_AND_MASK:
+        case PVA_OR_MASK:
+        case PVA_FMA_F32:
+        case PVA_FMS_F32:
+        case PVA_REDSUM_F32:
+        case PVA_REDSUM_ORD_F32:
+        case PVA_REDMAX_F32:
+        case PVA_REDMIN_F32:
+        case PVA_CONST_F32:
+        case PVA_SETZERO:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static size_t hash_key(const value_key_t* k) {
+    uint64_t h = 1469598103934665603ull;
+    uint32_t parts[8] = {(uint32_t)k->op, k->a, k->b, k->c, k->d, k->mask, k->imm, k->epoch};
+    for (int i = 0; i < 8; i++) {
+        h ^= parts[i];
+        h *= 1099511628211ull;
+    }
+    return (size_t)(h ^ (h >> 29));
+}
+
+// slot holding key, or the empty slot where it would go
+static value_slot_t* table_find(value_table_t* t, const value_key_t* key) {
+    size_t i = hash_key(key) & t->mask;
+    while (t->slots[i].used && memcmp(&t->slots[i].key, key, sizeof(*key)) != 0) {
+        i = (i + 1) & t->mask;
+    }
+    return &t->slots[i];
+}
+
+static uint32_t resolve(uint32_t* leader, uint32_t name) {
+    uint32_t root = name;
+    while (leader[root] != root) root = leader[root];
+    while (leader[name] != root) {
+        uint32_t next = leader[name];
+        leader[name] = root;
+        name = next;
+    }
+    return root;
+}
+
+// one numbering sweep; returns the number of values removed, -1 on failure
+static int gvn_sweep(pva_module_t* mod, pva_ssa_t* ssa, uint32_t* leader) {
+    size_t capacity = 16;
+    while (capacity < mod->size * 2) capacity <<= 1;
+
+    value_table_t table = {calloc(capacity, sizeof(value_slot_t)), capacity - 1};
+    value_slot_t** body_slots = malloc((mod->size ? mod->size : 1) * sizeof(value_slot_t*));
+    if (!table.slots || !body_slots) {
+        free(table.slots);
+        free(body_slots);
+        return -1;
+    }
+
+    size_t num_body_slots = 0;
+    int in_body = 0;
+    uint32_t epoch = 1;
+    int removed = 0;
+    uint32_t* fields[PVA_MAX_USES];
+
+    for (size_t i = 0; i < mod->size; i++) {
+        pva_instr_t* instr = &mod->code[i];
+
+        if (instr->op == PVA_LOOP_BEGIN) {
+            in_body = 1;
+            epoch++;
+            continue;
+        }
+        if (instr->op == PVA_LOOP_END) {
+            // body values do not dominate the exit
+            for (size_t s = 0; s < num_body_slots; s++) body_slots[s]->used = 0;
+            num_body_slots = 0;
+            in_body = 0;
+            epoch++;
+            continue;
+        }
+        if (instr->op == PVA_NOP) continue;
+
+        int count = pva_instr_use_fields(instr, fields);
+        for (int u = 0; u < count; u++) *fields[u] = resolve(leader, *fields[u]);
+
+        if (instr->op == PVA_STORE_F32 || instr->op == PVA_SCATTER_F32) {
+            epoch++;
+            continue;
+        }
+        if (instr->op == PVA_MOV_F32 && instr->mask_reg == PVA_NO_MASK) {
+            leader[instr->dst] = instr->src1;
+            instr->op = PVA_NOP;
+            removed++;
+            continue;
+        }
+        int load = instr->op == PVA_LOAD_F32 || instr->op == PVA_GATHER_F32 ||
+                   instr->op == PVA_LOAD_STRIDED_F32;
+        if (!is_pure(instr->op) && !load) continue;
+
+        value_key_t key;
+        memset(&key, 0, sizeof(key));
+        key.op = instr->op;
+        if (load) {
+            key.a = instr->src1;    // buffer index, not a register
+            key.b = instr->src2;    // the index register or the stride
+            key.imm = instr->imm;
+            key.epoch = epoch;
+        } else {
+            uint32_t uses[PVA_MAX_USES] = {0, 0, 0, 0};
+            pva_instr_uses(instr, uses);
+            key.a = uses[0];
+            key.b = uses[1];
+            key.c = uses[2];
+            key.d = uses[3];
+            key.mask = instr->mask_reg;
+            key.imm = instr->imm;
+            if (is_commutative(instr->op) && key.a > key.b) {
+                key.a = uses[1];
+                key.b = uses[0];
+            }
+        }
+
+        value_slot_t* slot = table_find(&table, &key);
+        if (slot->used) {
+            leader[instr->dst] = slot->name;
+            instr->op = PVA_NOP;
+            removed++;
+        } else {
+            slot->key = key;
+            slot->name = instr->dst;
+            slot->used = 1;
+            if (in_body) body_slots[num_body_slots++] = slot;
+        }
+    }
+
+    // a phi whose back value is the phi itself or its entry value is a copy
+    size_t kept = 0;
+    for (size_t p = 0; p < ssa->num_phis; p++) {
+        pva_phi_t* phi = &ssa->phis[p];
+        if (phi->entry != NO_NAME) phi->entry = resolve(leader, phi->entry);
+        phi->back = resolve(leader, phi->back);
+        if (phi->entry != NO_NAME && (phi->back == phi->dst || phi->back == phi->entry)) {
+            leader[phi->dst] = phi->entry;
+            removed++;
+            continue;
+        }
+        ssa->phis[kept++] = *phi;
+    }
+    ssa->num_phis = kept;
+
+    free(table.slots);
+    free(body_slots);
+    return removed;
+}
+
+int pva_gvn(pva_module_t* mod, pva_ssa_t* ssa) {
+    uint32_t* leader = malloc((ssa->num_names ? ssa->num_names : 1) * sizeof(uint32_t));
+    if (!leader) return -1;
+    for (uint32_t n = 0; n < ssa->num_names; n++) leader[n] = n;
+
+    // dropping a phi can make its users equal to values seen earlier
+    int total = 0;
+    for (;;) {
+        int removed = gvn_sweep(mod, ssa, leader);
+        if (removed < 0) {
+            free(leader);
+            return -1;
+        }
+        total += removed;
+        if (removed == 0) break;
+    }
+
+    size_t write_idx = 0;
+    for (size_t i = 0; i < mod->size; i++) {
+        if (mod->code[i].op != PVA_NOP) mod->code[write_idx++] = mod->code[i];
+    }
+    mod->size = write_idx;
+
+    free(leader);
+    return total;
+}
+
+// phi copies go at the end of the block they leave: entry copies just
+// before loop_begin, back-edge copies just before loop_end
+static int insert_copies(pva_module_t* mod, const pva_instr_t* pre, size_t num_pre,
+                         const pva_instr_t* back, size_t num_back) {
+    size_t new_size = mod->size + num_pre + num_back;
+    pva_instr_t* code = malloc((new_size ? new_size : 1) * sizeof(pva_instr_t));
+    if (!code) return -1;
+
+    size_t out = 0;
+    for (size_t i = 0; i < mod->size; i++) {
+        if (mod->code[i].op == PVA_LOOP_BEGIN) {
+            memcpy(&code[out], pre, num_pre * sizeof(pva_instr_t));
+            out += num_pre;
+        } else if (mod->code[i].op == PVA_LOOP_END) {
+            memcpy(&code[out], back, num_back * sizeof(pva_instr_t));
+            out += num_back;
+        }
+        code[out++] = mod->code[i];
+    }
+
+    pva_module_replace_code(mod, code, new_size, new_size ? new_size : 1);
+    return 0;
+}
+
+// phi copies on one edge happen at once: a phi may be the back value of
+// another (values rotating through registers), so order them so nothing
+// is overwritten before it is read, saving one value to a fresh register
+// to break each cycle. copies[] needs room for n extra entries
+static size_t sequentialize(pva_instr_t* copies, size_t n, uint32_t* next_temp) {
+    pva_instr_t* pending = malloc((n ? n : 1) * sizeof(pva_instr_t));
+    if (!pending) return n;
+
+    size_t num_pending = 0;
+    for (size_t c = 0; c < n; c++) {
+        if (copies[c].dst != copies[c].src1) pending[num_pending++] = copies[c];
+    }
+
+    size_t out = 0;
+    while (num_pending > 0) {
+        size_t ready = num_pending;
+        for (size_t c = 0; c < num_pending && ready == num_pending; c++) {
+            int read_later = 0;
+            for (size_t k = 0; k < num_pending; k++) {
+                if (k != c && pending[k].src1 == pending[c].dst) read_later = 1;
+            }
+            if (!read_later) ready = c;
+        }
+
+        if (ready == num_pending) {
+            // every destination is still to be read: move one aside
+            pva_instr_t save = pending[0];
+            save.dst = (*next_temp)++;
+            save.src1 = pending[0].dst;
+            copies[out++] = save;
+            for (size_t k = 0; k < num_pending; k++) {
+                if (pending[k].src1 == save.src1) pending[k].src1 = save.dst;
+            }
+            continue;
+        }
+
+        copies[out++] = pending[ready];
+        pending[ready] = pending[--num_pending];
+    }
+
+    free(pending);
+    return out;
+}
+
+// leave SSA: each phi gets one register shared with its entry and back
+// values where their live ranges allow, and vmov copies otherwise
+int pva_ssa_destroy(pva_module_t* mod, pva_ssa_t* ssa) {
+    long begin, end;
+    if (pva_find_loop(mod, &begin, &end) != 0) return -1;
+
+    uint32_t n_alloc = ssa->num_names ? ssa->num_names : 1;
+    uint32_t* reg = malloc(n_alloc * sizeof(uint32_t));
+    long* def_pos = malloc(n_alloc * sizeof(long));
+    long* last_use = malloc(n_alloc * sizeof(long));
+    long* last_body_use = malloc(n_alloc * sizeof(long));
+    uint8_t* joined = calloc(n_alloc, 1);
+    // room for one extra copy per phi when cycles need breaking
+    pva_instr_t* pre = malloc((ssa->num_phis ? ssa->num_phis : 1) * 2 * sizeof(pva_instr_t));
+    pva_instr_t* back = malloc((ssa->num_phis ? ssa->num_phis : 1) * 2 * sizeof(pva_instr_t));
+    int result = -1;
+    if (!reg || !def_pos || !last_use || !last_body_use || !joined || !pre || !back) goto out;
+
+    for (uint32_t n = 0; n < ssa->num_names; n++) {
+        reg[n] = n;
+        def_pos[n] = -1;
+        last_use[n] = -1;
+        last_body_use[n] = -1;
+    }
+
+    uint32_t uses[PVA_MAX_USES];
+    for (size_t i = 0; i < mod->size; i++) {
+        int def = pva_instr_def(&mod->code[i]);
+        if (def >= 0) def_pos[def] = (long)i;
+        int count = pva_instr_uses(&mod->code[i], uses);
+        for (int u = 0; u < count; u++) {
+            last_use[uses[u]] = (long)i;
+            if ((long)i > begin && (long)i < end) last_body_use[uses[u]] = (long)i;
+        }
+    }
+    // back values are read by the copies at loop_end, which matters when
+    // one is another phi or a value hoisted out of the loop
+    for (size_t p = 0; p < ssa->num_phis; p++) {
+        last_use[ssa->phis[p].back] = end;
+        last_body_use[ssa->phis[p].back] = end;
+    }
+
+    size_t num_pre = 0, num_back = 0;
+    for (size_t p = 0; p < ssa->num_phis; p++) {
+        const pva_phi_t* phi = &ssa->phis[p];
+        pva_instr_t copy = {0};
+        copy.op = PVA_MOV_F32;
+        copy.dst = phi->dst;
+        copy.mask_reg = PVA_NO_MASK;
+
+        // the entry value may share the register if nothing reads it once
+        // the loop has started
+        uint32_t a = phi->entry;
+        if (a != NO_NAME) {
+            if (!joined[a] && def_pos[a] >= 0 && def_pos[a] < begin && last_use[a] < begin) {
+                reg[a] = phi->dst;
+                joined[a] = 1;
+            } else {
+                copy.src1 = a;
+                pre[num_pre++] = copy;
+            }
+        }
+
+        // so may the back value if the body computes it no earlier than its
+        // last read of the phi; reads after the loop come through the header
+        uint32_t b = phi->back;
+        if (!joined[b] && def_pos[b] > begin && def_pos[b] < end &&
+            last_body_use[phi->dst] <= def_pos[b]) {
+            reg[b] = phi->dst;
+            joined[b] = 1;
+        } else {
+            copy.src1 = b;
+            back[num_back++] = copy;
+        }
+    }
+
+    uint32_t* fields[PVA_MAX_USES];
+    for (size_t i = 0; i < mod->size; i++) {
+        pva_instr_t* instr = &mod->code[i];
+        int count = pva_instr_use_fields(instr, fields);
+        for (int u = 0; u < count; u++) *fields[u] = reg[*fields[u]];
+        if (pva_instr_def(instr) >= 0) instr->dst = reg[instr->dst];
+    }
+
+    uint32_t next_temp = ssa->num_names;
+    for (size_t c = 0; c < num_pre; c++) pre[c].src1 = reg[pre[c].src1];
+    for (size_t c = 0; c < num_back; c++) back[c].src1 = reg[back[c].src1];
+    num_pre = sequentialize(pre, num_pre, &next_temp);
+    num_back = sequentialize(back, num_back, &next_temp);
+
+    if (insert_copies(mod, pre, num_pre, back, num_back) != 0) goto out;
+    result = 0;
+
+out:
+    free(reg);
+    free(def_pos);
+    free(last_use);
+    free(last_body_use);
+    free(joined);
+    free(pre);
+    free(back);
+    pva_ssa_free(ssa);
+    return result;
+}
@@ -0,0 +1,58 @@
+#include "pva.h"
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// the process high-water mark; it only grows, so a pass that raises it is
+// the one that allocated past every earlier stage
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_maxrss;    // kilobytes on Linux
+}
+
+void pva_timer_begin(pva_timer_t* timer, const char* name, size_t in) {
+    if (!timer || timer->count >= PVA_MAX_TIMED_PASSES) return;
+    pva_pass_time_t* pass = &timer->passes[timer->count];
+    pass->name = name;
+    pass->in = in;
+    pass->out = PVA_TIMER_NONE;
+    pass->ms = now_ms();
+}
+
+void pva_timer_end(pva_timer_t* timer, size_t out) {
+    if (!timer || timer->count >= PVA_MAX_TIMED_PASSES) return;
+    pva_pass_time_t* pass = &timer->passes[timer->count++];
+    pass->ms = now_ms() - pass->ms;
+    pass->out = out;
+    pass->peak_rss_kb = peak_rss_kb();
+}
+
+static void print_count(size_t count) {
+    if (count == PVA_TIMER_NONE) printf(" %10s", "-");
+    else printf(" %10zu", count);
+}
+
+void pva_timer_report(const pva_timer_t* timer) {
+    if (!timer) return;
+    double total = 0;
+    for (int i = 0; i < timer->count; i++) total += timer->passes[i].ms;
+
+    printf("\n[time-passes] %-28s %10s %6s %10s %10s %10s\n", "pass", "wall ms", "%", "instrs in",
+           "instrs out", "peak KiB");
+    for (int i = 0; i < timer->count; i++) {
+        const pva_pass_time_t* pass = &timer->passes[i];
+        printf("[time-passes] %-28s %10.3f %6.1f", pass->name, pass->ms,
+               total > 0 ? 100.0 * pass->ms / total : 0.0);
+        print_count(pass->in);
+        print_count(pass->out);
+        printf(" %10ld\n", pass->peak_rss_kb);
+    }
+    printf("[time-passes] %-28s %10.3f\n", "total", total);
+}